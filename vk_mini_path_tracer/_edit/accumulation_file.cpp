@@ -0,0 +1,74 @@
+#include "accumulation_file.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+AccumulationFileHeader MakeAccumulationFileHeader(uint32_t width, uint32_t height, const AccumulationInfo& info)
+{
+  AccumulationFileHeader header;
+  memcpy(header.magic, kAccumulationFileMagic, sizeof(header.magic));
+  header.width  = width;
+  header.height = height;
+  header.info   = info;
+  return header;
+}
+
+bool AccumulationFile::open(const std::string& path)
+{
+  if(!m_file.open(path))
+  {
+    fprintf(stderr, "Could not open %s\n", path.c_str());
+    return false;
+  }
+  if(m_file.size() < sizeof(m_header) || memcmp(m_file.data(), kAccumulationFileMagic, sizeof(kAccumulationFileMagic)) != 0)
+  {
+    fprintf(stderr, "%s is not an accumulation file\n", path.c_str());
+    return false;
+  }
+  memcpy(&m_header, m_file.data(), sizeof(m_header));
+  if(m_header.version != kAccumulationFileVersion || m_header.headerSize < sizeof(m_header) || m_header.headerSize % 4 != 0)
+  {
+    fprintf(stderr, "%s has an unsupported version (%u) of the accumulation file format\n", path.c_str(), m_header.version);
+    return false;
+  }
+  const uint64_t expectedSize = m_header.headerSize + uint64_t(m_header.width) * m_header.height * sizeof(shaderio::PixelAccumulator);
+  if(m_file.size() < expectedSize)
+  {
+    fprintf(stderr, "%s is truncated: %zu of %llu bytes\n", path.c_str(), m_file.size(), (unsigned long long)expectedSize);
+    return false;
+  }
+  return true;
+}
+
+const shaderio::PixelAccumulator* AccumulationFile::getRow(uint32_t y) const
+{
+  const uint8_t* pixels = m_file.data() + m_header.headerSize;
+  return reinterpret_cast<const shaderio::PixelAccumulator*>(pixels) + size_t(m_header.width) * y;
+}
+
+void AccumulatorSum::add(const shaderio::PixelAccumulator& accumulator)
+{
+  sum[0] += accumulator.sum.x;
+  sum[1] += accumulator.sum.y;
+  sum[2] += accumulator.sum.z;
+  sumSquares[0] += accumulator.sumSquares.x;
+  sumSquares[1] += accumulator.sumSquares.y;
+  sumSquares[2] += accumulator.sumSquares.z;
+  sampleCount += accumulator.sampleCount;
+}
+
+float AccumulatorSum::getMean(uint32_t channel) const
+{
+  return (sampleCount > 0.0) ? float(sum[channel] / sampleCount) : 0.0f;
+}
+
+float AccumulatorSum::getVarianceOfMean(uint32_t channel) const
+{
+  if(sampleCount <= 1.0)
+  {
+    return 0.0f;
+  }
+  const double mean = sum[channel] / sampleCount;
+  return float(std::max(0.0, (sumSquares[channel] - sampleCount * mean * mean) / (sampleCount - 1.0)) / sampleCount);
+}
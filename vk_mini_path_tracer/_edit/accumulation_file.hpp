@@ -0,0 +1,78 @@
+#pragma once
+
+// Accumulation files (--output-format accum), to split the samples of a render over several runs or machines.
+//
+// An image is the mean of each pixel's samples, which can't be combined with the samples of another run
+// without knowing how many there were. An accumulation file keeps each pixel's PixelAccumulator instead:
+// the sums of its sample colors and of their squares, and its sample count, which simply add up across
+// runs. Runs either use different --seeds, or the same seed with --first-sample 0, N, 2N, ... and
+// --samples N each, which traces exactly the samples of one run of k * N samples (so low-discrepancy
+// samplers keep their stratification across runs). The merge tool (tools/merge_accumulations.cpp) adds
+// up any number of files into the final image, and a map of the variance of each pixel's mean.
+//
+// A file is an AccumulationFileHeader, followed at headerSize by width * height PixelAccumulators of 28
+// bytes each, row by row, in the byte order of the machine that wrote it. Everything is 4-byte aligned, so
+// a memory mapping of the file can be read in place.
+
+#include "mapped_file.hpp"
+#include "shaders/host_device.h"
+
+#include <cstdint>
+#include <string>
+
+constexpr char     kAccumulationFileMagic[8] = {'V', 'K', 'M', 'P', 'T', 'A', 'C', 0};
+constexpr uint32_t kAccumulationFileVersion  = 1;
+
+// The samples a run traced.
+struct AccumulationInfo
+{
+  uint32_t seed        = 0;            // --seed
+  uint32_t sampler     = SAMPLER_PCG;  // --sampler
+  uint32_t firstSample = 0;            // --first-sample
+  uint32_t sampleCount = 0;            // Samples per pixel of the job; pixels of tiles that converged early have fewer
+};
+
+struct AccumulationFileHeader
+{
+  char             magic[8]   = {};
+  uint32_t         version    = kAccumulationFileVersion;
+  uint32_t         headerSize = sizeof(AccumulationFileHeader);  // Offset of the pixels, so that later versions can add fields
+  uint32_t         width      = 0;
+  uint32_t         height     = 0;
+  AccumulationInfo info;
+};
+
+// Returns the header of a width x height accumulation file of `info`.
+AccumulationFileHeader MakeAccumulationFileHeader(uint32_t width, uint32_t height, const AccumulationInfo& info);
+
+// The PixelAccumulators of one pixel over several runs, added up in double: a float sum of many files would
+// lose the low bits of the later ones.
+struct AccumulatorSum
+{
+  double sum[3]        = {};
+  double sumSquares[3] = {};
+  double sampleCount   = 0.0;
+
+  void add(const shaderio::PixelAccumulator& accumulator);
+  // The mean of the pixel's samples in one channel, and the variance of that mean: the variance of the
+  // samples, divided by their number. Both are 0 without enough samples.
+  float getMean(uint32_t channel) const;
+  float getVarianceOfMean(uint32_t channel) const;
+};
+
+// A memory-mapped accumulation file, read in place.
+class AccumulationFile
+{
+public:
+  // Maps `path`, and checks its header and its size. Prints the problem and returns false if it isn't a
+  // complete accumulation file.
+  bool open(const std::string& path);
+
+  const AccumulationFileHeader& getHeader() const { return m_header; }
+  // Returns the width PixelAccumulators of row y.
+  const shaderio::PixelAccumulator* getRow(uint32_t y) const;
+
+private:
+  MappedFile             m_file;
+  AccumulationFileHeader m_header;
+};
@@ -0,0 +1,187 @@
+#include "benchmark.hpp"
+#include "cpu_renderer.hpp"
+#include "gpu_renderer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+// The sweep. Every scene is rendered with every combination of the other parameters.
+constexpr uint32_t kSceneTriangleCounts[] = {1u << 10, 1u << 14, 1u << 18, 1u << 20};
+constexpr uint32_t kResolutions[][2]      = {{320, 240}, {800, 600}, {1920, 1080}};
+constexpr uint32_t kSampleCounts[]        = {16, 64};
+constexpr uint32_t kMaxSegments[]         = {4, 32};
+
+void addQuad(ObjMesh& mesh, const Vec3& corner, const Vec3& edge0, const Vec3& edge1)
+{
+  const uint32_t first = uint32_t(mesh.vertices.size() / 3);
+  for(const Vec3& vertex : {corner, corner + edge0, corner + edge0 + edge1, corner + edge1})
+  {
+    mesh.vertices.insert(mesh.vertices.end(), {vertex.x, vertex.y, vertex.z});
+  }
+  mesh.indices.insert(mesh.indices.end(), {first, first + 1, first + 2, first, first + 2, first + 3});
+}
+
+// A UV sphere with `stacks` rings of latitude and 2 * stacks segments of longitude.
+void addSphere(ObjMesh& mesh, const Vec3& center, float radius, uint32_t stacks)
+{
+  const uint32_t slices = 2 * stacks;
+  const uint32_t first  = uint32_t(mesh.vertices.size() / 3);
+  for(uint32_t stack = 0; stack <= stacks; stack++)
+  {
+    const float theta = 3.14159265f * float(stack) / float(stacks);
+    for(uint32_t slice = 0; slice <= slices; slice++)
+    {
+      const float phi    = 6.2831853f * float(slice) / float(slices);
+      const Vec3  vertex = center + radius * Vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+      mesh.vertices.insert(mesh.vertices.end(), {vertex.x, vertex.y, vertex.z});
+    }
+  }
+  for(uint32_t stack = 0; stack < stacks; stack++)
+  {
+    for(uint32_t slice = 0; slice < slices; slice++)
+    {
+      const uint32_t i0 = first + stack * (slices + 1) + slice;
+      const uint32_t i1 = i0 + slices + 1;
+      // The first and last rings are triangles that meet at the poles
+      if(stack != 0)
+        mesh.indices.insert(mesh.indices.end(), {i0, i0 + 1, i1});
+      if(stack != stacks - 1)
+        mesh.indices.insert(mesh.indices.end(), {i0 + 1, i1 + 1, i1});
+    }
+  }
+}
+}  // namespace
+
+void GenerateSyntheticScene(uint32_t triangleCount, ObjMesh& mesh)
+{
+  mesh.vertices.clear();
+  mesh.indices.clear();
+
+  // A floor, and 3 x 3 spheres in front of the default camera (at (0, 1, 6), looking down -z).
+  // Each sphere has 4 * stacks * (stacks - 1) triangles.
+  addQuad(mesh, Vec3(-4.0f, 0.0f, 4.0f), Vec3(8.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, -8.0f));
+  const float    trianglesPerSphere = float(triangleCount) / 9.0f;
+  const uint32_t stacks             = std::max(3u, uint32_t(std::lround(0.5f + 0.5f * std::sqrt(trianglesPerSphere))));
+  for(int row = 0; row < 3; row++)
+  {
+    for(int column = -1; column <= 1; column++)
+    {
+      addSphere(mesh, Vec3(0.7f * float(column), 0.4f + 0.6f * float(row), 0.0f), 0.28f, stacks);
+    }
+  }
+}
+
+bool RunBenchmark(const RenderOptions& options, const std::vector<std::string>& searchPaths, Profiler& profiler)
+{
+  profiler.setInfo("mode", "benchmark");
+
+  for(uint32_t sceneTriangles : kSceneTriangleCounts)
+  {
+    ObjMesh mesh;
+    GenerateSyntheticScene(sceneTriangles, mesh);
+    const uint64_t triangleCount = mesh.indices.size() / 3;
+    Scene          scene;
+    scene.addMesh(std::move(mesh));
+    printf("Scene with %llu triangles\n", static_cast<unsigned long long>(triangleCount));
+
+    // On the GPU, each scene is rendered with both geometry layouts (see compact_geometry.hpp).
+    const uint32_t layoutCount = options.useCpuBackend ? 1 : 2;
+    for(uint32_t layout = 0; layout < layoutCount; layout++)
+    {
+      // The backends are set up once per scene, like in batch mode; each run only traces.
+      CpuRenderer cpuRenderer;
+      GpuRenderer gpuRenderer;
+      if(options.useCpuBackend)
+      {
+        Profiler::Scope scope(profiler, "bvh build");
+        cpuRenderer.setScene(scene);
+      }
+      else
+      {
+        RenderOptions gpuOptions     = options;
+        gpuOptions.countRays         = true;
+        gpuOptions.targetNoise       = 0.0f;  // Always trace every sample, so that runs are comparable
+        gpuOptions.timeBudgetSeconds = 0.0;
+        gpuOptions.compactGeometry   = (layout == 1);
+        gpuOptions.quantizePositions = false;
+        gpuOptions.denoise           = false;  // The sweep measures tracing
+        if(!gpuRenderer.init(gpuOptions, scene, searchPaths, profiler))
+        {
+          return false;
+        }
+      }
+
+      for(uint32_t maxSegments : kMaxSegments)
+      {
+        if(!options.useCpuBackend)
+        {
+          gpuRenderer.setMaxSegments(maxSegments);
+        }
+        bool warmedUp = false;
+        for(const auto& resolution : kResolutions)
+        {
+          for(uint32_t samples : kSampleCounts)
+          {
+            RenderJob job;
+            job.width   = resolution[0];
+            job.height  = resolution[1];
+            job.samples = samples;
+            char name[96];
+            snprintf(name, sizeof(name), "%llutri_%ux%u_%uspp_%useg%s", static_cast<unsigned long long>(triangleCount),
+                     job.width, job.height, samples, maxSegments, (layout == 1) ? "_compact" : "");
+            job.outputPath = name;
+
+            JobReport report;
+            if(options.useCpuBackend)
+            {
+              CpuRenderSettings cpuSettings;
+              cpuSettings.width                = job.width;
+              cpuSettings.height               = job.height;
+              cpuSettings.numSamples           = job.samples;
+              cpuSettings.samplesPerBatch      = options.samplesPerBatch;
+              cpuSettings.maxSegments          = maxSegments;
+              cpuSettings.sampleLights         = options.sampleLights;
+              cpuSettings.russianRouletteStart = options.russianRouletteStart;
+              cpuSettings.sampler              = options.sampler;
+              cpuSettings.seed                 = options.seed;
+              cpuSettings.firstSample          = options.firstSample;
+              cpuSettings.threadCount          = options.threadCount;
+              cpuSettings.camera               = job.camera;
+              std::vector<float> imageData;
+              const auto         startTime = std::chrono::steady_clock::now();
+              report.rayCount              = cpuRenderer.render(cpuSettings, imageData).rayCount;
+              report.traceSeconds          = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+              profiler.addCpuTime("trace", report.traceSeconds);
+            }
+            else
+            {
+              // The first dispatches of a new pipeline include one-time driver work; don't count them.
+              if(!warmedUp)
+              {
+                gpuRenderer.render(job, false);
+                warmedUp = true;
+              }
+              report = gpuRenderer.render(job, false);
+            }
+            report.output        = job.outputPath;
+            report.width         = job.width;
+            report.height        = job.height;
+            report.samples       = job.samples;
+            report.maxSegments   = maxSegments;
+            report.triangleCount = triangleCount;
+            profiler.addJob(report);
+          }
+        }
+      }
+
+      if(!options.useCpuBackend)
+      {
+        gpuRenderer.deinit();
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Benchmark driver (--benchmark report.json).
+//
+// Renders synthetic scenes of growing triangle count (a floor under a 3 x 3 grid of spheres,
+// tessellated more and more finely) and, for each of them, sweeps the resolution, the number of
+// samples per pixel and the maximum number of ray segments. Rays are always counted, so each run
+// of the report has its Mrays/s; comparing reports from two builds shows how performance scales
+// with each parameter, and catches regressions. On the GPU, each scene is rendered with both the
+// standard and the compact geometry layout (runs named *_compact). No images are written.
+
+#include "obj_parser.hpp"
+#include "options.hpp"
+#include "profiler.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Generates the synthetic scene with about `triangleCount` triangles, in the camera's default view.
+void GenerateSyntheticScene(uint32_t triangleCount, ObjMesh& mesh);
+
+// Runs the sweep with the backend from `options`, adding every run to `profiler` as a job.
+// Returns false if the backend could not be set up.
+bool RunBenchmark(const RenderOptions& options, const std::vector<std::string>& searchPaths, Profiler& profiler);
@@ -0,0 +1,108 @@
+#include "compact_geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Same as GLSL's packSnorm2x16
+uint32_t packSnorm2x16(float x, float y)
+{
+  auto pack = [](float v) { return uint32_t(uint16_t(int16_t(std::round(std::clamp(v, -1.0f, 1.0f) * 32767.0f)))); };
+  return pack(x) | (pack(y) << 16);
+}
+}  // namespace
+
+uint32_t EncodeOctahedral(const Vec3& normal)
+{
+  // Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the upper one.
+  const float invL1 = 1.0f / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+  float       x     = normal.x * invL1;
+  float       y     = normal.y * invL1;
+  if(normal.z < 0.0f)
+  {
+    const float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    const float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x                   = foldedX;
+    y                   = foldedY;
+  }
+  return packSnorm2x16(x, y);
+}
+
+void BuildCompactGeometry(const Scene& scene, bool quantizePositions, CompactGeometry& geometry)
+{
+  geometry = CompactGeometry();
+  uint32_t firstVertex = 0;
+  for(const SceneMesh& mesh : scene.getMeshes())
+  {
+    CompactMesh compactMesh;
+    compactMesh.firstVertex    = firstVertex;
+    compactMesh.firstIndexWord = uint32_t(geometry.indices.size());
+    compactMesh.shortIndices   = mesh.vertexCount <= 65536;
+    firstVertex += mesh.vertexCount;
+
+    auto getVertex = [&](uint32_t index) {
+      return Vec3(mesh.vertices[3 * index + 0], mesh.vertices[3 * index + 1], mesh.vertices[3 * index + 2]);
+    };
+
+    // Positions: map the mesh's bounds to [-1, 1] on each axis. Flat axes keep a scale of 1, so that
+    // the instance transform stays invertible.
+    Vec3 scale(1.0f);
+    if(quantizePositions)
+    {
+      Vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+      for(uint32_t i = 0; i < mesh.vertexCount; i++)
+      {
+        boundsMin = min(boundsMin, getVertex(i));
+        boundsMax = max(boundsMax, getVertex(i));
+      }
+      const Vec3 center = (boundsMin + boundsMax) * 0.5f;
+      for(int axis = 0; axis < 3; axis++)
+      {
+        const float halfExtent = (boundsMax[axis] - boundsMin[axis]) * 0.5f;
+        scale[axis]            = (halfExtent > 0.0f) ? halfExtent : 1.0f;
+        compactMesh.dequantize.matrix[axis][axis] = scale[axis];
+        compactMesh.dequantize.matrix[axis][3]    = center[axis];
+      }
+      for(uint32_t i = 0; i < mesh.vertexCount; i++)
+      {
+        const Vec3 vertex = getVertex(i);
+        for(int axis = 0; axis < 3; axis++)
+        {
+          const float normalized = std::clamp((vertex[axis] - center[axis]) / scale[axis], -1.0f, 1.0f);
+          geometry.quantizedPositions.push_back(int16_t(std::round(normalized * 32767.0f)));
+        }
+        geometry.quantizedPositions.push_back(0);
+      }
+    }
+
+    // Indices
+    if(compactMesh.shortIndices)
+    {
+      for(uint32_t i = 0; i < mesh.indexCount; i += 2)
+      {
+        const uint32_t high = (i + 1 < mesh.indexCount) ? mesh.indices[i + 1] : 0;
+        geometry.indices.push_back(mesh.indices[i] | (high << 16));
+      }
+    }
+    else
+    {
+      geometry.indices.insert(geometry.indices.end(), mesh.indices, mesh.indices + mesh.indexCount);
+    }
+
+    // Hit records. The normal is stored in the space the BLAS is built in: with quantized positions,
+    // that space is object space divided by `scale` on each axis, so normals get multiplied by it.
+    // The material ID is the mesh's own; the shader adds the material offset of the instance.
+    for(uint32_t i = 0; i < mesh.indexCount; i += 3)
+    {
+      const Vec3  v0     = getVertex(mesh.indices[i + 0]);
+      const Vec3  v1     = getVertex(mesh.indices[i + 1]);
+      const Vec3  v2     = getVertex(mesh.indices[i + 2]);
+      Vec3        normal = cross(v1 - v0, v2 - v0) * scale;
+      const float length = std::sqrt(dot(normal, normal));
+      normal             = (length > 0.0f) ? normal / length : Vec3(0.0f, 0.0f, 1.0f);  // Degenerate triangles are never hit
+      geometry.hitRecords.push_back({EncodeOctahedral(normal), mesh.materialIds[i / 3]});
+    }
+
+    geometry.meshes.push_back(compactMesh);
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Compact hit-shading layout (--compact-geometry).
+//
+// In the standard layout, each hit loads three indices and three vertices from the index and
+// vertex buffers, and recomputes the normal of the triangle. In the compact layout, each triangle
+// has an 8-byte HitRecord instead (see host_device.h): its face normal, octahedral-encoded, and
+// its material ID. The shader fetches that one record per hit, and takes the hit position from
+// the ray. The vertices and indices are then only inputs of the BLAS builds, and are freed once
+// the BLASes are built; to make those inputs smaller too, meshes with at most 65536 vertices get
+// 16-bit indices, and with --quantize-positions, positions are stored as 16-bit SNORM coordinates
+// within the bounds of their mesh, whose scale and offset go into the instance transforms.
+
+#include "scene.hpp"
+#include "shaders/host_device.h"
+
+#include <cstdint>
+#include <vector>
+
+struct CompactMesh
+{
+  uint32_t  firstVertex    = 0;      // In vertices; the same as in the standard layout
+  uint32_t  firstIndexWord = 0;      // In 32-bit words of CompactGeometry::indices
+  bool      shortIndices   = false;  // 16-bit indices, packed two per word (low half first)
+  Transform dequantize;              // Maps quantized positions to the mesh's object space; identity without quantization
+};
+
+struct CompactGeometry
+{
+  std::vector<int16_t>             quantizedPositions;  // xyzw per vertex, with --quantize-positions
+  std::vector<uint32_t>            indices;             // Each mesh starts on a new word
+  std::vector<shaderio::HitRecord> hitRecords;          // One per triangle, mesh after mesh
+  std::vector<CompactMesh>         meshes;
+};
+
+// Builds the compact layout of the scene's meshes. Without quantization, the BLASes are built from
+// the scene's float positions, so quantizedPositions stays empty.
+void BuildCompactGeometry(const Scene& scene, bool quantizePositions, CompactGeometry& geometry);
+
+// Encodes a unit vector in the octahedral mapping, as two 16-bit SNORM values in one uint
+// (decoded by decodeOctahedral() in raytrace.comp.glsl).
+uint32_t EncodeOctahedral(const Vec3& normal);
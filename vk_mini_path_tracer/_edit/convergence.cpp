@@ -0,0 +1,64 @@
+#include "convergence.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Mirrors kDarkPixelFloor in tile_stats.comp.glsl.
+constexpr float kDarkPixelFloor = 0.01f;
+
+// Mirrors estimatePixelNoise() in tile_stats.comp.glsl.
+float estimatePixelNoise(const shaderio::PixelAccumulator& accumulator)
+{
+  const uint32_t n = accumulator.sampleCount;
+  if(n < 2)
+  {
+    return 1.0e30f;
+  }
+  auto relativeError = [n](float sum, float sumSquares) {
+    const float mean     = sum / float(n);
+    const float variance = std::max(0.0f, (sumSquares - float(n) * mean * mean) / float(n - 1));
+    return std::sqrt(variance / float(n)) / std::max(mean, kDarkPixelFloor);
+  };
+  return (relativeError(accumulator.sum.x, accumulator.sumSquares.x) + relativeError(accumulator.sum.y, accumulator.sumSquares.y)
+          + relativeError(accumulator.sum.z, accumulator.sumSquares.z))
+         / 3.0f;
+}
+}  // namespace
+
+uint32_t UpdateTileMask(const shaderio::TileStats* tileStats,
+                        uint32_t                   tileCount,
+                        const ConvergenceSettings& settings,
+                        uint32_t*                  tileActive)
+{
+  uint32_t activeTiles = 0;
+  for(uint32_t tile = 0; tile < tileCount; tile++)
+  {
+    // tileStats is only up to date for tiles that were active in the last batch.
+    uint32_t& active = tileActive[tile];
+    if(active && settings.targetNoise > 0.0f)
+    {
+      const shaderio::TileStats& stats = tileStats[tile];
+      if(stats.minSampleCount >= settings.minSamples && stats.meanNoise <= settings.targetNoise)
+        active = 0;
+    }
+    activeTiles += active;
+  }
+  return activeTiles;
+}
+
+shaderio::TileStats GetTileStats(const shaderio::PixelAccumulator* accumulators, uint32_t width, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+  float    noiseSum       = 0.0f;
+  uint32_t minSampleCount = ~0u;
+  for(uint32_t y = y0; y < y1; y++)
+  {
+    for(uint32_t x = x0; x < x1; x++)
+    {
+      const shaderio::PixelAccumulator& accumulator = accumulators[size_t(width) * y + x];
+      noiseSum += estimatePixelNoise(accumulator);
+      minSampleCount = std::min(minSampleCount, accumulator.sampleCount);
+    }
+  }
+  return {noiseSum / float(std::max((x1 - x0) * (y1 - y0), 1u)), minSampleCount};
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Convergence test for progressive rendering.
+//
+// After each batch of samples, tile_stats.comp.glsl estimates on the GPU how noisy each tile still
+// is, from the per-pixel accumulators (sum, sum of squares and sample count), and the host reads
+// back one TileStats per tile. Tiles whose noise is below the target are masked out, so that later
+// batches only spend samples where the image still needs them: flat, evenly lit areas stop early
+// while corners and shadows keep sampling.
+//
+// The CPU backend does the same after each batch, with GetTileStats() in place of the shader, over the
+// tiles its scheduler hands out.
+
+#include "shaders/host_device.h"
+
+#include <cstdint>
+
+struct ConvergenceSettings
+{
+  float    targetNoise = 0.0f;  // Target relative standard error of each tile's mean; 0 disables the test
+  uint32_t minSamples  = 16;    // Tiles never converge before every pixel has this many samples
+};
+
+// Updates tileActive (one uint per tile) from the statistics of each tile, clearing the flags of
+// tiles that have converged. Returns the number of tiles that are still active.
+uint32_t UpdateTileMask(const shaderio::TileStats* tileStats,
+                        uint32_t                   tileCount,
+                        const ConvergenceSettings& settings,
+                        uint32_t*                  tileActive);
+
+// Returns the statistics of the pixels [x0, x1) x [y0, y1) of an image `width` pixels wide, as
+// tile_stats.comp.glsl computes them for a tile.
+shaderio::TileStats GetTileStats(const shaderio::PixelAccumulator* accumulators, uint32_t width, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
@@ -0,0 +1,481 @@
+#include "cpu_bvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define CPU_BVH_USE_SSE 1
+#else
+#define CPU_BVH_USE_SSE 0
+#endif
+
+namespace {
+// Build parameters
+constexpr int      kBinCount          = 16;    // Number of SAH bins per axis
+constexpr uint32_t kMaxLeafTriangles  = 16;    // Leaves never hold more than this many triangles
+constexpr float    kTraversalCost     = 1.0f;  // Cost of visiting an inner node...
+constexpr float    kBlockIntersectCost = 1.0f;  // ...relative to testing one block of 4 triangles
+constexpr uint32_t kMaxSahDepth       = 64;    // Below this depth, nodes split at the median instead
+constexpr uint32_t kMaxDepth          = 128;   // Nodes at this depth are leaves, however many triangles they hold
+constexpr int      kMaxStackDepth     = 128;
+// Traversal pushes at most one node per level, so trees of at most kMaxDepth levels fit the stack.
+static_assert(kMaxDepth <= uint32_t(kMaxStackDepth), "the traversal stack must hold a node for every level of the tree");
+
+//-----------------------------------------------------------------------------
+// 4-wide float vectors. All of the triangle test is written in terms of these,
+// so that the SSE and scalar paths run exactly the same arithmetic.
+#if CPU_BVH_USE_SSE
+struct F4
+{
+  __m128 v;
+  static F4 load(const float* p) { return {_mm_load_ps(p)}; }
+  static F4 broadcast(float s) { return {_mm_set1_ps(s)}; }
+};
+inline F4  operator+(F4 a, F4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline F4  operator-(F4 a, F4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline F4  operator*(F4 a, F4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline F4  operator/(F4 a, F4 b) { return {_mm_div_ps(a.v, b.v)}; }
+inline F4  operator&(F4 a, F4 b) { return {_mm_and_ps(a.v, b.v)}; }
+inline F4  operator>=(F4 a, F4 b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+inline F4  operator<=(F4 a, F4 b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline F4  operator<(F4 a, F4 b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline F4  operator!=(F4 a, F4 b) { return {_mm_cmpneq_ps(a.v, b.v)}; }
+inline int moveMask(F4 a) { return _mm_movemask_ps(a.v); }
+inline void store(float* p, F4 a) { _mm_storeu_ps(p, a.v); }
+#else
+struct F4
+{
+  std::array<float, 4> v;
+  static F4 load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+  static F4 broadcast(float s) { return {{s, s, s, s}}; }
+};
+template <class Op>
+inline F4 apply(F4 a, F4 b, Op op)
+{
+  return {{op(a.v[0], b.v[0]), op(a.v[1], b.v[1]), op(a.v[2], b.v[2]), op(a.v[3], b.v[3])}};
+}
+// Comparisons produce 1.0 for true and 0.0 for false; operator& and moveMask work on that encoding.
+inline F4  operator+(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+inline F4  operator-(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+inline F4  operator*(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+inline F4  operator/(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+inline F4  operator&(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return float(x != 0.0f && y != 0.0f); }); }
+inline F4  operator>=(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return float(x >= y); }); }
+inline F4  operator<=(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return float(x <= y); }); }
+inline F4  operator<(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return float(x < y); }); }
+inline F4  operator!=(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return float(x != y); }); }
+inline int moveMask(F4 a)
+{
+  return int(a.v[0] != 0.0f) | (int(a.v[1] != 0.0f) << 1) | (int(a.v[2] != 0.0f) << 2) | (int(a.v[3] != 0.0f) << 3);
+}
+inline void store(float* p, F4 a) { std::copy(a.v.begin(), a.v.end(), p); }
+#endif
+
+//-----------------------------------------------------------------------------
+// Build helpers
+struct Bounds
+{
+  Vec3 lo{std::numeric_limits<float>::max()};
+  Vec3 hi{-std::numeric_limits<float>::max()};
+
+  void  grow(const Vec3& p) { lo = min(lo, p), hi = max(hi, p); }
+  void  grow(const Bounds& b) { lo = min(lo, b.lo), hi = max(hi, b.hi); }
+  bool  empty() const { return lo.x > hi.x; }
+  float area() const
+  {
+    if(empty())
+      return 0.0f;
+    const Vec3 d = hi - lo;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+};
+
+struct PrimitiveRef
+{
+  Bounds   bounds;
+  Vec3     centroid;
+  uint32_t primitiveID;
+};
+
+inline float blockCountOf(uint32_t triangleCount)
+{
+  return float((triangleCount + 3) / 4);
+}
+
+// Ray-box slab test; returns the entry distance, or infinity on a miss.
+inline float intersectBox(const float boundsMin[3], const float boundsMax[3], const Vec3& origin, const Vec3& invDirection, float tMin, float tMax)
+{
+  for(int axis = 0; axis < 3; axis++)
+  {
+    const float t0 = (boundsMin[axis] - origin[axis]) * invDirection[axis];
+    const float t1 = (boundsMax[axis] - origin[axis]) * invDirection[axis];
+    tMin           = std::fmax(tMin, std::fmin(t0, t1));
+    tMax           = std::fmin(tMax, std::fmax(t0, t1));
+  }
+  return (tMin <= tMax) ? tMin : std::numeric_limits<float>::infinity();
+}
+}  // namespace
+
+void CpuBvh::build(const float* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+{
+  m_nodes.clear();
+  m_blocks.clear();
+
+  const uint32_t triangleCount = uint32_t(indexCount / 3);
+  auto           vertex        = [&](uint32_t index) {
+    assert(index < vertexCount);
+    return Vec3(vertices[3 * index + 0], vertices[3 * index + 1], vertices[3 * index + 2]);
+  };
+
+  std::vector<PrimitiveRef> refs(triangleCount);
+  for(uint32_t prim = 0; prim < triangleCount; prim++)
+  {
+    PrimitiveRef& ref = refs[prim];
+    ref.bounds.grow(vertex(indices[3 * prim + 0]));
+    ref.bounds.grow(vertex(indices[3 * prim + 1]));
+    ref.bounds.grow(vertex(indices[3 * prim + 2]));
+    ref.centroid    = (ref.bounds.lo + ref.bounds.hi) * 0.5f;
+    ref.primitiveID = prim;
+  }
+
+  m_nodes.reserve(size_t(2) * std::max(1u, triangleCount));
+
+  auto makeLeaf = [&](uint32_t nodeIndex, uint32_t first, uint32_t count) {
+    Node& node      = m_nodes[nodeIndex];
+    node.offset     = uint32_t(m_blocks.size());
+    node.blockCount = (count + 3) / 4;
+    for(uint32_t i = 0; i < count; i += 4)
+    {
+      TriangleBlock block{};
+      for(uint32_t lane = 0; lane < 4; lane++)
+      {
+        block.primitiveID[lane] = ~0u;
+        if(i + lane >= count)
+          continue;
+        const uint32_t prim = refs[first + i + lane].primitiveID;
+        const Vec3     v0   = vertex(indices[3 * prim + 0]);
+        const Vec3     e1   = vertex(indices[3 * prim + 1]) - v0;
+        const Vec3     e2   = vertex(indices[3 * prim + 2]) - v0;
+        for(int axis = 0; axis < 3; axis++)
+        {
+          block.v0[axis][lane] = v0[axis];
+          block.e1[axis][lane] = e1[axis];
+          block.e2[axis][lane] = e2[axis];
+        }
+        block.primitiveID[lane] = prim;
+      }
+      m_blocks.push_back(block);
+    }
+  };
+
+  // Recursive build. Since the left child is always allocated right after its parent,
+  // only the right child's index has to be stored. Clustered triangles can make SAH trees
+  // arbitrarily deep, so past kMaxSahDepth nodes split at the median, which halves them.
+  auto buildNode = [&](auto&& self, uint32_t first, uint32_t count, uint32_t depth) -> void {
+    const uint32_t nodeIndex = uint32_t(m_nodes.size());
+    m_nodes.push_back({});
+
+    Bounds bounds, centroidBounds;
+    for(uint32_t i = first; i < first + count; i++)
+    {
+      bounds.grow(refs[i].bounds);
+      centroidBounds.grow(refs[i].centroid);
+    }
+    for(int axis = 0; axis < 3; axis++)
+    {
+      m_nodes[nodeIndex].boundsMin[axis] = bounds.lo[axis];
+      m_nodes[nodeIndex].boundsMax[axis] = bounds.hi[axis];
+    }
+
+    if(count <= 4 || depth >= kMaxDepth)
+    {
+      makeLeaf(nodeIndex, first, count);
+      return;
+    }
+    if(depth >= kMaxSahDepth)
+    {
+      // Median of the centroids along the longest axis of their bounds
+      const Vec3    extent = centroidBounds.hi - centroidBounds.lo;
+      const int     axis   = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : ((extent.y >= extent.z) ? 1 : 2);
+      PrimitiveRef* begin  = refs.data() + first;
+      std::nth_element(begin, begin + count / 2, begin + count,
+                       [&](const PrimitiveRef& a, const PrimitiveRef& b) { return a.centroid[axis] < b.centroid[axis]; });
+      self(self, first, count / 2, depth + 1);
+      m_nodes[nodeIndex].offset = uint32_t(m_nodes.size());
+      self(self, first + count / 2, count - count / 2, depth + 1);
+      return;
+    }
+
+    // Find the cheapest binned SAH split over all three axes.
+    float bestCost  = std::numeric_limits<float>::max();
+    int   bestAxis  = -1;
+    int   bestSplit = 0;
+    for(int axis = 0; axis < 3; axis++)
+    {
+      const float extent = centroidBounds.hi[axis] - centroidBounds.lo[axis];
+      if(extent <= 0.0f)
+        continue;
+      const float scale = kBinCount / extent;
+
+      Bounds   binBounds[kBinCount];
+      uint32_t binCounts[kBinCount] = {};
+      for(uint32_t i = first; i < first + count; i++)
+      {
+        const int bin = std::min(kBinCount - 1, int((refs[i].centroid[axis] - centroidBounds.lo[axis]) * scale));
+        binBounds[bin].grow(refs[i].bounds);
+        binCounts[bin]++;
+      }
+
+      // Sweep from the right to get the area and count right of each split plane
+      float    rightArea[kBinCount];
+      uint32_t rightCount[kBinCount];
+      Bounds   accumulated;
+      uint32_t accumulatedCount = 0;
+      for(int bin = kBinCount - 1; bin > 0; bin--)
+      {
+        accumulated.grow(binBounds[bin]);
+        accumulatedCount += binCounts[bin];
+        rightArea[bin]  = accumulated.area();
+        rightCount[bin] = accumulatedCount;
+      }
+
+      // Then sweep from the left and evaluate every split plane
+      accumulated      = Bounds();
+      accumulatedCount = 0;
+      for(int split = 1; split < kBinCount; split++)
+      {
+        accumulated.grow(binBounds[split - 1]);
+        accumulatedCount += binCounts[split - 1];
+        if(accumulatedCount == 0 || rightCount[split] == 0)
+          continue;
+        const float cost = accumulated.area() * blockCountOf(accumulatedCount) + rightArea[split] * blockCountOf(rightCount[split]);
+        if(cost < bestCost)
+        {
+          bestCost  = cost;
+          bestAxis  = axis;
+          bestSplit = split;
+        }
+      }
+    }
+
+    const float leafCost = blockCountOf(count) * kBlockIntersectCost;
+    const float splitCost =
+        (bestAxis >= 0) ? kTraversalCost + kBlockIntersectCost * bestCost / std::max(bounds.area(), 1e-30f) : leafCost;
+    if(count <= kMaxLeafTriangles && leafCost <= splitCost)
+    {
+      makeLeaf(nodeIndex, first, count);
+      return;
+    }
+
+    uint32_t middle;
+    if(bestAxis >= 0)
+    {
+      const float extent = centroidBounds.hi[bestAxis] - centroidBounds.lo[bestAxis];
+      const float scale  = kBinCount / extent;
+      PrimitiveRef* mid  = std::partition(refs.data() + first, refs.data() + first + count, [&](const PrimitiveRef& ref) {
+        return std::min(kBinCount - 1, int((ref.centroid[bestAxis] - centroidBounds.lo[bestAxis]) * scale)) < bestSplit;
+      });
+      middle             = uint32_t(mid - refs.data());
+    }
+    else
+    {
+      // All centroids coincide, so no plane separates them; split the list in half.
+      middle = first + count / 2;
+    }
+
+    self(self, first, middle - first, depth + 1);
+    m_nodes[nodeIndex].offset = uint32_t(m_nodes.size());
+    self(self, middle, first + count - middle, depth + 1);
+  };
+
+  if(triangleCount > 0)
+  {
+    buildNode(buildNode, 0, triangleCount, 0);
+  }
+}
+
+void CpuBvh::refit(const float* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+{
+  assert(indexCount / 3 <= size_t(m_blocks.size()) * 4);
+  (void)indexCount;
+  auto vertex = [&](uint32_t index) {
+    assert(index < vertexCount);
+    return Vec3(vertices[3 * index + 0], vertices[3 * index + 1], vertices[3 * index + 2]);
+  };
+
+  // Children come after their parents, so going backwards refits the children first.
+  for(size_t nodeIndex = m_nodes.size(); nodeIndex-- > 0;)
+  {
+    Node&  node = m_nodes[nodeIndex];
+    Bounds bounds;
+    if(node.blockCount > 0)
+    {
+      for(uint32_t b = node.offset; b < node.offset + node.blockCount; b++)
+      {
+        TriangleBlock& block = m_blocks[b];
+        for(uint32_t lane = 0; lane < 4 && block.primitiveID[lane] != ~0u; lane++)
+        {
+          const uint32_t prim = block.primitiveID[lane];
+          const Vec3     v0   = vertex(indices[3 * prim + 0]);
+          const Vec3     v1   = vertex(indices[3 * prim + 1]);
+          const Vec3     v2   = vertex(indices[3 * prim + 2]);
+          for(int axis = 0; axis < 3; axis++)
+          {
+            block.v0[axis][lane] = v0[axis];
+            block.e1[axis][lane] = v1[axis] - v0[axis];
+            block.e2[axis][lane] = v2[axis] - v0[axis];
+          }
+          bounds.grow(v0);
+          bounds.grow(v1);
+          bounds.grow(v2);
+        }
+      }
+    }
+    else
+    {
+      for(const Node* child : {&m_nodes[nodeIndex + 1], &m_nodes[node.offset]})
+      {
+        bounds.grow(Vec3(child->boundsMin[0], child->boundsMin[1], child->boundsMin[2]));
+        bounds.grow(Vec3(child->boundsMax[0], child->boundsMax[1], child->boundsMax[2]));
+      }
+    }
+    for(int axis = 0; axis < 3; axis++)
+    {
+      node.boundsMin[axis] = bounds.lo[axis];
+      node.boundsMax[axis] = bounds.hi[axis];
+    }
+  }
+}
+
+float CpuBvh::getSahCost() const
+{
+  if(m_nodes.empty())
+    return 0.0f;
+  auto area = [](const Node& node) {
+    Bounds bounds;
+    bounds.grow(Vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]));
+    bounds.grow(Vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]));
+    return bounds.area();
+  };
+  float cost = 0.0f;
+  for(const Node& node : m_nodes)
+  {
+    cost += area(node) * ((node.blockCount > 0) ? kBlockIntersectCost * float(node.blockCount) : kTraversalCost);
+  }
+  return cost / std::max(area(m_nodes[0]), 1e-30f);
+}
+
+CpuHit CpuBvh::intersect(const Vec3& origin, const Vec3& direction, float tMin, float tMax, bool anyHit) const
+{
+  CpuHit hit;
+  if(m_nodes.empty())
+    return hit;
+
+  const Vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+  const F4   ox = F4::broadcast(origin.x), oy = F4::broadcast(origin.y), oz = F4::broadcast(origin.z);
+  const F4   dx = F4::broadcast(direction.x), dy = F4::broadcast(direction.y), dz = F4::broadcast(direction.z);
+  const F4   zero = F4::broadcast(0.0f), one = F4::broadcast(1.0f), tMinV = F4::broadcast(tMin);
+
+  float closestT = tMax;
+
+  uint32_t stack[kMaxStackDepth];
+  int      stackSize = 0;
+  uint32_t nodeIndex = 0;
+  if(intersectBox(m_nodes[0].boundsMin, m_nodes[0].boundsMax, origin, invDirection, tMin, closestT)
+     == std::numeric_limits<float>::infinity())
+    return hit;
+
+  while(true)
+  {
+    const Node& node = m_nodes[nodeIndex];
+    if(node.blockCount > 0)
+    {
+      for(uint32_t b = node.offset; b < node.offset + node.blockCount; b++)
+      {
+        // Moller-Trumbore, 4 triangles at a time
+        const TriangleBlock& block = m_blocks[b];
+        const F4 e1x = F4::load(block.e1[0]), e1y = F4::load(block.e1[1]), e1z = F4::load(block.e1[2]);
+        const F4 e2x = F4::load(block.e2[0]), e2y = F4::load(block.e2[1]), e2z = F4::load(block.e2[2]);
+        // pvec = cross(direction, e2)
+        const F4 px  = dy * e2z - dz * e2y;
+        const F4 py  = dz * e2x - dx * e2z;
+        const F4 pz  = dx * e2y - dy * e2x;
+        const F4 det = e1x * px + e1y * py + e1z * pz;
+        const F4 invDet = one / det;
+        // tvec = origin - v0
+        const F4 tx = ox - F4::load(block.v0[0]);
+        const F4 ty = oy - F4::load(block.v0[1]);
+        const F4 tz = oz - F4::load(block.v0[2]);
+        const F4 u  = (tx * px + ty * py + tz * pz) * invDet;
+        // qvec = cross(tvec, e1)
+        const F4 qx = ty * e1z - tz * e1y;
+        const F4 qy = tz * e1x - tx * e1z;
+        const F4 qz = tx * e1y - ty * e1x;
+        const F4 v  = (dx * qx + dy * qy + dz * qz) * invDet;
+        const F4 t  = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+        const F4 mask = (det != zero) & (u >= zero) & (v >= zero) & ((u + v) <= one) & (t >= tMinV) & (t < F4::broadcast(closestT));
+        int      bits = moveMask(mask);
+        if(bits == 0)
+          continue;
+
+        alignas(16) float tLanes[4], uLanes[4], vLanes[4];
+        store(tLanes, t);
+        store(uLanes, u);
+        store(vLanes, v);
+        for(int lane = 0; lane < 4; lane++)
+        {
+          if((bits & (1 << lane)) && tLanes[lane] < closestT)
+          {
+            closestT        = tLanes[lane];
+            hit.primitiveID = block.primitiveID[lane];
+            hit.t           = tLanes[lane];
+            hit.u           = uLanes[lane];
+            hit.v           = vLanes[lane];
+          }
+        }
+        if(anyHit)
+          return hit;
+      }
+    }
+    else
+    {
+      // Visit the nearer child first, and keep the other one for later.
+      uint32_t    nearChild = nodeIndex + 1, farChild = node.offset;
+      const float tNear = intersectBox(m_nodes[nearChild].boundsMin, m_nodes[nearChild].boundsMax, origin, invDirection, tMin, closestT);
+      const float tFar = intersectBox(m_nodes[farChild].boundsMin, m_nodes[farChild].boundsMax, origin, invDirection, tMin, closestT);
+      const bool  hitNear = tNear != std::numeric_limits<float>::infinity();
+      const bool  hitFar  = tFar != std::numeric_limits<float>::infinity();
+      if(hitNear && hitFar)
+      {
+        if(tFar < tNear)
+          std::swap(nearChild, farChild);
+        if(stackSize == kMaxStackDepth)
+        {
+          // build() limits the depth of the tree, so this is a bug rather than a scene that is too deep.
+          fprintf(stderr, "CpuBvh: traversal stack overflow\n");
+          std::abort();
+        }
+        stack[stackSize++] = farChild;
+        nodeIndex          = nearChild;
+        continue;
+      }
+      if(hitNear || hitFar)
+      {
+        nodeIndex = hitNear ? nearChild : farChild;
+        continue;
+      }
+    }
+
+    if(stackSize == 0)
+      break;
+    nodeIndex = stack[--stackSize];
+  }
+
+  return hit;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// Bounding volume hierarchy for the CPU backend.
+//
+// The tree is a binary BVH built with the surface area heuristic (SAH) over binned centroids.
+// Leaves store their triangles in blocks of 4, laid out as structures of arrays, so that one
+// ray is tested against 4 triangles at once with SIMD instructions (SSE on x86-64, with a
+// scalar fallback elsewhere).
+//
+// Intersection follows the semantics of the ray query in raytrace.comp.glsl: all geometry is
+// opaque, back faces are not culled, and the closest hit in [tMin, tMax] is returned together
+// with the primitive ID and the barycentric coordinates of the hit.
+
+#include "cpu_math.hpp"
+
+#include <cstdint>
+#include <vector>
+
+struct CpuHit
+{
+  uint32_t primitiveID = ~0u;  // Index of the triangle, as in rayQueryGetIntersectionPrimitiveIndexEXT
+  float    t           = 0.0f;
+  float    u = 0.0f, v = 0.0f;  // Barycentrics of v1 and v2, as in rayQueryGetIntersectionBarycentricsEXT
+
+  bool valid() const { return primitiveID != ~0u; }
+};
+
+class CpuBvh
+{
+public:
+  // Builds the BVH over the triangles (indices[3*i], indices[3*i+1], indices[3*i+2]) of a
+  // mesh with tightly packed xyz float vertices.
+  void build(const float* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount);
+  // Moves the triangles of the last build() to new vertices, keeping the tree: recomputes the
+  // triangles of the leaves and the bounds of all nodes. `indices` may differ from the ones of the
+  // build, but must describe the same number of triangles.
+  void refit(const float* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount);
+
+  // Returns the closest intersection of the ray origin + t * direction with t in [tMin, tMax]. With anyHit,
+  // returns the first intersection found instead, like gl_RayFlagsTerminateOnFirstHitEXT (for shadow rays).
+  CpuHit intersect(const Vec3& origin, const Vec3& direction, float tMin, float tMax, bool anyHit = false) const;
+
+  size_t getNodeCount() const { return m_nodes.size(); }
+  // The SAH cost of the tree: the expected cost of a ray that hits the root, as in the build (see refit.hpp).
+  float getSahCost() const;
+
+private:
+  // 32-byte node. For inner nodes, the left child directly follows its parent and
+  // `offset` is the index of the right child. For leaves, `offset` is the first triangle block.
+  struct Node
+  {
+    float    boundsMin[3];
+    uint32_t offset;
+    float    boundsMax[3];
+    uint32_t blockCount;  // 0 for inner nodes
+  };
+
+  // 4 triangles in structure-of-arrays layout, stored as v0 and the two edges v1 - v0 and v2 - v0.
+  // Unused lanes have zero edges (which never intersect) and a primitive ID of ~0.
+  struct alignas(16) TriangleBlock
+  {
+    float    v0[3][4];
+    float    e1[3][4];
+    float    e2[3][4];
+    uint32_t primitiveID[4];
+  };
+
+  std::vector<Node>          m_nodes;
+  std::vector<TriangleBlock> m_blocks;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+// Minimal vector math for the CPU backend. The functions are named after their GLSL
+// counterparts so that the CPU code can be read side by side with raytrace.comp.glsl.
+
+#include <cmath>
+#include <cstdint>
+
+struct Vec3
+{
+  float x = 0.0f, y = 0.0f, z = 0.0f;
+
+  Vec3() = default;
+  Vec3(float x_, float y_, float z_)
+      : x(x_)
+      , y(y_)
+      , z(z_)
+  {
+  }
+  explicit Vec3(float s)
+      : x(s)
+      , y(s)
+      , z(s)
+  {
+  }
+
+  float  operator[](int i) const { return (&x)[i]; }
+  float& operator[](int i) { return (&x)[i]; }
+};
+
+inline Vec3 operator+(const Vec3& a, const Vec3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Vec3 operator-(const Vec3& a, const Vec3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Vec3 operator*(const Vec3& a, const Vec3& b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+inline Vec3 operator*(const Vec3& a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+inline Vec3 operator*(float s, const Vec3& a) { return {a.x * s, a.y * s, a.z * s}; }
+inline Vec3 operator/(const Vec3& a, float s) { return {a.x / s, a.y / s, a.z / s}; }
+inline Vec3& operator+=(Vec3& a, const Vec3& b) { return a = a + b; }
+inline Vec3& operator*=(Vec3& a, const Vec3& b) { return a = a * b; }
+
+inline float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3  cross(const Vec3& a, const Vec3& b)
+{
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+inline Vec3  normalize(const Vec3& a) { return a * (1.0f / std::sqrt(dot(a, a))); }
+inline Vec3  mix(const Vec3& a, const Vec3& b, float t) { return a * (1.0f - t) + b * t; }
+inline Vec3  min(const Vec3& a, const Vec3& b) { return {std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z)}; }
+inline Vec3  max(const Vec3& a, const Vec3& b) { return {std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z)}; }
+inline float sign(float x) { return (x > 0.0f) ? 1.0f : ((x < 0.0f) ? -1.0f : 0.0f); }
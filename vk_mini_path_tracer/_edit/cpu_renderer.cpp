@@ -0,0 +1,439 @@
+#include "cpu_renderer.hpp"
+#include "work_stealing.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+// Tiles are the unit of work handed to the scheduler, and the tiles whose convergence is tested.
+constexpr uint32_t kTileWidth  = 16;
+constexpr uint32_t kTileHeight = 16;
+
+// The functions below mirror the ones with the same names in raytrace.comp.glsl.
+
+// Returns the color of the sky in a given direction (in linear color space)
+inline Vec3 skyColor(const Vec3& direction)
+{
+  // +y in world space is up, so:
+  if(direction.y > 0.0f)
+  {
+    return mix(Vec3(1.0f), Vec3(0.25f, 0.5f, 1.0f), direction.y);
+  }
+  else
+  {
+    return Vec3(0.03f);
+  }
+}
+
+// The AOVs of the first segment of a sample, which started at the camera.
+inline shaderio::PixelAovs firstHitAovs(bool hit, const HitInfo& hitInfo, const Vec3& cameraOrigin, const Vec3& rayDirection)
+{
+  if(hit)
+  {
+    const Vec3 toHit  = hitInfo.worldPosition - cameraOrigin;
+    const Vec3 normal = (dot(rayDirection, hitInfo.worldNormal) < 0.0f) ? hitInfo.worldNormal : hitInfo.worldNormal * -1.0f;
+    return {{hitInfo.color.x, hitInfo.color.y, hitInfo.color.z}, std::sqrt(dot(toHit, toHit)), {normal.x, normal.y, normal.z}};
+  }
+  const Vec3 sky = skyColor(rayDirection);
+  return {{sky.x, sky.y, sky.z}, SKY_DEPTH, {-rayDirection.x, -rayDirection.y, -rayDirection.z}};
+}
+
+inline void addAovs(shaderio::PixelAovs& pixelAovs, const shaderio::PixelAovs& aovs)
+{
+  pixelAovs.albedo = {pixelAovs.albedo.x + aovs.albedo.x, pixelAovs.albedo.y + aovs.albedo.y, pixelAovs.albedo.z + aovs.albedo.z};
+  pixelAovs.depth += aovs.depth;
+  pixelAovs.normal = {pixelAovs.normal.x + aovs.normal.x, pixelAovs.normal.y + aovs.normal.y, pixelAovs.normal.z + aovs.normal.z};
+}
+
+// Solid-angle pdf of a Lambertian bounce about `normal`.
+inline float lambertianPdf(const Vec3& normal, const Vec3& direction)
+{
+  return std::max(dot(normal, direction), 0.0f) / 3.14159265f;
+}
+
+// Solid-angle pdf with which sampleLight() picks a point of a light at `distance`, seen at `cosLight` to its normal.
+inline float lightPdf(const Vec3& emission, float inverseLightPower, float distance, float cosLight)
+{
+  return Luminance(emission) * inverseLightPower * distance * distance / std::max(cosLight, 1e-6f);
+}
+
+// The power heuristic of multiple importance sampling, for one sample of each of two strategies.
+inline float powerHeuristic(float pdf, float otherPdf)
+{
+  return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// Russian roulette: returns false if the path ends; otherwise, divides its throughput by the survival probability.
+inline bool survivesRussianRoulette(uint32_t               rouletteStart,
+                                    uint32_t               tracedSegments,
+                                    Vec3&                  throughput,
+                                    const SamplerSettings& samplerSettings,
+                                    shaderio::PathSampler& sampler)
+{
+  if(rouletteStart == 0 || tracedSegments < rouletteStart)
+  {
+    return true;
+  }
+  const float survival = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.95f);
+  if(Sample1D(samplerSettings, sampler) >= survival)
+  {
+    return false;
+  }
+  throughput = throughput / survival;
+  return true;
+}
+}  // namespace
+
+void CpuRenderer::setScene(const Scene& scene)
+{
+  flattenScene(scene);
+  m_bvh.build(m_vertices.data(), m_vertices.size() / 3, m_indices.data(), m_indices.size());
+  m_builtSahCost = m_bvh.getSahCost();
+  m_refitCount   = 0;
+}
+
+AccelerationUpdate CpuRenderer::updateScene(const Scene& scene, const RefitSettings& settings)
+{
+  const auto         startTime = std::chrono::steady_clock::now();
+  AccelerationUpdate update;
+  flattenScene(scene);
+  m_bvh.refit(m_vertices.data(), m_vertices.size() / 3, m_indices.data(), m_indices.size());
+  m_refitCount++;
+  update.kind      = "refit";
+  update.sahGrowth = (m_builtSahCost > 0.0f) ? m_bvh.getSahCost() / m_builtSahCost : 1.0f;
+  if(ShouldRebuild(settings, update.sahGrowth, m_refitCount))
+  {
+    m_bvh.build(m_vertices.data(), m_vertices.size() / 3, m_indices.data(), m_indices.size());
+    m_builtSahCost = m_bvh.getSahCost();
+    m_refitCount   = 0;
+    update.kind    = "rebuild";
+  }
+  update.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  return update;
+}
+
+void CpuRenderer::flattenScene(const Scene& scene)
+{
+  m_vertices.clear();
+  m_indices.clear();
+  m_triangleMaterials.clear();
+  m_materials = scene.getMaterials();
+  BuildLightTable(scene, m_lights);
+  m_inverseLightPower = m_lights.triangles.empty() ? 0.0f : 1.0f / m_lights.totalPower;
+  if(m_samplerTables.sobolMatrices.empty())
+  {
+    BuildSamplerTables(m_samplerTables);
+  }
+  for(const SceneInstance& instance : scene.getInstances())
+  {
+    const SceneMesh& mesh        = scene.getMeshes()[instance.meshIndex];
+    const uint32_t   firstVertex = uint32_t(m_vertices.size() / 3);
+    for(uint32_t i = 0; i < mesh.vertexCount; i++)
+    {
+      const Vec3 vertex = instance.transform.transformPoint(Vec3(mesh.vertices[3 * i + 0], mesh.vertices[3 * i + 1], mesh.vertices[3 * i + 2]));
+      m_vertices.insert(m_vertices.end(), {vertex.x, vertex.y, vertex.z});
+    }
+    // The shader transforms object-space normals with the inverse transpose, which keeps their
+    // direction under mirroring transforms; here, the normal comes from the world-space winding
+    // instead, so mirrored triangles are flipped back.
+    const bool mirrored = instance.transform.determinant() < 0.0f;
+    for(uint32_t i = 0; i < mesh.indexCount; i += 3)
+    {
+      const uint32_t i1 = mesh.indices[i + (mirrored ? 2 : 1)];
+      const uint32_t i2 = mesh.indices[i + (mirrored ? 1 : 2)];
+      m_indices.insert(m_indices.end(), {firstVertex + mesh.indices[i], firstVertex + i1, firstVertex + i2});
+      m_triangleMaterials.push_back(instance.materialOffset + mesh.materialIds[i / 3]);
+    }
+  }
+}
+
+Vec3 CpuRenderer::getVertex(uint32_t index) const
+{
+  return Vec3(m_vertices[3 * index + 0], m_vertices[3 * index + 1], m_vertices[3 * index + 2]);
+}
+
+// Mirrors getObjectHitInfo() in raytrace.comp.glsl.
+HitInfo CpuRenderer::getObjectHitInfo(const CpuHit& hit) const
+{
+  HitInfo result;
+
+  // Get the vertices of the triangle
+  const Vec3 v0 = getVertex(m_indices[3 * hit.primitiveID + 0]);
+  const Vec3 v1 = getVertex(m_indices[3 * hit.primitiveID + 1]);
+  const Vec3 v2 = getVertex(m_indices[3 * hit.primitiveID + 2]);
+
+  // Compute the coordinates of the intersection from the barycentric coordinates
+  const Vec3 barycentrics(1.0f - hit.u - hit.v, hit.u, hit.v);
+  result.worldPosition = v0 * barycentrics.x + v1 * barycentrics.y + v2 * barycentrics.z;
+
+  // Compute the normal of the triangle using the right-hand rule
+  result.worldNormal = normalize(cross(v1 - v0, v2 - v0));
+
+  const SceneMaterial& material = m_materials[m_triangleMaterials[hit.primitiveID]];
+  result.color                  = material.diffuse;
+  result.emission               = material.emission;
+
+  return result;
+}
+
+// Mirrors emittedLight() in raytrace.comp.glsl.
+Vec3 CpuRenderer::emittedLight(const HitInfo& hitInfo, const Vec3& rayOrigin, const Vec3& rayDirection, float bsdfPdf, bool sampleLights) const
+{
+  if(!sampleLights || bsdfPdf == 0.0f || (hitInfo.emission.x == 0.0f && hitInfo.emission.y == 0.0f && hitInfo.emission.z == 0.0f))
+  {
+    return hitInfo.emission;
+  }
+  const Vec3  toHit    = hitInfo.worldPosition - rayOrigin;
+  const float distance = std::sqrt(dot(toHit, toHit));
+  const float cosLight = std::abs(dot(rayDirection, hitInfo.worldNormal));
+  return hitInfo.emission * powerHeuristic(bsdfPdf, lightPdf(hitInfo.emission, m_inverseLightPower, distance, cosLight));
+}
+
+// Mirrors sampleLight() in raytrace.comp.glsl.
+Vec3 CpuRenderer::sampleLight(const Vec3& origin, const Vec3& normal, const SamplerSettings& samplerSettings, shaderio::PathSampler& sampler) const
+{
+  const uint32_t lightCount = uint32_t(m_lights.triangles.size());
+  const float    scaled     = Sample1D(samplerSettings, sampler) * float(lightCount);
+  uint32_t       index      = std::min(uint32_t(scaled), lightCount - 1);
+  if(scaled - float(index) >= m_lights.triangles[index].probability)
+  {
+    index = m_lights.triangles[index].alias;
+  }
+  const shaderio::EmissiveTriangle& light = m_lights.triangles[index];
+  const Vec3                        v0(light.v0.x, light.v0.y, light.v0.z);
+  const Vec3                        v1(light.v1.x, light.v1.y, light.v1.z);
+  const Vec3                        v2(light.v2.x, light.v2.y, light.v2.z);
+  const Vec3                        emission(light.emission.x, light.emission.y, light.emission.z);
+
+  float u, v;
+  Sample2D(samplerSettings, sampler, u, v);
+  const float rootU = std::sqrt(u);
+  const Vec3  point = (1.0f - rootU) * v0 + rootU * (1.0f - v) * v1 + rootU * v * v2;
+
+  const Vec3  toLight    = point - origin;
+  const float distance   = std::sqrt(dot(toLight, toLight));
+  const Vec3  direction  = toLight / distance;
+  const float cosSurface = dot(normal, direction);
+  const float cosLight   = std::abs(dot(normalize(cross(v1 - v0, v2 - v0)), direction));
+  if(cosSurface <= 0.0f || cosLight <= 0.0f || m_bvh.intersect(origin, direction, 0.0f, distance * 0.999f, true).valid())
+  {
+    return Vec3(0.0f);
+  }
+  const float pdf = lightPdf(emission, m_inverseLightPower, distance, cosLight);
+  return emission * (cosSurface / 3.14159265f) * powerHeuristic(pdf, lambertianPdf(normal, direction)) / pdf;
+}
+
+CpuTraceStats CpuRenderer::render(const CpuRenderSettings&                 settings,
+                                  std::vector<float>&                      imageData,
+                                  std::vector<shaderio::PixelAccumulator>* accumulators,
+                                  std::vector<shaderio::PixelAovs>*        aovs) const
+{
+  const size_t pixelCount = size_t(settings.width) * settings.height;
+  imageData.assign(pixelCount * 3, 0.0f);
+  std::vector<shaderio::PixelAccumulator>  ownAccumulators;
+  std::vector<shaderio::PixelAccumulator>& pixelAccumulators = (accumulators != nullptr) ? *accumulators : ownAccumulators;
+  pixelAccumulators.assign(pixelCount, shaderio::PixelAccumulator{});
+  if(aovs != nullptr)
+  {
+    aovs->assign(pixelCount, shaderio::PixelAovs{});
+  }
+
+  const uint32_t tilesX    = (settings.width + kTileWidth - 1) / kTileWidth;
+  const uint32_t tilesY    = (settings.height + kTileHeight - 1) / kTileHeight;
+  const uint32_t tileCount = tilesX * tilesY;
+
+  // Progressive rendering, as in GpuRenderer::trace(): each batch of samples goes over the tiles that are still
+  // active, and then the tiles whose noise has dropped below the target stop sampling. The CPU's convergence
+  // tiles are its scheduler tiles.
+  const bool                       checkConvergence = settings.convergence.targetNoise > 0.0f;
+  std::vector<uint32_t>            tileActive(tileCount, 1u);
+  std::vector<shaderio::TileStats> tileStats(tileCount);
+
+  WorkStealingScheduler scheduler(settings.threadCount);
+  std::vector<uint64_t> workerRayCounts(scheduler.getThreadCount(), 0);  // Summed at the end, so that workers don't share a counter
+  CpuTraceStats         stats;
+  stats.tileCount       = tileCount;
+  uint32_t   activeTiles = tileCount;
+  const auto startTime   = std::chrono::steady_clock::now();
+  while(activeTiles > 0 && stats.samplesTraced < settings.numSamples)
+  {
+    const uint32_t batchSamples = std::min(settings.samplesPerBatch, settings.numSamples - stats.samplesTraced);
+    scheduler.run(tileCount, [&](uint32_t tile, uint32_t worker) {
+      if(!tileActive[tile])
+        return;
+      const uint32_t x0 = (tile % tilesX) * kTileWidth;
+      const uint32_t y0 = (tile / tilesX) * kTileHeight;
+      const uint32_t x1 = std::min(x0 + kTileWidth, settings.width);
+      const uint32_t y1 = std::min(y0 + kTileHeight, settings.height);
+      uint64_t       tileRayCount = 0;
+      for(uint32_t y = y0; y < y1; y++)
+      {
+        for(uint32_t x = x0; x < x1; x++)
+        {
+          const size_t linearIndex = size_t(settings.width) * y + x;
+          tracePixel(settings, x, y, stats.batchCount, batchSamples, tileRayCount, pixelAccumulators[linearIndex],
+                     (aovs != nullptr) ? &(*aovs)[linearIndex] : nullptr);
+        }
+      }
+      if(checkConvergence)
+      {
+        tileStats[tile] = GetTileStats(pixelAccumulators.data(), settings.width, x0, y0, x1, y1);
+      }
+      workerRayCounts[worker] += tileRayCount;
+    });
+    stats.batchCount++;
+    stats.samplesTraced += batchSamples;
+    activeTiles = UpdateTileMask(tileStats.data(), tileCount, settings.convergence, tileActive.data());
+
+    const double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    if(settings.timeBudgetSeconds > 0.0 && elapsedSeconds >= settings.timeBudgetSeconds)
+      break;
+  }
+  stats.convergedTiles = tileCount - activeTiles;
+
+  // Each pixel's color is the mean of its samples, however many its tile traced
+  for(size_t i = 0; i < pixelCount; i++)
+  {
+    const shaderio::PixelAccumulator& accumulator = pixelAccumulators[i];
+    const float                       n           = float(std::max(accumulator.sampleCount, 1u));
+    imageData[3 * i + 0]                          = accumulator.sum.x / n;
+    imageData[3 * i + 1]                          = accumulator.sum.y / n;
+    imageData[3 * i + 2]                          = accumulator.sum.z / n;
+  }
+
+  for(uint64_t workerRayCount : workerRayCounts)
+  {
+    stats.rayCount += workerRayCount;
+  }
+  return stats;
+}
+
+// This is the body of main() in raytrace.comp.glsl for a single pixel and batch: traces the `batchSamples` samples
+// of batch number `batch` of the render, and adds them to the pixel's accumulator.
+void CpuRenderer::tracePixel(const CpuRenderSettings&    settings,
+                             uint32_t                    pixelX,
+                             uint32_t                    pixelY,
+                             uint32_t                    batch,
+                             uint32_t                    batchSamples,
+                             uint64_t&                   rayCount,
+                             shaderio::PixelAccumulator& accumulator,
+                             shaderio::PixelAovs*        aovs) const
+{
+  // The sum of the colors and of the squared colors of all of the samples.
+  Vec3 summedPixelColor(accumulator.sum.x, accumulator.sum.y, accumulator.sum.z);
+  Vec3 summedPixelSquares(accumulator.sumSquares.x, accumulator.sumSquares.y, accumulator.sumSquares.z);
+
+  // Samples are traced in the same batches as the GPU's dispatches, with the same seeds.
+  const SamplerSettings samplerSettings{&m_samplerTables, settings.sampler, settings.seed, settings.width};
+  const uint32_t        linearIndex = settings.width * pixelY + pixelX;
+  const uint32_t        batchIndex  = settings.firstSample / settings.samplesPerBatch + batch;
+
+  // State of the sampler; its random number generator starts from the batch's seed.
+  shaderio::PathSampler sampler{PcgSeed(settings.width, settings.height, batchIndex, linearIndex, settings.seed), 0, 0, linearIndex};
+  for(uint32_t sampleIdx = 0; sampleIdx < batchSamples; sampleIdx++)
+  {
+    // Each sample takes the points of its index, from the first dimension on
+    sampler.sampleIndex = batchIndex * settings.samplesPerBatch + sampleIdx;
+    sampler.dimension   = 0;
+    const Vec3 sampleColor = traceSample(settings, samplerSettings, pixelX, pixelY, sampler, rayCount, aovs);
+    summedPixelColor += sampleColor;
+    summedPixelSquares += sampleColor * sampleColor;
+  }
+
+  accumulator.sum         = {summedPixelColor.x, summedPixelColor.y, summedPixelColor.z};
+  accumulator.sumSquares  = {summedPixelSquares.x, summedPixelSquares.y, summedPixelSquares.z};
+  accumulator.sampleCount += batchSamples;
+}
+
+// Traces one sample of a pixel: one path from the camera through the scene. If `aovs` isn't null, adds the
+// first-hit AOVs of the sample to it, like firstHitAovs() in raytrace.comp.glsl.
+Vec3 CpuRenderer::traceSample(const CpuRenderSettings& settings,
+                              const SamplerSettings&   samplerSettings,
+                              uint32_t                 pixelX,
+                              uint32_t                 pixelY,
+                              shaderio::PathSampler&   sampler,
+                              uint64_t&                rayCount,
+                              shaderio::PixelAovs*     aovs) const
+{
+  const float resolutionX = float(settings.width);
+  const float resolutionY = float(settings.height);
+
+  // By default, the camera is located at (-0.001, 1, 6), looking down the -z axis.
+  const Camera& camera           = settings.camera;
+  const float   fovVerticalSlope = camera.fovVerticalSlope;
+
+  Vec3 rayOrigin = camera.origin;
+  float randomX, randomY;
+  Sample2D(samplerSettings, sampler, randomX, randomY);
+  const float centerX      = float(pixelX) + randomX;
+  const float centerY      = float(pixelY) + randomY;
+  const float screenU      = (2.0f * centerX - resolutionX) / resolutionY;
+  const float screenV      = -(2.0f * centerY - resolutionY) / resolutionY;  // Flip the y axis
+  Vec3        rayDirection = normalize(fovVerticalSlope * screenU * camera.right  //
+                                       + fovVerticalSlope * screenV * camera.up   //
+                                       + camera.forward);
+
+  Vec3  accumulatedRayColor(1.0f);  // The amount of light that made it to the end of the current ray.
+  Vec3  sampleColor(0.0f);          // The light gathered along the path so far.
+  float bsdfPdf = 0.0f;             // Solid-angle pdf of rayDirection; 0 for the camera ray.
+
+  const bool sampleLights = settings.sampleLights && !m_lights.triangles.empty();  // As the GPU backend decides SPEC_SAMPLE_LIGHTS
+  for(uint32_t tracedSegments = 0; tracedSegments < settings.maxSegments; tracedSegments++)
+  {
+    const CpuHit  hit     = m_bvh.intersect(rayOrigin, rayDirection, 0.0f, 10000.0f);
+    const HitInfo hitInfo = hit.valid() ? getObjectHitInfo(hit) : HitInfo{};
+    rayCount++;
+    if(aovs != nullptr && tracedSegments == 0)
+    {
+      addAovs(*aovs, firstHitAovs(hit.valid(), hitInfo, camera.origin, rayDirection));
+    }
+    if(hit.valid())
+    {
+      // Ray hit a triangle, which may emit light
+      sampleColor += accumulatedRayColor * emittedLight(hitInfo, rayOrigin, rayDirection, bsdfPdf, sampleLights);
+
+      // Apply color absorption
+      accumulatedRayColor *= hitInfo.color;
+
+      // Start a new ray at the hit position, but offset it slightly along
+      // the normal against rayDirection:
+      rayOrigin = hitInfo.worldPosition - 0.0001f * sign(dot(rayDirection, hitInfo.worldNormal)) * hitInfo.worldNormal;
+
+      // Shade the side of the surface the ray came from (GLSL's faceforward): about a normal that faces away
+      // from it, the light sample and the bounce would go through the surface.
+      const Vec3 normal = (dot(rayDirection, hitInfo.worldNormal) < 0.0f) ? hitInfo.worldNormal : hitInfo.worldNormal * -1.0f;
+
+      // Add the light that a light sample finds from here
+      if(sampleLights)
+      {
+        rayCount++;
+        sampleColor += accumulatedRayColor * sampleLight(rayOrigin, normal, samplerSettings, sampler);
+      }
+
+      // Lambertian reflection: a random point on the unit sphere, offset by the normal
+      float random0, random1;
+      Sample2D(samplerSettings, sampler, random0, random1);
+      const float theta = 6.2831853f * random0;    // Random in [0, 2pi]
+      const float u     = 2.0f * random1 - 1.0f;  // Random in [-1, 1]
+      const float r     = std::sqrt(1.0f - u * u);
+
+      rayDirection = normalize(normal + Vec3(r * std::cos(theta), r * std::sin(theta), u));
+      bsdfPdf      = lambertianPdf(normal, rayDirection);
+
+      if(!survivesRussianRoulette(settings.russianRouletteStart, tracedSegments + 1, accumulatedRayColor, samplerSettings, sampler))
+      {
+        break;
+      }
+    }
+    else
+    {
+      // Ray hit the sky
+      sampleColor += accumulatedRayColor * skyColor(rayDirection);
+      break;
+    }
+  }
+
+  // Paths that never find a light source contribute no light.
+  return sampleColor;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+// CPU backend for machines without a GPU that supports ray queries.
+//
+// CpuRenderer runs the same algorithm as shaders/raytrace.comp.glsl - the same samplers (see
+// samplers.hpp), camera, materials, Lambertian bounces, light sampling, Russian roulette and sky - but
+// traces rays against a CpuBvh and spreads image tiles over all cores with a WorkStealingScheduler. The result is written in the same
+// layout as the GPU's float output format (RGB floats, row by row), so it goes through the same
+// ImageWriter, and can be compared with GPU output for regression checks.
+//
+// Unlike the GPU, which builds one BLAS per mesh, the CPU backend has a single BVH over the
+// triangles of all instances, transformed to world space; so on the CPU, memory grows with
+// the number of instances.
+
+#include "convergence.hpp"
+#include "cpu_bvh.hpp"
+#include "light_table.hpp"
+#include "profiler.hpp"  // For AccelerationUpdate
+#include "refit.hpp"
+#include "render_jobs.hpp"
+#include "samplers.hpp"
+#include "scene.hpp"
+
+#include <cstdint>
+#include <vector>
+
+struct CpuRenderSettings
+{
+  uint32_t width                = 800;
+  uint32_t height               = 600;
+  uint32_t numSamples           = 64;           // Total number of samples per pixel
+  uint32_t samplesPerBatch      = 8;            // Samples per GPU dispatch; each batch reseeds the RNG like the shader does
+  uint32_t maxSegments          = 32;           // Number of traced segments per sample in the shader
+  bool     sampleLights         = true;         // Next-event estimation, if the scene has lights (SPEC_SAMPLE_LIGHTS)
+  uint32_t russianRouletteStart = 3;            // SPEC_RUSSIAN_ROULETTE
+  uint32_t sampler              = SAMPLER_PCG;  // SPEC_SAMPLER
+  uint32_t seed                 = 0;            // PushConstants::seed
+  uint32_t firstSample          = 0;            // PushConstants::firstSample; a multiple of samplesPerBatch
+  uint32_t threadCount          = 0;            // 0 = one thread per hardware thread
+  Camera   camera;
+
+  // Progressive rendering, as on the GPU: batches stop once every tile has converged, or once the time budget has run out
+  ConvergenceSettings convergence;
+  double              timeBudgetSeconds = 0.0;  // 0 = no limit
+};
+
+// What CpuRenderer::render() traced, as in GpuRenderer::TraceStats
+struct CpuTraceStats
+{
+  uint32_t batchCount     = 0;
+  uint32_t samplesTraced  = 0;  // Samples per pixel of the tiles that never converged
+  uint32_t convergedTiles = 0;
+  uint32_t tileCount      = 0;
+  uint64_t rayCount       = 0;  // Number of ray segments traced
+};
+
+// Shading data of a hit, as in the shader
+struct HitInfo
+{
+  Vec3 color;
+  Vec3 emission;
+  Vec3 worldPosition;
+  Vec3 worldNormal;
+};
+
+class CpuRenderer
+{
+public:
+  // Transforms the scene's instances to world space, and builds the BVH over them.
+  void setScene(const Scene& scene);
+
+  // Brings the renderer up to date with a scene that setScene() was called with, after its instances moved or
+  // its meshes deformed (see sequence.hpp): refits the BVH, or rebuilds it when refit.hpp says so.
+  AccelerationUpdate updateScene(const Scene& scene, const RefitSettings& settings);
+
+  // Renders the image into `imageData` (width * height * 3 floats), batch by batch; after each batch, the
+  // tiles whose noise has dropped below settings.convergence.targetNoise stop sampling (see convergence.hpp).
+  // If `accumulators` or `aovs` aren't null, they get each pixel's PixelAccumulator or PixelAovs, row by row,
+  // as the GPU backend fills them (see denoiser.hpp and accumulation_file.hpp).
+  CpuTraceStats render(const CpuRenderSettings&                 settings,
+                       std::vector<float>&                      imageData,
+                       std::vector<shaderio::PixelAccumulator>* accumulators = nullptr,
+                       std::vector<shaderio::PixelAovs>*        aovs         = nullptr) const;
+
+private:
+  // Transforms the scene's instances to world space, and collects their materials and lights.
+  void    flattenScene(const Scene& scene);
+  Vec3    getVertex(uint32_t index) const;
+  HitInfo getObjectHitInfo(const CpuHit& hit) const;
+  void    tracePixel(const CpuRenderSettings&    settings,
+                     uint32_t                    pixelX,
+                     uint32_t                    pixelY,
+                     uint32_t                    batch,
+                     uint32_t                    batchSamples,
+                     uint64_t&                   rayCount,
+                     shaderio::PixelAccumulator& accumulator,
+                     shaderio::PixelAovs*        aovs) const;
+  Vec3    traceSample(const CpuRenderSettings& settings,
+                      const SamplerSettings&   samplerSettings,
+                      uint32_t                 pixelX,
+                      uint32_t                 pixelY,
+                      shaderio::PathSampler&   sampler,
+                      uint64_t&                rayCount,
+                      shaderio::PixelAovs*     aovs) const;
+  Vec3    emittedLight(const HitInfo& hitInfo, const Vec3& rayOrigin, const Vec3& rayDirection, float bsdfPdf, bool sampleLights) const;
+  Vec3    sampleLight(const Vec3& origin, const Vec3& normal, const SamplerSettings& samplerSettings, shaderio::PathSampler& sampler) const;
+
+  std::vector<float>         m_vertices;  // World-space xyz per vertex
+  std::vector<uint32_t>      m_indices;
+  std::vector<uint32_t>      m_triangleMaterials;  // Index in m_materials of each triangle
+  std::vector<SceneMaterial> m_materials;
+  LightTable                 m_lights;
+  float                      m_inverseLightPower = 0.0f;
+  SamplerTables              m_samplerTables;
+  CpuBvh                     m_bvh;
+  float                      m_builtSahCost = 0.0f;  // SAH cost of m_bvh when it was last built
+  uint32_t                   m_refitCount   = 0;     // Refits since then
+};
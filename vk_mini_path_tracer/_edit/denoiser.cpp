@@ -0,0 +1,249 @@
+#include "denoiser.hpp"
+#include "cpu_math.hpp"
+#include "light_table.hpp"  // For Luminance
+#include "work_stealing.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Bands of rows are the unit of work handed to the scheduler.
+constexpr uint32_t kBandHeight = 8;
+
+// The constants and functions below mirror the ones with the same names in denoise.comp.glsl.
+
+constexpr float    kAlbedoFloor   = 0.01f;
+constexpr float    kPhiLuminance  = 4.0f;
+constexpr float    kPhiNormal     = 128.0f;
+constexpr float    kPhiDepth      = 1.0f;
+constexpr uint32_t kMinOwnSamples = 4;
+constexpr float    kKernel[3]     = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+inline Vec3 toVec3(const shaderio::vec3& v)
+{
+  return {v.x, v.y, v.z};
+}
+
+// The AOVs of a pixel, averaged over its samples.
+struct Guide
+{
+  Vec3  albedo;
+  float depth;
+  Vec3  normal;
+};
+
+// The pixels of the image and their AOVs, with the geometry of the image.
+struct DenoiserInput
+{
+  const std::vector<shaderio::PixelAccumulator>& accumulators;
+  const std::vector<shaderio::PixelAovs>&        aovs;
+  int                                            width;
+  int                                            height;
+  float                                          fovVerticalSlope;
+};
+
+// A pixel of the denoiser's images, as DenoiserPixel in host_device.h.
+struct DenoiserPixel
+{
+  Vec3  illumination;
+  float variance;
+  float depthSlopeX, depthSlopeY;
+};
+
+Guide loadGuide(const DenoiserInput& input, size_t index)
+{
+  const float                n      = float(std::max(input.accumulators[index].sampleCount, 1u));
+  const shaderio::PixelAovs& aovs   = input.aovs[index];
+  const Vec3                 normal = toVec3(aovs.normal);
+  Guide                      guide;
+  guide.albedo = max(toVec3(aovs.albedo) / n, Vec3(kAlbedoFloor));
+  guide.depth  = aovs.depth / n;
+  guide.normal = (dot(normal, normal) == 0.0f) ? Vec3(0.0f) : normalize(normal);
+  return guide;
+}
+
+Vec3 demodulatedMean(const DenoiserInput& input, size_t index, const Guide& guide)
+{
+  const shaderio::PixelAccumulator& accumulator = input.accumulators[index];
+  if(accumulator.sampleCount == 0)
+  {
+    return Vec3(0.0f);
+  }
+  const Vec3 mean = toVec3(accumulator.sum) / float(accumulator.sampleCount);
+  return {mean.x / guide.albedo.x, mean.y / guide.albedo.y, mean.z / guide.albedo.z};
+}
+
+float demodulatedVariance(const DenoiserInput& input, size_t index, const Guide& guide)
+{
+  const shaderio::PixelAccumulator& accumulator = input.accumulators[index];
+  const uint32_t                    n           = accumulator.sampleCount;
+  if(n < 2)
+  {
+    return 0.0f;
+  }
+  const Vec3 mean       = toVec3(accumulator.sum) / float(n);
+  const Vec3 sumSquares = toVec3(accumulator.sumSquares);
+  const Vec3 variance   = max(Vec3(0.0f), (sumSquares - float(n) * mean * mean) / float(n - 1)) / float(n);
+  return Luminance({variance.x / (guide.albedo.x * guide.albedo.x), variance.y / (guide.albedo.y * guide.albedo.y),
+                    variance.z / (guide.albedo.z * guide.albedo.z)});
+}
+
+float depthSlope(const DenoiserInput& input, int x, int y, int axisX, int axisY, float depth)
+{
+  float slope = float(SKY_DEPTH);
+  for(int side = -1; side <= 1; side += 2)
+  {
+    const int nx = x + side * axisX, ny = y + side * axisY;
+    if(nx >= 0 && ny >= 0 && nx < input.width && ny < input.height)
+    {
+      slope = std::min(slope, std::abs(loadGuide(input, size_t(input.width) * ny + nx).depth - depth));
+    }
+  }
+  return slope;
+}
+
+DenoiserPixel prepareDenoiserPixel(const DenoiserInput& input, int x, int y)
+{
+  const size_t center      = size_t(input.width) * y + x;
+  const Guide  guide       = loadGuide(input, center);
+  const bool   ownVariance = input.accumulators[center].sampleCount >= kMinOwnSamples;
+
+  DenoiserPixel result;
+  result.illumination = demodulatedMean(input, center, guide);
+  float weightSum = 0.0f, varianceSum = 0.0f, luminanceSum = 0.0f, squaredLuminanceSum = 0.0f;
+  for(int dy = -1; dy <= 1; dy++)
+  {
+    for(int dx = -1; dx <= 1; dx++)
+    {
+      const int nx = x + dx, ny = y + dy;
+      if(nx < 0 || ny < 0 || nx >= input.width || ny >= input.height)
+      {
+        continue;
+      }
+      const size_t index         = size_t(input.width) * ny + nx;
+      const Guide  neighborGuide = loadGuide(input, index);
+      const float  weight        = kKernel[std::abs(dx)] * kKernel[std::abs(dy)];
+      if(ownVariance)
+      {
+        varianceSum += weight * demodulatedVariance(input, index, neighborGuide);
+      }
+      else
+      {
+        const float l = Luminance(demodulatedMean(input, index, neighborGuide));
+        luminanceSum += weight * l;
+        squaredLuminanceSum += weight * l * l;
+      }
+      weightSum += weight;
+    }
+  }
+  const float meanLuminance = luminanceSum / weightSum;
+  result.variance    = ownVariance ? varianceSum / weightSum : std::max(0.0f, squaredLuminanceSum / weightSum - meanLuminance * meanLuminance);
+  result.depthSlopeX = depthSlope(input, x, y, 1, 0, guide.depth);
+  result.depthSlopeY = depthSlope(input, x, y, 0, 1, guide.depth);
+  return result;
+}
+
+DenoiserPixel filterDenoiserPixel(const DenoiserInput& input, const std::vector<DenoiserPixel>& source, int x, int y, uint32_t pass, bool lastPass)
+{
+  const size_t        center          = size_t(input.width) * y + x;
+  const int           step            = 1 << (pass - 1);
+  const Guide         guide           = loadGuide(input, center);
+  const DenoiserPixel centerPixel     = source[center];
+  const float         centerLuminance = Luminance(centerPixel.illumination);
+  const float         luminanceScale  = kPhiLuminance * std::sqrt(std::max(centerPixel.variance, 0.0f)) + 1e-6f;
+  // The size of a pixel at the depth of the center: how much the depth may change per pixel on top of the slope
+  const float pixelDepth = guide.depth * 2.0f * input.fovVerticalSlope / float(input.height);
+
+  Vec3  illuminationSum(0.0f);
+  float varianceSum = 0.0f, weightSum = 0.0f;
+  for(int dy = -2; dy <= 2; dy++)
+  {
+    for(int dx = -2; dx <= 2; dx++)
+    {
+      const int nx = x + step * dx, ny = y + step * dy;
+      if(nx < 0 || ny < 0 || nx >= input.width || ny >= input.height)
+      {
+        continue;
+      }
+      const size_t         index         = size_t(input.width) * ny + nx;
+      const Guide          neighborGuide = loadGuide(input, index);
+      const DenoiserPixel& neighborPixel = source[index];
+
+      const float normalWeight      = std::pow(std::max(dot(guide.normal, neighborGuide.normal), 0.0f), kPhiNormal);
+      const float expectedDepth     = float(step) * (std::abs(dx) * centerPixel.depthSlopeX + std::abs(dy) * centerPixel.depthSlopeY  //
+                                                 + pixelDepth * std::sqrt(float(dx * dx + dy * dy)));
+      const float depthDistance     = std::abs(guide.depth - neighborGuide.depth) / (kPhiDepth * expectedDepth + 1e-6f);
+      const float luminanceDistance = std::abs(centerLuminance - Luminance(neighborPixel.illumination)) / luminanceScale;
+      const float weight            = kKernel[std::abs(dx)] * kKernel[std::abs(dy)] * normalWeight * std::exp(-depthDistance - luminanceDistance);
+      illuminationSum += weight * neighborPixel.illumination;
+      varianceSum += weight * weight * neighborPixel.variance;
+      weightSum += weight;
+    }
+  }
+  // The center tap always weighs kKernel[0]^2: its distances are 0, and the guide normal of a pixel with samples
+  // has unit length (the sky's is the direction back to the camera). So the weight sum can only be 0 for a pixel
+  // without samples, whose AOVs are all 0, or NaN when a tap isn't finite. The check is defensive: such a pixel
+  // keeps its own value rather than dividing by 0 or taking in the NaN.
+  DenoiserPixel result = centerPixel;
+  if(weightSum > 1e-12f)
+  {
+    result.illumination = illuminationSum / weightSum;
+    result.variance     = varianceSum / (weightSum * weightSum);
+  }
+  if(lastPass)
+  {
+    result.illumination *= guide.albedo;
+  }
+  return result;
+}
+}  // namespace
+
+const char* GetDenoisePassName(uint32_t pass)
+{
+  static const char* const kNames[kMaxDenoiseIterations + 1] = {
+      "denoise prepare", "denoise pass 1", "denoise pass 2", "denoise pass 3", "denoise pass 4",
+      "denoise pass 5",  "denoise pass 6", "denoise pass 7", "denoise pass 8",
+  };
+  return kNames[std::min(pass, kMaxDenoiseIterations)];
+}
+
+void Denoise(const DenoiseSettings&                        settings,
+             const std::vector<shaderio::PixelAccumulator>& accumulators,
+             const std::vector<shaderio::PixelAovs>&        aovs,
+             std::vector<float>&                            imageData,
+             Profiler&                                      profiler)
+{
+  const DenoiserInput input{accumulators, aovs, int(settings.width), int(settings.height), settings.fovVerticalSlope};
+  const size_t        pixelCount = size_t(settings.width) * settings.height;
+  const uint32_t      passCount  = 1 + std::min(settings.iterations, kMaxDenoiseIterations);
+
+  // Each pass reads the whole image of the pass before, so the passes run one after the other, each spread
+  // over the worker threads by bands of rows; they ping-pong between two images.
+  WorkStealingScheduler      scheduler(settings.threadCount);
+  const uint32_t             bandCount = (settings.height + kBandHeight - 1) / kBandHeight;
+  std::vector<DenoiserPixel> source(pixelCount), destination(pixelCount);
+  for(uint32_t pass = 0; pass < passCount; pass++)
+  {
+    Profiler::Scope scope(profiler, GetDenoisePassName(pass));
+    scheduler.run(bandCount, [&](uint32_t band, uint32_t) {
+      for(uint32_t y = band * kBandHeight; y < std::min((band + 1) * kBandHeight, settings.height); y++)
+      {
+        for(uint32_t x = 0; x < settings.width; x++)
+        {
+          destination[size_t(settings.width) * y + x] =
+              (pass == 0) ? prepareDenoiserPixel(input, int(x), int(y)) :
+                            filterDenoiserPixel(input, source, int(x), int(y), pass, pass + 1 == passCount);
+        }
+      }
+    });
+    std::swap(source, destination);
+  }
+
+  imageData.resize(pixelCount * 3);
+  for(size_t i = 0; i < pixelCount; i++)
+  {
+    imageData[3 * i + 0] = source[i].illumination.x;
+    imageData[3 * i + 1] = source[i].illumination.y;
+    imageData[3 * i + 2] = source[i].illumination.z;
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Denoiser (--denoise): the spatial filter of SVGF (Schied et al. 2017, "Spatiotemporal Variance-Guided
+// Filtering"), which makes images of a few samples per pixel usable as previews.
+//
+// The trace sums the first-hit albedo, normal and depth of each pixel's samples (see PixelAovs in
+// host_device.h), alongside its PixelAccumulator. A prepare pass divides each pixel's mean color by its
+// albedo, so that textures stay sharp, and estimates the variance of the result from the pixel's sum of
+// squares. Then each of `iterations` passes of an edge-aware a-trous wavelet filter blurs the image with a
+// 5 x 5 kernel whose taps are twice as far apart as in the pass before: taps across a change of normal or
+// depth get no weight, and neither do taps whose luminance differs by much more than the noise does. The
+// last pass multiplies the albedo back in.
+//
+// The GPU backend runs these passes in shaders/denoise.comp.glsl over each render tile and an apron around it
+// that covers their reach, so each pixel sees the same neighbors as in Denoise() below, which runs the same
+// passes on the CPU, over the whole image. Both time each pass into the profiler, under the
+// names of GetDenoisePassName(). There is no temporal part: each job is denoised on its own.
+
+#include "profiler.hpp"
+#include "shaders/host_device.h"
+
+#include <cstdint>
+#include <vector>
+
+constexpr uint32_t kMaxDenoiseIterations = 8;  // The taps of the last pass are 2^7 = 128 pixels apart
+
+struct DenoiseSettings
+{
+  uint32_t width            = 800;
+  uint32_t height           = 600;
+  uint32_t iterations       = 5;      // Number of a-trous passes, after the prepare pass
+  float    fovVerticalSlope = 0.25f;  // Of the job's camera: how large a pixel is at a given depth
+  uint32_t threadCount      = 0;      // 0 = one thread per hardware thread
+};
+
+// Returns the name pass `pass` of the denoiser is timed under: "denoise prepare", then "denoise pass 1", ...
+const char* GetDenoisePassName(uint32_t pass);
+
+// Replaces `imageData` (width * height RGB floats) with the denoised image of `accumulators` and `aovs`, which
+// have one element per pixel, row by row, as the CPU backend fills them.
+void Denoise(const DenoiseSettings&                        settings,
+             const std::vector<shaderio::PixelAccumulator>& accumulators,
+             const std::vector<shaderio::PixelAovs>&        aovs,
+             std::vector<float>&                            imageData,
+             Profiler&                                      profiler);
@@ -0,0 +1,2016 @@
+#include "gpu_renderer.hpp"
+
+#include <nvh/fileoperations.hpp>  // For nvh::loadFile
+#include <nvvk/error_vk.hpp>       // For NVVK_CHECK
+#include <nvvk/shaders_vk.hpp>     // For nvvk::createShaderModule
+
+#include "compact_geometry.hpp"  // For BuildCompactGeometry
+#include "convergence.hpp"       // For UpdateTileMask
+#include "denoiser.hpp"          // For GetDenoisePassName
+#include "hash.hpp"              // For HashFnv1a
+#include "image_writer.hpp"      // For GetBytesPerPixel
+#include "light_table.hpp"       // For BuildLightTable
+#include "samplers.hpp"          // For BuildSamplerTables
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+
+
+
+
+// Default workgroup size, when neither the command line nor the autotuner chose one
+static const uint32_t workgroup_width  = 16;
+static const uint32_t workgroup_height = 8;
+
+// Images whose accumulators would take more than this, or more than maxStorageBufferRange, are traced
+// in render tiles of the default size, unless --render-tile sets one
+static const VkDeviceSize max_untiled_accumulator_bytes = VkDeviceSize(256) << 20;
+static const uint32_t     render_tile_width             = 1024;
+static const uint32_t     render_tile_height            = 256;
+
+
+
+
+
+// second command buffer to upload vertex and index data to the GPU
+static VkCommandBuffer AllocateAndBeginOneTimeCommandBuffer(VkDevice device, VkCommandPool cmdPool)
+{
+    VkCommandBufferAllocateInfo cmdAllocInfo{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                             .commandPool = cmdPool,
+                                             .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                             .commandBufferCount = 1 };
+    VkCommandBuffer cmdBuffer;
+    NVVK_CHECK(vkAllocateCommandBuffers(device, &cmdAllocInfo, &cmdBuffer));
+    VkCommandBufferBeginInfo beginInfo{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                       .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT };
+    NVVK_CHECK(vkBeginCommandBuffer(cmdBuffer, &beginInfo));
+    return cmdBuffer;
+}
+
+
+
+
+// function that ends recording a command buffer, then submits it to a queue, waits for it to finish, and then frees the command buffer
+static void EndSubmitWaitAndFreeCommandBuffer(VkDevice device, VkQueue queue, VkCommandPool cmdPool, VkCommandBuffer& cmdBuffer)
+{
+    NVVK_CHECK(vkEndCommandBuffer(cmdBuffer));
+    VkSubmitInfo submitInfo{ .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO, .commandBufferCount = 1, .pCommandBuffers = &cmdBuffer };
+    NVVK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+    NVVK_CHECK(vkQueueWaitIdle(queue));
+    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+}
+
+
+
+
+
+// Ends recording a command buffer and submits it to a queue without waiting for it; `fence` is signaled once it has finished.
+static void EndAndSubmitCommandBuffer(VkQueue queue, VkCommandBuffer cmdBuffer, VkFence fence)
+{
+  NVVK_CHECK(vkEndCommandBuffer(cmdBuffer));
+  VkSubmitInfo submitInfo{.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO, .commandBufferCount = 1, .pCommandBuffers = &cmdBuffer};
+  NVVK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
+}
+
+
+
+
+
+// Waits for a command buffer that EndAndSubmitCommandBuffer() submitted with `fence`, then resets the fence and frees the
+// command buffer. Unlike vkQueueWaitIdle(), this doesn't wait for what was submitted after it.
+static void WaitAndFreeCommandBuffer(VkDevice device, VkFence fence, VkCommandPool cmdPool, VkCommandBuffer& cmdBuffer)
+{
+  NVVK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+  NVVK_CHECK(vkResetFences(device, 1, &fence));
+  vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+}
+
+
+
+
+
+// Returns whether the device can run compute shaders with a workgroup of width x height invocations.
+static bool WorkgroupFits(const VkPhysicalDeviceLimits& limits, uint32_t width, uint32_t height)
+{
+  return width <= limits.maxComputeWorkGroupSize[0] && height <= limits.maxComputeWorkGroupSize[1]
+         && uint64_t(width) * height <= limits.maxComputeWorkGroupInvocations;
+}
+
+
+
+
+
+// Function that gets the device address of a VkBuffer. A device address is like the address of a piece of memory on the GPU.
+static VkDeviceAddress GetBufferDeviceAddress(VkDevice device, VkBuffer buffer)
+{
+    VkBufferDeviceAddressInfo addressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer };
+    return vkGetBufferDeviceAddress(device, &addressInfo);
+}
+
+
+
+
+
+// Barrier between two steps of the wavefront kernel: each step may read what the previous ones wrote to the queues,
+// as shader storage or as indirect dispatch arguments, and reset a queue the previous ones were still reading.
+static void CmdWavefrontBarrier(VkCommandBuffer cmdBuffer)
+{
+  VkMemoryBarrier memoryBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                                .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+                                                 | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT};
+  const VkPipelineStageFlags stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+  vkCmdPipelineBarrier(cmdBuffer, stages, stages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+
+
+
+
+bool GpuRenderer::init(const RenderOptions& options, const Scene& scene, const std::vector<std::string>& searchPaths, Profiler& profiler)
+{
+  m_options       = options;
+  m_profiler      = &profiler;
+  m_triangleCount = scene.getInstancedTriangleCount();
+
+  // Context
+  // Create the Vulkan context, consisting of an instance, device, physical device, and queues.
+  nvvk::ContextCreateInfo deviceInfo;  // Settings
+  deviceInfo.apiMajor = 1;             // Specify the version of Vulkan we'll use
+  deviceInfo.apiMinor = 2;
+  // Required by KHR_acceleration_structure; allows work to be offloaded onto background threads and parallelized
+  deviceInfo.addDeviceExtension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
+  deviceInfo.addDeviceExtension(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, false, &asFeatures);
+  VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR};
+  deviceInfo.addDeviceExtension(VK_KHR_RAY_QUERY_EXTENSION_NAME, false, &rayQueryFeatures);
+
+  {
+    Profiler::Scope scope(*m_profiler, "device init");
+    m_context.init(deviceInfo);  // Initialize the context
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_context.m_physicalDevice, &properties);
+  m_profiler->setInfo("device", properties.deviceName);
+  m_maxStorageBufferRange = properties.limits.maxStorageBufferRange;
+
+  // The workgroup size is a specialization constant, so a size the device can't run would only fail in pipeline creation
+  if(m_options.workgroupWidth != 0 && !WorkgroupFits(properties.limits, m_options.workgroupWidth, m_options.workgroupHeight))
+  {
+    fprintf(stderr, "--workgroup %ux%u does not fit %s: at most %u x %u, and %u invocations\n", m_options.workgroupWidth,
+            m_options.workgroupHeight, properties.deviceName, properties.limits.maxComputeWorkGroupSize[0],
+            properties.limits.maxComputeWorkGroupSize[1], properties.limits.maxComputeWorkGroupInvocations);
+    m_context.deinit();
+    return false;
+  }
+
+
+
+
+
+  // Allocator
+  // Create the allocator
+  m_allocator.init(m_context, m_context.m_physicalDevice);
+
+
+
+
+
+  // Command Pool
+  // Create the command pool
+  VkCommandPoolCreateInfo cmdPoolInfo{.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,  //
+                                      .queueFamilyIndex = m_context.m_queueGCT};
+  NVVK_CHECK(vkCreateCommandPool(m_context, &cmdPoolInfo, nullptr, &m_cmdPool));
+
+  // Fences: one for the submissions the host waits for, and one per staging buffer, for the copies it doesn't
+  VkFenceCreateInfo fenceCreateInfo{.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+  NVVK_CHECK(vkCreateFence(m_context, &fenceCreateInfo, nullptr, &m_submitFence));
+  for(StagingBuffer& staging : m_stagingBuffers)
+  {
+    NVVK_CHECK(vkCreateFence(m_context, &fenceCreateInfo, nullptr, &staging.copyFence));
+  }
+
+  // Timestamp queries
+  // Two pairs of timestamps are enough: each measurement is read back before the next one starts. The resolve
+  // pass has a pair of its own, since it isn't waited for; its time is read once the next submission is done.
+  // Not every queue supports timestamps; then, phases only get CPU times.
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(m_context.m_physicalDevice, &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(m_context.m_physicalDevice, &queueFamilyCount, queueFamilies.data());
+  if(queueFamilies[m_context.m_queueGCT.familyIndex].timestampValidBits > 0)
+  {
+    m_timestampPeriodSeconds = double(properties.limits.timestampPeriod) * 1e-9;  // timestampPeriod is in nanoseconds
+  }
+  VkQueryPoolCreateInfo queryPoolInfo{.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO, .queryType = VK_QUERY_TYPE_TIMESTAMP, .queryCount = 4};
+  NVVK_CHECK(vkCreateQueryPool(m_context, &queryPoolInfo, nullptr, &m_queryPool));
+
+  // Create the ray counter, which the CPU resets before each job and reads after it
+  VkBufferCreateInfo rayCounterCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                          .size  = sizeof(shaderio::RayCounter),
+                                          .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+  m_rayCounterBuffer = m_allocator.createBuffer(rayCounterCreateInfo,                       //
+                                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT         //
+                                                    | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_rayCounter       = reinterpret_cast<shaderio::RayCounter*>(m_allocator.map(m_rayCounterBuffer));
+
+  // Create the path queues of the wavefront kernel, which the GPU resets, fills and dispatches from by itself.
+  // They're tiny, so the megakernel's descriptor set gets them too.
+  VkBufferCreateInfo pathQueueCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                         .size  = PATH_QUEUE_COUNT * sizeof(shaderio::PathQueue),
+                                         .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                                                  | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+  m_pathQueueBuffer = m_allocator.createBuffer(pathQueueCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  // Start the thread that writes images in the background
+  m_imageWriter = std::make_unique<ImageWriter>(*m_profiler);
+
+
+
+
+
+  // Upload the meshes to the GPU.
+  // All meshes share one vertex buffer and one index buffer; the mesh info table records where each
+  // mesh starts in them. Only unique meshes are uploaded, however many instances they have.
+  const std::vector<SceneMesh>&   meshes = scene.getMeshes();
+  std::vector<shaderio::MeshInfo> meshInfos;
+  uint64_t                        vertexCount = 0, indexCount = 0, primitiveCount = 0;
+  for(const SceneMesh& mesh : meshes)
+  {
+    meshInfos.push_back({uint32_t(vertexCount), uint32_t(indexCount), uint32_t(primitiveCount)});
+    vertexCount += mesh.vertexCount;
+    indexCount += mesh.indexCount;
+    primitiveCount += mesh.indexCount / 3;
+  }
+
+  // With the compact layout (see compact_geometry.hpp), hits are shaded from one record per triangle,
+  // and the vertex and index buffers, in smaller formats, are only used to build the BLASes.
+  CompactGeometry compact;
+  const bool      useCompactLayout = m_options.compactGeometry;
+  const bool      quantized        = m_options.quantizePositions;
+  if(useCompactLayout)
+  {
+    Profiler::Scope scope(*m_profiler, "compact geometry");
+    BuildCompactGeometry(scene, quantized, compact);
+  }
+  // Materials, and the emissive triangles that light sampling picks from
+  std::vector<shaderio::Material> materials;
+  for(const SceneMaterial& material : scene.getMaterials())
+  {
+    materials.push_back({{material.diffuse.x, material.diffuse.y, material.diffuse.z},
+                         {material.emission.x, material.emission.y, material.emission.z}});
+  }
+  LightTable lightTable;
+  {
+    Profiler::Scope scope(*m_profiler, "light table");
+    BuildLightTable(scene, lightTable);
+  }
+  m_lightCount        = uint32_t(lightTable.triangles.size());
+  m_inverseLightPower = (m_lightCount > 0) ? 1.0f / lightTable.totalPower : 0.0f;
+  if(lightTable.triangles.empty())
+  {
+    lightTable.triangles.resize(1);  // Every binding needs a buffer; with no lights, the shader never reads it
+  }
+  m_profiler->setInfo("lights", uint64_t(m_lightCount));
+  // The tables of the low-discrepancy samplers are uploaded whichever sampler the job uses, so that switching
+  // samplers (see setSampler()) only needs another pipeline
+  SamplerTables samplerTables;
+  {
+    Profiler::Scope scope(*m_profiler, "sampler tables");
+    BuildSamplerTables(samplerTables);
+  }
+
+  const VkDeviceSize vertexStride     = quantized ? 4 * sizeof(int16_t) : 3 * sizeof(float);
+  const VkDeviceSize vertexBufferSize = vertexCount * vertexStride;
+  const VkDeviceSize indexBufferSize  = (useCompactLayout ? compact.indices.size() : indexCount) * sizeof(uint32_t);
+  {
+      Profiler::Scope scope(*m_profiler, "upload");
+
+      // Start a command buffer for uploading the buffers
+      VkCommandBuffer uploadCmdBuffer = AllocateAndBeginOneTimeCommandBuffer(m_context, m_cmdPool);
+
+      // We get these buffers' device addresses, and use them as storage buffers and build inputs.
+      const VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+          | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+      VkBufferCreateInfo vertexBufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                          .size  = vertexBufferSize,
+                                          .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+      VkBufferCreateInfo indexBufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                         .size  = indexBufferSize,
+                                         .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+      m_vertexBuffer = m_allocator.createBuffer(vertexBufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      m_indexBuffer  = m_allocator.createBuffer(indexBufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+      // In the standard layout, each mesh is copied into its range of the buffers. When the meshes point into
+      // memory-mapped scene caches, the data is copied straight into the staging buffers.
+      nvvk::StagingMemoryManager* staging = m_allocator.getStaging();
+      for(size_t i = 0; i < meshes.size(); i++)
+      {
+        if(!quantized)
+        {
+          staging->cmdToBuffer(uploadCmdBuffer, m_vertexBuffer.buffer, VkDeviceSize(meshInfos[i].firstVertex) * vertexStride,
+                               VkDeviceSize(meshes[i].vertexCount) * vertexStride, meshes[i].vertices);
+        }
+        if(!useCompactLayout)
+        {
+          staging->cmdToBuffer(uploadCmdBuffer, m_indexBuffer.buffer, VkDeviceSize(meshInfos[i].firstIndex) * sizeof(uint32_t),
+                               VkDeviceSize(meshes[i].indexCount) * sizeof(uint32_t), meshes[i].indices);
+        }
+      }
+      if(quantized)
+      {
+        staging->cmdToBuffer(uploadCmdBuffer, m_vertexBuffer.buffer, 0, vertexBufferSize, compact.quantizedPositions.data());
+      }
+      if(useCompactLayout)
+      {
+        staging->cmdToBuffer(uploadCmdBuffer, m_indexBuffer.buffer, 0, indexBufferSize, compact.indices.data());
+        m_hitRecordBuffer = m_allocator.createBuffer(uploadCmdBuffer, compact.hitRecords.size() * sizeof(shaderio::HitRecord),
+                                                     compact.hitRecords.data(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      }
+      m_meshInfoBuffer  = m_allocator.createBuffer(uploadCmdBuffer, meshInfos.size() * sizeof(shaderio::MeshInfo),
+                                                   meshInfos.data(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      m_materialBuffer  = m_allocator.createBuffer(uploadCmdBuffer, materials.size() * sizeof(shaderio::Material),
+                                                   materials.data(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      m_lightBuffer     = m_allocator.createBuffer(uploadCmdBuffer, lightTable.triangles.size() * sizeof(shaderio::EmissiveTriangle),
+                                                   lightTable.triangles.data(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      m_sobolBuffer     = m_allocator.createBuffer(uploadCmdBuffer, samplerTables.sobolMatrices.size() * sizeof(uint32_t),
+                                                   samplerTables.sobolMatrices.data(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      m_blueNoiseBuffer = m_allocator.createBuffer(uploadCmdBuffer, samplerTables.blueNoise.size() * sizeof(uint32_t),
+                                                   samplerTables.blueNoise.data(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      if(!useCompactLayout)
+      {
+        // One material ID per triangle, like the hit records of the compact layout
+        VkBufferCreateInfo materialIdBufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                                .size  = primitiveCount * sizeof(uint32_t),
+                                                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+        m_materialIdBuffer = m_allocator.createBuffer(materialIdBufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        for(size_t i = 0; i < meshes.size(); i++)
+        {
+          staging->cmdToBuffer(uploadCmdBuffer, m_materialIdBuffer.buffer, VkDeviceSize(meshInfos[i].firstPrimitive) * sizeof(uint32_t),
+                               VkDeviceSize(meshes[i].indexCount / 3) * sizeof(uint32_t), meshes[i].materialIds);
+        }
+      }
+
+      // End the command buffer, submit it, and wait for it to finish
+      EndSubmitWaitAndFreeCommandBuffer(m_context, m_context.m_queueGCT, m_cmdPool, uploadCmdBuffer);
+      // Free the memory of the allocator: the allocator also allocates some temporary staging memory to perform these uploads to GPU-local memory
+      m_allocator.finalizeAndReleaseStaging();
+  }
+
+  // Report how much geometry memory shading needs, and how much the BLAS builds read, in both layouts.
+  const uint64_t standardBytes   = vertexCount * 3 * sizeof(float) + indexCount * sizeof(uint32_t);
+  const uint64_t buildInputBytes = vertexBufferSize + indexBufferSize;
+  const uint64_t shadingBytes    = useCompactLayout ? compact.hitRecords.size() * sizeof(shaderio::HitRecord) : standardBytes;
+  m_profiler->setInfo("meshes", uint64_t(meshes.size()));
+  m_profiler->setInfo("instances", uint64_t(scene.getInstances().size()));
+  m_profiler->setInfo("geometry bytes", shadingBytes);
+  m_profiler->setInfo("blas input bytes", buildInputBytes);
+  if(useCompactLayout)
+  {
+    printf("Compact geometry: %.2f MiB of hit records instead of %.2f MiB of vertices and indices for shading; "
+           "BLAS build inputs %.2f MiB instead of %.2f MiB, freed after the build\n",
+           double(shadingBytes) / (1024.0 * 1024.0), double(standardBytes) / (1024.0 * 1024.0),
+           double(buildInputBytes) / (1024.0 * 1024.0), double(standardBytes) / (1024.0 * 1024.0));
+  }
+
+  // Describe one bottom-level acceleration structure (BLAS) per mesh
+  std::vector<nvvk::RaytracingBuilderKHR::BlasInput> blases;
+  // Get the device addresses of the vertex and index buffers
+  const VkDeviceAddress vertexBufferAddress = GetBufferDeviceAddress(m_context, m_vertexBuffer.buffer);
+  const VkDeviceAddress indexBufferAddress  = GetBufferDeviceAddress(m_context, m_indexBuffer.buffer);
+  for(size_t i = 0; i < meshes.size(); i++)
+  {
+      nvvk::RaytracingBuilderKHR::BlasInput blas;
+      // Specify where the builder can find the vertices and indices for the mesh's triangles, and their formats.
+      // In the compact layout, small meshes have 16-bit indices, and positions may be 16-bit SNORM.
+      const bool         shortIndices = useCompactLayout && compact.meshes[i].shortIndices;
+      const VkDeviceSize indexOffset  = useCompactLayout ? VkDeviceSize(compact.meshes[i].firstIndexWord) * sizeof(uint32_t) :
+                                                           VkDeviceSize(meshInfos[i].firstIndex) * sizeof(uint32_t);
+      VkAccelerationStructureGeometryTrianglesDataKHR triangles{
+          .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+          .vertexFormat = quantized ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT,
+          .vertexData = {.deviceAddress = vertexBufferAddress + VkDeviceSize(meshInfos[i].firstVertex) * vertexStride},
+          .vertexStride = vertexStride,
+          .maxVertex = meshes[i].vertexCount - 1,
+          .indexType = shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+          .indexData = {.deviceAddress = indexBufferAddress + indexOffset},
+          .transformData = {.deviceAddress = 0}  // No transform; instances have their own
+  };
+
+   // Create a VkAccelerationStructureGeometryKHR object that says it handles opaque triangles and points to the above:
+   VkAccelerationStructureGeometryKHR geometry{ .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+                                               .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+                                               .geometry = {.triangles = triangles},
+                                               .flags = VK_GEOMETRY_OPAQUE_BIT_KHR };
+   blas.asGeometry.push_back(geometry);
+   // Create offset info that allows us to say how many triangles and vertices to read
+   VkAccelerationStructureBuildRangeInfoKHR offsetInfo{
+       .primitiveCount = meshes[i].indexCount / 3,  // Number of triangles
+       .primitiveOffset = 0,                        // Offset added when looking up triangles
+       .firstVertex = 0,  // Offset added when looking up vertices in the vertex buffer
+       .transformOffset = 0   // Offset added when looking up transformation matrices, if we used them
+   };
+   blas.asBuildOffsetInfo.push_back(offsetInfo);
+   blases.push_back(blas);
+  }
+  // Create the BLASes
+  // With ALLOW_COMPACTION, nvvk's builder queries the compacted size of each BLAS after building it,
+  // copies it into a buffer of that size, and frees the original. Sequences (see sequence.hpp) build them
+  // with ALLOW_UPDATE instead, so that deformed meshes can be refitted in place; in the compact layout,
+  // which frees the vertices, meshes can't deform, so only the TLAS needs updates.
+  // nvvk's builder records and submits its own command buffers, so we time the build with timestamps in
+  // command buffers of our own, submitted just before and after it to the same queue.
+  const bool deformable = m_options.sequence && !useCompactLayout;
+  m_blasFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                | (deformable ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR : VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
+  m_tlasFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+  if(m_options.sequence)
+  {
+    m_tlasFlags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+  }
+  m_raytracingBuilder.setup(m_context, &m_allocator, m_context.m_queueGCT);
+  {
+    Profiler::Scope scope(*m_profiler, "blas build");
+    submitTimestamp(0);
+    m_raytracingBuilder.buildBlas(blases, m_blasFlags);
+    submitTimestamp(1);
+  }
+  m_profiler->addGpuTime("blas build", getTimestampSeconds());
+  if(useCompactLayout)
+  {
+    // The shader doesn't read the vertices and indices in the compact layout
+    m_allocator.destroy(m_vertexBuffer);
+    m_allocator.destroy(m_indexBuffer);
+  }
+  if(quantized)
+  {
+    for(const CompactMesh& mesh : compact.meshes)
+    {
+      m_dequantize.push_back(mesh.dequantize);
+    }
+  }
+
+  // Sequences keep what refits need, and build the proxy trees that tell when to rebuild (see refit.hpp)
+  if(m_options.sequence)
+  {
+    Profiler::Scope scope(*m_profiler, "refit trackers");
+    m_refitSettings.maxSahGrowth    = m_options.refitThreshold;
+    m_refitSettings.rebuildInterval = m_options.rebuildInterval;
+    m_meshInfos                     = meshInfos;
+    m_meshBounds.resize(meshes.size());
+    m_blasTrackers.resize(deformable ? meshes.size() : 0);
+    m_blasRefitCounts.assign(m_blasTrackers.size(), 0);
+    m_rebuiltBlases.resize(m_blasTrackers.size());
+    for(uint32_t i = 0; i < uint32_t(meshes.size()); i++)
+    {
+      const std::vector<Aabb> triangleBounds = getTriangleBounds(scene, i);
+      if(deformable)
+      {
+        m_blasTrackers[i].build(triangleBounds);
+      }
+    }
+    if(deformable)
+    {
+      m_blasInputs = std::move(blases);
+    }
+  }
+
+  // Create one instance per scene instance, pointing to its mesh's BLAS, and build them into a TLAS
+  m_tlasBuilder.setup(m_context, &m_allocator, m_context.m_queueGCT);
+  {
+    Profiler::Scope scope(*m_profiler, "tlas build");
+    submitTimestamp(0);
+    m_tlasBuilder.buildTlas(makeTlasInstances(scene), m_tlasFlags);
+    submitTimestamp(1);
+  }
+  m_profiler->addGpuTime("tlas build", getTimestampSeconds());
+  if(m_options.sequence)
+  {
+    m_tlasTracker.build(getInstanceBounds(scene));
+  }
+
+
+
+
+
+  // Descriptor Set
+
+  // Here's the list of bindings for the descriptor set layout, from raytrace.comp.glsl (see shaders/host_device.h):
+  // 0 - a storage buffer (the accumulation buffer)
+  // 1 - an acceleration structure (the TLAS)
+  // 2, 3 - storage buffers (the vertex and index buffers)
+  // 4 - a storage buffer (the tile mask)
+  // 5 - a storage buffer (the ray counter)
+  // 6 - a storage buffer (the mesh info table)
+  // 7 - a storage buffer (the hit records of the compact layout)
+  // 8 - a storage buffer (the tile statistics, from tile_stats.comp.glsl)
+  // 9 - a storage buffer (the packed output image, from resolve.comp.glsl)
+  // 10 to 13 - storage buffers (the paths, path queues, pixel RNG states and path counts of the wavefront kernel)
+  // 14 to 16 - storage buffers (the materials, the material ID of each triangle, and the emissive triangles)
+  // 17 and 18 - storage buffers (the tables of the Sobol and blue-noise samplers)
+  // 19 and 20 - storage buffers (the AOVs of each pixel, and the images of the denoiser)
+  // To trace rays from a shader, we need to add the acceleration structure to the descriptor set.
+  m_descriptorSetContainer.init(m_context);
+  m_descriptorSetContainer.addBinding(BINDING_ACCUMULATORS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_TLAS, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_VERTICES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_INDICES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_TILE_MASK, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_RAY_COUNTER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_MESHES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_HIT_RECORDS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_TILE_STATS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_OUTPUT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_PATHS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_PATH_QUEUES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_PIXEL_RNG, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_PATH_COUNTS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_MATERIALS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_MATERIAL_IDS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_LIGHTS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_SOBOL, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_BLUE_NOISE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_AOVS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  m_descriptorSetContainer.addBinding(BINDING_DENOISER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+  // Create a layout from the list of bindings
+  m_descriptorSetContainer.initLayout();
+  // Create a descriptor pool with space for one set, and allocate it
+  m_descriptorSetContainer.initPool(1);
+  // Create a pipeline layout from the descriptor set layout, plus a push constant range for the camera and batch:
+  VkPushConstantRange pushConstantRange{.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT, .offset = 0, .size = sizeof(shaderio::PushConstants)};
+  m_descriptorSetContainer.initPipeLayout(1, &pushConstantRange);
+
+  // Write the descriptors that don't depend on the job: the TLAS, the vertex and index buffers and
+  // the mesh info table (read mesh data from triangle intersections), the materials and lights, the sampler tables, the ray counter and the path queues. The render target's
+  // buffers are written by prepareRenderTarget(), since they depend on the job's resolution.
+  VkAccelerationStructureKHR tlasCopy = m_tlasBuilder.getAccelerationStructure();  // So that we can take its address
+  VkWriteDescriptorSetAccelerationStructureKHR descriptorAS{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+                                                            .accelerationStructureCount = 1,
+                                                            .pAccelerationStructures = &tlasCopy };
+  // Each layout only reads its own buffers, but every binding needs a valid buffer: the other layout's
+  // bindings point at a buffer of this one.
+  const VkBuffer         shadingBuffer = useCompactLayout ? m_hitRecordBuffer.buffer : m_meshInfoBuffer.buffer;
+  VkDescriptorBufferInfo vertexDescriptorBufferInfo{ .buffer = useCompactLayout ? shadingBuffer : m_vertexBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo indexDescriptorBufferInfo{ .buffer = useCompactLayout ? shadingBuffer : m_indexBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo meshInfoDescriptorBufferInfo{ .buffer = m_meshInfoBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo hitRecordDescriptorBufferInfo{ .buffer = shadingBuffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo rayCounterDescriptorBufferInfo{ .buffer = m_rayCounterBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo pathQueueDescriptorBufferInfo{ .buffer = m_pathQueueBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo materialDescriptorBufferInfo{ .buffer = m_materialBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo materialIdDescriptorBufferInfo{ .buffer = useCompactLayout ? shadingBuffer : m_materialIdBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo lightDescriptorBufferInfo{ .buffer = m_lightBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo sobolDescriptorBufferInfo{ .buffer = m_sobolBuffer.buffer, .range = VK_WHOLE_SIZE };
+  VkDescriptorBufferInfo blueNoiseDescriptorBufferInfo{ .buffer = m_blueNoiseBuffer.buffer, .range = VK_WHOLE_SIZE };
+  const std::array<VkWriteDescriptorSet, 12> writeDescriptorSets{
+      m_descriptorSetContainer.makeWrite(0 /*set index*/, BINDING_TLAS /*binding*/, &descriptorAS),
+      m_descriptorSetContainer.makeWrite(0, BINDING_VERTICES, &vertexDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_INDICES, &indexDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_MESHES, &meshInfoDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_HIT_RECORDS, &hitRecordDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_RAY_COUNTER, &rayCounterDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_PATH_QUEUES, &pathQueueDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_MATERIALS, &materialDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_MATERIAL_IDS, &materialIdDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_LIGHTS, &lightDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_SOBOL, &sobolDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_BLUE_NOISE, &blueNoiseDescriptorBufferInfo),
+  };
+  vkUpdateDescriptorSets(m_context,                                         // The context
+      static_cast<uint32_t>(writeDescriptorSets.size()),                    // Number of VkWriteDescriptorSet objects
+      writeDescriptorSets.data(),                                           // Pointer to VkWriteDescriptorSet objects
+      0, nullptr);                                                          // An array of VkCopyDescriptorSet objects (unused)
+
+
+
+
+
+  // Shader loading and pipeline creation
+  // The pipeline cache is keyed by the device and by the hash of the SPIR-V of all four shaders (see pipeline_cache.hpp).
+  const std::string rayTraceSpirv  = nvh::loadFile("shaders/raytrace.comp.glsl.spv", true, searchPaths);
+  const std::string tileStatsSpirv = nvh::loadFile("shaders/tile_stats.comp.glsl.spv", true, searchPaths);
+  const std::string resolveSpirv   = nvh::loadFile("shaders/resolve.comp.glsl.spv", true, searchPaths);
+  const std::string denoiseSpirv   = nvh::loadFile("shaders/denoise.comp.glsl.spv", true, searchPaths);
+  m_rayTraceModule                 = nvvk::createShaderModule(m_context, rayTraceSpirv);
+  m_tileStatsModule                = nvvk::createShaderModule(m_context, tileStatsSpirv);
+  m_resolveModule                  = nvvk::createShaderModule(m_context, resolveSpirv);
+  m_denoiseModule                  = nvvk::createShaderModule(m_context, denoiseSpirv);
+  uint64_t spirvHash               = HashFnv1a(rayTraceSpirv.data(), rayTraceSpirv.size());
+  spirvHash                        = HashFnv1a(tileStatsSpirv.data(), tileStatsSpirv.size(), spirvHash);
+  spirvHash                        = HashFnv1a(resolveSpirv.data(), resolveSpirv.size(), spirvHash);
+  spirvHash                        = HashFnv1a(denoiseSpirv.data(), denoiseSpirv.size(), spirvHash);
+  m_pipelineCache.init(m_context, m_context.m_physicalDevice, spirvHash);
+
+  // Choose the workgroup size: the one from the command line, else the one the autotuner found
+  // for this device the last time it ran, else 16 x 8.
+  m_specialization.maxSegments     = m_options.maxSegments;
+  m_specialization.countRays       = m_options.countRays ? VK_TRUE : VK_FALSE;
+  m_specialization.compactGeometry = useCompactLayout ? VK_TRUE : VK_FALSE;
+  m_specialization.outputFormat    = m_options.outputFormat;
+  // Light sampling needs lights; without them, it would only cost shadow rays that find nothing
+  m_specialization.sampleLights         = (m_options.sampleLights && m_lightCount > 0) ? VK_TRUE : VK_FALSE;
+  m_specialization.russianRouletteStart = m_options.russianRouletteStart;
+  m_specialization.samplerType          = m_options.sampler;
+  m_specialization.denoise              = m_options.denoise ? VK_TRUE : VK_FALSE;
+  if(m_options.workgroupWidth != 0)
+  {
+    m_specialization.workgroupWidth  = m_options.workgroupWidth;
+    m_specialization.workgroupHeight = m_options.workgroupHeight;
+  }
+  else if(!m_pipelineCache.getTunedWorkgroup(m_specialization.workgroupWidth, m_specialization.workgroupHeight))
+  {
+    m_specialization.workgroupWidth  = workgroup_width;
+    m_specialization.workgroupHeight = workgroup_height;
+  }
+
+  if(m_options.autotune)
+  {
+    Profiler::Scope scope(*m_profiler, "autotune");
+    autotuneWorkgroup();
+  }
+  createPipeline();
+  return true;
+}
+
+
+
+
+
+VkDeviceAddress GpuRenderer::getBlasDeviceAddress(uint32_t meshIndex)
+{
+  if(meshIndex < m_rebuiltBlases.size() && m_rebuiltBlases[meshIndex])
+  {
+    return m_rebuiltBlases[meshIndex]->getBlasDeviceAddress(0);
+  }
+  return m_raytracingBuilder.getBlasDeviceAddress(meshIndex);
+}
+
+
+
+
+
+std::vector<VkAccelerationStructureInstanceKHR> GpuRenderer::makeTlasInstances(const Scene& scene)
+{
+  std::vector<VkAccelerationStructureInstanceKHR> instances;
+  for(const SceneInstance& sceneInstance : scene.getInstances())
+  {
+      VkAccelerationStructureInstanceKHR instance{};
+      instance.accelerationStructureReference = getBlasDeviceAddress(sceneInstance.meshIndex);  // The address of the BLAS of its mesh
+      // Set the instance transform to the object-to-world transform of the scene instance; with quantized
+      // positions, the BLAS is in the mesh's quantized space, which has to be mapped to object space first:
+      const Transform transform = m_dequantize.empty() ? sceneInstance.transform : sceneInstance.transform * m_dequantize[sceneInstance.meshIndex];
+      std::copy(&transform.matrix[0][0], &transform.matrix[0][0] + 12, &instance.transform.matrix[0][0]);
+      instance.instanceCustomIndex = sceneInstance.meshIndex;  // 24 bits accessible to ray shaders via rayQueryGetIntersectionInstanceCustomIndexEXT
+      // Used for a shader offset index, accessible via rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT;
+      // ray queries don't use a shader binding table, so it holds the index of the instance's first material
+      instance.instanceShaderBindingTableRecordOffset = sceneInstance.materialOffset;
+      instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;  // How to trace this instance
+      instance.mask = 0xFF;
+      instances.push_back(instance);
+  }
+  return instances;
+}
+
+
+
+
+
+std::vector<Aabb> GpuRenderer::getInstanceBounds(const Scene& scene) const
+{
+  std::vector<Aabb> bounds;
+  for(const SceneInstance& instance : scene.getInstances())
+  {
+    // The world-space box around the transformed corners of the mesh's box
+    const Aabb& meshBounds = m_meshBounds[instance.meshIndex];
+    Aabb        box;
+    for(int corner = 0; corner < 8; corner++)
+    {
+      const Vec3 point((corner & 1) ? meshBounds.hi.x : meshBounds.lo.x, (corner & 2) ? meshBounds.hi.y : meshBounds.lo.y,
+                       (corner & 4) ? meshBounds.hi.z : meshBounds.lo.z);
+      box.grow(instance.transform.transformPoint(point));
+    }
+    bounds.push_back(box);
+  }
+  return bounds;
+}
+
+
+
+
+
+std::vector<Aabb> GpuRenderer::getTriangleBounds(const Scene& scene, uint32_t meshIndex)
+{
+  const SceneMesh&  mesh = scene.getMeshes()[meshIndex];
+  std::vector<Aabb> bounds(mesh.indexCount / 3);
+  Aabb              meshBounds;
+  for(uint32_t i = 0; i < mesh.indexCount; i++)
+  {
+    const uint32_t index = mesh.indices[i];
+    bounds[i / 3].grow(Vec3(mesh.vertices[3 * index + 0], mesh.vertices[3 * index + 1], mesh.vertices[3 * index + 2]));
+  }
+  for(const Aabb& box : bounds)
+  {
+    meshBounds.grow(box);
+  }
+  m_meshBounds[meshIndex] = meshBounds;
+  return bounds;
+}
+
+
+
+
+
+bool GpuRenderer::updateScene(const Scene& scene, const SceneChanges& changes, AccelerationUpdate& update)
+{
+  update = AccelerationUpdate();
+  if(changes.empty())
+  {
+    return true;
+  }
+  // Only sequences build the acceleration structures with ALLOW_UPDATE, and keep the BLAS inputs of deformable meshes
+  if(!m_options.sequence)
+  {
+    fprintf(stderr, "The scene can only change between the frames of a --sequence\n");
+    return false;
+  }
+  if(!changes.deformedMeshes.empty() && m_blasInputs.empty())
+  {
+    fprintf(stderr, "Meshes can't be deformed with --compact-geometry\n");
+    return false;
+  }
+  completeStagingCopies();  // The last copy's submission still uses the descriptor set, which may point to a new TLAS
+  const auto startTime = std::chrono::steady_clock::now();
+
+  // Refit the proxy trees over the new boxes first: their SAH growth decides whether the GPU refits or rebuilds
+  // each BLAS and the TLAS. A rebuilt BLAS moves, so the TLAS has to be rebuilt too.
+  std::vector<bool> rebuildBlas(m_blasTrackers.size(), false);
+  bool              rebuildBlases = false, rebuildTlas = false;
+  {
+    Profiler::Scope scope(*m_profiler, "refit trackers");
+    for(uint32_t meshIndex : changes.deformedMeshes)
+    {
+      const float sahGrowth  = m_blasTrackers[meshIndex].refit(getTriangleBounds(scene, meshIndex));
+      update.sahGrowth       = std::max(update.sahGrowth, sahGrowth);
+      rebuildBlas[meshIndex] = ShouldRebuild(m_refitSettings, sahGrowth, ++m_blasRefitCounts[meshIndex]);
+      rebuildBlases |= rebuildBlas[meshIndex];
+    }
+    const float sahGrowth = m_tlasTracker.refit(getInstanceBounds(scene));
+    update.sahGrowth      = std::max(update.sahGrowth, sahGrowth);
+    rebuildTlas           = rebuildBlases || ShouldRebuild(m_refitSettings, sahGrowth, ++m_tlasRefitCount);
+  }
+  update.kind       = (rebuildBlases || rebuildTlas) ? "rebuild" : "refit";
+  update.gpuSeconds = 0.0;
+  auto addGpuTime   = [&](const char* phase) {
+    const double seconds = getTimestampSeconds();
+    m_profiler->addGpuTime(phase, seconds);
+    update.gpuSeconds = (seconds < 0.0 || update.gpuSeconds < 0.0) ? -1.0 : update.gpuSeconds + seconds;
+  };
+
+  // Upload the new vertices of deformed meshes, and the light table, whose triangles moved with them
+  LightTable lightTable;
+  {
+    Profiler::Scope scope(*m_profiler, "scene upload");
+    BuildLightTable(scene, lightTable);
+    const uint32_t lightCount = uint32_t(lightTable.triangles.size());
+    m_inverseLightPower       = (lightCount > 0) ? 1.0f / lightTable.totalPower : 0.0f;
+    if(lightTable.triangles.empty())
+    {
+      lightTable.triangles.resize(1);  // As in init()
+    }
+
+    submitTimestamp(0);
+    VkCommandBuffer             uploadCmdBuffer = AllocateAndBeginOneTimeCommandBuffer(m_context, m_cmdPool);
+    nvvk::StagingMemoryManager* staging         = m_allocator.getStaging();
+    for(uint32_t meshIndex : changes.deformedMeshes)
+    {
+      const SceneMesh& mesh = scene.getMeshes()[meshIndex];
+      staging->cmdToBuffer(uploadCmdBuffer, m_vertexBuffer.buffer, VkDeviceSize(m_meshInfos[meshIndex].firstVertex) * 3 * sizeof(float),
+                           VkDeviceSize(mesh.vertexCount) * 3 * sizeof(float), mesh.vertices);
+    }
+    // Triangles that were degenerate don't get into the table, so the number of lights can change
+    const VkDeviceSize lightBytes = lightTable.triangles.size() * sizeof(shaderio::EmissiveTriangle);
+    if(lightCount == m_lightCount)
+    {
+      staging->cmdToBuffer(uploadCmdBuffer, m_lightBuffer.buffer, 0, lightBytes, lightTable.triangles.data());
+    }
+    else
+    {
+      m_allocator.destroy(m_lightBuffer);
+      m_lightBuffer = m_allocator.createBuffer(uploadCmdBuffer, lightBytes, lightTable.triangles.data(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      VkDescriptorBufferInfo lightDescriptorBufferInfo{.buffer = m_lightBuffer.buffer, .range = VK_WHOLE_SIZE};
+      const VkWriteDescriptorSet write = m_descriptorSetContainer.makeWrite(0, BINDING_LIGHTS, &lightDescriptorBufferInfo);
+      vkUpdateDescriptorSets(m_context, 1, &write, 0, nullptr);
+    }
+    EndSubmitWaitAndFreeCommandBuffer(m_context, m_context.m_queueGCT, m_cmdPool, uploadCmdBuffer);
+    m_allocator.finalizeAndReleaseStaging();
+    submitTimestamp(1);
+    addGpuTime("scene upload");
+
+    // Light sampling is compiled out of scenes without lights, so the pipeline changes if the scene gains or loses its last one
+    const VkBool32 sampleLights = (m_options.sampleLights && lightCount > 0) ? VK_TRUE : VK_FALSE;
+    m_lightCount                = lightCount;
+    if(sampleLights != m_specialization.sampleLights)
+    {
+      m_specialization.sampleLights = sampleLights;
+      createPipeline();
+    }
+  }
+
+  // Refit the BLASes of the deformed meshes in place, except for those that need a rebuild. nvvk's builder can't
+  // rebuild one of its BLASes, so each of those is built anew by a builder of its own, which replaces its last one.
+  if(!changes.deformedMeshes.empty())
+  {
+    Profiler::Scope scope(*m_profiler, rebuildBlases ? "blas rebuild" : "blas refit");
+    submitTimestamp(0);
+    for(uint32_t meshIndex : changes.deformedMeshes)
+    {
+      std::unique_ptr<nvvk::RaytracingBuilderKHR>& rebuiltBlas = m_rebuiltBlases[meshIndex];
+      if(rebuildBlas[meshIndex])
+      {
+        if(rebuiltBlas)
+        {
+          rebuiltBlas->destroy();
+        }
+        else
+        {
+          rebuiltBlas = std::make_unique<nvvk::RaytracingBuilderKHR>();
+        }
+        rebuiltBlas->setup(m_context, &m_allocator, m_context.m_queueGCT);
+        rebuiltBlas->buildBlas({m_blasInputs[meshIndex]}, m_blasFlags);
+        m_blasTrackers[meshIndex].build(getTriangleBounds(scene, meshIndex));
+        m_blasRefitCounts[meshIndex] = 0;
+      }
+      else if(rebuiltBlas)
+      {
+        rebuiltBlas->updateBlas(0, m_blasInputs[meshIndex], m_blasFlags);
+      }
+      else
+      {
+        m_raytracingBuilder.updateBlas(meshIndex, m_blasInputs[meshIndex], m_blasFlags);
+      }
+    }
+    submitTimestamp(1);
+    addGpuTime(rebuildBlases ? "blas rebuild" : "blas refit");
+  }
+
+  // Refit the TLAS to the new instance transforms and BLASes, or build a new one and point the descriptor set at it
+  {
+    Profiler::Scope scope(*m_profiler, rebuildTlas ? "tlas rebuild" : "tlas refit");
+    submitTimestamp(0);
+    if(rebuildTlas)
+    {
+      m_tlasBuilder.destroy();
+      m_tlasBuilder.setup(m_context, &m_allocator, m_context.m_queueGCT);
+      m_tlasBuilder.buildTlas(makeTlasInstances(scene), m_tlasFlags);
+      m_tlasTracker.build(getInstanceBounds(scene));
+      m_tlasRefitCount = 0;
+    }
+    else
+    {
+      m_tlasBuilder.buildTlas(makeTlasInstances(scene), m_tlasFlags, true);
+    }
+    submitTimestamp(1);
+    addGpuTime(rebuildTlas ? "tlas rebuild" : "tlas refit");
+  }
+  if(rebuildTlas)
+  {
+    VkAccelerationStructureKHR                   tlasCopy = m_tlasBuilder.getAccelerationStructure();  // So that we can take its address
+    VkWriteDescriptorSetAccelerationStructureKHR descriptorAS{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+                                                              .accelerationStructureCount = 1,
+                                                              .pAccelerationStructures    = &tlasCopy};
+    const VkWriteDescriptorSet write = m_descriptorSetContainer.makeWrite(0, BINDING_TLAS, &descriptorAS);
+    vkUpdateDescriptorSets(m_context, 1, &write, 0, nullptr);
+  }
+
+  update.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  return true;
+}
+
+
+
+
+
+void GpuRenderer::setMaxSegments(uint32_t maxSegments)
+{
+  m_specialization.maxSegments = maxSegments;
+  createPipeline();
+}
+
+
+
+
+
+void GpuRenderer::setSampler(uint32_t sampler, uint32_t seed)
+{
+  m_options.seed = seed;  // Only a push constant
+  if(m_specialization.samplerType != sampler)
+  {
+    m_specialization.samplerType = sampler;
+    createPipeline();
+  }
+}
+
+
+
+
+
+void GpuRenderer::cmdWriteTimestamp(VkCommandBuffer cmdBuffer, uint32_t query, VkPipelineStageFlagBits stage)
+{
+  if(m_timestampPeriodSeconds > 0.0)
+  {
+    // A query must be reset before each use
+    vkCmdResetQueryPool(cmdBuffer, m_queryPool, query, 1);
+    vkCmdWriteTimestamp(cmdBuffer, stage, m_queryPool, query);
+  }
+}
+
+
+
+
+
+// Writes a timestamp once all of the work submitted to the queue before it has finished.
+void GpuRenderer::submitTimestamp(uint32_t query)
+{
+  VkCommandBuffer cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(m_context, m_cmdPool);
+  cmdWriteTimestamp(cmdBuffer, query, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+  EndSubmitWaitAndFreeCommandBuffer(m_context, m_context.m_queueGCT, m_cmdPool, cmdBuffer);
+}
+
+
+
+
+
+double GpuRenderer::getTimestampSeconds(uint32_t firstQuery)
+{
+  if(m_timestampPeriodSeconds == 0.0)
+  {
+    return -1.0;
+  }
+  uint64_t timestamps[2] = {};
+  NVVK_CHECK(vkGetQueryPoolResults(m_context, m_queryPool, firstQuery, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                                   VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+  return double(timestamps[1] - timestamps[0]) * m_timestampPeriodSeconds;
+}
+
+
+
+
+
+void GpuRenderer::collectResolveTime()
+{
+  if(m_resolveTimePending)
+  {
+    m_resolveTimePending = false;
+    m_profiler->addGpuTime("resolve", getTimestampSeconds(2));
+  }
+}
+
+
+
+
+
+void GpuRenderer::createPipeline()
+{
+  completeStagingCopies();  // The last copy's submission may still use the resolve pipeline
+  Profiler::Scope scope(*m_profiler, "pipeline creation");
+
+  // Set the specialization constants: each entry maps a constant_id in the shaders to a member of m_specialization.
+  // Each pipeline only gets the entries its shader uses, so that e.g. the output format doesn't make a new
+  // ray tracing pipeline.
+  // The entries of the trace shader come first, then the output format and the wavefront stage.
+  const std::array<VkSpecializationMapEntry, 11> specializationMapEntries{{
+      {SPEC_WORKGROUP_WIDTH, offsetof(shaderio::SpecializationConstants, workgroupWidth), sizeof(uint32_t)},
+      {SPEC_WORKGROUP_HEIGHT, offsetof(shaderio::SpecializationConstants, workgroupHeight), sizeof(uint32_t)},
+      {SPEC_MAX_SEGMENTS, offsetof(shaderio::SpecializationConstants, maxSegments), sizeof(uint32_t)},
+      {SPEC_COUNT_RAYS, offsetof(shaderio::SpecializationConstants, countRays), sizeof(VkBool32)},
+      {SPEC_COMPACT_GEOMETRY, offsetof(shaderio::SpecializationConstants, compactGeometry), sizeof(VkBool32)},
+      {SPEC_SAMPLE_LIGHTS, offsetof(shaderio::SpecializationConstants, sampleLights), sizeof(VkBool32)},
+      {SPEC_RUSSIAN_ROULETTE, offsetof(shaderio::SpecializationConstants, russianRouletteStart), sizeof(uint32_t)},
+      {SPEC_SAMPLER, offsetof(shaderio::SpecializationConstants, samplerType), sizeof(uint32_t)},
+      {SPEC_DENOISE, offsetof(shaderio::SpecializationConstants, denoise), sizeof(VkBool32)},
+      {SPEC_OUTPUT_FORMAT, offsetof(shaderio::SpecializationConstants, outputFormat), sizeof(uint32_t)},
+      {SPEC_WAVEFRONT_STAGE, offsetof(shaderio::SpecializationConstants, wavefrontStage), sizeof(uint32_t)},
+  }};
+  constexpr uint32_t traceMapEntryCount = 9;
+
+  const std::array<VkSpecializationMapEntry, 4> resolveMapEntries{specializationMapEntries[0], specializationMapEntries[1],
+                                                                   specializationMapEntries[9], specializationMapEntries[8]};
+
+  auto createComputePipeline = [&](VkShaderModule module, const VkSpecializationMapEntry* mapEntries, uint32_t mapEntryCount, VkPipeline& pipeline) {
+    if(pipeline != VK_NULL_HANDLE)
+    {
+      vkDestroyPipeline(m_context, pipeline, nullptr);
+    }
+
+    VkSpecializationInfo specializationInfo{.mapEntryCount = mapEntryCount,
+                                            .pMapEntries   = mapEntries,
+                                            .dataSize      = sizeof(m_specialization),
+                                            .pData         = &m_specialization};
+
+    // Describes the entrypoint and the stage to use for this shader module in the pipeline
+    VkPipelineShaderStageCreateInfo shaderStageCreateInfo{ .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                                                          .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                                                          .module = module,
+                                                          .pName = "main",
+                                                          .pSpecializationInfo = &specializationInfo };
+
+    // Create the compute pipeline. All four shaders share one pipeline layout.
+    VkComputePipelineCreateInfo pipelineCreateInfo{ .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                                                   .stage = shaderStageCreateInfo,
+                                                   .layout = m_descriptorSetContainer.getPipeLayout() };
+    // Don't modify flags, basePipelineHandle, or basePipelineIndex
+    NVVK_CHECK(vkCreateComputePipelines(m_context,                 // Device
+        m_pipelineCache.getCache(),  // Pipeline cache (skips the compile if this variant was created before)
+        1, &pipelineCreateInfo,      // Compute pipeline create info
+        nullptr,                     // Allocator (uses default)
+        &pipeline));                 // Output
+  };
+  if(m_options.wavefront)
+  {
+    // Each stage of the wavefront kernel is a variant of the trace shader, with the same constants plus its stage
+    std::array<VkSpecializationMapEntry, traceMapEntryCount + 1> stageMapEntries;
+    std::copy(specializationMapEntries.begin(), specializationMapEntries.begin() + traceMapEntryCount, stageMapEntries.begin());
+    stageMapEntries[traceMapEntryCount] = specializationMapEntries[10];
+    const std::pair<uint32_t, VkPipeline*> stages[] = {{WAVEFRONT_STAGE_GENERATE, &m_generatePipeline},
+                                                       {WAVEFRONT_STAGE_EXTEND, &m_extendPipeline},
+                                                       {WAVEFRONT_STAGE_SHADE, &m_shadePipeline},
+                                                       {WAVEFRONT_STAGE_MISS, &m_missPipeline}};
+    for(const auto& [stage, pipeline] : stages)
+    {
+      m_specialization.wavefrontStage = stage;
+      createComputePipeline(m_rayTraceModule, stageMapEntries.data(), uint32_t(stageMapEntries.size()), *pipeline);
+    }
+    m_specialization.wavefrontStage = WAVEFRONT_STAGE_NONE;
+  }
+  else
+  {
+    createComputePipeline(m_rayTraceModule, specializationMapEntries.data(), traceMapEntryCount, m_computePipeline);  // All but the output format and stage
+  }
+  createComputePipeline(m_tileStatsModule, specializationMapEntries.data(), 2, m_tileStatsPipeline);  // The workgroup (tile) size
+  createComputePipeline(m_resolveModule, resolveMapEntries.data(), 4, m_resolvePipeline);             // The workgroup size, output format and denoising
+  if(m_options.denoise)
+  {
+    createComputePipeline(m_denoiseModule, specializationMapEntries.data(), 2, m_denoisePipeline);  // The workgroup size
+  }
+}
+
+
+
+
+
+void GpuRenderer::autotuneWorkgroup()
+{
+  // Candidate workgroup shapes, from wide to tall. Rays from neighboring pixels tend to traverse
+  // the same BVH nodes, so the best shape depends on the GPU's SIMD width and caches.
+  const uint32_t candidates[][2] = {{8, 4}, {8, 8}, {16, 4}, {32, 2}, {16, 8}, {8, 16}, {32, 4},
+                                    {16, 16}, {32, 8}, {64, 4}, {8, 32}, {32, 16}, {16, 32}};
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_context.m_physicalDevice, &properties);
+  const VkPhysicalDeviceLimits& limits = properties.limits;
+
+  // Time the default view, tracing every sample: convergence and the time budget would make the
+  // amount of work depend on the shape.
+  const RenderOptions savedOptions = m_options;
+  m_options.targetNoise            = 0.0f;
+  m_options.timeBudgetSeconds      = 0.0;
+  RenderJob job;
+  job.samples = 2 * m_options.samplesPerBatch;
+
+  printf("Autotuning the workgroup size on %s:\n", properties.deviceName);
+  double   bestSeconds = 0.0;
+  uint32_t bestWidth = 0, bestHeight = 0;
+  for(const auto& candidate : candidates)
+  {
+    const uint32_t width = candidate[0], height = candidate[1];
+    if(!WorkgroupFits(limits, width, height))
+    {
+      continue;
+    }
+    m_specialization.workgroupWidth  = width;
+    m_specialization.workgroupHeight = height;
+    createPipeline();
+
+    // The first run warms up caches and clocks; keep the fastest of the next few.
+    // GPU timestamps are more precise than the CPU's clock, when the queue has them.
+    const auto timeJob = [&]() {
+      const TraceStats stats = trace(job, {0, 0, job.width, job.height}, 0.0);
+      return (stats.gpuSeconds >= 0.0) ? stats.gpuSeconds : stats.seconds;
+    };
+    timeJob();
+    double seconds = timeJob();
+    for(int run = 0; run < 2; run++)
+    {
+      seconds = std::min(seconds, timeJob());
+    }
+    printf("  %2u x %-2u: %.3f ms\n", width, height, seconds * 1000.0);
+    if(bestWidth == 0 || seconds < bestSeconds)
+    {
+      bestSeconds = seconds;
+      bestWidth   = width;
+      bestHeight  = height;
+    }
+  }
+  printf("Fastest: %u x %u\n", bestWidth, bestHeight);
+
+  m_options = savedOptions;
+  m_pipelineCache.setTunedWorkgroup(bestWidth, bestHeight);
+  // The command line still wins over the tuned shape for this run.
+  if(m_options.workgroupWidth == 0)
+  {
+    m_specialization.workgroupWidth  = bestWidth;
+    m_specialization.workgroupHeight = bestHeight;
+  }
+  else
+  {
+    m_specialization.workgroupWidth  = m_options.workgroupWidth;
+    m_specialization.workgroupHeight = m_options.workgroupHeight;
+  }
+}
+
+
+
+
+
+void GpuRenderer::prepareRenderTarget(VkDeviceSize pixelCount, VkDeviceSize tileCount, VkDeviceSize segmentCount)
+{
+  RenderTarget& target = m_renderTarget;
+  if(pixelCount <= target.pixelCapacity && tileCount <= target.tileCapacity && segmentCount <= target.segmentCapacity)
+  {
+    return;  // Big enough for this job, and the descriptor set already points to it
+  }
+  // Only the copy of the last render tile may still be using the render target; the image writer only reads
+  // the staging buffers.
+  completeStagingCopies();
+  destroyRenderTarget();
+  target.pixelCapacity   = pixelCount;
+  target.tileCapacity    = tileCount;
+  target.segmentCapacity = segmentCount;
+
+  // Buffer
+  // Create the accumulation buffer: one PixelAccumulator (sum, sum of squares and sample count) per pixel.
+  // Each dispatch adds a batch of samples to it. Only shaders read it - the tile statistics after each batch,
+  // and the resolve pass at the end - so it lives in device-local memory, which is the fastest for the GPU.
+  VkDeviceSize       bufferSizeBytes = pixelCount * sizeof(shaderio::PixelAccumulator);
+  VkBufferCreateInfo bufferCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                      .size  = bufferSizeBytes,
+                                      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+  target.accumulatorBuffer = m_allocator.createBuffer(bufferCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  // Create the output buffer, which resolve.comp.glsl packs the image into. It is copied to a staging
+  // buffer from there; its size is rounded up to whole pairs of pixels, which the shader packs together.
+  VkDeviceSize       outputSizeBytes = ((pixelCount + 1) / 2) * 2 * GetBytesPerPixel(m_options.outputFormat);
+  VkBufferCreateInfo outputCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                      .size  = outputSizeBytes,
+                                      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT};
+  target.outputBuffer = m_allocator.createBuffer(outputCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  // Create the tile mask (one flag per workgroup, which the CPU clears once the workgroup's tile has converged)
+  // and the tile statistics the CPU decides that from. Both are small, and stay mapped.
+  // VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT means that the CPU can read this buffer's memory.
+  // VK_MEMORY_PROPERTY_HOST_CACHED_BIT means that the CPU caches this memory.
+  // VK_MEMORY_PROPERTY_HOST_COHERENT_BIT means that the CPU side of cache management
+  // is handled automatically, with potentially slower reads/writes.
+  VkDeviceSize       tileMaskSizeBytes = tileCount * sizeof(uint32_t);
+  VkBufferCreateInfo tileMaskCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                        .size  = tileMaskSizeBytes,
+                                        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+  target.tileMaskBuffer = m_allocator.createBuffer(tileMaskCreateInfo,                        //
+                                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT        //
+                                                       | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  target.tileActive = reinterpret_cast<uint32_t*>(m_allocator.map(target.tileMaskBuffer));
+
+  VkDeviceSize       tileStatsSizeBytes = tileCount * sizeof(shaderio::TileStats);
+  VkBufferCreateInfo tileStatsCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                         .size  = tileStatsSizeBytes,
+                                         .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+  target.tileStatsBuffer = m_allocator.createBuffer(tileStatsCreateInfo,                       //
+                                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT        //
+                                                        | VK_MEMORY_PROPERTY_HOST_CACHED_BIT   //
+                                                        | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  target.tileStats = reinterpret_cast<shaderio::TileStats*>(m_allocator.map(target.tileStatsBuffer));
+
+  // The wavefront kernel's buffers: a slot per pixel in each path queue, since each pixel has at most one path
+  // in flight; an RNG state per pixel; and a path count per segment, which the CPU reads after each job.
+  // The megakernel doesn't read them, so its descriptor set points these bindings at the accumulators instead.
+  VkDeviceSize pathSizeBytes = bufferSizeBytes, pixelRngSizeBytes = bufferSizeBytes, pathCountSizeBytes = bufferSizeBytes;
+  VkBuffer     pathBuffer = target.accumulatorBuffer.buffer, pixelRngBuffer = pathBuffer, pathCountBuffer = pathBuffer;
+  if(segmentCount > 0)
+  {
+    pathSizeBytes      = PATH_QUEUE_COUNT * pixelCount * sizeof(shaderio::WavefrontPath);
+    pixelRngSizeBytes  = pixelCount * sizeof(uint32_t);
+    pathCountSizeBytes = segmentCount * sizeof(shaderio::RayCounter);
+    VkBufferCreateInfo pathCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = pathSizeBytes, .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+    VkBufferCreateInfo pixelRngCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = pixelRngSizeBytes, .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+    VkBufferCreateInfo pathCountCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = pathCountSizeBytes, .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+    target.pathBuffer      = m_allocator.createBuffer(pathCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    target.pixelRngBuffer  = m_allocator.createBuffer(pixelRngCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    target.pathCountBuffer = m_allocator.createBuffer(pathCountCreateInfo,                       //
+                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT        //
+                                                          | VK_MEMORY_PROPERTY_HOST_CACHED_BIT   //
+                                                          | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    target.pathCounts = reinterpret_cast<shaderio::RayCounter*>(m_allocator.map(target.pathCountBuffer));
+    pathBuffer        = target.pathBuffer.buffer;
+    pixelRngBuffer    = target.pixelRngBuffer.buffer;
+    pathCountBuffer   = target.pathCountBuffer.buffer;
+  }
+
+  // The denoiser's buffers: the AOVs the trace sums per pixel, which are cleared with the accumulators, and the
+  // two images the passes of denoise.comp.glsl ping-pong between. Without --denoise, no shader reads them.
+  VkDeviceSize aovSizeBytes = bufferSizeBytes, denoiserSizeBytes = bufferSizeBytes;
+  VkBuffer     aovBuffer = target.accumulatorBuffer.buffer, denoiserBuffer = aovBuffer;
+  if(m_options.denoise)
+  {
+    aovSizeBytes      = pixelCount * sizeof(shaderio::PixelAovs);
+    denoiserSizeBytes = 2 * pixelCount * sizeof(shaderio::DenoiserPixel);
+    VkBufferCreateInfo aovCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                     .size  = aovSizeBytes,
+                                     .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+    VkBufferCreateInfo denoiserCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = denoiserSizeBytes, .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+    target.aovBuffer      = m_allocator.createBuffer(aovCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    target.denoiserBuffer = m_allocator.createBuffer(denoiserCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    aovBuffer             = target.aovBuffer.buffer;
+    denoiserBuffer        = target.denoiserBuffer.buffer;
+  }
+
+  // Point the descriptor set to the new buffers.
+  VkDescriptorBufferInfo descriptorBufferInfo{ .buffer = target.accumulatorBuffer.buffer,  // The VkBuffer object
+                                              .range = bufferSizeBytes };                 // The length of memory to bind; offset is 0.
+  VkDescriptorBufferInfo outputDescriptorBufferInfo{ .buffer = target.outputBuffer.buffer, .range = outputSizeBytes };
+  VkDescriptorBufferInfo tileMaskDescriptorBufferInfo{ .buffer = target.tileMaskBuffer.buffer, .range = tileMaskSizeBytes };
+  VkDescriptorBufferInfo tileStatsDescriptorBufferInfo{ .buffer = target.tileStatsBuffer.buffer, .range = tileStatsSizeBytes };
+  VkDescriptorBufferInfo pathDescriptorBufferInfo{ .buffer = pathBuffer, .range = pathSizeBytes };
+  VkDescriptorBufferInfo pixelRngDescriptorBufferInfo{ .buffer = pixelRngBuffer, .range = pixelRngSizeBytes };
+  VkDescriptorBufferInfo pathCountDescriptorBufferInfo{ .buffer = pathCountBuffer, .range = pathCountSizeBytes };
+  VkDescriptorBufferInfo aovDescriptorBufferInfo{ .buffer = aovBuffer, .range = aovSizeBytes };
+  VkDescriptorBufferInfo denoiserDescriptorBufferInfo{ .buffer = denoiserBuffer, .range = denoiserSizeBytes };
+  const std::array<VkWriteDescriptorSet, 9> writeDescriptorSets{
+      m_descriptorSetContainer.makeWrite(0 /*set index*/, BINDING_ACCUMULATORS /*binding*/, &descriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_OUTPUT, &outputDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_TILE_MASK, &tileMaskDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_TILE_STATS, &tileStatsDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_PATHS, &pathDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_PIXEL_RNG, &pixelRngDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_PATH_COUNTS, &pathCountDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_AOVS, &aovDescriptorBufferInfo),
+      m_descriptorSetContainer.makeWrite(0, BINDING_DENOISER, &denoiserDescriptorBufferInfo),
+  };
+  vkUpdateDescriptorSets(m_context, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+}
+
+
+
+
+
+void GpuRenderer::destroyRenderTarget()
+{
+  RenderTarget& target = m_renderTarget;
+  if(target.tileActive != nullptr)
+  {
+    m_allocator.destroy(target.accumulatorBuffer);
+    m_allocator.destroy(target.outputBuffer);
+    m_allocator.unmap(target.tileMaskBuffer);
+    m_allocator.destroy(target.tileMaskBuffer);
+    m_allocator.unmap(target.tileStatsBuffer);
+    m_allocator.destroy(target.tileStatsBuffer);
+    target.tileActive = nullptr;
+    target.tileStats  = nullptr;
+  }
+  if(target.pathCounts != nullptr)
+  {
+    m_allocator.destroy(target.pathBuffer);
+    m_allocator.destroy(target.pixelRngBuffer);
+    m_allocator.unmap(target.pathCountBuffer);
+    m_allocator.destroy(target.pathCountBuffer);
+    target.pathCounts = nullptr;
+  }
+  if(target.aovBuffer.buffer != VK_NULL_HANDLE)
+  {
+    m_allocator.destroy(target.aovBuffer);
+    m_allocator.destroy(target.denoiserBuffer);
+    target.aovBuffer      = {};
+    target.denoiserBuffer = {};
+  }
+  target.pixelCapacity   = 0;
+  target.tileCapacity    = 0;
+  target.segmentCapacity = 0;
+}
+
+
+
+
+
+void GpuRenderer::recordBatch(VkCommandBuffer cmdBuffer, const shaderio::PushConstants& pushConstants, uint32_t tileCountX, uint32_t tileCountY)
+{
+  if(m_options.wavefront)
+  {
+    recordWavefrontBatch(cmdBuffer, pushConstants, tileCountX, tileCountY);
+  }
+  else
+  {
+    // Binding
+    // Bind the compute shader pipeline
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_computePipeline);
+
+    // Bind the descriptor set
+    VkDescriptorSet descriptorSet = m_descriptorSetContainer.getSet(0);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_descriptorSetContainer.getPipeLayout(), 0, 1,
+                            &descriptorSet, 0, nullptr);
+
+    // Tell the shader about the camera, which batch this is, and how many samples to trace
+    vkCmdPushConstants(cmdBuffer, m_descriptorSetContainer.getPipeLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(pushConstants), &pushConstants);
+
+    // Dispatch
+    // Run the compute shader with enough workgroups to cover the entire image:
+    vkCmdDispatch(cmdBuffer, tileCountX, tileCountY, 1);
+  }
+
+  // Memory Barrier
+  // Add a command that says "Make it so that memory writes by the compute shader
+  // are available to read from the CPU." (In other words, "Flush the GPU caches
+  // so the CPU can read the data.") To do this, we use a memory barrier.
+  // This is one of the most complex parts of Vulkan, so don't worry if this is
+  // confusing! We'll talk about pipeline barriers more in the extras.
+  // The CPU reads the ray counter and path counts; the next dispatch (another batch, the tile statistics or the
+  // resolve pass) reads the accumulators, so the barrier covers it too.
+  VkMemoryBarrier memoryBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,  // Make shader writes
+                                .dstAccessMask = VK_ACCESS_HOST_READ_BIT      // Readable by the CPU
+                                                 | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};  // and the next dispatch
+  vkCmdPipelineBarrier(cmdBuffer,                                                          // The command buffer
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,                               // From the compute shader
+                       VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,  // To the CPU and the next dispatch
+                       0,                                                                  // No special flags
+                       1, &memoryBarrier,                                                  // An array of memory barriers
+                       0, nullptr, 0, nullptr);                                            // No other barriers
+}
+
+
+
+
+
+void GpuRenderer::recordWavefrontBatch(VkCommandBuffer cmdBuffer, shaderio::PushConstants pushConstants, uint32_t tileCountX, uint32_t tileCountY)
+{
+  // All stages share the pipeline layout, so the descriptor set stays bound when the pipeline changes
+  const VkPipelineLayout pipelineLayout = m_descriptorSetContainer.getPipeLayout();
+  VkDescriptorSet        descriptorSet  = m_descriptorSetContainer.getSet(0);
+  vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+  // Empties queueCount queues from firstQueue on: no paths, and no workgroups for their consumer
+  auto resetQueues = [&](uint32_t firstQueue, uint32_t queueCount) {
+    const shaderio::PathQueue emptyQueues[PATH_QUEUE_COUNT] = {{0, 0, 1, 1}, {0, 0, 1, 1}, {0, 0, 1, 1}};
+    vkCmdUpdateBuffer(cmdBuffer, m_pathQueueBuffer.buffer, firstQueue * sizeof(shaderio::PathQueue),
+                      queueCount * sizeof(shaderio::PathQueue), emptyQueues);
+    CmdWavefrontBarrier(cmdBuffer);
+  };
+  auto dispatchStage = [&](VkPipeline pipeline) {
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+  };
+  // Dispatches a stage on the paths of a queue, with the number of workgroups its producers counted
+  auto dispatchQueue = [&](VkPipeline pipeline, uint32_t queue) {
+    dispatchStage(pipeline);
+    vkCmdDispatchIndirect(cmdBuffer, m_pathQueueBuffer.buffer, queue * sizeof(shaderio::PathQueue) + offsetof(shaderio::PathQueue, groupCountX));
+  };
+
+  // The previous batch may still be reading the queues
+  CmdWavefrontBarrier(cmdBuffer);
+
+  // Each sample of the batch is a wave of one path per pixel. The host can't know when every path has ended
+  // without waiting for the GPU, so it records all MAX_SEGMENTS segments; once the extend queue is empty,
+  // the remaining dispatches have no workgroups and cost little more than their barriers.
+  for(uint32_t sampleIndex = 0; sampleIndex < pushConstants.samplesPerBatch; sampleIndex++)
+  {
+    pushConstants.sampleIndex = sampleIndex;
+    pushConstants.segment     = 0;
+    resetQueues(PATH_QUEUE_EXTEND, 1);
+    dispatchStage(m_generatePipeline);
+    vkCmdDispatch(cmdBuffer, tileCountX, tileCountY, 1);
+    CmdWavefrontBarrier(cmdBuffer);
+
+    for(uint32_t segment = 0; segment < m_specialization.maxSegments; segment++)
+    {
+      pushConstants.segment = segment;
+      // Extend sorts the live paths into the hit and miss queues
+      resetQueues(PATH_QUEUE_HIT, 2);
+      dispatchQueue(m_extendPipeline, PATH_QUEUE_EXTEND);
+      CmdWavefrontBarrier(cmdBuffer);
+      // Then the extend queue is free for shade to refill with the paths that bounce. Miss and shade work on
+      // different paths, so they can run at the same time.
+      resetQueues(PATH_QUEUE_EXTEND, 1);
+      dispatchQueue(m_missPipeline, PATH_QUEUE_MISS);
+      dispatchQueue(m_shadePipeline, PATH_QUEUE_HIT);
+      CmdWavefrontBarrier(cmdBuffer);
+    }
+  }
+}
+
+
+
+
+
+void GpuRenderer::recordTileStats(VkCommandBuffer cmdBuffer, const shaderio::PushConstants& pushConstants, uint32_t tileCountX, uint32_t tileCountY)
+{
+  // Same descriptor set and push constants as the batch, one workgroup per tile
+  vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_tileStatsPipeline);
+  VkDescriptorSet descriptorSet = m_descriptorSetContainer.getSet(0);
+  vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_descriptorSetContainer.getPipeLayout(), 0, 1,
+                          &descriptorSet, 0, nullptr);
+  vkCmdPushConstants(cmdBuffer, m_descriptorSetContainer.getPipeLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(pushConstants), &pushConstants);
+  vkCmdDispatch(cmdBuffer, tileCountX, tileCountY, 1);
+
+  // Make the statistics readable by the CPU
+  VkMemoryBarrier memoryBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+  vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memoryBarrier,
+                       0, nullptr, 0, nullptr);
+}
+
+
+
+
+
+void GpuRenderer::chooseRenderTile(const RenderJob& job, uint32_t& width, uint32_t& height) const
+{
+  // The wavefront kernel's path queues take far more memory per pixel than the accumulators, so they
+  // count towards the limit of an untiled image too.
+  VkDeviceSize bytesPerPixel = sizeof(shaderio::PixelAccumulator);
+  if(m_options.wavefront)
+  {
+    bytesPerPixel += PATH_QUEUE_COUNT * sizeof(shaderio::WavefrontPath) + sizeof(uint32_t);
+  }
+  if(m_options.denoise)
+  {
+    bytesPerPixel += sizeof(shaderio::PixelAovs) + 2 * sizeof(shaderio::DenoiserPixel);
+  }
+
+  if(m_options.renderTileWidth != 0)
+  {
+    width  = std::min(m_options.renderTileWidth, job.width);
+    height = std::min(m_options.renderTileHeight, job.height);
+  }
+  else if(VkDeviceSize(job.width) * job.height * bytesPerPixel <= std::min(m_maxStorageBufferRange, max_untiled_accumulator_bytes))
+  {
+    width  = job.width;
+    height = job.height;
+  }
+  else
+  {
+    width  = std::min(render_tile_width, job.width);
+    height = std::min(render_tile_height, job.height);
+  }
+
+  // The queue stages are dispatched with one row of workgroups, so a tile can't have more paths than
+  // 65535 (the smallest maxComputeWorkGroupCount a device can have) workgroups hold. The paths of a tile
+  // include those of its denoiser apron, which makes narrower tiles pay off with a wide apron.
+  if(m_options.wavefront)
+  {
+    const VkDeviceSize maxPaths = VkDeviceSize(65535) * m_specialization.workgroupWidth * m_specialization.workgroupHeight;
+    const uint32_t     apron    = getDenoiseApron();
+    auto tracedSize = [apron](uint32_t size, uint32_t imageSize) { return VkDeviceSize(std::min(size + 2 * apron, imageSize)); };
+    while(width > 1 && tracedSize(width, job.width) * tracedSize(1, job.height) > maxPaths)
+    {
+      width /= 2;
+    }
+    const VkDeviceSize maxTracedHeight = maxPaths / tracedSize(width, job.width);
+    if(tracedSize(height, job.height) > maxTracedHeight)
+    {
+      height = uint32_t(std::max<VkDeviceSize>(maxTracedHeight - 2 * apron, 1));
+    }
+  }
+}
+
+
+
+
+
+uint32_t GpuRenderer::getDenoiseApron() const
+{
+  // The prepare pass reads 1 pixel away, and pass i reads 2 * 2^(i-1) pixels away from the pixels pass i-1 wrote
+  return m_options.denoise ? (2u << m_options.denoiseIterations) - 1 : 0;
+}
+
+
+
+
+
+GpuRenderer::RenderTile GpuRenderer::getTracedTile(const RenderJob& job, const RenderTile& renderTile) const
+{
+  const uint32_t apron = getDenoiseApron();
+  const uint32_t x0    = renderTile.x - std::min(renderTile.x, apron);
+  const uint32_t y0    = renderTile.y - std::min(renderTile.y, apron);
+  const uint32_t x1    = renderTile.x + renderTile.width + std::min(job.width - renderTile.x - renderTile.width, apron);
+  const uint32_t y1    = renderTile.y + renderTile.height + std::min(job.height - renderTile.y - renderTile.height, apron);
+  return {x0, y0, x1 - x0, y1 - y0};
+}
+
+
+
+
+
+GpuRenderer::TraceStats GpuRenderer::trace(const RenderJob& job, const RenderTile& renderTile, double timeBudgetSeconds)
+{
+  // One workgroup per convergence tile
+  const uint32_t     tileCountX   = (renderTile.width + m_specialization.workgroupWidth - 1) / m_specialization.workgroupWidth;
+  const uint32_t     tileCountY   = (renderTile.height + m_specialization.workgroupHeight - 1) / m_specialization.workgroupHeight;
+  const uint32_t     tileCount    = tileCountX * tileCountY;
+  const VkDeviceSize pixelCount   = VkDeviceSize(renderTile.width) * renderTile.height;
+  const uint32_t     segmentCount = m_options.wavefront ? m_specialization.maxSegments : 0;
+  prepareRenderTarget(pixelCount, tileCount, segmentCount);
+  RenderTarget& target = m_renderTarget;
+  std::fill(target.tileActive, target.tileActive + tileCount, 1u);  // All tiles start active
+
+  // Everything but the batch index and the number of samples stays the same for the whole job
+  shaderio::PushConstants pushConstants{};
+  pushConstants.cameraOrigin      = {job.camera.origin.x, job.camera.origin.y, job.camera.origin.z};
+  pushConstants.fovVerticalSlope  = job.camera.fovVerticalSlope;
+  pushConstants.cameraRight       = {job.camera.right.x, job.camera.right.y, job.camera.right.z};
+  pushConstants.cameraUp          = {job.camera.up.x, job.camera.up.y, job.camera.up.z};
+  pushConstants.cameraForward     = {job.camera.forward.x, job.camera.forward.y, job.camera.forward.z};
+  pushConstants.resolution        = {job.width, job.height};
+  pushConstants.tileOrigin        = {renderTile.x, renderTile.y};
+  pushConstants.tileSize          = {renderTile.width, renderTile.height};
+  pushConstants.lightCount        = m_lightCount;
+  pushConstants.inverseLightPower = m_inverseLightPower;
+  pushConstants.seed              = m_options.seed;
+  pushConstants.firstSample       = m_options.firstSample;
+
+  // Progressive rendering
+  // Instead of tracing every sample in one long dispatch, we dispatch batches of samples and add each batch
+  // to the accumulation buffer. After each batch, the GPU estimates the noise of each tile, and the CPU masks
+  // out the tiles that have converged, so later batches only spend time where the image is still noisy. We stop
+  // when all tiles have converged, when the time budget runs out, or when we've traced the job's number of samples.
+  // Without a noise target or a time budget, there's nothing to decide between batches, so all batches
+  // are recorded into a single command buffer and submitted at once.
+  const bool checkAfterEachBatch = (m_options.targetNoise > 0.0f) || (timeBudgetSeconds > 0.0);
+
+  ConvergenceSettings convergenceSettings;
+  convergenceSettings.targetNoise = m_options.targetNoise;
+  convergenceSettings.minSamples  = m_options.minSamples;
+
+  // Only the copy of the last render tile may still be running on the GPU, and it doesn't use the tile mask or the
+  // counters, so the CPU can reset them directly
+  *m_rayCounter = {0, 0};
+  std::fill(target.pathCounts, target.pathCounts + segmentCount, shaderio::RayCounter{0, 0});
+
+  const auto startTime     = std::chrono::steady_clock::now();
+  double     gpuSeconds    = (m_timestampPeriodSeconds > 0.0) ? 0.0 : -1.0;
+  uint32_t   batchIndex    = 0;
+  uint32_t   samplesTraced = 0;
+  uint32_t   activeTiles   = tileCount;
+  while(true)
+  {
+    // Command Buffer
+    // Create and start recording a command buffer
+    VkCommandBuffer cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(m_context, m_cmdPool);
+    cmdWriteTimestamp(cmdBuffer, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+    // Clear the accumulators before the first batch, and make the clear visible to the compute shader.
+    // The resolve and copy of the last render tile may still be running: they read the buffers this clears,
+    // and write the output buffer the next resolve writes, so everything from here on waits for them.
+    const bool firstSubmission = (batchIndex == 0);
+    if(firstSubmission)
+    {
+      VkMemoryBarrier resolveBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                     .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                                     .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT};
+      const VkPipelineStageFlags resolveStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+      vkCmdPipelineBarrier(cmdBuffer, resolveStages, resolveStages, 0, 1, &resolveBarrier, 0, nullptr, 0, nullptr);
+      vkCmdFillBuffer(cmdBuffer, target.accumulatorBuffer.buffer, 0, pixelCount * sizeof(shaderio::PixelAccumulator), 0);
+      if(m_options.denoise)
+      {
+        vkCmdFillBuffer(cmdBuffer, target.aovBuffer.buffer, 0, pixelCount * sizeof(shaderio::PixelAovs), 0);
+      }
+      VkMemoryBarrier clearBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                   .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                                   .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+      vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                           &clearBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    do
+    {
+      pushConstants.batchIndex      = m_options.firstSample / m_options.samplesPerBatch + batchIndex;
+      pushConstants.samplesPerBatch = std::min(m_options.samplesPerBatch, job.samples - samplesTraced);
+      recordBatch(cmdBuffer, pushConstants, tileCountX, tileCountY);
+      samplesTraced += pushConstants.samplesPerBatch;
+      batchIndex++;
+    } while(!checkAfterEachBatch && samplesTraced < job.samples);
+    if(m_options.targetNoise > 0.0f)
+    {
+      recordTileStats(cmdBuffer, pushConstants, tileCountX, tileCountY);
+    }
+    cmdWriteTimestamp(cmdBuffer, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+    // Finishing operations
+    // End and submit the command buffer, then wait for it to finish. The copies of the render tiles before this
+    // one were submitted first, so while the GPU traces, they finish and go to the image writer.
+    EndAndSubmitCommandBuffer(m_context.m_queueGCT, cmdBuffer, m_submitFence);
+    if(firstSubmission)
+    {
+      completeStagingCopies();
+    }
+    WaitAndFreeCommandBuffer(m_context, m_submitFence, m_cmdPool, cmdBuffer);
+    if(gpuSeconds >= 0.0)
+    {
+      gpuSeconds += getTimestampSeconds();
+    }
+
+    // Convergence
+    // Mask out the tiles that have converged. The shader reads the mask at the start of the next batch.
+    if(checkAfterEachBatch)
+    {
+      activeTiles = UpdateTileMask(target.tileStats, tileCount, convergenceSettings, target.tileActive);
+    }
+
+    const double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const bool   outOfTime      = (timeBudgetSeconds > 0.0) && (elapsedSeconds >= timeBudgetSeconds);
+    if(activeTiles == 0 || outOfTime || samplesTraced >= job.samples)
+    {
+      const uint64_t        rayCount = (uint64_t(m_rayCounter->high) << 32) | m_rayCounter->low;
+      std::vector<uint64_t> pathsPerSegment(segmentCount);
+      for(uint32_t segment = 0; segment < segmentCount; segment++)
+      {
+        pathsPerSegment[segment] = (uint64_t(target.pathCounts[segment].high) << 32) | target.pathCounts[segment].low;
+      }
+      return {batchIndex, samplesTraced, tileCount - activeTiles, tileCount, elapsedSeconds, gpuSeconds, rayCount, pathsPerSegment};
+    }
+  }
+}
+
+
+
+
+
+GpuRenderer::StagingBuffer& GpuRenderer::acquireStagingBuffer(VkDeviceSize sizeBytes)
+{
+  StagingBuffer& staging = m_stagingBuffers[m_nextStagingBuffer];
+  m_nextStagingBuffer    = (m_nextStagingBuffer + 1) % uint32_t(m_stagingBuffers.size());
+
+  // The band that was copied into this buffer three bands ago may still be being written.
+  if(staging.copyPending)
+  {
+    completeStagingCopies();
+  }
+  if(staging.pendingWrite.valid())
+  {
+    m_allWritesSucceeded &= staging.pendingWrite.get();
+  }
+
+  if(sizeBytes > staging.sizeBytes)
+  {
+    if(staging.data != nullptr)
+    {
+      m_allocator.unmap(staging.buffer);
+      m_allocator.destroy(staging.buffer);
+    }
+    // Host-visible and cached, since the image writer reads all of it
+    VkBufferCreateInfo stagingCreateInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                                         .size  = sizeBytes,
+                                         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+    staging.buffer    = m_allocator.createBuffer(stagingCreateInfo,                          //
+                                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT         //
+                                                     | VK_MEMORY_PROPERTY_HOST_CACHED_BIT    //
+                                                     | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    staging.data      = m_allocator.map(staging.buffer);
+    staging.sizeBytes = sizeBytes;
+  }
+  return staging;
+}
+
+
+
+
+
+void GpuRenderer::completeStagingCopies()
+{
+  // Oldest first, so that the image writer gets the bands in order
+  for(uint32_t i = 0; i < uint32_t(m_stagingBuffers.size()); i++)
+  {
+    StagingBuffer& staging = m_stagingBuffers[(m_nextStagingBuffer + i) % m_stagingBuffers.size()];
+    if(!staging.copyPending)
+    {
+      continue;
+    }
+    NVVK_CHECK(vkWaitForFences(m_context, 1, &staging.copyFence, VK_TRUE, UINT64_MAX));
+    NVVK_CHECK(vkResetFences(m_context, 1, &staging.copyFence));
+    vkFreeCommandBuffers(m_context, m_cmdPool, uint32_t(staging.copyCmdBuffers.size()), staging.copyCmdBuffers.data());
+    staging.copyCmdBuffers.clear();
+    staging.copyPending = false;
+    if(staging.startWrite)
+    {
+      staging.pendingWrite = staging.startWrite();
+      staging.startWrite   = nullptr;
+    }
+  }
+  collectResolveTime();
+}
+
+
+
+
+
+void GpuRenderer::denoiseTile(const RenderJob& job, const RenderTile& tracedTile)
+{
+  shaderio::PushConstants pushConstants{};
+  pushConstants.fovVerticalSlope = job.camera.fovVerticalSlope;
+  pushConstants.resolution       = {job.width, job.height};
+  pushConstants.tileOrigin       = {tracedTile.x, tracedTile.y};
+  pushConstants.tileSize         = {tracedTile.width, tracedTile.height};
+  pushConstants.denoisePassCount = 1 + m_options.denoiseIterations;
+
+  const uint32_t  tileCountX    = (tracedTile.width + m_specialization.workgroupWidth - 1) / m_specialization.workgroupWidth;
+  const uint32_t  tileCountY    = (tracedTile.height + m_specialization.workgroupHeight - 1) / m_specialization.workgroupHeight;
+  VkDescriptorSet descriptorSet = m_descriptorSetContainer.getSet(0);
+
+  // Each pass reads pixels of the pass before that other workgroups wrote, so the passes are separate dispatches;
+  // each has its own submission, so that the profile has the GPU time of each pass. Taps outside the traced tile
+  // are skipped, as at the edges of the image; those of the render tile's pixels only fall outside it at the
+  // edges of the image, since the apron covers their reach.
+  for(uint32_t pass = 0; pass < pushConstants.denoisePassCount; pass++)
+  {
+    const char* passName = GetDenoisePassName(pass);
+    {
+      Profiler::Scope scope(*m_profiler, passName);
+      VkCommandBuffer cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(m_context, m_cmdPool);
+      cmdWriteTimestamp(cmdBuffer, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+      pushConstants.denoisePass = pass;
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
+      vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_descriptorSetContainer.getPipeLayout(), 0, 1,
+                              &descriptorSet, 0, nullptr);
+      vkCmdPushConstants(cmdBuffer, m_descriptorSetContainer.getPipeLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(pushConstants), &pushConstants);
+      vkCmdDispatch(cmdBuffer, tileCountX, tileCountY, 1);
+
+      // Make this pass visible to the next one, or to the resolve pass
+      VkMemoryBarrier passBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                  .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                  .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+      vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                           &passBarrier, 0, nullptr, 0, nullptr);
+      cmdWriteTimestamp(cmdBuffer, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+      EndAndSubmitCommandBuffer(m_context.m_queueGCT, cmdBuffer, m_submitFence);
+      WaitAndFreeCommandBuffer(m_context, m_submitFence, m_cmdPool, cmdBuffer);
+    }
+    const double passGpuSeconds = getTimestampSeconds();
+    if(passGpuSeconds >= 0.0)
+    {
+      m_profiler->addGpuTime(passName, passGpuSeconds);
+    }
+  }
+}
+
+
+
+
+
+void GpuRenderer::resolveTile(const RenderJob& job, const RenderTile& renderTile, const RenderTile& tracedTile, StagingBuffer& staging)
+{
+  collectResolveTime();  // The last render tile's resolve has finished, since this one's trace has
+  VkCommandBuffer cmdBuffer = AllocateAndBeginOneTimeCommandBuffer(m_context, m_cmdPool);
+  cmdWriteTimestamp(cmdBuffer, 2, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+  // Pack the tile. Each invocation packs two pixels; when there are more workgroups than one row of
+  // the dispatch can have, they are spread over several rows.
+  shaderio::PushConstants pushConstants{};
+  pushConstants.resolution = {job.width, job.height};
+  pushConstants.tileOrigin = {tracedTile.x, tracedTile.y};
+  pushConstants.tileSize   = {tracedTile.width, tracedTile.height};
+
+  const VkDeviceSize pixelCount      = VkDeviceSize(tracedTile.width) * tracedTile.height;
+  const uint32_t     workgroupSize   = m_specialization.workgroupWidth * m_specialization.workgroupHeight;
+  const uint32_t     workgroupCount  = uint32_t(((pixelCount + 1) / 2 + workgroupSize - 1) / workgroupSize);
+  const uint32_t     workgroupCountX = std::min(workgroupCount, 65535u);
+  const uint32_t     workgroupCountY = (workgroupCount + workgroupCountX - 1) / workgroupCountX;
+
+  VkDescriptorSet descriptorSet = m_descriptorSetContainer.getSet(0);
+  vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_resolvePipeline);
+  vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_descriptorSetContainer.getPipeLayout(), 0, 1,
+                          &descriptorSet, 0, nullptr);
+  vkCmdPushConstants(cmdBuffer, m_descriptorSetContainer.getPipeLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(pushConstants), &pushConstants);
+  vkCmdDispatch(cmdBuffer, workgroupCountX, workgroupCountY, 1);
+
+  // Copy each row of the render tile, without the apron, to its place in the band of rows, and make the copy visible
+  // to the CPU
+  VkMemoryBarrier resolveBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                 .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                 .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT};
+  vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                       &resolveBarrier, 0, nullptr, 0, nullptr);
+  const VkDeviceSize        bytesPerPixel = GetBytesPerPixel(m_options.outputFormat);
+  std::vector<VkBufferCopy> regions(renderTile.height);
+  for(uint32_t row = 0; row < renderTile.height; row++)
+  {
+    const VkDeviceSize tracedRow = row + renderTile.y - tracedTile.y;
+    regions[row] = {.srcOffset = (tracedRow * tracedTile.width + renderTile.x - tracedTile.x) * bytesPerPixel,
+                    .dstOffset = (VkDeviceSize(row) * job.width + renderTile.x) * bytesPerPixel,
+                    .size      = renderTile.width * bytesPerPixel};
+  }
+  vkCmdCopyBuffer(cmdBuffer, m_renderTarget.outputBuffer.buffer, staging.buffer.buffer, uint32_t(regions.size()), regions.data());
+  VkMemoryBarrier copyBarrier{.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                              .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                              .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+  vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &copyBarrier, 0,
+                       nullptr, 0, nullptr);
+  cmdWriteTimestamp(cmdBuffer, 3, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+  // Don't wait: the next render tile traces in the meantime, and the staging buffer's fence tells when the copy is done
+  EndAndSubmitCommandBuffer(m_context.m_queueGCT, cmdBuffer, VK_NULL_HANDLE);
+  staging.copyCmdBuffers.push_back(cmdBuffer);
+  m_resolveTimePending = (m_timestampPeriodSeconds > 0.0);
+}
+
+
+
+
+
+JobReport GpuRenderer::render(const RenderJob& job, bool writeImage, std::vector<float>* imageData)
+{
+  // Render tiles
+  // Without tiling, the whole image is one render tile. Otherwise, tiles are traced left to right, one band
+  // of rows after the other, each with its own progressive rendering into the render target. Each tile is
+  // packed into a staging buffer that holds its band's rows; once the last tile of a band is in, the image
+  // writer streams the band to the file while the next band traces. So the file is written sequentially,
+  // and memory is bounded by one render tile on the GPU and three bands on the host, whatever the height.
+  // With --denoise, each tile is traced and denoised together with its apron (see getTracedTile()).
+  uint32_t renderTileWidth, renderTileHeight;
+  chooseRenderTile(job, renderTileWidth, renderTileHeight);
+  const VkDeviceSize bytesPerPixel = GetBytesPerPixel(m_options.outputFormat);
+  const double       imageArea     = double(job.width) * job.height;
+
+  TraceStats total{0, 0, 0, 0, 0.0, (m_timestampPeriodSeconds > 0.0) ? 0.0 : -1.0, 0};
+  for(uint32_t bandY = 0; bandY < job.height; bandY += renderTileHeight)
+  {
+    const uint32_t bandHeight = std::min(renderTileHeight, job.height - bandY);
+    StagingBuffer* staging    = (writeImage || imageData != nullptr) ? &acquireStagingBuffer(VkDeviceSize(job.width) * bandHeight * bytesPerPixel) : nullptr;
+    for(uint32_t tileX = 0; tileX < job.width; tileX += renderTileWidth)
+    {
+      // Each tile gets a share of the time budget proportional to its area
+      const RenderTile renderTile{tileX, bandY, std::min(renderTileWidth, job.width - tileX), bandHeight};
+      const RenderTile tracedTile = getTracedTile(job, renderTile);
+      const double     timeBudget = m_options.timeBudgetSeconds * double(renderTile.width) * renderTile.height / imageArea;
+      const TraceStats stats      = trace(job, tracedTile, timeBudget);
+      total.batchCount += stats.batchCount;
+      total.samplesTraced = std::max(total.samplesTraced, stats.samplesTraced);
+      total.convergedTiles += stats.convergedTiles;
+      total.tileCount += stats.tileCount;
+      total.seconds += stats.seconds;
+      total.rayCount += stats.rayCount;
+      total.pathsPerSegment.resize(std::max(total.pathsPerSegment.size(), stats.pathsPerSegment.size()));
+      for(size_t segment = 0; segment < stats.pathsPerSegment.size(); segment++)
+      {
+        total.pathsPerSegment[segment] += stats.pathsPerSegment[segment];
+      }
+      if(total.gpuSeconds >= 0.0)
+      {
+        total.gpuSeconds += stats.gpuSeconds;
+      }
+
+      if(staging != nullptr)
+      {
+        if(m_options.denoise)
+        {
+          denoiseTile(job, tracedTile);
+        }
+        Profiler::Scope scope(*m_profiler, "resolve");
+        resolveTile(job, renderTile, tracedTile, *staging);
+      }
+    }
+    if(staging == nullptr)
+    {
+      continue;
+    }
+
+    // The band's fence is signaled once everything submitted before it, including the copies of its tiles, has
+    // finished. The band is then written once the next submission that waits (usually the next tile's trace) is done.
+    NVVK_CHECK(vkQueueSubmit(m_context.m_queueGCT, 0, nullptr, staging->copyFence));
+    staging->copyPending = true;
+    if(writeImage)
+    {
+      const AccumulationInfo accumulationInfo{m_options.seed, m_options.sampler, m_options.firstSample, job.samples};
+      staging->startWrite = [this, path = job.outputPath, width = job.width, height = job.height, bandY, bandHeight,
+                             data = staging->data, accumulationInfo]() {
+        return m_imageWriter->write(path, width, height, m_options.outputFormat, bandY, bandHeight, data, accumulationInfo);
+      };
+    }
+    if(imageData != nullptr)
+    {
+      // The band's pixels are RGB floats (the caller chose OUTPUT_FORMAT_FLOAT); the caller needs them now
+      completeStagingCopies();
+      imageData->resize(size_t(job.width) * job.height * 3);
+      std::memcpy(imageData->data() + size_t(job.width) * bandY * 3, staging->data, size_t(job.width) * bandHeight * bytesPerPixel);
+    }
+  }
+
+  printf("%s: traced %u batches (up to %u samples per pixel) in %.3f s; %u of %u tiles converged\n", job.outputPath.c_str(),
+         total.batchCount, total.samplesTraced, total.seconds, total.convergedTiles, total.tileCount);
+  m_profiler->addCpuTime("trace", total.seconds);
+  if(total.gpuSeconds >= 0.0)
+  {
+    m_profiler->addGpuTime("trace", total.gpuSeconds);
+  }
+
+  JobReport report;
+  report.output          = job.outputPath;
+  report.width           = job.width;
+  report.height          = job.height;
+  report.samples         = total.samplesTraced;
+  report.maxSegments     = m_specialization.maxSegments;
+  report.triangleCount   = m_triangleCount;
+  report.traceSeconds    = total.seconds;
+  report.gpuSeconds      = total.gpuSeconds;
+  report.rayCount        = total.rayCount;
+  report.pathsPerSegment = total.pathsPerSegment;
+  return report;
+}
+
+
+
+
+
+bool GpuRenderer::finish()
+{
+  completeStagingCopies();
+  for(StagingBuffer& staging : m_stagingBuffers)
+  {
+    if(staging.pendingWrite.valid())
+    {
+      m_allWritesSucceeded &= staging.pendingWrite.get();
+    }
+  }
+  m_allWritesSucceeded &= m_imageWriter->finish();
+  return m_allWritesSucceeded;
+}
+
+
+
+
+
+void GpuRenderer::deinit()
+{
+  finish();
+
+  // Save the compiled pipelines (and the autotuned workgroup size) for the next run
+  m_pipelineCache.save();
+
+  // Cleanup
+  m_imageWriter.reset();
+  vkDestroyPipeline(m_context, m_computePipeline, nullptr);
+  vkDestroyPipeline(m_context, m_tileStatsPipeline, nullptr);
+  vkDestroyPipeline(m_context, m_resolvePipeline, nullptr);
+  vkDestroyPipeline(m_context, m_generatePipeline, nullptr);
+  vkDestroyPipeline(m_context, m_extendPipeline, nullptr);
+  vkDestroyPipeline(m_context, m_shadePipeline, nullptr);
+  vkDestroyPipeline(m_context, m_missPipeline, nullptr);
+  vkDestroyPipeline(m_context, m_denoisePipeline, nullptr);
+  m_pipelineCache.deinit();
+  vkDestroyQueryPool(m_context, m_queryPool, nullptr);
+  vkDestroyFence(m_context, m_submitFence, nullptr);
+  m_allocator.unmap(m_rayCounterBuffer);
+  m_allocator.destroy(m_rayCounterBuffer);
+  m_allocator.destroy(m_pathQueueBuffer);
+  vkDestroyShaderModule(m_context, m_rayTraceModule, nullptr);
+  vkDestroyShaderModule(m_context, m_tileStatsModule, nullptr);
+  vkDestroyShaderModule(m_context, m_resolveModule, nullptr);
+  vkDestroyShaderModule(m_context, m_denoiseModule, nullptr);
+  m_descriptorSetContainer.deinit();
+  m_raytracingBuilder.destroy();
+  for(std::unique_ptr<nvvk::RaytracingBuilderKHR>& rebuiltBlas : m_rebuiltBlases)
+  {
+    if(rebuiltBlas)
+    {
+      rebuiltBlas->destroy();
+    }
+  }
+  m_rebuiltBlases.clear();
+  m_tlasBuilder.destroy();
+  m_allocator.destroy(m_vertexBuffer);
+  m_allocator.destroy(m_indexBuffer);
+  m_allocator.destroy(m_meshInfoBuffer);
+  m_allocator.destroy(m_hitRecordBuffer);
+  m_allocator.destroy(m_materialBuffer);
+  m_allocator.destroy(m_materialIdBuffer);
+  m_allocator.destroy(m_lightBuffer);
+  m_allocator.destroy(m_sobolBuffer);
+  m_allocator.destroy(m_blueNoiseBuffer);
+  vkDestroyCommandPool(m_context, m_cmdPool, nullptr);
+  destroyRenderTarget();
+  for(StagingBuffer& staging : m_stagingBuffers)
+  {
+    vkDestroyFence(m_context, staging.copyFence, nullptr);
+    if(staging.data != nullptr)
+    {
+      m_allocator.unmap(staging.buffer);
+      m_allocator.destroy(staging.buffer);
+    }
+  }
+  m_allocator.deinit();
+  m_context.deinit();
+}
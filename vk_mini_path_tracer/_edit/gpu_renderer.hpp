@@ -0,0 +1,264 @@
+#pragma once
+
+// GPU backend: traces rays with ray queries in shaders/raytrace.comp.glsl.
+//
+// GpuRenderer creates the device, uploads the scene, builds the acceleration structures and
+// creates the pipeline once, in init(); after that, each call to render() only records and
+// submits dispatches. This is what makes batch mode (--jobs) cheap: a stream of jobs pays for
+// device creation, BLAS/TLAS builds and pipeline compilation only once.
+//
+// Each mesh of the scene gets its own BLAS, built with ALLOW_COMPACTION and then compacted, and
+// each instance of the scene becomes a TLAS instance whose custom index is its mesh's index in a
+// table of offsets into the shared vertex and index buffers (see MeshInfo in host_device.h).
+//
+// Jobs accumulate samples in a device-local render target. After each batch, tile_stats.comp.glsl
+// reduces the accumulators to one TileStats per convergence tile (workgroup), so the host never
+// reads the accumulators themselves. Once tracing has finished, resolve.comp.glsl packs the image
+// in the output format (RGBE by default: 4 bytes per pixel instead of 12), and the packed image is
+// copied into the next buffer of a ring of host-visible staging buffers. The copy isn't waited for:
+// the next job (or render tile) submits its first batch right away, and only then waits for the
+// copy's fence, so the GPU goes on tracing while an ImageWriter encodes and writes the image on a
+// background thread.
+//
+// Images too large for one render target are traced in render tiles, band by band, and each band
+// of rows is streamed to the output file as soon as its tiles are done (see render()).
+//
+// With --kernel wavefront, each batch is traced by the stages of the wavefront kernel instead of one
+// dispatch of the megakernel: the paths of one sample per pixel go through queues in device memory, and
+// each stage is dispatched indirectly on its queue (see recordWavefrontBatch()).
+//
+// With --sequence, the BLASes and the TLAS are built with ALLOW_UPDATE, and updateScene() refits them in place
+// between frames, or rebuilds them when the SAH growth of proxy trees over the same boxes says so (see refit.hpp).
+// The TLAS has a builder of its own, so that it can be rebuilt without the BLASes. nvvk's builder can't rebuild
+// one BLAS of several either, so a BLAS that needs a rebuild gets a builder of its own too, and only it is rebuilt.
+//
+// With --denoise, the trace also sums the first-hit AOVs of each pixel, and the passes of denoise.comp.glsl
+// filter each render tile before it is resolved (see denoiser.hpp). So that the filter sees the same neighbors as
+// over the whole image, a tiled image traces each tile with an apron of getDenoiseApron() pixels around it, as far
+// as the passes reach, and resolves only the tile; so there are no seams, at the cost of tracing the aprons twice.
+
+#include <nvvk/context_vk.hpp>
+#include <nvvk/descriptorsets_vk.hpp>     // For nvvk::DescriptorSetContainer
+#include <nvvk/raytraceKHR_vk.hpp>        // For nvvk::RaytracingBuilderKHR
+#include <nvvk/resourceallocator_vk.hpp>  // For NVVK memory allocators
+
+#include "image_writer.hpp"
+#include "options.hpp"
+#include "pipeline_cache.hpp"
+#include "profiler.hpp"
+#include "refit.hpp"
+#include "render_jobs.hpp"
+#include "scene.hpp"
+#include "sequence.hpp"
+#include "shaders/host_device.h"
+
+#include <array>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+class GpuRenderer
+{
+public:
+  // Creates the device and all of the resources that don't depend on the job. The scene's meshes
+  // are copied to the GPU, so the scene doesn't need to stay alive afterwards.
+  // Each phase is timed into `profiler`, which must outlive the renderer.
+  // Returns false (and prints an error) if the options don't fit the device; then, don't call deinit().
+  bool init(const RenderOptions& options, const Scene& scene, const std::vector<std::string>& searchPaths, Profiler& profiler);
+
+  // Brings the GPU's copy of the scene up to date after `changes` (see sequence.hpp): uploads deformed vertices
+  // and the light table, and refits or rebuilds the acceleration structures, into `update`. Returns false (and
+  // prints an error) if the acceleration structures can't be updated: without --sequence, or when deforming meshes
+  // with --compact-geometry.
+  bool updateScene(const Scene& scene, const SceneChanges& changes, AccelerationUpdate& update);
+
+  // Recreates the pipeline with another maximum number of ray segments.
+  void setMaxSegments(uint32_t maxSegments);
+
+  // Switches to another sampler (one of SAMPLER_*) and seed; only a new sampler needs a new pipeline.
+  void setSampler(uint32_t sampler, uint32_t seed);
+
+  // Renders `job`, then starts writing its image to job.outputPath in the background
+  // (unless writeImage is false). Returns the job's timings for the profiler.
+  // If imageData isn't null, the image is also copied into it, as RGB floats: the output format must be
+  // OUTPUT_FORMAT_FLOAT.
+  JobReport render(const RenderJob& job, bool writeImage = true, std::vector<float>* imageData = nullptr);
+
+  // Waits until all images have been written. Returns false if any of them could not be written.
+  bool finish();
+
+  void deinit();
+
+private:
+  // Everything a job renders into. The buffers grow when a job needs more pixels.
+  struct RenderTarget
+  {
+    nvvk::Buffer          accumulatorBuffer;  // Device-local PixelAccumulator per pixel
+    nvvk::Buffer          outputBuffer;       // Device-local packed output image
+    nvvk::Buffer          tileMaskBuffer;     // Host-visible and mapped: the CPU writes the tile mask
+    nvvk::Buffer          tileStatsBuffer;    // and reads the tile statistics
+    nvvk::Buffer          pathBuffer;         // Wavefront kernel only: device-local WavefrontPath slots of each queue,
+    nvvk::Buffer          pixelRngBuffer;     // the RNG state of each pixel,
+    nvvk::Buffer          pathCountBuffer;    // and, host-visible and mapped, the paths alive at each segment
+    nvvk::Buffer          aovBuffer;          // --denoise only: device-local PixelAovs per pixel,
+    nvvk::Buffer          denoiserBuffer;     // and the two images of DenoiserPixels the denoiser passes ping-pong between
+    uint32_t*             tileActive      = nullptr;
+    shaderio::TileStats*  tileStats       = nullptr;
+    shaderio::RayCounter* pathCounts      = nullptr;
+    VkDeviceSize          pixelCapacity   = 0;
+    VkDeviceSize          tileCapacity    = 0;
+    VkDeviceSize          segmentCapacity = 0;
+  };
+
+  // A host-visible buffer the packed image is copied into, which stays untouched until the image
+  // writer is done with it.
+  struct StagingBuffer
+  {
+    nvvk::Buffer                       buffer;
+    void*                              data        = nullptr;
+    VkDeviceSize                       sizeBytes   = 0;
+    VkFence                            copyFence   = VK_NULL_HANDLE;  // Signaled once the GPU has copied the band in
+    bool                               copyPending = false;           // The copy was submitted, but not waited for
+    std::vector<VkCommandBuffer>       copyCmdBuffers;  // The resolve submissions of the band, freed once it's in
+    std::function<std::future<bool>()> startWrite;      // Queues the band for the image writer, once it's in; may be empty
+    std::future<bool>                  pendingWrite;    // Writes the last image copied into this buffer
+  };
+
+  // A rectangle of the image that is traced on its own (see render())
+  struct RenderTile
+  {
+    uint32_t x, y;
+    uint32_t width, height;
+  };
+
+  struct TraceStats
+  {
+    uint32_t              batchCount;
+    uint32_t              samplesTraced;
+    uint32_t              convergedTiles;
+    uint32_t              tileCount;
+    double                seconds;          // CPU wall-clock time
+    double                gpuSeconds;       // Sum of the GPU times of the submissions, or -1
+    uint64_t              rayCount;         // 0 unless rays are counted
+    std::vector<uint64_t> pathsPerSegment;  // Wavefront kernel: paths alive at the start of each segment
+  };
+
+  // Returns the device address of the BLAS of a mesh: the one in m_rebuiltBlases, if it was rebuilt.
+  VkDeviceAddress getBlasDeviceAddress(uint32_t meshIndex);
+  // Makes the TLAS instances of the scene's instances, pointing at the BLASes of their meshes.
+  std::vector<VkAccelerationStructureInstanceKHR> makeTlasInstances(const Scene& scene);
+  // Returns the world-space box of each instance of the scene, from m_meshBounds, for m_tlasTracker.
+  std::vector<Aabb> getInstanceBounds(const Scene& scene) const;
+  // Returns the box of each triangle of a mesh, for its BLAS's tracker; also sets its m_meshBounds.
+  std::vector<Aabb> getTriangleBounds(const Scene& scene, uint32_t meshIndex);
+
+  // Timestamp queries: the GPU time between query firstQuery and the next one. Queries 0 and 1 time submissions
+  // that are waited for right away, and queries 2 and 3 the last resolveTile(), which isn't.
+  void   cmdWriteTimestamp(VkCommandBuffer cmdBuffer, uint32_t query, VkPipelineStageFlagBits stage);
+  void   submitTimestamp(uint32_t query);
+  double getTimestampSeconds(uint32_t firstQuery = 0);  // Returns -1 if the queue doesn't support timestamps
+  // Adds the GPU time of the last resolveTile() to the profile, if it hasn't been yet; waits until it has finished.
+  void collectResolveTime();
+
+  // Creates the trace (or wavefront stage), tile statistics and resolve pipelines from m_specialization,
+  // through the pipeline cache.
+  void createPipeline();
+  // Times the default view with several workgroup sizes, and records the fastest in the pipeline cache.
+  void autotuneWorkgroup();
+  // Chooses the size of the render tiles of a job: the --render-tile size, else the whole image if it fits in one buffer.
+  // The wavefront kernel also needs its queues of paths to fit, and its indirect dispatches to have few enough workgroups.
+  void chooseRenderTile(const RenderJob& job, uint32_t& width, uint32_t& height) const;
+  // Returns how far the passes of the denoiser reach from a pixel, in pixels, or 0 without --denoise.
+  uint32_t getDenoiseApron() const;
+  // Returns the part of the image trace() traces for `renderTile`: the tile and its denoiser apron, within the image.
+  RenderTile getTracedTile(const RenderJob& job, const RenderTile& renderTile) const;
+  // Traces one render tile of `job` into the render target, and waits until the GPU has finished.
+  TraceStats trace(const RenderJob& job, const RenderTile& renderTile, double timeBudgetSeconds);
+  // segmentCount is the number of path counts of the wavefront kernel, and 0 with the megakernel.
+  void prepareRenderTarget(VkDeviceSize pixelCount, VkDeviceSize tileCount, VkDeviceSize segmentCount);
+  void destroyRenderTarget();
+  // Records one batch of samples into `cmdBuffer`, followed by a barrier for the CPU and the next batch.
+  void recordBatch(VkCommandBuffer cmdBuffer, const shaderio::PushConstants& pushConstants, uint32_t tileCountX, uint32_t tileCountY);
+  // Records the stages of the wavefront kernel for each sample of one batch (without the final barrier).
+  void recordWavefrontBatch(VkCommandBuffer cmdBuffer, shaderio::PushConstants pushConstants, uint32_t tileCountX, uint32_t tileCountY);
+  // Records the tile statistics of the last batch, followed by a barrier for the CPU.
+  void recordTileStats(VkCommandBuffer cmdBuffer, const shaderio::PushConstants& pushConstants, uint32_t tileCountX, uint32_t tileCountY);
+  // Returns the next staging buffer, with room for sizeBytes, once the image writer is done with it.
+  StagingBuffer& acquireStagingBuffer(VkDeviceSize sizeBytes);
+  // Waits until the copies into the staging buffers have finished, and queues their bands for the image writer.
+  // Anything that destroys or rewrites what the resolve submissions use must call this first.
+  void completeStagingCopies();
+  // Runs the passes of denoise.comp.glsl over the tile that was just traced, so that resolveTile() packs the
+  // denoised image.
+  void denoiseTile(const RenderJob& job, const RenderTile& tracedTile);
+  // Packs `tracedTile`, which was just traced, and copies the rows of `renderTile`, which it contains, into
+  // `staging`, which holds whole rows of the image, starting at the render tile's first row. Only submits the
+  // copy; it goes to staging.copyCmdBuffers.
+  void resolveTile(const RenderJob& job, const RenderTile& renderTile, const RenderTile& tracedTile, StagingBuffer& staging);
+
+  RenderOptions                     m_options;
+  Profiler*                         m_profiler = nullptr;
+  nvvk::Context                     m_context;
+  nvvk::ResourceAllocatorDedicated  m_allocator;
+  VkCommandPool                     m_cmdPool = VK_NULL_HANDLE;
+  nvvk::Buffer                      m_vertexBuffer;
+  nvvk::Buffer                      m_indexBuffer;
+  nvvk::Buffer                      m_meshInfoBuffer;
+  nvvk::Buffer                      m_hitRecordBuffer;  // Only in the compact layout, which frees the vertex and index buffers
+  nvvk::Buffer                      m_materialBuffer;
+  nvvk::Buffer                      m_materialIdBuffer;  // Only in the standard layout; hit records have their material IDs
+  nvvk::Buffer                      m_lightBuffer;       // EmissiveTriangles (see light_table.hpp)
+  nvvk::Buffer                      m_sobolBuffer;       // Tables of the low-discrepancy samplers (see samplers.hpp)
+  nvvk::Buffer                      m_blueNoiseBuffer;
+  uint32_t                          m_lightCount        = 0;
+  float                             m_inverseLightPower = 0.0f;
+  nvvk::RaytracingBuilderKHR        m_raytracingBuilder;  // The BLAS of each mesh
+  nvvk::RaytracingBuilderKHR        m_tlasBuilder;
+  nvvk::DescriptorSetContainer      m_descriptorSetContainer;
+  VkShaderModule                    m_rayTraceModule  = VK_NULL_HANDLE;
+  VkShaderModule                    m_tileStatsModule = VK_NULL_HANDLE;
+  VkShaderModule                    m_resolveModule   = VK_NULL_HANDLE;
+  VkShaderModule                    m_denoiseModule   = VK_NULL_HANDLE;
+  PipelineCache                     m_pipelineCache;
+  shaderio::SpecializationConstants m_specialization{};
+  VkPipeline                        m_computePipeline   = VK_NULL_HANDLE;
+  VkPipeline                        m_tileStatsPipeline = VK_NULL_HANDLE;
+  VkPipeline                        m_resolvePipeline   = VK_NULL_HANDLE;
+  VkPipeline                        m_generatePipeline  = VK_NULL_HANDLE;  // The stages of the wavefront kernel, which
+  VkPipeline                        m_extendPipeline    = VK_NULL_HANDLE;  // replace m_computePipeline with --kernel wavefront
+  VkPipeline                        m_shadePipeline     = VK_NULL_HANDLE;
+  VkPipeline                        m_missPipeline      = VK_NULL_HANDLE;
+  VkPipeline                        m_denoisePipeline   = VK_NULL_HANDLE;  // Only with --denoise
+  nvvk::Buffer                      m_pathQueueBuffer;  // PATH_QUEUE_COUNT PathQueues, also read as indirect dispatch arguments
+  RenderTarget                      m_renderTarget;
+  std::array<StagingBuffer, 3>      m_stagingBuffers;  // Used in turn; three, so that a slow write doesn't stall the next two bands
+  uint32_t                          m_nextStagingBuffer = 0;
+  std::unique_ptr<ImageWriter>      m_imageWriter;
+  nvvk::Buffer                      m_rayCounterBuffer;
+  shaderio::RayCounter*             m_rayCounter = nullptr;
+  VkQueryPool                       m_queryPool  = VK_NULL_HANDLE;
+  bool                              m_resolveTimePending = false;  // Queries 2 and 3 have a resolve time to collect
+  VkFence                           m_submitFence        = VK_NULL_HANDLE;  // For the submissions the host waits for
+  double                            m_timestampPeriodSeconds = 0.0;  // 0 if the queue doesn't support timestamps
+  VkDeviceSize                      m_maxStorageBufferRange  = 0;
+  uint64_t                          m_triangleCount = 0;
+  bool                              m_allWritesSucceeded = true;
+
+  // Acceleration structure updates (--sequence)
+  VkBuildAccelerationStructureFlagsKHR               m_blasFlags = 0;
+  VkBuildAccelerationStructureFlagsKHR               m_tlasFlags = 0;
+  RefitSettings                                      m_refitSettings;
+  std::vector<shaderio::MeshInfo>                    m_meshInfos;        // Where each mesh starts in the vertex buffer
+  std::vector<Transform>                             m_dequantize;       // By mesh, with --quantize-positions (see CompactMesh)
+  std::vector<nvvk::RaytracingBuilderKHR::BlasInput> m_blasInputs;       // Kept in the standard layout only, where meshes can deform
+  std::vector<Aabb>                                  m_meshBounds;       // Object-space box of each mesh
+  std::vector<RefitTracker>                          m_blasTrackers;
+  std::vector<uint32_t>                              m_blasRefitCounts;  // Refits of each BLAS since it was built
+  // By mesh: null until the mesh's BLAS is rebuilt, then the builder of the new BLAS, which replaces the one in
+  // m_raytracingBuilder. The replaced BLAS is only freed with the others, by deinit().
+  std::vector<std::unique_ptr<nvvk::RaytracingBuilderKHR>> m_rebuiltBlases;
+  RefitTracker                                       m_tlasTracker;
+  uint32_t                                           m_tlasRefitCount = 0;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+// 64-bit FNV-1a hashing, used to identify file and buffer contents (for instance, to check
+// that a cached scene was built from the OBJ file that is on disk now).
+
+#include "work_stealing.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr uint64_t kFnv1aOffsetBasis = 14695981039346656037ull;
+constexpr uint64_t kFnv1aPrime       = 1099511628211ull;
+
+inline uint64_t HashFnv1a(const void* data, size_t size, uint64_t hash = kFnv1aOffsetBasis)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for(size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ bytes[i]) * kFnv1aPrime;
+  }
+  return hash;
+}
+
+// Hashes large buffers in parallel: each 1 MiB chunk is hashed on its own, and the result is the
+// hash of the chunk hashes. This is not the same value as HashFnv1a(data, size), but it is just
+// as stable, and scales with the number of cores.
+inline uint64_t HashFnv1aChunked(const void* data, size_t size, const WorkStealingScheduler& scheduler)
+{
+  constexpr size_t      kChunkSize = size_t(1) << 20;
+  const uint8_t*        bytes      = static_cast<const uint8_t*>(data);
+  const size_t          chunkCount = (size + kChunkSize - 1) / kChunkSize;
+  std::vector<uint64_t> chunkHashes(chunkCount);
+  scheduler.run(uint32_t(chunkCount), [&](uint32_t chunk, uint32_t /*worker*/) {
+    const size_t begin = size_t(chunk) * kChunkSize;
+    const size_t end   = (begin + kChunkSize < size) ? begin + kChunkSize : size;
+    chunkHashes[chunk] = HashFnv1a(bytes + begin, end - begin);
+  });
+  const uint64_t size64   = size;
+  const uint64_t sizeHash = HashFnv1a(&size64, sizeof(size64));
+  return HashFnv1a(chunkHashes.data(), chunkHashes.size() * sizeof(uint64_t), sizeHash);
+}
@@ -0,0 +1,322 @@
+#include "image_writer.hpp"
+
+#include "shaders/host_device.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+// Same as GLSL's unpackHalf2x16, for one half
+float halfToFloat(uint16_t half)
+{
+  const uint32_t sign     = (half >> 15) & 1;
+  const uint32_t exponent = (half >> 10) & 0x1F;
+  const uint32_t mantissa = half & 0x3FF;
+  float          value;
+  if(exponent == 0)
+    value = std::ldexp(float(mantissa), -24);  // Zero or subnormal
+  else if(exponent == 31)
+    value = (mantissa == 0) ? INFINITY : NAN;
+  else
+    value = std::ldexp(float(mantissa | 0x400), int(exponent) - 25);
+  return sign ? -value : value;
+}
+
+// Shared-exponent RGBE, as stb_image_write's stbiw__linear_to_rgbe and packRgbe() in resolve.comp.glsl compute it
+void linearToRgbe(const float* rgb, uint8_t* rgbe)
+{
+  const float maxComponent = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+  if(maxComponent < 1e-32f)
+  {
+    rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+    return;
+  }
+  int         exponent;
+  const float normalize = std::frexp(maxComponent, &exponent) * 256.0f / maxComponent;
+  rgbe[0]               = uint8_t(rgb[0] * normalize);
+  rgbe[1]               = uint8_t(rgb[1] * normalize);
+  rgbe[2]               = uint8_t(rgb[2] * normalize);
+  rgbe[3]               = uint8_t(exponent + 128);
+}
+
+// Appends one channel of a scanline, with the run-length encoding of Radiance files: a byte
+// above 128 is a run of (byte - 128) copies of the next byte, and any other byte n is followed
+// by n literal bytes.
+void encodeRun(const uint8_t* bytes, size_t count, std::vector<uint8_t>& out)
+{
+  // Runs shorter than this are cheaper to store as literals
+  constexpr size_t kMinRun = 4;
+  auto runLength = [&](size_t start) {
+    size_t length = 1;
+    while(start + length < count && length < 127 && bytes[start + length] == bytes[start])
+      length++;
+    return length;
+  };
+
+  size_t x = 0;
+  while(x < count)
+  {
+    const size_t run = runLength(x);
+    if(run >= kMinRun)
+    {
+      out.push_back(uint8_t(128 + run));
+      out.push_back(bytes[x]);
+      x += run;
+      continue;
+    }
+    // Literals, up to the next run or 128 bytes
+    size_t end = x + 1;
+    while(end < count && end - x < 128 && runLength(end) < kMinRun)
+      end++;
+    out.push_back(uint8_t(end - x));
+    out.insert(out.end(), bytes + x, bytes + end);
+    x = end;
+  }
+}
+
+bool isRawPath(const std::string& path)
+{
+  return path.size() >= 4 && path.compare(path.size() - 4, 4, ".raw") == 0;
+}
+}  // namespace
+
+uint32_t GetBytesPerPixel(uint32_t outputFormat)
+{
+  switch(outputFormat)
+  {
+    case OUTPUT_FORMAT_RGBE:
+      return 4;
+    case OUTPUT_FORMAT_HALF:
+      return 6;
+    case OUTPUT_FORMAT_ACCUMULATORS:
+      return sizeof(shaderio::PixelAccumulator);
+    default:
+      return 12;
+  }
+}
+
+ImageWriter::ImageWriter(Profiler& profiler)
+    : m_profiler(profiler)
+    , m_thread(&ImageWriter::threadMain, this)
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+  finish();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_queueChanged.notify_all();
+  m_thread.join();
+}
+
+std::future<bool> ImageWriter::write(const std::string&      path,
+                                     uint32_t                width,
+                                     uint32_t                height,
+                                     uint32_t                outputFormat,
+                                     uint32_t                firstRow,
+                                     uint32_t                rowCount,
+                                     const void*             pixels,
+                                     const AccumulationInfo& accumulationInfo)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_queue.push_back({path, width, height, outputFormat, firstRow, rowCount, pixels, accumulationInfo, std::promise<bool>()});
+  std::future<bool> written = m_queue.back().written.get_future();
+  m_queueChanged.notify_all();
+  return written;
+}
+
+bool ImageWriter::finish()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_queueChanged.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+  // The thread is idle, so the streams can be closed from here.
+  for(auto& [path, file] : m_streams)
+  {
+    if(fclose(file) != 0)
+    {
+      fprintf(stderr, "Could not write %s\n", path.c_str());
+      m_allSucceeded = false;
+    }
+  }
+  m_streams.clear();
+  const bool allSucceeded = m_allSucceeded;
+  m_allSucceeded          = true;
+  return allSucceeded;
+}
+
+void ImageWriter::threadMain()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while(true)
+  {
+    m_queueChanged.wait(lock, [this]() { return !m_queue.empty() || m_stopping; });
+    if(m_queue.empty())
+    {
+      return;  // Stopping
+    }
+    Request request = std::move(m_queue.front());
+    m_queue.pop_front();
+    m_busy = true;
+
+    lock.unlock();
+    const bool ok = writeBand(request);
+    request.written.set_value(ok);
+    lock.lock();
+
+    m_allSucceeded &= ok;
+    m_busy = false;
+    m_queueChanged.notify_all();
+  }
+}
+
+bool ImageWriter::writeBand(const Request& request)
+{
+  Profiler::Scope scope(m_profiler, "write image");
+  const uint32_t  bytesPerPixel = GetBytesPerPixel(request.outputFormat);
+
+  if(isRawPath(request.path))
+  {
+    // The first frame written to a path creates (or truncates) it; later ones are appended.
+    FILE*& file = m_streams[request.path];
+    if(file == nullptr)
+    {
+      file = fopen(request.path.c_str(), "wb");
+      if(file == nullptr)
+      {
+        m_streams.erase(request.path);
+        fprintf(stderr, "Could not write %s\n", request.path.c_str());
+        return false;
+      }
+    }
+    bool ok = true;
+    if(request.firstRow == 0)
+    {
+      RawFrameHeader header;
+      header.width         = request.width;
+      header.height        = request.height;
+      header.outputFormat  = request.outputFormat;
+      header.bytesPerPixel = bytesPerPixel;
+      ok                   = (fwrite(&header, sizeof(header), 1, file) == 1);
+    }
+    // Flush after each band, so that a process reading the stream gets the rows right away.
+    const size_t bandBytes = size_t(request.width) * request.rowCount * bytesPerPixel;
+    ok = ok && (fwrite(request.pixels, 1, bandBytes, file) == bandBytes) && (fflush(file) == 0);
+    if(!ok)
+    {
+      fprintf(stderr, "Could not write %s\n", request.path.c_str());
+    }
+    return ok;
+  }
+
+  if(request.firstRow == 0)
+  {
+    m_imageFailed = !beginImage(request);
+  }
+  if(m_imageFailed)
+  {
+    return false;  // Already reported
+  }
+  bool ok;
+  if(request.outputFormat == OUTPUT_FORMAT_ACCUMULATORS)
+  {
+    // The rows of an accumulation file are the accumulators themselves
+    const size_t bandBytes = size_t(request.width) * request.rowCount * bytesPerPixel;
+    ok                     = (fwrite(request.pixels, 1, bandBytes, m_imageFile) == bandBytes);
+  }
+  else
+  {
+    ok = writeHdrRows(request);
+  }
+  if(request.firstRow + request.rowCount == request.height)
+  {
+    ok &= (fclose(m_imageFile) == 0);
+    m_imageFile = nullptr;
+  }
+  if(!ok)
+  {
+    fprintf(stderr, "Could not write %s\n", request.path.c_str());
+    m_imageFailed = true;
+  }
+  return ok;
+}
+
+bool ImageWriter::beginImage(const Request& request)
+{
+  if(m_imageFile != nullptr)
+  {
+    fclose(m_imageFile);  // The last image was never finished
+  }
+  m_imageFile = fopen(request.path.c_str(), "wb");
+  if(m_imageFile == nullptr)
+  {
+    fprintf(stderr, "Could not write %s\n", request.path.c_str());
+    return false;
+  }
+  if(request.outputFormat == OUTPUT_FORMAT_ACCUMULATORS)
+  {
+    const AccumulationFileHeader header = MakeAccumulationFileHeader(request.width, request.height, request.accumulationInfo);
+    if(fwrite(&header, sizeof(header), 1, m_imageFile) != 1)
+    {
+      fprintf(stderr, "Could not write %s\n", request.path.c_str());
+      return false;
+    }
+    return true;
+  }
+  fprintf(m_imageFile, "#?RADIANCE\n# Written by vk_mini_path_tracer\nFORMAT=32-bit_rle_rgbe\n\n-Y %u +X %u\n", request.height,
+          request.width);
+  return true;
+}
+
+bool ImageWriter::writeHdrRows(const Request& request)
+{
+  // Scanlines of 8 to 32767 pixels are run-length encoded one channel after the other, after a
+  // 4-byte marker; other widths can only be stored flat.
+  const uint32_t       width         = request.width;
+  const uint32_t       bytesPerPixel = GetBytesPerPixel(request.outputFormat);
+  const bool           encode        = (width >= 8 && width < 32768);
+  std::vector<uint8_t> rgbeRow(size_t(width) * 4);
+  std::vector<uint8_t> channel(width);
+  std::vector<uint8_t> scanline;
+  for(uint32_t y = 0; y < request.rowCount; y++)
+  {
+    const uint8_t* row  = static_cast<const uint8_t*>(request.pixels) + size_t(width) * y * bytesPerPixel;
+    const uint8_t* rgbe = row;
+    if(request.outputFormat != OUTPUT_FORMAT_RGBE)
+    {
+      for(uint32_t x = 0; x < width; x++)
+      {
+        float rgb[3];
+        for(uint32_t c = 0; c < 3; c++)
+        {
+          if(request.outputFormat == OUTPUT_FORMAT_HALF)
+            rgb[c] = halfToFloat(reinterpret_cast<const uint16_t*>(row)[3 * x + c]);
+          else
+            rgb[c] = reinterpret_cast<const float*>(row)[3 * x + c];
+        }
+        linearToRgbe(rgb, &rgbeRow[4 * x]);
+      }
+      rgbe = rgbeRow.data();
+    }
+
+    if(!encode)
+    {
+      if(fwrite(rgbe, 4, width, m_imageFile) != width)
+        return false;
+      continue;
+    }
+    scanline = {2, 2, uint8_t(width >> 8), uint8_t(width & 0xFF)};
+    for(uint32_t c = 0; c < 4; c++)
+    {
+      for(uint32_t x = 0; x < width; x++)
+        channel[x] = rgbe[4 * x + c];
+      encodeRun(channel.data(), width, scanline);
+    }
+    if(fwrite(scanline.data(), 1, scanline.size(), m_imageFile) != scanline.size())
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// Writing output images.
+//
+// Images arrive packed in one of the OUTPUT_FORMAT_* pixel formats of host_device.h (the GPU
+// backend packs them in resolve.comp.glsl before reading them back; the CPU backend renders
+// floats), as bands of whole rows, top to bottom. Each band is written as soon as it arrives, so
+// an image never needs to be in memory all at once. The file format depends on the output path's
+// extension:
+//
+// - .raw: a raw stream. Each image is a RawFrameHeader followed by its pixels, exactly as they
+//   were read back, row by row. Jobs that write to the same .raw path append their frames to one
+//   stream, which can also be a named pipe read by another process.
+// - anything else: a Radiance .hdr file, with run-length encoded RGBE scanlines. Half and float
+//   pixels are converted to RGBE the same way stb_image_write does. Images of PixelAccumulators
+//   (OUTPUT_FORMAT_ACCUMULATORS) are written as accumulation files instead (see accumulation_file.hpp).
+//
+// An ImageWriter encodes and writes bands on a background thread, so that the renderer can trace
+// the next band or image in the meantime.
+
+#include "accumulation_file.hpp"
+#include "profiler.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Header of each frame of a .raw stream
+struct RawFrameHeader
+{
+  char     magic[4]      = {'V', 'K', 'P', 'T'};
+  uint32_t width         = 0;
+  uint32_t height        = 0;
+  uint32_t outputFormat  = 0;  // OUTPUT_FORMAT_*
+  uint32_t bytesPerPixel = 0;  // Size of each pixel; rows are not padded
+};
+
+// Size of a pixel in an OUTPUT_FORMAT_* format.
+uint32_t GetBytesPerPixel(uint32_t outputFormat);
+
+class ImageWriter
+{
+public:
+  // Starts the writer thread. Encoding and writing are timed into `profiler` as "write image".
+  explicit ImageWriter(Profiler& profiler);
+  // Waits for the queued bands, and stops the writer thread.
+  ~ImageWriter();
+
+  // Queues rowCount rows of a width x height image in `outputFormat`, starting at row firstRow, to
+  // be written to `path`. The bands of an image must be queued in order, from row 0 to the last row,
+  // and one image after the other. `pixels` must stay valid and unchanged until the returned future
+  // is ready; its value is false if the band could not be written. The header of an accumulation file
+  // gets `accumulationInfo`.
+  std::future<bool> write(const std::string&      path,
+                          uint32_t                width,
+                          uint32_t                height,
+                          uint32_t                outputFormat,
+                          uint32_t                firstRow,
+                          uint32_t                rowCount,
+                          const void*             pixels,
+                          const AccumulationInfo& accumulationInfo = {});
+
+  // Waits until all queued bands have been written, and closes the .raw streams.
+  // Returns false if anything could not be written since the last call.
+  bool finish();
+
+private:
+  struct Request
+  {
+    std::string        path;
+    uint32_t           width;
+    uint32_t           height;
+    uint32_t           outputFormat;
+    uint32_t           firstRow;
+    uint32_t           rowCount;
+    const void*        pixels;
+    AccumulationInfo   accumulationInfo;
+    std::promise<bool> written;
+  };
+
+  void threadMain();
+  bool writeBand(const Request& request);
+  bool beginImage(const Request& request);
+  bool writeHdrRows(const Request& request);
+
+  Profiler&                    m_profiler;
+  std::mutex                   m_mutex;
+  std::condition_variable      m_queueChanged;  // Signals new requests to the thread, and an empty queue to finish()
+  std::deque<Request>          m_queue;
+  bool                         m_busy         = false;  // The thread is writing a band that is no longer in the queue
+  bool                         m_stopping     = false;
+  bool                         m_allSucceeded = true;
+  // Only used by the writer thread while it is busy:
+  std::map<std::string, FILE*> m_streams;               // Open .raw streams
+  FILE*                        m_imageFile   = nullptr;  // The .hdr or accumulation file being written, until its last row
+  bool                         m_imageFailed = false;    // Whether the current image could not be opened or written
+  std::thread                  m_thread;  // Last, so that it starts after everything it uses
+};
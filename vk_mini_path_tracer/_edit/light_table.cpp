@@ -0,0 +1,69 @@
+#include "light_table.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void BuildLightTable(const Scene& scene, LightTable& table)
+{
+  table = LightTable();
+  const std::vector<SceneMaterial>& materials = scene.getMaterials();
+  if(std::none_of(materials.begin(), materials.end(), [](const SceneMaterial& material) { return Luminance(material.emission) > 0.0f; }))
+  {
+    return;
+  }
+
+  // Collect the emissive triangles of all instances, and their power
+  std::vector<double> powers;
+  double              totalPower = 0.0;
+  auto                toShader   = [](const Vec3& v) { return shaderio::vec3{v.x, v.y, v.z}; };
+  for(const SceneInstance& instance : scene.getInstances())
+  {
+    const SceneMesh& mesh = scene.getMeshes()[instance.meshIndex];
+    for(uint32_t triangle = 0; triangle < mesh.indexCount / 3; triangle++)
+    {
+      const SceneMaterial& material  = materials[instance.materialOffset + mesh.materialIds[triangle]];
+      const float          luminance = Luminance(material.emission);
+      if(luminance <= 0.0f)
+        continue;
+
+      Vec3 v[3];
+      for(int corner = 0; corner < 3; corner++)
+      {
+        const uint32_t index = mesh.indices[3 * triangle + corner];
+        v[corner] = instance.transform.transformPoint(Vec3(mesh.vertices[3 * index + 0], mesh.vertices[3 * index + 1], mesh.vertices[3 * index + 2]));
+      }
+      const Vec3   normal = cross(v[1] - v[0], v[2] - v[0]);
+      const double power  = 0.5 * std::sqrt(double(dot(normal, normal))) * luminance;
+      if(power <= 0.0)
+        continue;  // Degenerate triangles are never hit, and can't be sampled
+
+      table.triangles.push_back({toShader(v[0]), 1.0f, toShader(v[1]), uint32_t(table.triangles.size()), toShader(v[2]),
+                                 toShader(material.emission)});
+      powers.push_back(power);
+      totalPower += power;
+    }
+  }
+  table.totalPower = float(totalPower);
+
+  // Build the alias table with Vose's method: scale the powers so that they average 1, then repeatedly fill up an
+  // entry below 1 with the excess of an entry above 1. Entries left over (up to rounding) keep probability 1.
+  const size_t          count = table.triangles.size();
+  std::vector<double>   scaled(count);
+  std::vector<uint32_t> small, large;
+  for(size_t i = 0; i < count; i++)
+  {
+    scaled[i] = powers[i] * double(count) / totalPower;
+    (scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+  }
+  while(!small.empty() && !large.empty())
+  {
+    const uint32_t less = small.back();
+    const uint32_t more = large.back();
+    small.pop_back();
+    large.pop_back();
+    table.triangles[less].probability = float(scaled[less]);
+    table.triangles[less].alias       = more;
+    scaled[more] -= 1.0 - scaled[less];
+    (scaled[more] < 1.0 ? small : large).push_back(more);
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// Emissive triangles, for next-event estimation.
+//
+// BuildLightTable() collects the triangles of all instances whose material emits light, in world
+// space, and builds an alias table over them that picks each one in proportion to its power: its
+// area times the luminance of its emission. Picking a light then takes one lookup and one
+// comparison however many lights there are, and the area pdf of a point on any light is
+// luminance(emission) / totalPower, so a path that hits a light can compute the pdf with which
+// light sampling would have found that point without knowing which triangle it hit.
+// Both backends sample the same table.
+
+#include "scene.hpp"
+#include "shaders/host_device.h"
+
+#include <vector>
+
+struct LightTable
+{
+  std::vector<shaderio::EmissiveTriangle> triangles;
+  float                                   totalPower = 0.0f;  // Sum of area * luminance over the triangles
+};
+
+// Luminance of a linear Rec. 709 color; mirrors luminance() in raytrace.comp.glsl.
+inline float Luminance(const Vec3& color)
+{
+  return dot(color, Vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Builds the table of the scene's emissive triangles; it is empty if nothing in the scene emits light.
+void BuildLightTable(const Scene& scene, LightTable& table);
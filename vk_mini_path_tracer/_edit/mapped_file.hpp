@@ -0,0 +1,34 @@
+#pragma once
+
+// Read-only memory mapping of a whole file. The operating system pages the file in on demand,
+// so mapping a large file is almost free, and its contents can be handed directly to
+// allocator.createBuffer() without first copying them into a std::vector.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile&)            = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Returns false if the file does not exist, is empty, or cannot be mapped.
+  bool open(const std::string& path);
+  void close();
+
+  bool           isOpen() const { return m_data != nullptr; }
+  const uint8_t* data() const { return m_data; }
+  size_t         size() const { return m_size; }
+
+private:
+  const uint8_t* m_data = nullptr;
+  size_t         m_size = 0;
+#ifdef _WIN32
+  void* m_fileHandle    = nullptr;
+  void* m_mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,359 @@
+#include "obj_parser.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+// Target size of the text chunks that are parsed in parallel.
+constexpr size_t kChunkSize = size_t(4) << 20;
+
+// What one chunk contributes to the mesh. Face indices can only be resolved once the number of
+// vertices in all earlier chunks is known, so faces are stored unresolved.
+struct ChunkResult
+{
+  std::vector<float>   vertices;
+  std::vector<int64_t> corners;  // OBJ vertex indices as written: 1-based, or negative (relative)
+  struct Face
+  {
+    uint32_t firstCorner;
+    uint32_t cornerCount;
+    uint64_t verticesBefore;  // Vertices defined earlier in this chunk, for relative indices
+  };
+  std::vector<Face> faces;
+  uint64_t          triangleCount = 0;
+  struct ShapeStart
+  {
+    std::string name;
+    uint64_t    firstTriangle;  // Triangles of this chunk before the statement
+  };
+  std::vector<ShapeStart>  shapeStarts;
+  std::vector<ShapeStart>  materialStarts;  // `usemtl` statements, with the material's name
+  std::vector<std::string> materialLibraries;
+  std::string              error;
+};
+
+inline bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpaces(const char* p, const char* end)
+{
+  while(p < end && isSpace(*p))
+    p++;
+  return p;
+}
+
+// Whether the line at `p` starts with `keyword`, followed by a space or the end of the line.
+inline bool isKeyword(const char* p, const char* end, const char* keyword)
+{
+  const size_t length = strlen(keyword);
+  return size_t(end - p) >= length && std::equal(keyword, keyword + length, p) && (size_t(end - p) == length || isSpace(p[length]));
+}
+
+// The rest of the line, without leading and trailing spaces.
+inline std::string trimmedName(const char* p, const char* end)
+{
+  p = skipSpaces(p, end);
+  while(end > p && isSpace(end[-1]))
+    end--;
+  return std::string(p, end);
+}
+
+inline const char* parseFloat(const char* p, const char* end, float& value)
+{
+  p = skipSpaces(p, end);
+  if(p < end && *p == '+')
+    p++;
+  const std::from_chars_result result = std::from_chars(p, end, value);
+  return (result.ec == std::errc()) ? result.ptr : nullptr;
+}
+
+void parseChunk(const char* begin, const char* end, ChunkResult& result)
+{
+  const char* line = begin;
+  while(line < end && result.error.empty())
+  {
+    const char* lineEnd = std::find(line, end, '\n');
+    const char* p       = skipSpaces(line, lineEnd);
+
+    if(lineEnd - p >= 2 && p[0] == 'v' && isSpace(p[1]))
+    {
+      // v x y z [w]
+      p++;
+      for(int axis = 0; axis < 3; axis++)
+      {
+        float value = 0.0f;
+        p           = p ? parseFloat(p, lineEnd, value) : nullptr;
+        result.vertices.push_back(value);
+      }
+      if(!p)
+        result.error = "invalid vertex: " + std::string(line, lineEnd);
+    }
+    else if(lineEnd - p >= 2 && p[0] == 'f' && isSpace(p[1]))
+    {
+      // f v1[/vt1][/vn1] v2[/vt2][/vn2] v3[/vt3][/vn3] ...
+      p++;
+      ChunkResult::Face face{uint32_t(result.corners.size()), 0, result.vertices.size() / 3};
+      while(true)
+      {
+        p = skipSpaces(p, lineEnd);
+        if(p >= lineEnd)
+          break;
+        int64_t                      index  = 0;
+        const std::from_chars_result parsed = std::from_chars(p, lineEnd, index);
+        if(parsed.ec != std::errc() || index == 0)
+        {
+          result.error = "invalid face: " + std::string(line, lineEnd);
+          break;
+        }
+        result.corners.push_back(index);
+        face.cornerCount++;
+        // Skip the texture coordinate and normal indices
+        p = parsed.ptr;
+        while(p < lineEnd && !isSpace(*p))
+          p++;
+      }
+      if(face.cornerCount < 3 && result.error.empty())
+        result.error = "face with fewer than 3 vertices: " + std::string(line, lineEnd);
+      result.faces.push_back(face);
+      result.triangleCount += face.cornerCount - 2;
+    }
+    else if(lineEnd - p >= 1 && (p[0] == 'o' || p[0] == 'g') && (lineEnd - p == 1 || isSpace(p[1])))
+    {
+      // o name, g name
+      result.shapeStarts.push_back({trimmedName(p + 1, lineEnd), result.triangleCount});
+    }
+    else if(isKeyword(p, lineEnd, "usemtl"))
+    {
+      result.materialStarts.push_back({trimmedName(p + 6, lineEnd), result.triangleCount});
+    }
+    else if(isKeyword(p, lineEnd, "mtllib"))
+    {
+      // mtllib file1 [file2 ...]
+      std::istringstream files(std::string(p + 6, lineEnd));
+      std::string        file;
+      while(files >> file)
+      {
+        result.materialLibraries.push_back(file);
+      }
+    }
+
+    line = lineEnd + 1;
+  }
+}
+}  // namespace
+
+bool ParseObjParallel(const char* text, size_t size, const WorkStealingScheduler& scheduler, ObjMesh& mesh)
+{
+  // Split the text into chunks that start at the beginning of a line.
+  std::vector<const char*> chunkStarts{text};
+  for(size_t target = kChunkSize; target < size; target += kChunkSize)
+  {
+    const char* start = std::find(std::max(text + target, chunkStarts.back()), text + size, '\n');
+    if(start == text + size)
+      break;
+    chunkStarts.push_back(start + 1);
+  }
+  chunkStarts.push_back(text + size);
+  const uint32_t chunkCount = uint32_t(chunkStarts.size() - 1);
+
+  // Pass 1: parse all chunks.
+  std::vector<ChunkResult> chunks(chunkCount);
+  scheduler.run(chunkCount, [&](uint32_t chunk, uint32_t /*worker*/) {
+    parseChunk(chunkStarts[chunk], chunkStarts[chunk + 1], chunks[chunk]);
+  });
+
+  // Compute where each chunk's vertices and triangles go in the final arrays.
+  std::vector<uint64_t> vertexBase(chunkCount + 1, 0), triangleBase(chunkCount + 1, 0);
+  for(uint32_t chunk = 0; chunk < chunkCount; chunk++)
+  {
+    if(!chunks[chunk].error.empty())
+    {
+      fprintf(stderr, "OBJ parse error: %s\n", chunks[chunk].error.c_str());
+      return false;
+    }
+    vertexBase[chunk + 1]   = vertexBase[chunk] + chunks[chunk].vertices.size() / 3;
+    triangleBase[chunk + 1] = triangleBase[chunk] + chunks[chunk].triangleCount;
+  }
+  const uint64_t vertexCount = vertexBase[chunkCount];
+  if(vertexCount > UINT32_MAX)
+  {
+    fprintf(stderr, "OBJ parse error: too many vertices for 32-bit indices\n");
+    return false;
+  }
+
+  if(triangleBase[chunkCount] * 3 > UINT32_MAX)
+  {
+    fprintf(stderr, "OBJ parse error: too many triangles for 32-bit index offsets\n");
+    return false;
+  }
+
+  mesh.vertices.resize(vertexCount * 3);
+  mesh.indices.resize(triangleBase[chunkCount] * 3);
+
+  // Each shape runs from its statement to the next one.
+  mesh.shapes.clear();
+  auto addShape = [&](const std::string& name, uint64_t firstTriangle) {
+    if(!mesh.shapes.empty())
+    {
+      ObjShape& previous  = mesh.shapes.back();
+      previous.indexCount = uint32_t(firstTriangle * 3) - previous.firstIndex;
+      if(previous.indexCount == 0)
+        mesh.shapes.pop_back();
+    }
+    mesh.shapes.push_back({name, uint32_t(firstTriangle * 3), 0});
+  };
+  addShape("", 0);
+  for(uint32_t chunk = 0; chunk < chunkCount; chunk++)
+  {
+    for(const ChunkResult::ShapeStart& start : chunks[chunk].shapeStarts)
+    {
+      addShape(start.name, triangleBase[chunk] + start.firstTriangle);
+    }
+  }
+  addShape("", triangleBase[chunkCount]);  // Closes the last shape
+  mesh.shapes.pop_back();
+
+  // Each `usemtl` applies to the triangles up to the next one. Material names get IDs in order of first use.
+  mesh.materialIds.resize(triangleBase[chunkCount]);
+  mesh.materialNames.clear();
+  mesh.materialLibraries.clear();
+  std::unordered_map<std::string, uint32_t> materialByName;
+  std::string                               material;
+  uint64_t                                  materialFirstTriangle = 0;
+  auto                                      applyMaterial         = [&](uint64_t endTriangle) {
+    if(endTriangle == materialFirstTriangle)
+      return;
+    const auto found = materialByName.emplace(material, uint32_t(mesh.materialNames.size()));
+    if(found.second)
+      mesh.materialNames.push_back(material);
+    std::fill(mesh.materialIds.begin() + materialFirstTriangle, mesh.materialIds.begin() + endTriangle, found.first->second);
+  };
+  for(uint32_t chunk = 0; chunk < chunkCount; chunk++)
+  {
+    for(const ChunkResult::ShapeStart& start : chunks[chunk].materialStarts)
+    {
+      applyMaterial(triangleBase[chunk] + start.firstTriangle);
+      material              = start.name;
+      materialFirstTriangle = triangleBase[chunk] + start.firstTriangle;
+    }
+    mesh.materialLibraries.insert(mesh.materialLibraries.end(), chunks[chunk].materialLibraries.begin(),
+                                  chunks[chunk].materialLibraries.end());
+  }
+  applyMaterial(triangleBase[chunkCount]);
+
+  // Pass 2: copy vertices, then resolve and triangulate faces.
+  std::vector<std::string> errors(chunkCount);
+  scheduler.run(chunkCount, [&](uint32_t chunk, uint32_t /*worker*/) {
+    const ChunkResult& result = chunks[chunk];
+    std::copy(result.vertices.begin(), result.vertices.end(), mesh.vertices.begin() + vertexBase[chunk] * 3);
+  });
+  scheduler.run(chunkCount, [&](uint32_t chunk, uint32_t /*worker*/) {
+    const ChunkResult& result = chunks[chunk];
+    uint32_t*          out    = mesh.indices.data() + triangleBase[chunk] * 3;
+    std::vector<uint32_t> polygon;
+    for(const ChunkResult::Face& face : result.faces)
+    {
+      polygon.clear();
+      for(uint32_t c = 0; c < face.cornerCount; c++)
+      {
+        const int64_t raw   = result.corners[face.firstCorner + c];
+        const int64_t index = (raw > 0) ? raw - 1 : int64_t(vertexBase[chunk] + face.verticesBefore) + raw;
+        if(index < 0 || uint64_t(index) >= vertexCount)
+        {
+          errors[chunk] = "face index out of range: " + std::to_string(raw);
+          return;
+        }
+        polygon.push_back(uint32_t(index));
+      }
+
+      auto emitTriangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+        *out++ = a;
+        *out++ = b;
+        *out++ = c;
+      };
+      if(polygon.size() == 4)
+      {
+        // Split quads along the shorter diagonal
+        auto distanceSquared = [&](uint32_t a, uint32_t b) {
+          float sum = 0.0f;
+          for(int axis = 0; axis < 3; axis++)
+          {
+            const float d = mesh.vertices[3 * a + axis] - mesh.vertices[3 * b + axis];
+            sum += d * d;
+          }
+          return sum;
+        };
+        if(distanceSquared(polygon[0], polygon[2]) < distanceSquared(polygon[1], polygon[3]))
+        {
+          emitTriangle(polygon[0], polygon[1], polygon[2]);
+          emitTriangle(polygon[0], polygon[2], polygon[3]);
+        }
+        else
+        {
+          emitTriangle(polygon[0], polygon[1], polygon[3]);
+          emitTriangle(polygon[1], polygon[2], polygon[3]);
+        }
+      }
+      else
+      {
+        for(size_t c = 1; c + 1 < polygon.size(); c++)
+        {
+          emitTriangle(polygon[0], polygon[c], polygon[c + 1]);
+        }
+      }
+    }
+  });
+
+  for(const std::string& error : errors)
+  {
+    if(!error.empty())
+    {
+      fprintf(stderr, "OBJ parse error: %s\n", error.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParseMtl(const std::string& path, std::vector<ObjMaterial>& materials)
+{
+  std::ifstream file(path);
+  if(!file)
+  {
+    fprintf(stderr, "Could not open material library %s\n", path.c_str());
+    return false;
+  }
+
+  std::string line;
+  while(std::getline(file, line))
+  {
+    const char* end = line.data() + line.size();
+    const char* p   = skipSpaces(line.data(), end);
+    if(isKeyword(p, end, "newmtl"))
+    {
+      materials.push_back({trimmedName(p + 6, end)});
+    }
+    else if(!materials.empty() && (isKeyword(p, end, "Kd") || isKeyword(p, end, "Ke")))
+    {
+      float* color = (p[1] == 'd') ? materials.back().diffuse : materials.back().emission;
+      p += 2;
+      for(int channel = 0; channel < 3 && p; channel++)
+      {
+        p = parseFloat(p, end, color[channel]);
+      }
+      if(!p)
+      {
+        fprintf(stderr, "%s: invalid color: %s\n", path.c_str(), line.c_str());
+        return false;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// A parallel OBJ parser for the parts of the format the path tracer uses: vertex positions (`v`),
+// faces (`f`), objects and groups (`o`, `g`), which split the faces into shapes like
+// tinyobjloader does, and materials (`mtllib`, `usemtl`). Everything else (normals, texture
+// coordinates, smoothing groups) is skipped. ParseMtl() reads the material libraries.
+//
+// The file is split into chunks at line boundaries, and the chunks are parsed on all cores.
+// Faces with more than three vertices are triangulated like tinyobjloader does: quads are split
+// along their shorter diagonal, and other polygons are split into a fan.
+
+#include "work_stealing.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A run of consecutive triangles that came from the same `o` or `g` statement. Faces before the
+// first statement form an unnamed shape; shapes without faces are dropped.
+struct ObjShape
+{
+  std::string name;
+  uint32_t    firstIndex = 0;
+  uint32_t    indexCount = 0;
+};
+
+struct ObjMesh
+{
+  std::vector<float>       vertices;           // xyz per vertex
+  std::vector<uint32_t>    indices;            // 3 per triangle
+  std::vector<ObjShape>    shapes;             // Cover all of `indices`, in file order
+  std::vector<uint32_t>    materialIds;        // 1 per triangle: an index into materialNames
+  std::vector<std::string> materialNames;      // In order of first use; "" for faces before the first `usemtl`
+  std::vector<std::string> materialLibraries;  // Files named by `mtllib`, relative to the OBJ file
+};
+
+// The parts of an MTL material the path tracer shades with: a Lambertian surface that can emit light.
+struct ObjMaterial
+{
+  std::string name;
+  float       diffuse[3]  = {0.7f, 0.7f, 0.7f};  // Kd; the default is the gray of scenes without materials
+  float       emission[3] = {0.0f, 0.0f, 0.0f};  // Ke, in radiance
+};
+
+// Parses OBJ text. Returns false (and prints the first error) if the text could not be parsed.
+bool ParseObjParallel(const char* text, size_t size, const WorkStealingScheduler& scheduler, ObjMesh& mesh);
+
+// Reads the materials (`newmtl`, `Kd`, `Ke`) of an MTL file and appends them to `materials`.
+// Returns false (and prints an error) if the file could not be read.
+bool ParseMtl(const std::string& path, std::vector<ObjMaterial>& materials);
@@ -0,0 +1,221 @@
+#include "options.hpp"
+#include "denoiser.hpp"  // For kMaxDenoiseIterations
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+void printUsage(const char* exeName)
+{
+  printf(
+      "Usage: %s [options]\n"
+      "  --backend gpu|cpu     Trace rays with the GPU (default) or with the CPU backend\n"
+      "  --threads N           Threads for the CPU backend and scene loading (default: all)\n"
+      "  --scene file          OBJ file or scene description to render (default: scenes/CornellBox-Original-Merged.obj)\n"
+      "  --jobs file|-         Render each job (line) of a file, or of stdin with -, keeping the scene loaded\n"
+      "  --sequence file|-     Render the frames of an animation, refitting the acceleration structures between frames\n"
+      "  --refit-threshold X   Rebuild an acceleration structure once refits have grown its SAH cost X times (default: 1.5)\n"
+      "  --rebuild-interval N  Also rebuild acceleration structures after N refits (default: 0, only on SAH growth)\n"
+      "  --samples N           Maximum number of samples per pixel, without --jobs (default: 64)\n"
+      "  --batch N             Samples per pixel in each dispatch (default: 8)\n"
+      "  --min-samples N       Samples every pixel traces before its tile can converge (default: 16)\n"
+      "  --target-noise X      Stop sampling a tile once its relative standard error is below X (default: 0, off)\n"
+      "  --time-budget S       Stop dispatching batches after S seconds (default: 0, no limit)\n"
+      "  --max-segments N      Maximum number of ray segments per sample, from 1 to 1024 (default: 32)\n"
+      "  --workgroup WxH       Workgroup size of the GPU backend (default: autotuned, or 16x8)\n"
+      "  --autotune            Time several workgroup sizes and remember the fastest for this GPU\n"
+      "  --no-light-sampling   Only find lights by bouncing into them, without next-event estimation\n"
+      "  --russian-roulette N  Let Russian roulette end paths after N segments (default: 3; 0 = never)\n"
+      "  --sampler S           Random numbers of paths: pcg (default), sobol (Owen-scrambled) or blue-noise\n"
+      "  --seed N              Seed of the samplers; runs with different seeds are independent (default: 0)\n"
+      "  --first-sample N      Index of the first sample of each pixel, a multiple of --batch, to split a render (default: 0)\n"
+      "  --denoise             Filter the image with an edge-aware a-trous denoiser guided by albedo, normal and depth\n"
+      "  --denoise-passes N    Number of a-trous passes of --denoise, from 1 to 8 (default: 5)\n"
+      "  --kernel K            GPU kernel: megakernel (default), or wavefront (separate stages with path queues)\n"
+      "  --compact-geometry    Shade hits from compact per-triangle records instead of vertices and indices\n"
+      "  --quantize-positions  Also build BLASes from 16-bit positions (implies --compact-geometry)\n"
+      "  --render-tile WxH     Trace large images in tiles of WxH pixels (default: whole image, or 1024x256 if too large)\n"
+      "  --output-format F     Pixels read back from the GPU: rgbe (default, 4 bytes), half (6) or float (12),\n"
+      "                        or accum: sums of samples, to merge with the samples of other runs\n"
+      "  --profile report.json Print the time of each phase, and write it as a JSON report\n"
+      "  --count-rays          Count traced rays in the shader, to report Mrays/s (slightly slower)\n"
+      "  --benchmark out.json  Sweep resolution, samples and segments over synthetic scenes of growing size\n"
+      "  --sampler-study out.json  Report the RMSE of each sampler against a reference, from 1 to --samples samples\n",
+      exeName);
+}
+
+// Parses "WxH". Throws std::invalid_argument if there is no 'x'.
+void parseSize(const std::string& size, uint32_t& width, uint32_t& height)
+{
+  const size_t separator = size.find('x');
+  if(separator == std::string::npos)
+    throw std::invalid_argument(size);
+  width  = uint32_t(std::stoul(size.substr(0, separator)));
+  height = uint32_t(std::stoul(size.substr(separator + 1)));
+}
+}  // namespace
+
+bool ParseCommandLine(int argc, const char** argv, RenderOptions& options)
+{
+  for(int i = 1; i < argc; i++)
+  {
+    const std::string arg     = argv[i];
+    const bool        hasNext = (i + 1 < argc);
+    try
+    {
+      if(arg == "--backend" && hasNext)
+      {
+        const std::string backend = argv[++i];
+        if(backend != "cpu" && backend != "gpu")
+          throw std::invalid_argument(backend);
+        options.useCpuBackend = (backend == "cpu");
+      }
+      else if(arg == "--threads" && hasNext)
+        options.threadCount = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--scene" && hasNext)
+        options.scenePath = argv[++i];
+      else if(arg == "--jobs" && hasNext)
+        options.jobsPath = argv[++i];
+      else if(arg == "--sequence" && hasNext)
+      {
+        options.jobsPath = argv[++i];
+        options.sequence = true;
+      }
+      else if(arg == "--refit-threshold" && hasNext)
+        options.refitThreshold = std::stof(argv[++i]);
+      else if(arg == "--rebuild-interval" && hasNext)
+        options.rebuildInterval = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--samples" && hasNext)
+        options.maxSamples = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--batch" && hasNext)
+        options.samplesPerBatch = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--min-samples" && hasNext)
+        options.minSamples = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--target-noise" && hasNext)
+        options.targetNoise = std::stof(argv[++i]);
+      else if(arg == "--time-budget" && hasNext)
+        options.timeBudgetSeconds = std::stod(argv[++i]);
+      else if(arg == "--max-segments" && hasNext)
+        options.maxSegments = uint32_t(std::min(std::stoul(argv[++i]), 0xFFFFFFFFul));  // Negative numbers wrap to large ones
+      else if(arg == "--workgroup" && hasNext)
+        parseSize(argv[++i], options.workgroupWidth, options.workgroupHeight);
+      else if(arg == "--render-tile" && hasNext)
+        parseSize(argv[++i], options.renderTileWidth, options.renderTileHeight);
+      else if(arg == "--autotune")
+        options.autotune = true;
+      else if(arg == "--no-light-sampling")
+        options.sampleLights = false;
+      else if(arg == "--russian-roulette" && hasNext)
+        options.russianRouletteStart = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--sampler" && hasNext)
+      {
+        const std::string sampler = argv[++i];
+        if(sampler == "pcg")
+          options.sampler = SAMPLER_PCG;
+        else if(sampler == "sobol")
+          options.sampler = SAMPLER_SOBOL;
+        else if(sampler == "blue-noise")
+          options.sampler = SAMPLER_BLUE_NOISE;
+        else
+          throw std::invalid_argument(sampler);
+      }
+      else if(arg == "--seed" && hasNext)
+        options.seed = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--first-sample" && hasNext)
+        options.firstSample = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--denoise")
+        options.denoise = true;
+      else if(arg == "--denoise-passes" && hasNext)
+        options.denoiseIterations = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--kernel" && hasNext)
+      {
+        const std::string kernel = argv[++i];
+        if(kernel != "megakernel" && kernel != "wavefront")
+          throw std::invalid_argument(kernel);
+        options.wavefront = (kernel == "wavefront");
+      }
+      else if(arg == "--compact-geometry")
+        options.compactGeometry = true;
+      else if(arg == "--quantize-positions")
+        options.quantizePositions = options.compactGeometry = true;
+      else if(arg == "--output-format" && hasNext)
+      {
+        const std::string format = argv[++i];
+        if(format == "rgbe")
+          options.outputFormat = OUTPUT_FORMAT_RGBE;
+        else if(format == "half")
+          options.outputFormat = OUTPUT_FORMAT_HALF;
+        else if(format == "float")
+          options.outputFormat = OUTPUT_FORMAT_FLOAT;
+        else if(format == "accum")
+          options.outputFormat = OUTPUT_FORMAT_ACCUMULATORS;
+        else
+          throw std::invalid_argument(format);
+      }
+      else if(arg == "--profile" && hasNext)
+        options.profilePath = argv[++i];
+      else if(arg == "--count-rays")
+        options.countRays = true;
+      else if(arg == "--benchmark" && hasNext)
+        options.benchmarkPath = argv[++i];
+      else if(arg == "--sampler-study" && hasNext)
+        options.samplerStudyPath = argv[++i];
+      else
+      {
+        if(arg != "--help")
+          fprintf(stderr, "Unknown or incomplete argument: %s\n", arg.c_str());
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    catch(const std::logic_error&)
+    {
+      fprintf(stderr, "Invalid value for %s: %s\n", arg.c_str(), argv[i]);
+      return false;
+    }
+  }
+
+  if(options.maxSamples == 0 || options.samplesPerBatch == 0)
+  {
+    fprintf(stderr, "--samples and --batch must be at least 1\n");
+    return false;
+  }
+  if(options.firstSample % options.samplesPerBatch != 0)
+  {
+    // The GPU seeds each batch by its index, so that a run starting at a batch boundary continues another's samples
+    fprintf(stderr, "--first-sample must be a multiple of --batch\n");
+    return false;
+  }
+  if(options.denoise && options.outputFormat == OUTPUT_FORMAT_ACCUMULATORS)
+  {
+    fprintf(stderr, "--denoise can't write accumulation files: denoise the merged image instead\n");
+    return false;
+  }
+  if(options.maxSegments == 0 || options.maxSegments > kMaxSegmentsLimit)
+  {
+    fprintf(stderr, "--max-segments must be between 1 and %u\n", kMaxSegmentsLimit);
+    return false;
+  }
+  if(options.denoiseIterations == 0 || options.denoiseIterations > kMaxDenoiseIterations)
+  {
+    fprintf(stderr, "--denoise-passes must be between 1 and %u\n", kMaxDenoiseIterations);
+    return false;
+  }
+  if(!(options.refitThreshold >= 1.0f))
+  {
+    fprintf(stderr, "--refit-threshold must be at least 1\n");
+    return false;
+  }
+  if((options.workgroupWidth == 0) != (options.workgroupHeight == 0))
+  {
+    fprintf(stderr, "--workgroup needs both a width and a height\n");
+    return false;
+  }
+  if((options.renderTileWidth == 0) != (options.renderTileHeight == 0))
+  {
+    fprintf(stderr, "--render-tile needs both a width and a height\n");
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// Command-line options of the path tracer. Run with --help for the list.
+
+#include "shaders/host_device.h"
+
+#include <cstdint>
+#include <string>
+
+// The most segments --max-segments allows: the wavefront kernel records the dispatches of each segment of a batch.
+constexpr uint32_t kMaxSegmentsLimit = 1024;
+
+struct RenderOptions
+{
+  // Backend and scene
+  bool        useCpuBackend = false;  // --backend cpu
+  uint32_t    threadCount   = 0;      // --threads; 0 = all hardware threads
+  std::string scenePath;              // --scene; an OBJ file or a scene description (see scene.hpp); empty = the Cornell box
+  std::string jobsPath;               // --jobs; a file of render jobs, or "-" for stdin (see render_jobs.hpp)
+
+  // Animated sequences (see sequence.hpp and refit.hpp): with --sequence, jobsPath is a sequence whose frames move
+  // instances and deform meshes, and the acceleration structures are refitted between frames
+  bool     sequence        = false;  // --sequence file|-
+  float    refitThreshold  = 1.5f;   // --refit-threshold; rebuild once refits have made the SAH cost this many times higher
+  uint32_t rebuildInterval = 0;      // --rebuild-interval; also rebuild after this many refits; 0 = only on SAH growth
+
+  // Progressive rendering: batches of samples are dispatched until every tile has converged
+  // to the target noise, the time budget runs out, or maxSamples have been traced.
+  uint32_t maxSamples        = 64;    // --samples
+  uint32_t samplesPerBatch   = 8;     // --batch
+  uint32_t minSamples        = 16;    // --min-samples
+  float    targetNoise       = 0.0f;  // --target-noise; 0 = always trace maxSamples
+  double   timeBudgetSeconds = 0.0;   // --time-budget; 0 = no limit
+
+  // Shader variant: these become specialization constants of raytrace.comp.glsl
+  uint32_t maxSegments     = 32;     // --max-segments; from 1 to kMaxSegmentsLimit
+  uint32_t workgroupWidth  = 0;      // --workgroup WxH; 0 = the autotuned shape, or 16 x 8
+  uint32_t workgroupHeight = 0;
+  bool     autotune        = false;  // --autotune: time several workgroup shapes and remember the fastest
+  bool     wavefront       = false;  // --kernel wavefront: trace with the stages of the wavefront kernel instead of the megakernel
+
+  // Path tracing, on both backends (see light_table.hpp)
+  bool     sampleLights         = true;  // --no-light-sampling turns off next-event estimation
+  uint32_t russianRouletteStart = 3;     // --russian-roulette; number of segments a path traces before Russian roulette can end it; 0 = never
+
+  // Sampling, on both backends (see samplers.hpp)
+  uint32_t sampler     = SAMPLER_PCG;  // --sampler pcg|sobol|blue-noise
+  uint32_t seed        = 0;            // --seed; runs with different seeds trace independent samples
+  uint32_t firstSample = 0;            // --first-sample; index of the first sample of each pixel, a multiple of --batch. Runs with
+                                       // the same seed and first samples 0, N, 2N, ... trace the samples of one run of k * N samples
+
+  // Denoising, on both backends (see denoiser.hpp)
+  bool     denoise           = false;  // --denoise: filter each image with the AOVs of its first hits
+  uint32_t denoiseIterations = 5;      // --denoise-passes; number of a-trous passes, 1 to kMaxDenoiseIterations
+
+  // Geometry layout of the GPU backend (see compact_geometry.hpp)
+  bool compactGeometry   = false;  // --compact-geometry: shade hits from one HitRecord per triangle
+  bool quantizePositions = false;  // --quantize-positions: 16-bit positions for BLAS builds; implies --compact-geometry
+
+  // Render tiles of the GPU backend: large images are traced one tile at a time, into a buffer the size of a
+  // tile, and written band by band (see GpuRenderer::render)
+  uint32_t renderTileWidth  = 0;  // --render-tile WxH; 0 = the whole image, or 1024 x 256 for images too large for one buffer
+  uint32_t renderTileHeight = 0;
+
+  // Output (see image_writer.hpp)
+  uint32_t outputFormat = OUTPUT_FORMAT_RGBE;  // --output-format; the pixel format the GPU packs the image into for readback, or
+                                               // OUTPUT_FORMAT_ACCUMULATORS for accumulation files (see accumulation_file.hpp)
+
+  // Profiling (see profiler.hpp)
+  std::string profilePath;        // --profile; write a JSON report of the run's phases and jobs here
+  bool        countRays = false;  // --count-rays: count traced rays in the shader, for Mrays/s
+  std::string benchmarkPath;      // --benchmark; run the benchmark sweep (see benchmark.hpp) and write its report here
+  std::string samplerStudyPath;   // --sampler-study; measure the error of each sampler (see sampler_study.hpp) and write the report here
+};
+
+// Parses argv into `options`. Prints the usage and returns false on --help or on an invalid argument.
+bool ParseCommandLine(int argc, const char** argv, RenderOptions& options);
@@ -0,0 +1,133 @@
+#include "pipeline_cache.hpp"
+
+#include <nvvk/error_vk.hpp>  // For NVVK_CHECK
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace {
+// One file per device, so that machines with several GPUs keep one cache for each of them.
+std::string cacheFileName(const uint8_t (&uuid)[VK_UUID_SIZE])
+{
+  std::string name = "pipeline_cache_";
+  for(uint8_t byte : uuid)
+  {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", byte);
+    name += hex;
+  }
+  return name + ".bin";
+}
+
+// Reads the cache file at `path`. Returns false if it doesn't exist or its header doesn't match `expected`.
+bool readCacheFile(const std::string& path, const PipelineCacheHeader& expected, PipelineCacheHeader& header, std::vector<char>& data)
+{
+  std::ifstream file(path, std::ios::binary);
+  if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    return false;
+
+  const bool valid = std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 && header.version == expected.version
+                     && header.headerSize == expected.headerSize && header.vendorID == expected.vendorID
+                     && header.deviceID == expected.deviceID && header.driverVersion == expected.driverVersion
+                     && std::memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0
+                     && header.spirvHash == expected.spirvHash;
+  if(!valid)
+    return false;
+
+  data.resize(size_t(header.dataSize));
+  return bool(file.read(data.data(), std::streamsize(data.size())));
+}
+}  // namespace
+
+void PipelineCache::init(VkDevice device, VkPhysicalDevice physicalDevice, uint64_t spirvHash, const std::string& directory)
+{
+  m_device = device;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  std::memcpy(m_header.magic, kPipelineCacheMagic, sizeof(m_header.magic));
+  m_header.version       = kPipelineCacheVersion;
+  m_header.headerSize    = sizeof(PipelineCacheHeader);
+  m_header.vendorID      = properties.vendorID;
+  m_header.deviceID      = properties.deviceID;
+  m_header.driverVersion = properties.driverVersion;
+  std::memcpy(m_header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+  m_header.spirvHash = spirvHash;
+  m_path             = (std::filesystem::path(directory) / cacheFileName(properties.pipelineCacheUUID)).string();
+
+  PipelineCacheHeader fileHeader{};
+  std::vector<char>   data;
+  if(readCacheFile(m_path, m_header, fileHeader, data))
+  {
+    m_header.workgroupWidth  = fileHeader.workgroupWidth;
+    m_header.workgroupHeight = fileHeader.workgroupHeight;
+  }
+  else
+  {
+    data.clear();
+  }
+
+  // The driver also checks the data's own header, and ignores data it can't use.
+  VkPipelineCacheCreateInfo cacheCreateInfo{.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                                            .initialDataSize = data.size(),
+                                            .pInitialData    = data.empty() ? nullptr : data.data()};
+  NVVK_CHECK(vkCreatePipelineCache(m_device, &cacheCreateInfo, nullptr, &m_cache));
+}
+
+bool PipelineCache::save() const
+{
+  size_t dataSize = 0;
+  NVVK_CHECK(vkGetPipelineCacheData(m_device, m_cache, &dataSize, nullptr));
+  std::vector<char> data(dataSize);
+  NVVK_CHECK(vkGetPipelineCacheData(m_device, m_cache, &dataSize, data.data()));
+
+  PipelineCacheHeader header = m_header;
+  header.dataSize            = dataSize;
+
+  // Write to a temporary file and rename it, like the scene cache, so that a crash while
+  // writing never leaves a truncated cache behind.
+  const std::string tempPath = m_path + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(data.data(), std::streamsize(dataSize));
+    if(!file)
+    {
+      fprintf(stderr, "Could not write %s\n", tempPath.c_str());
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tempPath, m_path, error);
+  if(error)
+  {
+    std::filesystem::remove(tempPath, error);
+    fprintf(stderr, "Could not write %s\n", m_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+void PipelineCache::deinit()
+{
+  vkDestroyPipelineCache(m_device, m_cache, nullptr);
+  m_cache = VK_NULL_HANDLE;
+}
+
+bool PipelineCache::getTunedWorkgroup(uint32_t& width, uint32_t& height) const
+{
+  if(m_header.workgroupWidth == 0 || m_header.workgroupHeight == 0)
+    return false;
+  width  = m_header.workgroupWidth;
+  height = m_header.workgroupHeight;
+  return true;
+}
+
+void PipelineCache::setTunedWorkgroup(uint32_t width, uint32_t height)
+{
+  m_header.workgroupWidth  = width;
+  m_header.workgroupHeight = height;
+}
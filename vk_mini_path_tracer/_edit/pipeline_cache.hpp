@@ -0,0 +1,66 @@
+#pragma once
+
+// On-disk pipeline cache.
+//
+// Creating the compute pipeline makes the driver compile SPIR-V to GPU code, which takes a while
+// for a ray query shader. A VkPipelineCache keeps the compiled code; this class loads it from
+// disk when the renderer starts and saves it when it exits, so repeat launches skip the compile.
+//
+// A pipeline cache is only valid for the device and driver that created it, and is only useful
+// for the shader it was created with, so the file is named after the device's pipeline cache UUID
+// and its header stores the SPIR-V hash; if either changes, the cache starts out empty.
+// The file also records the fastest workgroup shape the autotuner found for this device and shader.
+//
+// File layout:
+//   PipelineCacheHeader
+//   dataSize bytes from vkGetPipelineCacheData()
+
+#include <vulkan/vulkan_core.h>
+
+#include <cstdint>
+#include <string>
+
+constexpr char     kPipelineCacheMagic[8] = {'V', 'K', 'M', 'P', 'T', 'P', 'C', 0};
+constexpr uint32_t kPipelineCacheVersion  = 1;  // Increase this whenever the layout changes
+
+struct PipelineCacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+  uint64_t spirvHash;       // HashFnv1a() of the shader's SPIR-V
+  uint32_t workgroupWidth;  // Fastest workgroup shape found by the autotuner; 0 if not tuned yet
+  uint32_t workgroupHeight;
+  uint64_t dataSize;
+};
+
+class PipelineCache
+{
+public:
+  // Creates the VkPipelineCache, filled with the data from the file for this device in `directory`
+  // if it matches the device and `spirvHash`. If not, the cache starts out empty.
+  void init(VkDevice device, VkPhysicalDevice physicalDevice, uint64_t spirvHash, const std::string& directory = ".");
+
+  // Writes the cache (including any pipelines created since init()) back to disk.
+  // Returns false (and prints an error) if the file could not be written.
+  bool save() const;
+
+  void deinit();
+
+  VkPipelineCache getCache() const { return m_cache; }
+
+  // The autotuned workgroup shape, if any: returns false if the autotuner hasn't run for this
+  // device and shader yet.
+  bool getTunedWorkgroup(uint32_t& width, uint32_t& height) const;
+  void setTunedWorkgroup(uint32_t width, uint32_t height);
+
+private:
+  VkDevice            m_device = VK_NULL_HANDLE;
+  VkPipelineCache     m_cache  = VK_NULL_HANDLE;
+  PipelineCacheHeader m_header{};
+  std::string         m_path;
+};
@@ -0,0 +1,189 @@
+#include "profiler.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+std::string jsonString(const std::string& text)
+{
+  std::string result = "\"";
+  for(char c : text)
+  {
+    if(c == '"' || c == '\\')
+    {
+      result += '\\';
+      result += c;
+    }
+    else if(static_cast<unsigned char>(c) < 0x20)
+    {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      result += escaped;
+    }
+    else
+    {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+// JSON has no NaN or infinity; those are written as null.
+std::string jsonNumber(double value)
+{
+  if(!std::isfinite(value))
+    return "null";
+  char text[32];
+  snprintf(text, sizeof(text), "%.4f", value);
+  return text;
+}
+
+double mraysPerSecond(const JobReport& job)
+{
+  const double seconds = (job.gpuSeconds > 0.0) ? job.gpuSeconds : job.traceSeconds;
+  return (job.rayCount > 0 && seconds > 0.0) ? double(job.rayCount) / seconds * 1e-6 : 0.0;
+}
+}  // namespace
+
+Profiler::Phase& Profiler::getPhase(const std::string& name)
+{
+  for(Phase& phase : m_phases)
+  {
+    if(phase.name == name)
+      return phase;
+  }
+  m_phases.push_back(Phase{name});
+  return m_phases.back();
+}
+
+void Profiler::addCpuTime(const std::string& phase, double seconds)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Phase&                      entry = getPhase(phase);
+  entry.calls++;
+  entry.cpuSeconds += seconds;
+}
+
+void Profiler::addGpuTime(const std::string& phase, double seconds)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Phase&                      entry = getPhase(phase);
+  entry.gpuSeconds                  = (entry.gpuSeconds < 0.0) ? seconds : entry.gpuSeconds + seconds;
+}
+
+void Profiler::addJob(const JobReport& job)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_jobs.push_back(job);
+}
+
+void Profiler::setInfo(const std::string& key, const std::string& value)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for(auto& entry : m_info)
+  {
+    if(entry.first == key)
+    {
+      entry.second = jsonString(value);
+      return;
+    }
+  }
+  m_info.emplace_back(key, jsonString(value));
+}
+
+void Profiler::setInfo(const std::string& key, uint64_t value)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for(auto& entry : m_info)
+  {
+    if(entry.first == key)
+    {
+      entry.second = std::to_string(value);
+      return;
+    }
+  }
+  m_info.emplace_back(key, std::to_string(value));
+}
+
+void Profiler::printSummary() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  printf("%-24s %6s %12s %12s\n", "phase", "calls", "cpu ms", "gpu ms");
+  for(const Phase& phase : m_phases)
+  {
+    if(phase.gpuSeconds >= 0.0)
+      printf("%-24s %6u %12.3f %12.3f\n", phase.name.c_str(), phase.calls, phase.cpuSeconds * 1000.0, phase.gpuSeconds * 1000.0);
+    else
+      printf("%-24s %6u %12.3f %12s\n", phase.name.c_str(), phase.calls, phase.cpuSeconds * 1000.0, "-");
+  }
+  for(const JobReport& job : m_jobs)
+  {
+    if(job.rayCount > 0)
+      printf("%s: %llu rays, %.1f Mrays/s\n", job.output.c_str(), static_cast<unsigned long long>(job.rayCount), mraysPerSecond(job));
+    // Path survival: the share of the camera paths that are still alive at each segment, until none are
+    if(!job.pathsPerSegment.empty() && job.pathsPerSegment[0] > 0)
+    {
+      printf("%s: paths alive per segment:", job.output.c_str());
+      for(size_t segment = 0; segment < job.pathsPerSegment.size() && job.pathsPerSegment[segment] > 0; segment++)
+        printf(" %.1f%%", 100.0 * double(job.pathsPerSegment[segment]) / double(job.pathsPerSegment[0]));
+      printf("\n");
+    }
+    if(job.rmse >= 0.0)
+      printf("%s: RMSE %.6f, relMSE %.6f\n", job.output.c_str(), job.rmse, job.relMse);
+    // Sequences: what keeping the acceleration structures up to date cost, next to what tracing the frame did
+    if(!job.update.kind.empty())
+    {
+      printf("%s: %s %.3f ms", job.output.c_str(), job.update.kind.c_str(), job.update.seconds * 1000.0);
+      if(job.update.gpuSeconds >= 0.0)
+        printf(" (gpu %.3f ms)", job.update.gpuSeconds * 1000.0);
+      printf(", SAH cost x%.3f; trace %.3f ms\n", job.update.sahGrowth, job.traceSeconds * 1000.0);
+    }
+  }
+}
+
+bool Profiler::writeJson(const std::string& path) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::ofstream               file(path, std::ios::trunc);
+
+  file << "{\n  \"info\": {";
+  for(size_t i = 0; i < m_info.size(); i++)
+  {
+    file << (i == 0 ? "" : ", ") << jsonString(m_info[i].first) << ": " << m_info[i].second;
+  }
+  file << "},\n  \"phases\": [";
+  for(size_t i = 0; i < m_phases.size(); i++)
+  {
+    const Phase& phase = m_phases[i];
+    file << (i == 0 ? "\n" : ",\n") << "    {\"name\": " << jsonString(phase.name) << ", \"calls\": " << phase.calls
+         << ", \"cpuMs\": " << jsonNumber(phase.cpuSeconds * 1000.0)
+         << ", \"gpuMs\": " << jsonNumber(phase.gpuSeconds < 0.0 ? -1.0 : phase.gpuSeconds * 1000.0) << "}";
+  }
+  file << "\n  ],\n  \"jobs\": [";
+  for(size_t i = 0; i < m_jobs.size(); i++)
+  {
+    const JobReport& job = m_jobs[i];
+    file << (i == 0 ? "\n" : ",\n") << "    {\"output\": " << jsonString(job.output) << ", \"width\": " << job.width
+         << ", \"height\": " << job.height << ", \"samples\": " << job.samples << ", \"maxSegments\": " << job.maxSegments
+         << ", \"triangles\": " << job.triangleCount << ", \"traceMs\": " << jsonNumber(job.traceSeconds * 1000.0)
+         << ", \"gpuMs\": " << jsonNumber(job.gpuSeconds < 0.0 ? -1.0 : job.gpuSeconds * 1000.0) << ", \"rays\": " << job.rayCount
+         << ", \"mraysPerSecond\": " << jsonNumber(mraysPerSecond(job)) << ", \"pathsPerSegment\": [";
+    for(size_t segment = 0; segment < job.pathsPerSegment.size(); segment++)
+    {
+      file << (segment == 0 ? "" : ", ") << job.pathsPerSegment[segment];
+    }
+    file << "], \"rmse\": " << jsonNumber(job.rmse) << ", \"relMse\": " << jsonNumber(job.relMse)
+         << ", \"updateKind\": " << jsonString(job.update.kind) << ", \"updateMs\": " << jsonNumber(job.update.seconds * 1000.0)
+         << ", \"updateGpuMs\": " << jsonNumber(job.update.gpuSeconds < 0.0 ? -1.0 : job.update.gpuSeconds * 1000.0)
+         << ", \"sahGrowth\": " << jsonNumber(job.update.sahGrowth) << "}";
+  }
+  file << "\n  ]\n}\n";
+
+  if(!file)
+  {
+    fprintf(stderr, "Could not write %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+// Phase profiler.
+//
+// Each phase of a run (loading the scene, uploading buffers, building acceleration structures,
+// creating the pipeline, tracing, writing images...) is timed on the CPU, and phases that run
+// on the GPU also get GPU times from timestamp queries. Each rendered job is recorded with its
+// trace time and, when rays are counted, its ray count, which gives Mrays/s. Jobs traced with the
+// wavefront kernel also record how many paths were still alive at each segment, summed over all samples,
+// which shows how quickly paths escape, and so how much idle work the megakernel has.
+//
+// With --profile report.json, the totals are printed at exit and written as a JSON report:
+//
+//   {
+//     "info":   {"backend": "gpu", "device": "...", "scene": "...", "triangles": 36, ...},
+//     "phases": [{"name": "blas build", "calls": 1, "cpuMs": 1.2, "gpuMs": 0.4}, ...],
+//     "jobs":   [{"output": "out.hdr", "width": 800, ..., "traceMs": 51.0, "gpuMs": 50.2,
+//                 "rays": 123456789, "mraysPerSecond": 2459.3, "pathsPerSegment": [480000, 312004, ...],
+//                 "rmse": -1, "relMse": -1, "updateKind": "refit", "updateMs": 0.8, "updateGpuMs": 0.1,
+//                 "sahGrowth": 1.04}, ...]
+//   }
+//
+// gpuMs is -1 when a phase or job has no GPU time, rays is 0 when rays weren't counted,
+// pathsPerSegment is empty with the megakernel, and rmse and relMse are -1 outside of the sampler study.
+// The frames of a sequence (see sequence.hpp) also record what updating the acceleration structures cost
+// before they were traced; updateKind is "" for jobs that didn't change the scene.
+// All methods may be called from several threads.
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How a frame of a sequence brought the acceleration structures up to date with the scene (see refit.hpp).
+struct AccelerationUpdate
+{
+  std::string kind;               // "refit" or "rebuild"; empty if the scene didn't change
+  double      seconds    = 0.0;   // CPU wall-clock time, including uploads and waiting for the GPU
+  double      gpuSeconds = -1.0;  // GPU time of the uploads and builds, or -1
+  float       sahGrowth  = 1.0f;  // Largest SAH cost after refitting, relative to the last build
+};
+
+struct JobReport
+{
+  std::string           output;
+  uint32_t              width         = 0;
+  uint32_t              height        = 0;
+  uint32_t              samples       = 0;  // Samples per pixel that were traced (at most)
+  uint32_t              maxSegments   = 0;
+  uint64_t              triangleCount = 0;
+  double                traceSeconds  = 0.0;   // CPU wall-clock time of tracing
+  double                gpuSeconds    = -1.0;  // GPU time of the dispatches, or -1
+  uint64_t              rayCount      = 0;     // Number of ray segments traced, or 0 if not counted
+  std::vector<uint64_t> pathsPerSegment;       // Wavefront kernel: paths alive at the start of each segment; empty otherwise
+  double                rmse   = -1.0;         // Sampler study: root mean squared error against the reference image, or -1
+  double                relMse = -1.0;         // and mean squared error relative to the squared reference
+  AccelerationUpdate    update;                // Sequences: the update of the acceleration structures before the job
+};
+
+class Profiler
+{
+public:
+  // Times the scope it lives in, and adds the time to a phase when it is destroyed.
+  class Scope
+  {
+  public:
+    Scope(Profiler& profiler, const char* phase)
+        : m_profiler(profiler)
+        , m_phase(phase)
+        , m_start(std::chrono::steady_clock::now())
+    {
+    }
+    ~Scope() { m_profiler.addCpuTime(m_phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count()); }
+
+  private:
+    Profiler&                             m_profiler;
+    const char*                           m_phase;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+  void addCpuTime(const std::string& phase, double seconds);
+  void addGpuTime(const std::string& phase, double seconds);
+  void addJob(const JobReport& job);
+  // Adds a key/value pair to the "info" object of the report, replacing any previous value.
+  void setInfo(const std::string& key, const std::string& value);
+  void setInfo(const std::string& key, uint64_t value);
+
+  void printSummary() const;
+  // Returns false (and prints an error) if the file could not be written.
+  bool writeJson(const std::string& path) const;
+
+private:
+  struct Phase
+  {
+    std::string name;
+    uint32_t    calls      = 0;
+    double      cpuSeconds = 0.0;
+    double      gpuSeconds = -1.0;
+  };
+
+  Phase& getPhase(const std::string& name);  // Creates the phase if needed; phases keep their first-use order
+
+  mutable std::mutex                               m_mutex;
+  std::vector<Phase>                               m_phases;
+  std::vector<JobReport>                           m_jobs;
+  std::vector<std::pair<std::string, std::string>> m_info;  // Values are already in JSON form
+};
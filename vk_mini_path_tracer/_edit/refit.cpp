@@ -0,0 +1,99 @@
+#include "refit.hpp"
+
+#include <algorithm>
+
+namespace {
+constexpr uint32_t kMaxLeafBoxes  = 4;     // Leaves of the proxy tree hold at most this many boxes
+constexpr float    kTraversalCost = 1.0f;  // Cost of visiting an inner node, relative to testing one box of a leaf
+}  // namespace
+
+float Aabb::area() const
+{
+  if(empty())
+    return 0.0f;
+  const Vec3 d = hi - lo;
+  return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+bool ShouldRebuild(const RefitSettings& settings, float sahGrowth, uint32_t refitCount)
+{
+  return sahGrowth > settings.maxSahGrowth || (settings.rebuildInterval > 0 && refitCount >= settings.rebuildInterval);
+}
+
+void RefitTracker::build(const std::vector<Aabb>& boxes)
+{
+  m_nodes.clear();
+  m_order.resize(boxes.size());
+  for(uint32_t i = 0; i < uint32_t(boxes.size()); i++)
+  {
+    m_order[i] = i;
+  }
+
+  auto centroid = [&](uint32_t box) { return (boxes[box].lo + boxes[box].hi) * 0.5f; };
+  // Splits at the median centroid along the longest axis of the centroids' bounds.
+  auto buildNode = [&](auto&& self, uint32_t first, uint32_t count) -> void {
+    const uint32_t nodeIndex = uint32_t(m_nodes.size());
+    m_nodes.push_back({});
+    Aabb bounds, centroidBounds;
+    for(uint32_t i = first; i < first + count; i++)
+    {
+      bounds.grow(boxes[m_order[i]]);
+      centroidBounds.grow(centroid(m_order[i]));
+    }
+    m_nodes[nodeIndex].bounds = bounds;
+    if(count <= kMaxLeafBoxes)
+    {
+      m_nodes[nodeIndex].offset = first;
+      m_nodes[nodeIndex].count  = count;
+      return;
+    }
+
+    const Vec3 extent = centroidBounds.hi - centroidBounds.lo;
+    const int  axis   = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : ((extent.y >= extent.z) ? 1 : 2);
+    uint32_t*  begin  = m_order.data() + first;
+    std::nth_element(begin, begin + count / 2, begin + count, [&](uint32_t a, uint32_t b) { return centroid(a)[axis] < centroid(b)[axis]; });
+    self(self, first, count / 2);
+    m_nodes[nodeIndex].offset = uint32_t(m_nodes.size());
+    self(self, first + count / 2, count - count / 2);
+  };
+  if(!boxes.empty())
+  {
+    buildNode(buildNode, 0, uint32_t(boxes.size()));
+  }
+  m_builtCost = getCost();
+}
+
+float RefitTracker::refit(const std::vector<Aabb>& boxes)
+{
+  // Children come after their parents, so going backwards refits the children first.
+  for(size_t i = m_nodes.size(); i-- > 0;)
+  {
+    Node& node = m_nodes[i];
+    node.bounds = Aabb();
+    if(node.count > 0)
+    {
+      for(uint32_t j = node.offset; j < node.offset + node.count; j++)
+      {
+        node.bounds.grow(boxes[m_order[j]]);
+      }
+    }
+    else
+    {
+      node.bounds.grow(m_nodes[i + 1].bounds);
+      node.bounds.grow(m_nodes[node.offset].bounds);
+    }
+  }
+  return (m_builtCost > 0.0f) ? getCost() / m_builtCost : 1.0f;
+}
+
+float RefitTracker::getCost() const
+{
+  if(m_nodes.empty())
+    return 0.0f;
+  float cost = 0.0f;
+  for(const Node& node : m_nodes)
+  {
+    cost += node.bounds.area() * ((node.count > 0) ? float(node.count) : kTraversalCost);
+  }
+  return cost / std::max(m_nodes[0].bounds.area(), 1e-30f);
+}
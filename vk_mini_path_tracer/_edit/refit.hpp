@@ -0,0 +1,71 @@
+#pragma once
+
+// When to refit an acceleration structure, and when to rebuild it (--sequence, see sequence.hpp).
+//
+// Between the frames of a sequence, a refit keeps the tree of a BVH and only recomputes its boxes,
+// which is much cheaper than a build; but the tree was chosen for where the primitives were, so as
+// they move, boxes grow and overlap, and rays visit more nodes. The surface area heuristic (SAH)
+// measures that: the expected cost of a ray through the tree, the sum of the surface areas of its
+// nodes weighted by what visiting each one costs, relative to the area of the root. ShouldRebuild()
+// compares the cost after a refit to the cost right after the last build, and asks for a rebuild
+// once it has grown too much, or after a fixed number of refits.
+//
+// The CPU backend measures its own BVH. Drivers don't expose the nodes of Vulkan acceleration
+// structures, so the GPU backend estimates the growth with a RefitTracker instead: a small proxy
+// tree over the same boxes, built and refitted whenever the real structure is, whose cost degrades
+// the same way.
+
+#include "cpu_math.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct Aabb
+{
+  Vec3 lo{std::numeric_limits<float>::max()};
+  Vec3 hi{-std::numeric_limits<float>::max()};
+
+  void  grow(const Vec3& p) { lo = min(lo, p), hi = max(hi, p); }
+  void  grow(const Aabb& b) { lo = min(lo, b.lo), hi = max(hi, b.hi); }
+  bool  empty() const { return lo.x > hi.x; }
+  float area() const;
+};
+
+struct RefitSettings
+{
+  float    maxSahGrowth    = 1.5f;  // --refit-threshold; rebuild once refits have made the SAH cost this many times higher
+  uint32_t rebuildInterval = 0;     // --rebuild-interval; also rebuild after this many refits; 0 = never
+};
+
+// Returns whether a structure whose SAH cost has grown by `sahGrowth` over `refitCount` refits since
+// its last build should be rebuilt rather than refitted.
+bool ShouldRebuild(const RefitSettings& settings, float sahGrowth, uint32_t refitCount);
+
+// A proxy BVH over a set of boxes, to estimate how much refits degrade a structure the GPU built over
+// the same boxes.
+class RefitTracker
+{
+public:
+  // Builds the tree over `boxes` by median splits, and takes its cost as the baseline.
+  void build(const std::vector<Aabb>& boxes);
+  // Recomputes the boxes of the tree for new `boxes` (as many as in build()), and returns its SAH cost
+  // relative to the baseline.
+  float refit(const std::vector<Aabb>& boxes);
+
+private:
+  // For inner nodes, the left child directly follows its parent and `offset` is the index of the right
+  // child; for leaves, `offset` is the first of `count` entries of m_order.
+  struct Node
+  {
+    Aabb     bounds;
+    uint32_t offset = 0;
+    uint32_t count  = 0;  // 0 for inner nodes
+  };
+
+  float getCost() const;
+
+  std::vector<Node>     m_nodes;
+  std::vector<uint32_t> m_order;  // Box indices, leaf by leaf
+  float                 m_builtCost = 0.0f;
+};
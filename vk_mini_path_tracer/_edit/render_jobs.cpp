@@ -0,0 +1,87 @@
+#include "render_jobs.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+bool isFinite(const Vec3& v)
+{
+  return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+}
+}  // namespace
+
+Camera Camera::lookAt(const Vec3& eye, const Vec3& target, float fovVerticalSlope)
+{
+  Camera camera;
+  camera.origin  = eye;
+  camera.forward = normalize(target - eye);
+  // When looking straight up or down, +y can't define the camera's roll; use -z as "up" instead.
+  const Vec3 worldUp      = (std::abs(camera.forward.y) > 0.9999f) ? Vec3(0.0f, 0.0f, -1.0f) : Vec3(0.0f, 1.0f, 0.0f);
+  camera.right            = normalize(cross(camera.forward, worldUp));
+  camera.up               = cross(camera.right, camera.forward);
+  camera.fovVerticalSlope = fovVerticalSlope;
+  return camera;
+}
+
+bool ParseRenderJob(const std::string& line, RenderJob& job, const char*& problem)
+{
+  std::istringstream tokens(line);
+  RenderJob          parsed;
+  Vec3               eye, target;
+  if(!(tokens >> parsed.outputPath >> parsed.width >> parsed.height >> parsed.samples >> eye.x >> eye.y >> eye.z >> target.x
+       >> target.y >> target.z))
+  {
+    problem = "expected an output path, width, height, samples, eye and target";
+    return false;
+  }
+  if(parsed.width == 0 || parsed.height == 0 || parsed.samples == 0)
+  {
+    problem = "width, height and samples must be positive";
+    return false;
+  }
+  float fovVerticalSlope = parsed.camera.fovVerticalSlope;
+  if(!(tokens >> fovVerticalSlope) && !tokens.eof())  // Optional
+  {
+    problem = "expected a number for fovVerticalSlope";
+    return false;
+  }
+  if(!(fovVerticalSlope > 0.0f) || !std::isfinite(fovVerticalSlope))
+  {
+    problem = "fovVerticalSlope must be positive";
+    return false;
+  }
+  // An eye at the target has no view direction, and its camera's vectors would be NaN. (Looking straight up or
+  // down is fine: lookAt() then takes another up vector.)
+  parsed.camera = Camera::lookAt(eye, target, fovVerticalSlope);
+  if(!isFinite(parsed.camera.forward) || !isFinite(parsed.camera.right) || !isFinite(parsed.camera.up))
+  {
+    problem = "the eye and the target must be at different points";
+    return false;
+  }
+
+  job = parsed;
+  return true;
+}
+
+bool ReadRenderJob(std::istream& input, const std::string& name, uint32_t& lineNumber, RenderJob& job)
+{
+  std::string line;
+  while(std::getline(input, line))
+  {
+    lineNumber++;
+    std::istringstream tokens(line);
+    std::string        outputPath;
+    if(!(tokens >> outputPath) || outputPath[0] == '#')
+      continue;  // Blank line or comment
+
+    const char* problem = nullptr;
+    if(!ParseRenderJob(line, job, problem))
+    {
+      fprintf(stderr, "%s:%u: %s, skipping: %s\n", name.c_str(), lineNumber, problem, line.c_str());
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
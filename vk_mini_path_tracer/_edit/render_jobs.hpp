@@ -0,0 +1,52 @@
+#pragma once
+
+// Render jobs: one image to render with a given camera, resolution and sample count.
+//
+// In batch mode (--jobs), the renderer keeps the device, acceleration structures and pipeline
+// resident and renders a stream of jobs read from a file, or from stdin with `--jobs -` (so that
+// another process can feed it jobs through a pipe). Each non-empty line that does not start with
+// '#' is one job:
+//
+//   output.hdr  width height samples  eyeX eyeY eyeZ  targetX targetY targetZ  [fovVerticalSlope]
+//
+// For instance, the default view of the Cornell box is
+//
+//   out.hdr 800 600 64  -0.001 1 6  -0.001 1 0  0.2
+
+#include "cpu_math.hpp"
+
+#include <cstdint>
+#include <istream>
+#include <string>
+
+// A pinhole camera. Primary rays go through
+//   forward + fovVerticalSlope * (screenU * right + screenV * up),
+// where screenV goes from -1 at the bottom of the image to 1 at the top.
+struct Camera
+{
+  Vec3  origin{-0.001f, 1.0f, 6.0f};
+  Vec3  right{1.0f, 0.0f, 0.0f};
+  Vec3  up{0.0f, 1.0f, 0.0f};
+  Vec3  forward{0.0f, 0.0f, -1.0f};
+  float fovVerticalSlope = 1.0f / 5.0f;
+
+  // A camera at `eye` looking at `target`, with +y up.
+  static Camera lookAt(const Vec3& eye, const Vec3& target, float fovVerticalSlope);
+};
+
+struct RenderJob
+{
+  std::string outputPath = "out.hdr";
+  uint32_t    width      = 800;
+  uint32_t    height     = 600;
+  uint32_t    samples    = 64;  // Maximum samples per pixel
+  Camera      camera;
+};
+
+// Parses one job line. Returns false if it is malformed, or if its camera can't be set up (an eye at the
+// target), with a description of the problem in `problem`.
+bool ParseRenderJob(const std::string& line, RenderJob& job, const char*& problem);
+
+// Reads the next job from `input`, skipping blank lines and comments; `lineNumber` counts the lines read so far.
+// Returns false at the end of the input. Invalid lines are reported, with `name` and their line number, and skipped.
+bool ReadRenderJob(std::istream& input, const std::string& name, uint32_t& lineNumber, RenderJob& job);
@@ -0,0 +1,132 @@
+#include "sampler_study.hpp"
+#include "cpu_renderer.hpp"
+#include "gpu_renderer.hpp"
+#include "image_writer.hpp"
+#include "samplers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+constexpr uint32_t kSamplers[]            = {SAMPLER_PCG, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE};
+constexpr uint32_t kReferenceSampleFactor = 16;
+constexpr double   kRelativeMseEpsilon    = 0.01;  // Keeps black pixels from dominating the relative error
+
+// Computes the errors of `image` against `reference`, over the three channels of every pixel.
+void measureError(const std::vector<float>& image, const std::vector<float>& reference, JobReport& report)
+{
+  double squaredError = 0.0;
+  double relativeMse  = 0.0;
+  for(size_t i = 0; i < reference.size(); i++)
+  {
+    const double difference = double(image[i]) - double(reference[i]);
+    squaredError += difference * difference;
+    relativeMse += difference * difference / (double(reference[i]) * double(reference[i]) + kRelativeMseEpsilon);
+  }
+  const double count = double(std::max<size_t>(reference.size(), 1));
+  report.rmse        = std::sqrt(squaredError / count);
+  report.relMse      = relativeMse / count;
+}
+}  // namespace
+
+bool RunSamplerStudy(const RenderOptions&            options,
+                     const Scene&                    scene,
+                     const RenderJob&                job,
+                     const std::vector<std::string>& searchPaths,
+                     Profiler&                       profiler)
+{
+  profiler.setInfo("mode", "sampler study");
+
+  // Every image is traced to the sample count of its run: no adaptive sampling, no time budget.
+  CpuRenderer cpuRenderer;
+  GpuRenderer gpuRenderer;
+  if(options.useCpuBackend)
+  {
+    Profiler::Scope scope(profiler, "bvh build");
+    cpuRenderer.setScene(scene);
+  }
+  else
+  {
+    RenderOptions gpuOptions     = options;
+    gpuOptions.targetNoise       = 0.0f;
+    gpuOptions.timeBudgetSeconds = 0.0;
+    gpuOptions.outputFormat      = OUTPUT_FORMAT_FLOAT;
+    gpuOptions.denoise           = false;  // The study measures the samplers, not the denoiser
+    if(!gpuRenderer.init(gpuOptions, scene, searchPaths, profiler))
+    {
+      return false;
+    }
+  }
+
+  // Renders `samples` samples per pixel of the job with `sampler` into `image`, and reports the run.
+  const auto renderRun = [&](uint32_t sampler, uint32_t seed, uint32_t samples, std::vector<float>& image) {
+    RenderJob runJob = job;
+    runJob.samples   = samples;
+    JobReport report;
+    if(options.useCpuBackend)
+    {
+      CpuRenderSettings cpuSettings;
+      cpuSettings.width                = runJob.width;
+      cpuSettings.height               = runJob.height;
+      cpuSettings.numSamples           = runJob.samples;
+      cpuSettings.samplesPerBatch      = options.samplesPerBatch;
+      cpuSettings.maxSegments          = options.maxSegments;
+      cpuSettings.sampleLights         = options.sampleLights;
+      cpuSettings.russianRouletteStart = options.russianRouletteStart;
+      cpuSettings.sampler              = sampler;
+      cpuSettings.seed                 = seed;
+      cpuSettings.firstSample          = options.firstSample;
+      cpuSettings.threadCount          = options.threadCount;
+      cpuSettings.camera               = runJob.camera;
+      const auto startTime             = std::chrono::steady_clock::now();
+      report.rayCount                  = cpuRenderer.render(cpuSettings, image).rayCount;
+      report.traceSeconds              = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      profiler.addCpuTime("trace", report.traceSeconds);
+    }
+    else
+    {
+      gpuRenderer.setSampler(sampler, seed);
+      report = gpuRenderer.render(runJob, false, &image);
+    }
+    report.width         = runJob.width;
+    report.height        = runJob.height;
+    report.samples       = runJob.samples;
+    report.maxSegments   = options.maxSegments;
+    report.triangleCount = scene.getInstancedTriangleCount();
+    return report;
+  };
+
+  // The reference uses another seed than the runs, so that its noise doesn't correlate with theirs.
+  std::vector<float> reference;
+  JobReport          referenceReport = renderRun(SAMPLER_PCG, options.seed + 1, options.maxSamples * kReferenceSampleFactor, reference);
+  referenceReport.output             = job.outputPath;
+  profiler.addJob(referenceReport);
+  ImageWriter imageWriter(profiler);
+  imageWriter.write(job.outputPath, job.width, job.height, OUTPUT_FORMAT_FLOAT, 0, job.height, reference.data());
+
+  printf("%-12s %8s %12s %12s\n", "sampler", "samples", "RMSE", "relMSE");
+  std::vector<float> image;
+  for(uint32_t sampler : kSamplers)
+  {
+    for(uint32_t samples = 1; samples <= options.maxSamples; samples *= 2)
+    {
+      JobReport report = renderRun(sampler, options.seed, samples, image);
+      measureError(image, reference, report);
+      char name[64];
+      snprintf(name, sizeof(name), "%s_%uspp", GetSamplerName(sampler), samples);
+      report.output = name;
+      printf("%-12s %8u %12.6f %12.6f\n", GetSamplerName(sampler), samples, report.rmse, report.relMse);
+      profiler.addJob(report);
+    }
+  }
+
+  bool succeeded = imageWriter.finish();
+  if(!options.useCpuBackend)
+  {
+    succeeded &= gpuRenderer.finish();
+    gpuRenderer.deinit();
+  }
+  return succeeded;
+}
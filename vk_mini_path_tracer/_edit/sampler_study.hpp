@@ -0,0 +1,27 @@
+#pragma once
+
+// Sampler study (--sampler-study report.json).
+//
+// Measures how fast the image of each sampler (see samplers.hpp) converges. The first render job is
+// rendered once as a reference, with the PCG sampler, another seed and 16 times --samples samples per
+// pixel, and written to the job's output path. Then it is rendered with each sampler at 1, 2, 4, ...
+// up to --samples samples per pixel, and compared with the reference: each run of the report (named
+// like sobol_16spp) has its root mean squared error, and its mean squared error relative to the squared
+// reference, which weighs dark and bright regions alike. The noise of the reference itself adds a
+// floor of about 1/16 of the error of the last runs of the PCG sampler. The other images aren't written.
+
+#include "options.hpp"
+#include "profiler.hpp"
+#include "render_jobs.hpp"
+#include "scene.hpp"
+
+#include <string>
+#include <vector>
+
+// Runs the study of `job` with the backend from `options`, adding every run to `profiler` as a job.
+// Returns false if the reference image could not be written.
+bool RunSamplerStudy(const RenderOptions&            options,
+                     const Scene&                    scene,
+                     const RenderJob&                job,
+                     const std::vector<std::string>& searchPaths,
+                     Profiler&                       profiler);
@@ -0,0 +1,277 @@
+#include "samplers.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// The generator matrices, as Joe and Kuo's primitive polynomials (degree s, coefficients a) and initial
+// direction numbers m. The first dimension is the van der Corput sequence, which has no polynomial.
+struct SobolPolynomial
+{
+  uint32_t degree;
+  uint32_t coefficients;
+  uint32_t initialDirections[1];
+};
+constexpr SobolPolynomial kSobolPolynomials[SOBOL_DIMENSIONS - 1] = {{1, 0, {1}}};
+
+void buildSobolMatrices(std::vector<uint32_t>& matrices)
+{
+  matrices.assign(SOBOL_DIMENSIONS * 32, 0);
+  for(uint32_t bit = 0; bit < 32; bit++)
+  {
+    matrices[bit] = 1u << (31 - bit);
+  }
+  for(uint32_t dimension = 1; dimension < SOBOL_DIMENSIONS; dimension++)
+  {
+    const SobolPolynomial& polynomial = kSobolPolynomials[dimension - 1];
+    uint32_t*              v          = matrices.data() + 32 * dimension;
+    for(uint32_t bit = 0; bit < 32; bit++)
+    {
+      if(bit < polynomial.degree)
+      {
+        v[bit] = polynomial.initialDirections[bit] << (31 - bit);
+        continue;
+      }
+      v[bit] = v[bit - polynomial.degree] ^ (v[bit - polynomial.degree] >> polynomial.degree);
+      for(uint32_t k = 1; k < polynomial.degree; k++)
+      {
+        if((polynomial.coefficients >> (polynomial.degree - 1 - k)) & 1)
+          v[bit] ^= v[bit - k];
+      }
+    }
+  }
+}
+
+// Void and cluster (Ulichney 1993): ranks the texels of a toroidal mask so that the texels of every rank
+// below n form a blue-noise pattern of n points. The energy of a texel is the sum of a Gaussian of its
+// toroidal distance to each point of the pattern; the tightest cluster is the point with the most energy,
+// and the largest void the empty texel with the least.
+void buildBlueNoise(std::vector<uint32_t>& ranks)
+{
+  constexpr uint32_t size  = BLUE_NOISE_SIZE;
+  constexpr uint32_t count = size * size;
+  constexpr float    sigma = 1.5f;
+
+  std::vector<float> kernel(count);  // Energy that a point adds at each toroidal offset
+  for(uint32_t y = 0; y < size; y++)
+  {
+    for(uint32_t x = 0; x < size; x++)
+    {
+      const float dx       = float(std::min(x, size - x));
+      const float dy       = float(std::min(y, size - y));
+      kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+    }
+  }
+
+  std::vector<uint8_t> pattern(count, 0);
+  std::vector<float>   energy(count, 0.0f);
+  auto                 setPoint = [&](uint32_t texel, bool value) {
+    pattern[texel]      = value ? 1 : 0;
+    const float    sign = value ? 1.0f : -1.0f;
+    const uint32_t px   = texel % size;
+    const uint32_t py   = texel / size;
+    for(uint32_t y = 0; y < size; y++)
+    {
+      const float* row = kernel.data() + ((y - py) % size) * size;
+      for(uint32_t x = 0; x < size; x++)
+      {
+        energy[y * size + x] += sign * row[(x - px) % size];
+      }
+    }
+  };
+  auto tightestCluster = [&]() {
+    uint32_t best = ~0u;
+    for(uint32_t texel = 0; texel < count; texel++)
+    {
+      if(pattern[texel] && (best == ~0u || energy[texel] > energy[best]))
+        best = texel;
+    }
+    return best;
+  };
+  auto largestVoid = [&]() {
+    uint32_t best = ~0u;
+    for(uint32_t texel = 0; texel < count; texel++)
+    {
+      if(!pattern[texel] && (best == ~0u || energy[texel] < energy[best]))
+        best = texel;
+    }
+    return best;
+  };
+
+  // An initial pattern of a tenth of the texels, from a fixed hash sequence so that the mask is the same
+  // every run; then points move from the tightest cluster to the largest void until they stop moving.
+  const uint32_t initialCount = count / 10;
+  for(uint32_t points = 0, i = 0; points < initialCount; i++)
+  {
+    const uint32_t texel = HashUint(i) % count;
+    if(!pattern[texel])
+    {
+      setPoint(texel, true);
+      points++;
+    }
+  }
+  for(uint32_t iteration = 0; iteration < count; iteration++)
+  {
+    const uint32_t cluster = tightestCluster();
+    setPoint(cluster, false);
+    const uint32_t emptiest = largestVoid();
+    setPoint(emptiest, true);
+    if(emptiest == cluster)
+      break;
+  }
+
+  // The points of the initial pattern get the ranks below initialCount, tightest cluster last; then the
+  // voids are filled, largest first. Past half of the texels, the largest void of the points is also the
+  // tightest cluster of the empty texels, since the energies of both add up to the same total everywhere.
+  ranks.assign(count, 0);
+  const std::vector<uint8_t> initialPattern = pattern;
+  const std::vector<float>   initialEnergy  = energy;
+  for(uint32_t rank = initialCount; rank-- > 0;)
+  {
+    const uint32_t cluster = tightestCluster();
+    setPoint(cluster, false);
+    ranks[cluster] = rank;
+  }
+  pattern = initialPattern;
+  energy  = initialEnergy;
+  for(uint32_t rank = initialCount; rank < count; rank++)
+  {
+    const uint32_t emptiest = largestVoid();
+    setPoint(emptiest, true);
+    ranks[emptiest] = rank;
+  }
+}
+
+uint32_t bitfieldReverse(uint32_t x)
+{
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+  x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// The functions below mirror the ones with the same names in raytrace.comp.glsl.
+
+// Random number generation using pcg32i_random_t, using inc = 1. Our random state is a uint.
+inline uint32_t stepRNG(uint32_t rngState)
+{
+  return rngState * 747796405u + 1u;
+}
+
+// Steps the RNG and returns a floating-point value between 0 and 1 inclusive.
+inline float stepAndOutputRNGFloat(uint32_t& rngState)
+{
+  // Condensed version of pcg_output_rxs_m_xs_32_32, with simple conversion to floating-point [0,1].
+  rngState      = stepRNG(rngState);
+  uint32_t word = ((rngState >> ((rngState >> 28) + 4)) ^ rngState) * 277803737u;
+  word          = (word >> 22) ^ word;
+  return float(word) / 4294967295.0f;
+}
+
+inline uint32_t hashCombine(uint32_t seed, uint32_t value)
+{
+  return seed ^ (HashUint(value) + 0x9E3779B9u + (seed << 6) + (seed >> 2));
+}
+
+// Owen scrambling: flips each bit of x depending on the bits above it, with the Laine-Karras hash
+// (which does this for the bits below each bit, hence the reversals).
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+  x = bitfieldReverse(x);
+  x ^= x * 0x3D20ADEAu;
+  x += seed;
+  x *= (seed >> 16) | 1u;
+  x ^= x * 0x05526C56u;
+  x ^= x * 0x53A22864u;
+  return bitfieldReverse(x);
+}
+
+inline void scrambledSobol2D(const SamplerTables& tables, uint32_t index, uint32_t seed, float& x, float& y)
+{
+  index           = nestedUniformScramble(index, seed);
+  uint32_t pointX = 0, pointY = 0;
+  for(uint32_t bit = 0; index != 0; bit++, index >>= 1)
+  {
+    if(index & 1)
+    {
+      pointX ^= tables.sobolMatrices[bit];
+      pointY ^= tables.sobolMatrices[32 + bit];
+    }
+  }
+  x = float(nestedUniformScramble(pointX, hashCombine(seed, 0)) >> 8) / 16777216.0f;
+  y = float(nestedUniformScramble(pointY, hashCombine(seed, 1)) >> 8) / 16777216.0f;
+}
+
+inline uint32_t blueNoiseRank(const SamplerTables& tables, uint32_t x, uint32_t y)
+{
+  return tables.blueNoise[(y % BLUE_NOISE_SIZE) * BLUE_NOISE_SIZE + x % BLUE_NOISE_SIZE];
+}
+}  // namespace
+
+uint32_t HashUint(uint32_t x)
+{
+  const uint32_t state = x * 747796405u + 2891336453u;
+  const uint32_t word  = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+  return (word >> 22) ^ word;
+}
+
+void BuildSamplerTables(SamplerTables& tables)
+{
+  buildSobolMatrices(tables.sobolMatrices);
+  buildBlueNoise(tables.blueNoise);
+}
+
+const char* GetSamplerName(uint32_t sampler)
+{
+  switch(sampler)
+  {
+    case SAMPLER_SOBOL:
+      return "sobol";
+    case SAMPLER_BLUE_NOISE:
+      return "blue-noise";
+    default:
+      return "pcg";
+  }
+}
+
+uint32_t PcgSeed(uint32_t width, uint32_t height, uint32_t batchIndex, uint32_t linearIndex, uint32_t seed)
+{
+  return (width * height * batchIndex + linearIndex) ^ (seed * 0x9E3779B9u);
+}
+
+void Sample2D(const SamplerSettings& settings, shaderio::PathSampler& sampler, float& x, float& y)
+{
+  if(settings.sampler == SAMPLER_PCG)
+  {
+    x = stepAndOutputRNGFloat(sampler.rngState);
+    y = stepAndOutputRNGFloat(sampler.rngState);
+    return;
+  }
+  const uint32_t dimensionSeed = hashCombine(HashUint(settings.seed), sampler.dimension++);
+  if(settings.sampler == SAMPLER_SOBOL)
+  {
+    scrambledSobol2D(*settings.tables, sampler.sampleIndex, hashCombine(dimensionSeed, sampler.pixel), x, y);
+    return;
+  }
+  const uint32_t texelX = sampler.pixel % settings.imageWidth;
+  const uint32_t texelY = sampler.pixel / settings.imageWidth;
+  const uint32_t shiftX = HashUint(dimensionSeed);
+  const uint32_t shiftY = HashUint(shiftX);
+  scrambledSobol2D(*settings.tables, sampler.sampleIndex, dimensionSeed, x, y);
+  x += (float(blueNoiseRank(*settings.tables, texelX + shiftX, texelY + (shiftX >> 16))) + 0.5f) / float(BLUE_NOISE_SIZE * BLUE_NOISE_SIZE);
+  y += (float(blueNoiseRank(*settings.tables, texelX + shiftY, texelY + (shiftY >> 16))) + 0.5f) / float(BLUE_NOISE_SIZE * BLUE_NOISE_SIZE);
+  x -= std::floor(x);
+  y -= std::floor(y);
+}
+
+float Sample1D(const SamplerSettings& settings, shaderio::PathSampler& sampler)
+{
+  if(settings.sampler == SAMPLER_PCG)
+  {
+    return stepAndOutputRNGFloat(sampler.rngState);
+  }
+  float x, y;
+  Sample2D(settings, sampler, x, y);
+  return x;
+}
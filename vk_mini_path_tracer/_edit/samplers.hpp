@@ -0,0 +1,59 @@
+#pragma once
+
+// Samplers: where the random numbers of paths come from (--sampler).
+//
+// pcg (the default) steps a PCG random number generator per pixel, seeded from the pixel and the batch:
+// white noise, whose error falls as 1 / sqrt(samples).
+//
+// sobol takes each 2D point a path needs (the pixel position, the point on a light, the bounce direction...)
+// from the 2D Sobol sequence, Owen-scrambled with a hash of the pixel, the dimension and --seed, with the
+// order of the points shuffled by scrambling their index (Burley 2020, "Practical Hash-based Owen Scrambling").
+// Padding dimensions pair by pair like this only needs the generator matrices of two dimensions, however
+// long the path; each pair is stratified on its own, and independent of the others.
+//
+// blue-noise takes the same points, but with a scrambling that is shared by all pixels, so that each
+// pixel would see the same points; instead, each pixel shifts them toroidally by the values of a
+// blue-noise mask at that pixel (Georgiev and Fajardo 2016, "Blue-noise dithered sampling"). The error
+// of neighboring pixels is then anti-correlated, which looks like fine grain rather than blotches at low
+// sample counts.
+//
+// BuildSamplerTables() generates the generator matrices and the mask (with the void-and-cluster method)
+// on the host; the GPU backend uploads them once, and the CPU backend reads them directly with the
+// functions below, which mirror the ones with the same names in raytrace.comp.glsl.
+// The study of --sampler-study (see sampler_study.hpp) measures how each sampler converges.
+
+#include "shaders/host_device.h"
+
+#include <cstdint>
+#include <vector>
+
+struct SamplerTables
+{
+  std::vector<uint32_t> sobolMatrices;  // SOBOL_DIMENSIONS x 32 columns: the direction number of each bit of the index
+  std::vector<uint32_t> blueNoise;      // BLUE_NOISE_SIZE x BLUE_NOISE_SIZE ranks, row by row; each rank appears once
+};
+
+void BuildSamplerTables(SamplerTables& tables);
+
+// Returns the --sampler name of one of SAMPLER_*.
+const char* GetSamplerName(uint32_t sampler);
+
+// Hashes a uint: the PCG hash, as hashUint() in raytrace.comp.glsl.
+uint32_t HashUint(uint32_t x);
+
+// The initial RNG state of a pixel in a batch, for SAMPLER_PCG. --seed scrambles the seeds of all pixels;
+// seed 0 keeps the seeds of earlier versions.
+uint32_t PcgSeed(uint32_t width, uint32_t height, uint32_t batchIndex, uint32_t linearIndex, uint32_t seed);
+
+// The sampler of a render, as the shader sees it through its specialization constant and push constants.
+struct SamplerSettings
+{
+  const SamplerTables* tables     = nullptr;
+  uint32_t             sampler    = SAMPLER_PCG;
+  uint32_t             seed       = 0;
+  uint32_t             imageWidth = 0;
+};
+
+// Takes the next point of a path. The PCG sampler takes its random numbers in the order of the coordinates.
+void  Sample2D(const SamplerSettings& settings, shaderio::PathSampler& sampler, float& x, float& y);
+float Sample1D(const SamplerSettings& settings, shaderio::PathSampler& sampler);
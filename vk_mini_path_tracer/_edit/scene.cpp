@@ -0,0 +1,230 @@
+#include "scene.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+bool MakeTransform(const std::vector<float>& numbers, Transform& transform)
+{
+  transform = Transform();
+  if(numbers.size() == 3)
+  {
+    for(int row = 0; row < 3; row++)
+      transform.matrix[row][3] = numbers[row];
+  }
+  else if(numbers.size() == 12)
+  {
+    std::memcpy(transform.matrix, numbers.data(), sizeof(transform.matrix));
+  }
+  return numbers.empty() || numbers.size() == 3 || numbers.size() == 12;
+}
+
+bool Scene::load(const std::string& path, const WorkStealingScheduler& scheduler)
+{
+  const bool loaded = (std::filesystem::path(path).extension() == ".obj") ? addObjInstance(path, Transform(), scheduler) :
+                                                                             loadDescription(path, scheduler);
+  if(loaded && getInstancedTriangleCount() == 0)
+  {
+    fprintf(stderr, "Scene %s has no triangles\n", path.c_str());
+    return false;
+  }
+  return loaded;
+}
+
+void Scene::addMesh(ObjMesh mesh)
+{
+  mesh.materialIds.assign(mesh.indices.size() / 3, 0);
+  m_generatedMeshes.push_back(std::make_unique<ObjMesh>(std::move(mesh)));
+  const ObjMesh& owned = *m_generatedMeshes.back();
+
+  SceneMesh sceneMesh;
+  sceneMesh.vertices    = owned.vertices.data();
+  sceneMesh.indices     = owned.indices.data();
+  sceneMesh.materialIds = owned.materialIds.data();
+  sceneMesh.vertexCount = uint32_t(owned.vertices.size() / 3);
+  sceneMesh.indexCount  = uint32_t(owned.indices.size());
+  sceneMesh.hash        = HashFnv1a(owned.materialIds.data(), owned.materialIds.size() * sizeof(uint32_t),
+                                    HashFnv1a(owned.indices.data(), owned.indices.size() * sizeof(uint32_t),
+                                              HashFnv1a(owned.vertices.data(), owned.vertices.size() * sizeof(float))));
+
+  SceneInstance instance;
+  instance.meshIndex = findOrAddMesh(sceneMesh);
+  m_instances.push_back(instance);
+}
+
+void Scene::setInstanceTransform(uint32_t instanceIndex, const Transform& transform)
+{
+  m_instances[instanceIndex].transform = transform;
+}
+
+void Scene::setMeshVertices(uint32_t meshIndex, std::vector<float> vertices)
+{
+  assert(vertices.size() == size_t(m_meshes[meshIndex].vertexCount) * 3);
+  m_deformedVertices.resize(m_meshes.size());
+  m_deformedVertices[meshIndex] = std::move(vertices);
+  m_meshes[meshIndex].vertices  = m_deformedVertices[meshIndex].data();
+}
+
+uint64_t Scene::getUniqueTriangleCount() const
+{
+  uint64_t triangleCount = 0;
+  for(const SceneMesh& mesh : m_meshes)
+  {
+    triangleCount += mesh.indexCount / 3;
+  }
+  return triangleCount;
+}
+
+uint64_t Scene::getInstancedTriangleCount() const
+{
+  uint64_t triangleCount = 0;
+  for(const SceneInstance& instance : m_instances)
+  {
+    triangleCount += m_meshes[instance.meshIndex].indexCount / 3;
+  }
+  return triangleCount;
+}
+
+uint64_t Scene::getGeometryBytes() const
+{
+  uint64_t bytes = 0;
+  for(const SceneMesh& mesh : m_meshes)
+  {
+    bytes += uint64_t(mesh.vertexCount) * 3 * sizeof(float) + uint64_t(mesh.indexCount) * sizeof(uint32_t);
+  }
+  return bytes;
+}
+
+bool Scene::addObjInstance(const std::string& objPath, const Transform& transform, const WorkStealingScheduler& scheduler)
+{
+  const std::string key   = std::filesystem::path(objPath).lexically_normal().string();
+  auto              found = m_objs.find(key);
+  if(found == m_objs.end())
+  {
+    LoadedObj obj;
+    obj.cache = std::make_unique<SceneCache>();
+    if(!obj.cache->loadOrBuild(objPath, scheduler))
+    {
+      return false;
+    }
+    // Meshes are deduplicated within the OBJ when its cache is built; this also merges them
+    // with meshes of the OBJ files loaded before.
+    std::vector<uint32_t> cacheMeshes(obj.cache->getMeshCount());
+    for(size_t i = 0; i < cacheMeshes.size(); i++)
+    {
+      const SceneCacheMesh& cacheMesh = obj.cache->getMeshes()[i];
+      SceneMesh             mesh;
+      mesh.vertices    = obj.cache->getVertices() + size_t(cacheMesh.firstVertex) * 3;
+      mesh.indices     = obj.cache->getIndices() + cacheMesh.firstIndex;
+      mesh.materialIds = obj.cache->getMaterialIds() + cacheMesh.firstIndex / 3;
+      mesh.vertexCount = cacheMesh.vertexCount;
+      mesh.indexCount  = cacheMesh.indexCount;
+      mesh.hash        = cacheMesh.hash;
+      cacheMeshes[i]   = findOrAddMesh(mesh);
+    }
+    for(size_t shape = 0; shape < obj.cache->getShapeCount(); shape++)
+    {
+      obj.shapeMeshes.push_back(cacheMeshes[obj.cache->getShapeMeshes()[shape]]);
+    }
+    obj.materialOffset = uint32_t(m_materials.size());
+    addObjMaterials(objPath, *obj.cache);
+    found = m_objs.emplace(key, std::move(obj)).first;
+  }
+
+  for(uint32_t meshIndex : found->second.shapeMeshes)
+  {
+    m_instances.push_back({transform, meshIndex, found->second.materialOffset});
+  }
+  return true;
+}
+
+bool Scene::loadDescription(const std::string& path, const WorkStealingScheduler& scheduler)
+{
+  std::ifstream file(path);
+  if(!file)
+  {
+    fprintf(stderr, "Could not open scene %s\n", path.c_str());
+    return false;
+  }
+  const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+
+  std::string line;
+  uint32_t    lineNumber = 0;
+  while(std::getline(file, line))
+  {
+    lineNumber++;
+    std::istringstream tokens(line);
+    std::string        objPath;
+    if(!(tokens >> objPath) || objPath[0] == '#')
+      continue;  // Blank line or comment
+
+    std::vector<float> numbers;
+    float              number;
+    while(tokens >> number)
+    {
+      numbers.push_back(number);
+    }
+    Transform transform;
+    if(!tokens.eof() || !MakeTransform(numbers, transform))
+    {
+      fprintf(stderr, "%s:%u: expected an OBJ path and 0, 3 or 12 numbers: %s\n", path.c_str(), lineNumber, line.c_str());
+      return false;
+    }
+
+    if(!addObjInstance((directory / objPath).string(), transform, scheduler))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Scene::addObjMaterials(const std::string& objPath, const SceneCache& cache)
+{
+  // A missing library or material only costs the look of the scene, so it is a warning.
+  std::vector<ObjMaterial> libraryMaterials;
+  for(const std::string& library : cache.getMaterialLibraries())
+  {
+    ParseMtl((std::filesystem::path(objPath).parent_path() / library).string(), libraryMaterials);
+  }
+  for(const std::string& name : cache.getMaterialNames())
+  {
+    SceneMaterial material;
+    const auto    found = std::find_if(libraryMaterials.begin(), libraryMaterials.end(),
+                                       [&](const ObjMaterial& libraryMaterial) { return libraryMaterial.name == name; });
+    if(found != libraryMaterials.end())
+    {
+      material.diffuse  = {found->diffuse[0], found->diffuse[1], found->diffuse[2]};
+      material.emission = {found->emission[0], found->emission[1], found->emission[2]};
+    }
+    else if(!name.empty())
+    {
+      fprintf(stderr, "%s: material %s is not in its material libraries; using the default material\n", objPath.c_str(), name.c_str());
+    }
+    m_materials.push_back(material);
+  }
+}
+
+uint32_t Scene::findOrAddMesh(const SceneMesh& mesh)
+{
+  const auto found = m_meshByHash.find(mesh.hash);
+  if(found != m_meshByHash.end())
+  {
+    const SceneMesh& other = m_meshes[found->second];
+    if(other.vertexCount == mesh.vertexCount && other.indexCount == mesh.indexCount
+       && std::memcmp(other.vertices, mesh.vertices, size_t(mesh.vertexCount) * 3 * sizeof(float)) == 0
+       && std::memcmp(other.indices, mesh.indices, size_t(mesh.indexCount) * sizeof(uint32_t)) == 0
+       && std::memcmp(other.materialIds, mesh.materialIds, size_t(mesh.indexCount / 3) * sizeof(uint32_t)) == 0)
+    {
+      return found->second;
+    }
+  }
+  m_meshByHash.emplace(mesh.hash, uint32_t(m_meshes.size()));
+  m_meshes.push_back(mesh);
+  return uint32_t(m_meshes.size() - 1);
+}
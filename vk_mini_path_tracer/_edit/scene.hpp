@@ -0,0 +1,146 @@
+#pragma once
+
+// Scenes: meshes, and instances of them with object-to-world transforms.
+//
+// Each mesh gets its own BLAS on the GPU, and each instance becomes one instance of the TLAS, so
+// memory grows with the amount of unique geometry rather than with the number of instances.
+// A scene is either a single OBJ file, where each shape is an instance with the identity transform,
+// or a scene description: a text file listing instances of OBJ files, one per non-empty line that
+// does not start with '#':
+//
+//   path.obj                                                          (identity)
+//   path.obj  tx ty tz                                                (translation)
+//   path.obj  m00 m01 m02 m03  m10 m11 m12 m13  m20 m21 m22 m23      (3 x 4 row-major matrix)
+//
+// Paths are relative to the description file. Each OBJ is loaded once (through its scene cache,
+// see scene_cache.hpp) however many times it is instanced, and meshes with the same contents
+// are shared, even across OBJ files.
+//
+// Materials come from the OBJ files' material libraries (`mtllib`); each OBJ adds its materials to
+// the scene's table, and each instance stores where they start, so a mesh shared by two OBJ files
+// can have different materials in each. Material 0 is the default: the gray diffuse surface used
+// for faces without a material, for materials that aren't in any library, and for generated meshes.
+
+#include "cpu_math.hpp"
+#include "obj_parser.hpp"
+#include "scene_cache.hpp"
+#include "work_stealing.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// An affine object-to-world transform, stored as the 3 x 4 row-major matrix of VkTransformMatrixKHR.
+struct Transform
+{
+  float matrix[3][4] = {{1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}};
+
+  Vec3 transformPoint(const Vec3& p) const
+  {
+    return {matrix[0][0] * p.x + matrix[0][1] * p.y + matrix[0][2] * p.z + matrix[0][3],
+            matrix[1][0] * p.x + matrix[1][1] * p.y + matrix[1][2] * p.z + matrix[1][3],
+            matrix[2][0] * p.x + matrix[2][1] * p.y + matrix[2][2] * p.z + matrix[2][3]};
+  }
+  // The transform that applies `inner`, then this one
+  Transform operator*(const Transform& inner) const
+  {
+    Transform result;
+    for(int row = 0; row < 3; row++)
+    {
+      for(int column = 0; column < 4; column++)
+      {
+        result.matrix[row][column] = matrix[row][0] * inner.matrix[0][column] + matrix[row][1] * inner.matrix[1][column]
+                                     + matrix[row][2] * inner.matrix[2][column] + (column == 3 ? matrix[row][3] : 0.0f);
+      }
+    }
+    return result;
+  }
+  // Negative for transforms that mirror, and so flip the winding of triangles
+  float determinant() const
+  {
+    return matrix[0][0] * (matrix[1][1] * matrix[2][2] - matrix[1][2] * matrix[2][1])
+           - matrix[0][1] * (matrix[1][0] * matrix[2][2] - matrix[1][2] * matrix[2][0])
+           + matrix[0][2] * (matrix[1][0] * matrix[2][1] - matrix[1][1] * matrix[2][0]);
+  }
+};
+
+// Makes the transform of a scene description line from its numbers: none (identity), 3 (translation) or
+// 12 (3 x 4 row-major matrix). Returns false for any other count.
+bool MakeTransform(const std::vector<float>& numbers, Transform& transform);
+
+// A Lambertian surface that can emit light.
+struct SceneMaterial
+{
+  Vec3 diffuse{0.7f};
+  Vec3 emission;  // Radiance, the same on both sides
+};
+
+// A mesh with its own vertices, and indices relative to them. The arrays belong to the Scene
+// (usually, they point into a memory-mapped scene cache).
+struct SceneMesh
+{
+  const float*    vertices    = nullptr;  // xyz per vertex
+  const uint32_t* indices     = nullptr;  // 3 per triangle
+  const uint32_t* materialIds = nullptr;  // 1 per triangle, relative to the materialOffset of each instance
+  uint32_t        vertexCount = 0;
+  uint32_t        indexCount  = 0;
+  uint64_t        hash        = 0;  // HashFnv1a() of the vertices, then the indices, then the material IDs
+};
+
+struct SceneInstance
+{
+  Transform transform;
+  uint32_t  meshIndex      = 0;
+  uint32_t  materialOffset = 0;  // Index in getMaterials() of the mesh's material 0
+};
+
+class Scene
+{
+public:
+  // Loads an OBJ file, or a scene description (any other extension).
+  // Returns false (and prints an error) if the scene could not be loaded or has no triangles.
+  bool load(const std::string& path, const WorkStealingScheduler& scheduler);
+
+  // Adds a mesh, and one instance of it with the identity transform; used for generated scenes.
+  // Its shapes and material names are ignored: all triangles get the default material.
+  void addMesh(ObjMesh mesh);
+
+  // Animation (see sequence.hpp). Moves an instance; or replaces the vertices of a mesh - and so of all of
+  // its instances - with as many new ones, which the scene keeps. Meshes keep their hash, topology and materials.
+  void setInstanceTransform(uint32_t instanceIndex, const Transform& transform);
+  void setMeshVertices(uint32_t meshIndex, std::vector<float> vertices);
+
+  const std::vector<SceneMesh>&     getMeshes() const { return m_meshes; }
+  const std::vector<SceneInstance>& getInstances() const { return m_instances; }
+  const std::vector<SceneMaterial>& getMaterials() const { return m_materials; }
+  uint64_t                          getUniqueTriangleCount() const;     // Triangles of all meshes
+  uint64_t                          getInstancedTriangleCount() const;  // Triangles of all instances
+  uint64_t                          getGeometryBytes() const;           // Size of the vertices and indices of all meshes
+
+private:
+  // An OBJ file, the index in m_meshes of each of its shapes, and where its materials start in m_materials.
+  struct LoadedObj
+  {
+    std::unique_ptr<SceneCache> cache;
+    std::vector<uint32_t>       shapeMeshes;
+    uint32_t                    materialOffset = 0;
+  };
+
+  // Adds one instance of each shape of an OBJ file, loading it first if needed.
+  bool addObjInstance(const std::string& objPath, const Transform& transform, const WorkStealingScheduler& scheduler);
+  bool loadDescription(const std::string& path, const WorkStealingScheduler& scheduler);
+  // Adds the materials an OBJ's faces name to m_materials, from its material libraries.
+  void addObjMaterials(const std::string& objPath, const SceneCache& cache);
+  // Returns the index of a mesh with the same contents as `mesh`, adding it if there is none.
+  uint32_t findOrAddMesh(const SceneMesh& mesh);
+
+  std::unordered_map<std::string, LoadedObj> m_objs;  // By path
+  std::vector<std::unique_ptr<ObjMesh>>      m_generatedMeshes;
+  std::vector<std::vector<float>>            m_deformedVertices;  // By mesh, for meshes given new vertices
+  std::vector<SceneMesh>                     m_meshes;
+  std::unordered_map<uint64_t, uint32_t>     m_meshByHash;
+  std::vector<SceneInstance>                 m_instances;
+  std::vector<SceneMaterial>                 m_materials{SceneMaterial()};
+};
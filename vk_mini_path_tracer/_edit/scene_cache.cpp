@@ -0,0 +1,263 @@
+#include "scene_cache.hpp"
+#include "hash.hpp"
+#include "obj_parser.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+namespace {
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// A shape of the OBJ, with its own vertices and indices relative to them.
+struct LocalMesh
+{
+  std::vector<float>    vertices;
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> materialIds;  // 1 per triangle
+  uint64_t              hash = 0;
+};
+
+// Splits the OBJ's shapes into meshes (in parallel), then merges shapes with the same geometry.
+void buildMeshes(const ObjMesh& mesh, const WorkStealingScheduler& scheduler, std::vector<LocalMesh>& meshes, std::vector<uint32_t>& shapeMeshes)
+{
+  const uint32_t         shapeCount = uint32_t(mesh.shapes.size());
+  std::vector<LocalMesh> shapes(shapeCount);
+  // Each worker maps OBJ vertex indices to mesh vertex indices with a table over all vertices;
+  // after each shape, only the entries it used are reset.
+  std::vector<std::vector<uint32_t>> remaps(scheduler.getThreadCount());
+  scheduler.run(shapeCount, [&](uint32_t shape, uint32_t worker) {
+    std::vector<uint32_t>& remap = remaps[worker];
+    if(remap.empty())
+      remap.assign(mesh.vertices.size() / 3, ~0u);
+    const ObjShape& source = mesh.shapes[shape];
+    LocalMesh&      local  = shapes[shape];
+    local.indices.reserve(source.indexCount);
+    local.materialIds.assign(mesh.materialIds.begin() + source.firstIndex / 3,
+                             mesh.materialIds.begin() + (source.firstIndex + source.indexCount) / 3);
+    for(uint32_t i = source.firstIndex; i < source.firstIndex + source.indexCount; i++)
+    {
+      const uint32_t vertex = mesh.indices[i];
+      if(remap[vertex] == ~0u)
+      {
+        remap[vertex] = uint32_t(local.vertices.size() / 3);
+        local.vertices.insert(local.vertices.end(), mesh.vertices.begin() + 3 * vertex, mesh.vertices.begin() + 3 * vertex + 3);
+      }
+      local.indices.push_back(remap[vertex]);
+    }
+    for(uint32_t i = source.firstIndex; i < source.firstIndex + source.indexCount; i++)
+    {
+      remap[mesh.indices[i]] = ~0u;
+    }
+    local.hash = HashFnv1a(local.materialIds.data(), local.materialIds.size() * sizeof(uint32_t),
+                           HashFnv1a(local.indices.data(), local.indices.size() * sizeof(uint32_t),
+                                     HashFnv1a(local.vertices.data(), local.vertices.size() * sizeof(float))));
+  });
+
+  // Shapes whose hashes match are compared in full, so that a hash collision can't merge different meshes.
+  std::unordered_map<uint64_t, uint32_t> meshByHash;
+  meshes.clear();
+  shapeMeshes.resize(shapeCount);
+  for(uint32_t shape = 0; shape < shapeCount; shape++)
+  {
+    LocalMesh& local = shapes[shape];
+    const auto found = meshByHash.find(local.hash);
+    if(found != meshByHash.end() && meshes[found->second].vertices == local.vertices && meshes[found->second].indices == local.indices
+       && meshes[found->second].materialIds == local.materialIds)
+    {
+      shapeMeshes[shape] = found->second;
+      continue;
+    }
+    shapeMeshes[shape] = uint32_t(meshes.size());
+    meshByHash.emplace(local.hash, uint32_t(meshes.size()));
+    meshes.push_back(std::move(local));
+  }
+}
+
+// Writes the cache to a temporary file and then renames it, so that a crash while writing
+// never leaves a truncated cache behind.
+bool writeCache(const std::string& cachePath, const std::vector<LocalMesh>& meshes, const std::vector<uint32_t>& shapeMeshes,
+                const ObjMesh& obj, uint64_t sourceHash, uint64_t sourceSize)
+{
+  std::string strings;
+  for(const std::string& name : obj.materialNames)
+  {
+    strings.append(name.c_str(), name.size() + 1);
+  }
+  for(const std::string& library : obj.materialLibraries)
+  {
+    strings.append(library.c_str(), library.size() + 1);
+  }
+
+  std::vector<SceneCacheMesh> meshInfos;
+  uint64_t                    vertexCount = 0, indexCount = 0;
+  for(const LocalMesh& mesh : meshes)
+  {
+    meshInfos.push_back({mesh.hash, uint32_t(vertexCount), uint32_t(mesh.vertices.size() / 3), uint32_t(indexCount),
+                         uint32_t(mesh.indices.size())});
+    vertexCount += mesh.vertices.size() / 3;
+    indexCount += mesh.indices.size();
+  }
+
+  SceneCacheHeader header{};
+  std::memcpy(header.magic, kSceneCacheMagic, sizeof(header.magic));
+  header.version              = kSceneCacheVersion;
+  header.headerSize           = sizeof(SceneCacheHeader);
+  header.sourceHash           = sourceHash;
+  header.sourceSize           = sourceSize;
+  header.vertexCount          = vertexCount;
+  header.indexCount           = indexCount;
+  header.meshCount            = meshes.size();
+  header.shapeCount           = shapeMeshes.size();
+  header.vertexOffset         = alignUp(sizeof(SceneCacheHeader), kSceneCacheAlignment);
+  header.indexOffset          = alignUp(header.vertexOffset + vertexCount * 3 * sizeof(float), kSceneCacheAlignment);
+  header.meshOffset           = alignUp(header.indexOffset + indexCount * sizeof(uint32_t), kSceneCacheAlignment);
+  header.shapeOffset          = alignUp(header.meshOffset + meshes.size() * sizeof(SceneCacheMesh), kSceneCacheAlignment);
+  header.materialIdOffset     = alignUp(header.shapeOffset + shapeMeshes.size() * sizeof(uint32_t), kSceneCacheAlignment);
+  header.materialNameCount    = obj.materialNames.size();
+  header.materialLibraryCount = obj.materialLibraries.size();
+  header.stringBytes          = strings.size();
+  header.stringOffset         = alignUp(header.materialIdOffset + indexCount / 3 * sizeof(uint32_t), kSceneCacheAlignment);
+
+  const std::string tempPath = cachePath + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if(!file)
+      return false;
+    const char padding[kSceneCacheAlignment] = {};
+    auto       writeAt = [&](uint64_t offset, const void* data, size_t size) {
+      file.write(padding, std::streamsize(offset - uint64_t(file.tellp())));
+      file.write(static_cast<const char*>(data), std::streamsize(size));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(size_t i = 0; i < meshes.size(); i++)
+    {
+      writeAt(header.vertexOffset + uint64_t(meshInfos[i].firstVertex) * 3 * sizeof(float), meshes[i].vertices.data(),
+              meshes[i].vertices.size() * sizeof(float));
+    }
+    for(size_t i = 0; i < meshes.size(); i++)
+    {
+      writeAt(header.indexOffset + uint64_t(meshInfos[i].firstIndex) * sizeof(uint32_t), meshes[i].indices.data(),
+              meshes[i].indices.size() * sizeof(uint32_t));
+    }
+    writeAt(header.meshOffset, meshInfos.data(), meshInfos.size() * sizeof(SceneCacheMesh));
+    writeAt(header.shapeOffset, shapeMeshes.data(), shapeMeshes.size() * sizeof(uint32_t));
+    for(size_t i = 0; i < meshes.size(); i++)
+    {
+      writeAt(header.materialIdOffset + uint64_t(meshInfos[i].firstIndex / 3) * sizeof(uint32_t), meshes[i].materialIds.data(),
+              meshes[i].materialIds.size() * sizeof(uint32_t));
+    }
+    writeAt(header.stringOffset, strings.data(), strings.size());
+    if(!file)
+      return false;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, cachePath, error);
+  if(error)
+  {
+    std::filesystem::remove(tempPath, error);
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+bool SceneCache::tryMap(const std::string& cachePath, uint64_t sourceHash, uint64_t sourceSize)
+{
+  if(!m_file.open(cachePath))
+    return false;
+
+  bool valid = m_file.size() >= sizeof(SceneCacheHeader);
+  if(valid)
+  {
+    const SceneCacheHeader& h = header();
+    valid = std::memcmp(h.magic, kSceneCacheMagic, sizeof(h.magic)) == 0 && h.version == kSceneCacheVersion
+            && h.headerSize == sizeof(SceneCacheHeader) && h.sourceHash == sourceHash && h.sourceSize == sourceSize
+            && h.vertexOffset + h.vertexCount * 3 * sizeof(float) <= m_file.size()
+            && h.indexOffset + h.indexCount * sizeof(uint32_t) <= m_file.size()
+            && h.meshOffset + h.meshCount * sizeof(SceneCacheMesh) <= m_file.size()
+            && h.shapeOffset + h.shapeCount * sizeof(uint32_t) <= m_file.size()
+            && h.materialIdOffset + h.indexCount / 3 * sizeof(uint32_t) <= m_file.size()
+            && h.stringOffset + h.stringBytes <= m_file.size();
+  }
+  // Split the strings; the last one must end before the end of the string table.
+  m_materialNames.clear();
+  m_materialLibraries.clear();
+  if(valid)
+  {
+    const char* p   = reinterpret_cast<const char*>(m_file.data() + header().stringOffset);
+    const char* end = p + header().stringBytes;
+    for(uint64_t i = 0; valid && i < header().materialNameCount + header().materialLibraryCount; i++)
+    {
+      const char*               stringEnd = std::find(p, end, '\0');
+      std::vector<std::string>& strings   = (i < header().materialNameCount) ? m_materialNames : m_materialLibraries;
+      valid                               = stringEnd != end;
+      strings.emplace_back(p, stringEnd);
+      p = stringEnd + 1;
+    }
+  }
+  for(size_t i = 0; valid && i < getIndexCount() / 3; i++)
+  {
+    valid = getMaterialIds()[i] < m_materialNames.size();
+  }
+  for(size_t i = 0; valid && i < getMeshCount(); i++)
+  {
+    const SceneCacheMesh& mesh = getMeshes()[i];
+    valid = uint64_t(mesh.firstVertex) + mesh.vertexCount <= header().vertexCount
+            && uint64_t(mesh.firstIndex) + mesh.indexCount <= header().indexCount;
+  }
+  for(size_t i = 0; valid && i < getShapeCount(); i++)
+  {
+    valid = getShapeMeshes()[i] < getMeshCount();
+  }
+  if(!valid)
+    m_file.close();
+  return valid;
+}
+
+bool SceneCache::loadOrBuild(const std::string& objPath, const WorkStealingScheduler& scheduler)
+{
+  MappedFile objFile;
+  if(!objFile.open(objPath))
+  {
+    fprintf(stderr, "Could not open scene %s\n", objPath.c_str());
+    return false;
+  }
+  const uint64_t sourceHash = HashFnv1aChunked(objFile.data(), objFile.size(), scheduler);
+
+  // If the scene's directory is read-only, the cache goes into the working directory instead.
+  const std::string cachePaths[] = {objPath + ".cache", std::filesystem::path(objPath).filename().string() + ".cache"};
+  for(const std::string& cachePath : cachePaths)
+  {
+    if(tryMap(cachePath, sourceHash, objFile.size()))
+      return true;
+  }
+
+  // First run (or the OBJ changed): parse the OBJ, split it into meshes and build the cache.
+  std::vector<LocalMesh> meshes;
+  std::vector<uint32_t>  shapeMeshes;
+  ObjMesh                mesh;
+  if(!ParseObjParallel(reinterpret_cast<const char*>(objFile.data()), objFile.size(), scheduler, mesh))
+  {
+    fprintf(stderr, "Could not parse scene %s\n", objPath.c_str());
+    return false;
+  }
+  buildMeshes(mesh, scheduler, meshes, shapeMeshes);
+  mesh.vertices = {};
+  mesh.indices  = {};
+  for(const std::string& cachePath : cachePaths)
+  {
+    if(writeCache(cachePath, meshes, shapeMeshes, mesh, sourceHash, objFile.size()) && tryMap(cachePath, sourceHash, objFile.size()))
+      return true;
+  }
+
+  fprintf(stderr, "Could not write a scene cache for %s\n", objPath.c_str());
+  return false;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+// Binary scene cache.
+//
+// Parsing OBJ text dominates startup for large meshes. The first time a scene is loaded, the OBJ
+// is parsed (in parallel) and its vertex and index arrays are written to a binary cache file
+// next to it, laid out exactly as they are uploaded to the GPU. Later runs memory-map the cache
+// and pass pointers into the mapping straight to allocator.createBuffer(), so no text is parsed
+// and no intermediate arrays are built.
+//
+// Each shape of the OBJ (see ObjShape) becomes a mesh with its own vertices, and indices that are
+// relative to them, so that each mesh can get its own BLAS. Shapes with the same geometry (the
+// same vertex positions, triangles and materials, found by their content hash) share one mesh, so
+// repeated geometry is stored, uploaded and built only once.
+//
+// Materials are stored by name: each triangle has the index of its `usemtl` name, and the names
+// are resolved through the OBJ's material libraries (which are small, and read on every load, see
+// Scene) so that editing an MTL file doesn't need a new cache.
+//
+// The cache stores a hash of the OBJ file's contents; if the OBJ changes, the cache is rebuilt.
+//
+// File layout (all offsets in bytes from the start of the file, little-endian):
+//   SceneCacheHeader
+//   vertices: vertexCount * 3 floats, at vertexOffset; the meshes' vertices, one after the other
+//   indices:  indexCount uint32_ts, at indexOffset; each mesh's indices start at 0
+//   meshes:   meshCount SceneCacheMeshes, at meshOffset
+//   shapes:   shapeCount uint32_ts, at shapeOffset; the mesh of each shape, in file order
+//   materials: indexCount / 3 uint32_ts, at materialIdOffset; the material name of each triangle of
+//             each mesh, in the same order as the indices
+//   strings:  stringBytes bytes, at stringOffset; materialNameCount NUL-terminated material names,
+//             then materialLibraryCount NUL-terminated `mtllib` file names
+
+#include "mapped_file.hpp"
+#include "work_stealing.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr char     kSceneCacheMagic[8]  = {'V', 'K', 'M', 'P', 'T', 'S', 'C', 0};
+constexpr uint32_t kSceneCacheVersion   = 3;   // Increase this whenever the layout changes
+constexpr uint64_t kSceneCacheAlignment = 256;  // Alignment of each array in the file
+
+struct SceneCacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t sourceHash;  // HashFnv1aChunked() of the OBJ file
+  uint64_t sourceSize;  // Size of the OBJ file in bytes
+  uint64_t vertexCount;
+  uint64_t indexCount;
+  uint64_t meshCount;
+  uint64_t shapeCount;
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  uint64_t meshOffset;
+  uint64_t shapeOffset;
+  uint64_t materialIdOffset;
+  uint64_t materialNameCount;
+  uint64_t materialLibraryCount;
+  uint64_t stringBytes;
+  uint64_t stringOffset;
+};
+
+struct SceneCacheMesh
+{
+  uint64_t hash;  // HashFnv1a() of the mesh's vertices, then its indices, then its material IDs
+  uint32_t firstVertex;
+  uint32_t vertexCount;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+};
+
+class SceneCache
+{
+public:
+  // Memory-maps the cache for `objPath` (at `objPath + ".cache"`), building it first if it does
+  // not exist, is from an older version, or was built from different OBJ contents.
+  // Returns false if neither the cache nor the OBJ could be loaded.
+  bool loadOrBuild(const std::string& objPath, const WorkStealingScheduler& scheduler);
+
+  const float*    getVertices() const { return reinterpret_cast<const float*>(m_file.data() + header().vertexOffset); }
+  const uint32_t* getIndices() const { return reinterpret_cast<const uint32_t*>(m_file.data() + header().indexOffset); }
+  size_t          getVertexCount() const { return size_t(header().vertexCount); }
+  size_t          getIndexCount() const { return size_t(header().indexCount); }
+  size_t          getVertexBytes() const { return getVertexCount() * 3 * sizeof(float); }
+  size_t          getIndexBytes() const { return getIndexCount() * sizeof(uint32_t); }
+
+  const SceneCacheMesh* getMeshes() const { return reinterpret_cast<const SceneCacheMesh*>(m_file.data() + header().meshOffset); }
+  const uint32_t* getShapeMeshes() const { return reinterpret_cast<const uint32_t*>(m_file.data() + header().shapeOffset); }
+  size_t          getMeshCount() const { return size_t(header().meshCount); }
+  size_t          getShapeCount() const { return size_t(header().shapeCount); }
+
+  // One per triangle, in the order of the indices: an index into getMaterialNames()
+  const uint32_t* getMaterialIds() const { return reinterpret_cast<const uint32_t*>(m_file.data() + header().materialIdOffset); }
+  const std::vector<std::string>& getMaterialNames() const { return m_materialNames; }
+  const std::vector<std::string>& getMaterialLibraries() const { return m_materialLibraries; }
+
+private:
+  const SceneCacheHeader& header() const { return *reinterpret_cast<const SceneCacheHeader*>(m_file.data()); }
+
+  // Maps the cache file and checks its header against the OBJ's contents.
+  bool tryMap(const std::string& cachePath, uint64_t sourceHash, uint64_t sourceSize);
+
+  MappedFile               m_file;
+  std::vector<std::string> m_materialNames;
+  std::vector<std::string> m_materialLibraries;
+};
@@ -0,0 +1,147 @@
+#include "sequence.hpp"
+#include "mapped_file.hpp"
+#include "obj_parser.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+
+namespace {
+// Reads the vertices of `mesh` from an OBJ with the same faces: its vertices in the order in which the
+// faces first use them, which is the order of the scene cache. Returns false (and prints an error) if
+// the OBJ can't be read or has other faces.
+bool loadMeshVertices(const std::string& path, const SceneMesh& mesh, const WorkStealingScheduler& scheduler, std::vector<float>& vertices)
+{
+  MappedFile file;
+  ObjMesh    obj;
+  if(!file.open(path) || !ParseObjParallel(reinterpret_cast<const char*>(file.data()), file.size(), scheduler, obj))
+  {
+    fprintf(stderr, "Could not load %s\n", path.c_str());
+    return false;
+  }
+
+  bool                  sameFaces = (obj.indices.size() == mesh.indexCount);
+  std::vector<uint32_t> remap(obj.vertices.size() / 3, ~0u);
+  vertices.clear();
+  for(size_t i = 0; sameFaces && i < obj.indices.size(); i++)
+  {
+    const uint32_t vertex = obj.indices[i];
+    if(remap[vertex] == ~0u)
+    {
+      remap[vertex] = uint32_t(vertices.size() / 3);
+      vertices.insert(vertices.end(), obj.vertices.begin() + 3 * vertex, obj.vertices.begin() + 3 * vertex + 3);
+    }
+    sameFaces = (remap[vertex] == mesh.indices[i]);
+  }
+  if(!sameFaces || vertices.size() != size_t(mesh.vertexCount) * 3)
+  {
+    fprintf(stderr, "%s does not have the faces of the mesh it deforms (%u triangles, %u vertices)\n", path.c_str(),
+            mesh.indexCount / 3, mesh.vertexCount);
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+SequenceReader::SequenceReader(std::istream& input, std::string name, std::string directory, bool allowDeformation)
+    : m_input(input)
+    , m_name(std::move(name))
+    , m_directory(std::move(directory))
+    , m_allowDeformation(allowDeformation)
+{
+}
+
+bool SequenceReader::readFrame(Scene& scene, const WorkStealingScheduler& scheduler, RenderJob& job, SceneChanges& changes)
+{
+  changes = SceneChanges();
+  while(std::getline(m_input, m_line))
+  {
+    m_lineNumber++;
+    std::istringstream tokens(m_line);
+    std::string        keyword;
+    if(!(tokens >> keyword) || keyword[0] == '#')
+      continue;  // Blank line or comment
+
+    if(keyword == "instance")
+    {
+      applyInstanceLine(tokens, scene, changes);
+    }
+    else if(keyword == "vertices")
+    {
+      applyVerticesLine(tokens, scene, scheduler, changes);
+    }
+    else
+    {
+      const char* problem = nullptr;
+      if(ParseRenderJob(m_line, job, problem))
+        return true;
+      skipLine(problem);
+    }
+  }
+  return false;
+}
+
+bool SequenceReader::applyInstanceLine(std::istream& tokens, Scene& scene, SceneChanges& changes)
+{
+  uint32_t           instanceIndex = 0;
+  std::vector<float> numbers;
+  float              number;
+  if(!(tokens >> instanceIndex))
+  {
+    return skipLine("expected an instance index");
+  }
+  while(tokens >> number)
+  {
+    numbers.push_back(number);
+  }
+  Transform transform;
+  if(!tokens.eof() || numbers.empty() || !MakeTransform(numbers, transform))
+  {
+    return skipLine("expected 3 or 12 numbers after the instance index");
+  }
+  if(instanceIndex >= scene.getInstances().size())
+  {
+    return skipLine("no such instance");
+  }
+  scene.setInstanceTransform(instanceIndex, transform);
+  changes.movedInstances = true;
+  return true;
+}
+
+bool SequenceReader::applyVerticesLine(std::istream& tokens, Scene& scene, const WorkStealingScheduler& scheduler, SceneChanges& changes)
+{
+  uint32_t    instanceIndex = 0;
+  std::string objPath;
+  if(!(tokens >> instanceIndex >> objPath))
+  {
+    return skipLine("expected an instance index and an OBJ path");
+  }
+  if(!m_allowDeformation)
+  {
+    return skipLine("meshes can't be deformed with --compact-geometry");
+  }
+  if(instanceIndex >= scene.getInstances().size())
+  {
+    return skipLine("no such instance");
+  }
+
+  const uint32_t     meshIndex = scene.getInstances()[instanceIndex].meshIndex;
+  std::vector<float> vertices;
+  if(!loadMeshVertices((std::filesystem::path(m_directory) / objPath).string(), scene.getMeshes()[meshIndex], scheduler, vertices))
+  {
+    return skipLine("could not deform the mesh");
+  }
+  scene.setMeshVertices(meshIndex, std::move(vertices));
+  if(std::find(changes.deformedMeshes.begin(), changes.deformedMeshes.end(), meshIndex) == changes.deformedMeshes.end())
+  {
+    changes.deformedMeshes.push_back(meshIndex);
+  }
+  return true;
+}
+
+bool SequenceReader::skipLine(const char* problem) const
+{
+  fprintf(stderr, "%s:%u: %s, skipping: %s\n", m_name.c_str(), m_lineNumber, problem, m_line.c_str());
+  return false;
+}
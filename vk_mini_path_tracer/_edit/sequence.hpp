@@ -0,0 +1,61 @@
+#pragma once
+
+// Animated sequences (--sequence file|-).
+//
+// A sequence is a job file (see render_jobs.hpp) whose jobs are the frames of an animation: the scene
+// is loaded and its acceleration structures are built once, and the lines between two jobs change the
+// scene for all later frames. Besides job lines, blank lines and comments, a sequence has
+//
+//   instance i  tx ty tz                                              (move instance i to a translation)
+//   instance i  m00 m01 m02 m03  m10 m11 m12 m13  m20 m21 m22 m23    (or to a 3 x 4 row-major matrix)
+//   vertices i  frame.obj                                             (deform the mesh of instance i)
+//
+// Instances are numbered from 0 in the order the scene adds them: one per shape of each OBJ, line by
+// line of a scene description. A `vertices` OBJ must have the faces of the mesh, in the same order, and
+// the new position of each of its vertices; like the scene, its path is relative to the sequence file.
+// Deforming a mesh deforms all of its instances. With --compact-geometry, which frees the vertices once
+// the BLASes are built, meshes can't be deformed, and `vertices` lines are skipped.
+//
+// Between frames, the renderers refit their acceleration structures to the changes rather than
+// rebuilding them, until refit.hpp decides that a rebuild pays off.
+
+#include "render_jobs.hpp"
+#include "scene.hpp"
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+// What a frame of a sequence changed in the scene since the frame before.
+struct SceneChanges
+{
+  bool                  movedInstances = false;
+  std::vector<uint32_t> deformedMeshes;  // Indices in Scene::getMeshes(), each once
+
+  bool empty() const { return !movedInstances && deformedMeshes.empty(); }
+};
+
+class SequenceReader
+{
+public:
+  // Reads `input`, named `name` in messages; paths are relative to `directory`.
+  SequenceReader(std::istream& input, std::string name, std::string directory, bool allowDeformation);
+
+  // Applies the scene changes up to the next job to `scene`, and returns the job and the changes.
+  // Returns false at the end of the input. Malformed lines are reported and skipped.
+  bool readFrame(Scene& scene, const WorkStealingScheduler& scheduler, RenderJob& job, SceneChanges& changes);
+
+private:
+  bool applyInstanceLine(std::istream& tokens, Scene& scene, SceneChanges& changes);
+  bool applyVerticesLine(std::istream& tokens, Scene& scene, const WorkStealingScheduler& scheduler, SceneChanges& changes);
+  // Reports the current line as malformed, with `problem`; returns false.
+  bool skipLine(const char* problem) const;
+
+  std::istream& m_input;
+  std::string   m_name;
+  std::string   m_directory;
+  bool          m_allowDeformation = true;
+  std::string   m_line;
+  uint32_t      m_lineNumber = 0;
+};
@@ -0,0 +1,214 @@
+#version 460
+#extension GL_EXT_scalar_block_layout : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "host_device.h"
+
+// Denoiser: the spatial filter of SVGF (Schied et al. 2017, "Spatiotemporal Variance-Guided Filtering"), an
+// edge-aware a-trous wavelet filter, run over the render tile and its apron once they have been traced (see
+// denoiser.hpp and gpu_renderer.hpp).
+// The host dispatches it once per pass, with one invocation per pixel:
+// - pass 0 divides each pixel's mean color by its first-hit albedo, so that the filter blurs lighting but not
+//   textures, and estimates the variance of the result;
+// - each pass i > 0 blurs the illumination with a 5 x 5 B3-spline kernel whose taps are 2^(i-1) pixels apart, so
+//   that each pass doubles the footprint at the same cost. The weight of each tap falls with the difference of its
+//   normal and depth, and with the difference of its luminance relative to the standard deviation of the noise,
+//   which the filtered variance tracks; so the filter stops at edges and blurs less as the noise goes away.
+// The last pass multiplies the albedo back in. Passes ping-pong between the two halves of `denoiserPixels`, so that
+// the last one always writes the first half, which resolve.comp.glsl packs.
+layout(local_size_x_id = SPEC_WORKGROUP_WIDTH, local_size_y_id = SPEC_WORKGROUP_HEIGHT, local_size_z = 1) in;
+
+layout(binding = BINDING_ACCUMULATORS, set = 0, scalar) buffer storageBuffer
+{
+  PixelAccumulator accumulators[];
+};
+layout(binding = BINDING_AOVS, set = 0, scalar) buffer Aovs
+{
+  PixelAovs pixelAovs[];
+};
+layout(binding = BINDING_DENOISER, set = 0, scalar) buffer Denoiser
+{
+  DenoiserPixel denoiserPixels[];
+};
+
+layout(push_constant) uniform PushConstantBlock
+{
+  PushConstants pushConstants;
+};
+
+// The functions below are mirrored by the ones with the same names in denoiser.cpp.
+
+const float kAlbedoFloor   = 0.01;   // Keeps black surfaces from dividing by 0 when demodulating
+const float kPhiLuminance  = 4.0;    // Luminance differences of this many standard deviations weigh 1/e
+const float kPhiNormal     = 128.0;  // Exponent of the cosine between normals
+const float kPhiDepth      = 1.0;    // Depth differences this many times the one expected across the tap weigh 1/e
+const uint  kMinOwnSamples = 4;      // Pixels with fewer samples estimate their variance from their neighbors instead
+const float kKernel[3]     = {3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};  // B3 spline, by distance from the center tap
+
+float luminance(vec3 color)
+{
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// The AOVs of a pixel of the render tile, averaged over its samples.
+PixelAovs loadGuide(uint index)
+{
+  const float n    = float(max(accumulators[index].sampleCount, 1u));
+  PixelAovs   aovs = pixelAovs[index];
+  aovs.albedo      = max(aovs.albedo / n, vec3(kAlbedoFloor));
+  aovs.depth       = aovs.depth / n;
+  aovs.normal      = (aovs.normal == vec3(0.0)) ? vec3(0.0) : normalize(aovs.normal);
+  return aovs;
+}
+
+// The mean color of a pixel, divided by its albedo.
+vec3 demodulatedMean(uint index, PixelAovs guide)
+{
+  const PixelAccumulator accumulator = accumulators[index];
+  return (accumulator.sampleCount > 0) ? accumulator.sum / (float(accumulator.sampleCount) * guide.albedo) : vec3(0.0);
+}
+
+// The variance of the luminance of demodulatedMean(), from the pixel's own samples.
+float demodulatedVariance(uint index, PixelAovs guide)
+{
+  const PixelAccumulator accumulator = accumulators[index];
+  const uint             n           = accumulator.sampleCount;
+  if(n < 2)
+  {
+    return 0.0;
+  }
+  const vec3 mean     = accumulator.sum / float(n);
+  const vec3 variance = max(vec3(0.0), (accumulator.sumSquares - float(n) * mean * mean) / float(n - 1)) / float(n);
+  return luminance(variance / (guide.albedo * guide.albedo));
+}
+
+// The smaller of the depth differences between a pixel and its two neighbors along `axis`: the slope of the
+// surface the pixel sees, which doesn't jump at silhouettes like the difference to the other side does.
+float depthSlope(ivec2 pixel, ivec2 tileSize, ivec2 axis, float depth)
+{
+  float slope = SKY_DEPTH;
+  for(int side = -1; side <= 1; side += 2)
+  {
+    const ivec2 neighbor = pixel + side * axis;
+    if(all(greaterThanEqual(neighbor, ivec2(0))) && all(lessThan(neighbor, tileSize)))
+    {
+      slope = min(slope, abs(loadGuide(uint(tileSize.x * neighbor.y + neighbor.x)).depth - depth));
+    }
+  }
+  return slope;
+}
+
+// Pass 0: the demodulated color of a pixel, the variance of its luminance, smoothed over its 3 x 3 neighbors,
+// and its depth slope. Pixels with few samples take the spatial variance of their neighbors' luminance instead.
+DenoiserPixel prepareDenoiserPixel(ivec2 pixel, ivec2 tileSize)
+{
+  const uint      center      = uint(tileSize.x * pixel.y + pixel.x);
+  const PixelAovs guide       = loadGuide(center);
+  const bool      ownVariance = accumulators[center].sampleCount >= kMinOwnSamples;
+
+  DenoiserPixel result;
+  result.illumination = demodulatedMean(center, guide);
+  float weightSum = 0.0, varianceSum = 0.0, luminanceSum = 0.0, squaredLuminanceSum = 0.0;
+  for(int dy = -1; dy <= 1; dy++)
+  {
+    for(int dx = -1; dx <= 1; dx++)
+    {
+      const ivec2 neighbor = pixel + ivec2(dx, dy);
+      if(any(lessThan(neighbor, ivec2(0))) || any(greaterThanEqual(neighbor, tileSize)))
+      {
+        continue;
+      }
+      const uint      index         = uint(tileSize.x * neighbor.y + neighbor.x);
+      const PixelAovs neighborGuide = loadGuide(index);
+      const float     weight        = kKernel[abs(dx)] * kKernel[abs(dy)];
+      if(ownVariance)
+      {
+        varianceSum += weight * demodulatedVariance(index, neighborGuide);
+      }
+      else
+      {
+        const float l = luminance(demodulatedMean(index, neighborGuide));
+        luminanceSum += weight * l;
+        squaredLuminanceSum += weight * l * l;
+      }
+      weightSum += weight;
+    }
+  }
+  const float meanLuminance = luminanceSum / weightSum;
+  result.variance           = ownVariance ? varianceSum / weightSum : max(0.0, squaredLuminanceSum / weightSum - meanLuminance * meanLuminance);
+  result.depthSlope         = vec2(depthSlope(pixel, tileSize, ivec2(1, 0), guide.depth), depthSlope(pixel, tileSize, ivec2(0, 1), guide.depth));
+  return result;
+}
+
+// Pass `pass` > 0: one a-trous step of a pixel, reading the pixels of the previous pass from `source`.
+DenoiserPixel filterDenoiserPixel(ivec2 pixel, ivec2 tileSize, uint pass, uint source)
+{
+  const uint          pixelCount      = uint(tileSize.x * tileSize.y);
+  const uint          center          = uint(tileSize.x * pixel.y + pixel.x);
+  const int           step            = 1 << (pass - 1);
+  const PixelAovs     guide           = loadGuide(center);
+  const DenoiserPixel centerPixel     = denoiserPixels[source * pixelCount + center];
+  const float         centerLuminance = luminance(centerPixel.illumination);
+  const float         luminanceScale  = kPhiLuminance * sqrt(max(centerPixel.variance, 0.0)) + 1e-6;
+  // The size of a pixel at the depth of the center: how much the depth may change per pixel on top of the slope
+  const float pixelDepth = guide.depth * 2.0 * pushConstants.fovVerticalSlope / float(pushConstants.resolution.y);
+
+  vec3  illuminationSum = vec3(0.0);
+  float varianceSum = 0.0, weightSum = 0.0;
+  for(int dy = -2; dy <= 2; dy++)
+  {
+    for(int dx = -2; dx <= 2; dx++)
+    {
+      const ivec2 neighbor = pixel + step * ivec2(dx, dy);
+      if(any(lessThan(neighbor, ivec2(0))) || any(greaterThanEqual(neighbor, tileSize)))
+      {
+        continue;
+      }
+      const uint          index         = uint(tileSize.x * neighbor.y + neighbor.x);
+      const PixelAovs     neighborGuide = loadGuide(index);
+      const DenoiserPixel neighborPixel = denoiserPixels[source * pixelCount + index];
+
+      const float normalWeight      = pow(max(dot(guide.normal, neighborGuide.normal), 0.0), kPhiNormal);
+      const float expectedDepth     = float(step) * (dot(abs(vec2(dx, dy)), centerPixel.depthSlope) + pixelDepth * length(vec2(dx, dy)));
+      const float depthDistance     = abs(guide.depth - neighborGuide.depth) / (kPhiDepth * expectedDepth + 1e-6);
+      const float luminanceDistance = abs(centerLuminance - luminance(neighborPixel.illumination)) / luminanceScale;
+      const float weight            = kKernel[abs(dx)] * kKernel[abs(dy)] * normalWeight * exp(-depthDistance - luminanceDistance);
+      illuminationSum += weight * neighborPixel.illumination;
+      varianceSum += weight * weight * neighborPixel.variance;
+      weightSum += weight;
+    }
+  }
+  // The center tap always weighs kKernel[0]^2: its distances are 0, and the guide normal of a pixel with samples
+  // has unit length (the sky's is the direction back to the camera). So the weight sum can only be 0 for a pixel
+  // without samples, whose AOVs are all 0, or NaN when a tap isn't finite. The check is defensive: such a pixel
+  // keeps its own value rather than dividing by 0 or taking in the NaN.
+  DenoiserPixel result = centerPixel;
+  if(weightSum > 1e-12)
+  {
+    result.illumination = illuminationSum / weightSum;
+    result.variance     = varianceSum / (weightSum * weightSum);
+  }
+  if(pass + 1 == pushConstants.denoisePassCount)
+  {
+    result.illumination *= guide.albedo;
+  }
+  return result;
+}
+
+void main()
+{
+  const ivec2 tileSize = ivec2(pushConstants.tileSize);
+  const ivec2 pixel    = ivec2(gl_GlobalInvocationID.xy);
+  if(any(greaterThanEqual(pixel, tileSize)))
+  {
+    return;
+  }
+
+  // Pass i writes the half that makes the last pass write half 0, and reads the half the pass before wrote
+  const uint pass        = pushConstants.denoisePass;
+  const uint destination = (pushConstants.denoisePassCount - 1 - pass) % 2;
+  const uint pixelCount  = uint(tileSize.x * tileSize.y);
+  const uint index       = uint(tileSize.x * pixel.y + pixel.x);
+  denoiserPixels[destination * pixelCount + index] =
+      (pass == 0) ? prepareDenoiserPixel(pixel, tileSize) : filterDenoiserPixel(pixel, tileSize, pass, 1 - destination);
+}
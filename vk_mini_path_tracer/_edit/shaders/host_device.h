@@ -0,0 +1,252 @@
+// Definitions shared between the C++ code and the shaders, so that both sides agree on
+// binding indices and on the layout of buffers and push constants.
+#ifndef HOST_DEVICE_H
+#define HOST_DEVICE_H
+
+#ifdef __cplusplus
+#include <cstdint>
+namespace shaderio {
+using uint = uint32_t;
+struct vec2
+{
+  float x, y;
+};
+struct vec3
+{
+  float x, y, z;
+};
+struct uvec2
+{
+  uint x, y;
+};
+#endif
+
+// Descriptor set bindings of raytrace.comp.glsl. tile_stats.comp.glsl, resolve.comp.glsl and denoise.comp.glsl
+// use the same descriptor set layout, so that all pipelines share one pipeline layout.
+#define BINDING_ACCUMULATORS 0   // PixelAccumulator per pixel
+#define BINDING_TLAS 1           // Top-level acceleration structure
+#define BINDING_VERTICES 2       // Vertex positions of all meshes
+#define BINDING_INDICES 3        // Triangle vertex indices of all meshes, relative to each mesh's first vertex
+#define BINDING_TILE_MASK 4      // One uint per tile: 0 if the tile has converged
+#define BINDING_RAY_COUNTER 5    // RayCounter, when SPEC_COUNT_RAYS is set
+#define BINDING_MESHES 6         // MeshInfo per mesh, indexed by the instance custom index
+#define BINDING_HIT_RECORDS 7    // HitRecord per triangle, when SPEC_COMPACT_GEOMETRY is set
+#define BINDING_TILE_STATS 8     // TileStats per tile, written by tile_stats.comp.glsl
+#define BINDING_OUTPUT 9         // Packed output pixels, written by resolve.comp.glsl in the format of SPEC_OUTPUT_FORMAT
+#define BINDING_PATHS 10         // Wavefront kernel: WavefrontPath slots of each PathQueue, one per pixel of the render tile
+#define BINDING_PATH_QUEUES 11   // Wavefront kernel: PATH_QUEUE_COUNT PathQueues
+#define BINDING_PIXEL_RNG 12     // Wavefront kernel: RNG state of each pixel of the render tile between samples
+#define BINDING_PATH_COUNTS 13   // Wavefront kernel: RayCounter per segment, of the paths still alive at that segment
+#define BINDING_MATERIALS 14     // Material per scene material (see Scene::getMaterials())
+#define BINDING_MATERIAL_IDS 15  // Material ID per triangle of each mesh, unless SPEC_COMPACT_GEOMETRY is set
+#define BINDING_LIGHTS 16        // EmissiveTriangle per emissive triangle of the scene, with the alias table that samples them
+#define BINDING_SOBOL 17         // SOBOL_DIMENSIONS generator matrices of 32 columns each (see samplers.hpp)
+#define BINDING_BLUE_NOISE 18    // BLUE_NOISE_SIZE x BLUE_NOISE_SIZE blue-noise mask: the rank of each texel
+#define BINDING_AOVS 19          // PixelAovs per pixel of the render tile, when SPEC_DENOISE is set
+#define BINDING_DENOISER 20      // Two images of DenoiserPixels of the render tile, which the passes of denoise.comp.glsl ping-pong between
+
+// Specialization constant IDs of raytrace.comp.glsl. The host sets these when it creates the
+// pipeline, so changing them needs a new pipeline (usually from the pipeline cache), not a new shader.
+#define SPEC_WORKGROUP_WIDTH 0   // local_size_x; also the width of the convergence tiles
+#define SPEC_WORKGROUP_HEIGHT 1  // local_size_y; also the height of the convergence tiles
+#define SPEC_MAX_SEGMENTS 2      // Maximum number of ray segments traced per sample
+#define SPEC_COUNT_RAYS 3        // Whether to count traced rays in the RayCounter (for Mrays/s)
+#define SPEC_COMPACT_GEOMETRY 4  // Whether hits are shaded from HitRecords instead of vertices and indices
+#define SPEC_OUTPUT_FORMAT 5     // One of OUTPUT_FORMAT_*; only used by resolve.comp.glsl
+#define SPEC_WAVEFRONT_STAGE 6   // One of WAVEFRONT_STAGE_*: which stage of the wavefront kernel the pipeline runs
+#define SPEC_SAMPLE_LIGHTS 7     // Whether each bounce samples a point on a light (next-event estimation)
+#define SPEC_RUSSIAN_ROULETTE 8  // Number of segments after which Russian roulette may end paths; 0 = never
+#define SPEC_SAMPLER 9           // One of SAMPLER_*: where the random numbers of paths come from
+#define SPEC_DENOISE 10          // Whether the trace writes the AOVs, and resolve.comp.glsl packs the denoised image
+
+// Samplers (see samplers.hpp).
+#define SAMPLER_PCG 0         // White noise from a PCG random number generator per pixel
+#define SAMPLER_SOBOL 1       // Owen-scrambled Sobol points, scrambled differently for each pixel
+#define SAMPLER_BLUE_NOISE 2  // Owen-scrambled Sobol points shared by all pixels, shifted by a blue-noise mask
+
+#define SOBOL_DIMENSIONS 2  // Sobol dimensions in the tables; paths use them in pairs, each pair with its own scrambling
+#define BLUE_NOISE_SIZE 64  // Width and height of the tiled blue-noise mask
+
+// Pixel formats resolve.comp.glsl can pack the image into before it is read back.
+#define OUTPUT_FORMAT_RGBE 0          // 4 bytes per pixel: shared-exponent RGBE, as stored in Radiance .hdr files
+#define OUTPUT_FORMAT_HALF 1          // 6 bytes per pixel: RGB half floats
+#define OUTPUT_FORMAT_FLOAT 2         // 12 bytes per pixel: RGB floats
+#define OUTPUT_FORMAT_ACCUMULATORS 3  // 28 bytes per pixel: the PixelAccumulator itself, for accumulation files (see accumulation_file.hpp)
+
+// Stages of the wavefront kernel (--kernel wavefront). Instead of one invocation tracing all of a pixel's
+// samples and bounces, paths are stored in queues between stages, so each stage only runs on live paths:
+// generate makes one camera path per pixel, extend traces each path's next segment and sorts it into the
+// hit or miss queue, shade samples a light from each hit and bounces it back into the extend queue, and miss
+// adds escaped paths to the accumulators, as shade does with paths that Russian roulette or the segment limit ends. WAVEFRONT_STAGE_NONE is the megakernel, which does all of this in one loop.
+#define WAVEFRONT_STAGE_NONE 0
+#define WAVEFRONT_STAGE_GENERATE 1  // One invocation per pixel, like the megakernel
+#define WAVEFRONT_STAGE_EXTEND 2    // One invocation per path of PATH_QUEUE_EXTEND, and so on:
+#define WAVEFRONT_STAGE_SHADE 3     // PATH_QUEUE_HIT
+#define WAVEFRONT_STAGE_MISS 4      // PATH_QUEUE_MISS
+
+#define PATH_QUEUE_EXTEND 0  // Paths whose next segment is to be traced
+#define PATH_QUEUE_HIT 1     // Paths whose last segment hit a triangle
+#define PATH_QUEUE_MISS 2    // Paths whose last segment escaped to the sky
+#define PATH_QUEUE_COUNT 3
+
+// Values of the specialization constants, in the order of their IDs.
+struct SpecializationConstants
+{
+  uint workgroupWidth;
+  uint workgroupHeight;
+  uint maxSegments;
+  uint countRays;        // A VkBool32
+  uint compactGeometry;  // A VkBool32
+  uint outputFormat;
+  uint wavefrontStage;
+  uint sampleLights;  // A VkBool32
+  uint russianRouletteStart;
+  uint samplerType;  // One of SAMPLER_*
+  uint denoise;      // A VkBool32
+};
+
+// 64-bit count of traced ray segments, split in two uints so that the shader doesn't need 64-bit
+// atomics: whoever makes `low` wrap around adds the carry to `high`.
+struct RayCounter
+{
+  uint low;
+  uint high;
+};
+
+// Where a mesh's data starts in the vertex, index and hit record buffers. Each TLAS instance
+// stores the index of its mesh in instanceCustomIndex.
+struct MeshInfo
+{
+  uint firstVertex;
+  uint firstIndex;
+  uint firstPrimitive;
+};
+
+// Everything the compact geometry layout needs to shade a hit on a triangle (see compact_geometry.hpp).
+struct HitRecord
+{
+  uint octahedralNormal;  // Object-space face normal, octahedral-encoded with packSnorm2x16
+  uint materialID;
+};
+
+// A Lambertian surface that can emit light. Each TLAS instance stores the index of its mesh's material 0 in
+// instanceShaderBindingTableRecordOffset, which ray queries don't otherwise use.
+struct Material
+{
+  vec3 diffuse;
+  vec3 emission;  // Radiance, the same on both sides
+};
+
+// A world-space emissive triangle, and its entry of the alias table that picks triangles in proportion to
+// their power (area * luminance of the emission): entry i is picked with probability `probability`, else
+// entry `alias` is.
+struct EmissiveTriangle
+{
+  vec3  v0;
+  float probability;
+  vec3  v1;
+  uint  alias;
+  vec3  v2;
+  vec3  emission;
+};
+
+// One accumulator per pixel of the current render tile. Each dispatch adds a batch of samples to it, until the pixel's
+// tile has converged. The final color is sum / sampleCount; the sum of squares gives the
+// variance used to decide when a tile has converged.
+struct PixelAccumulator
+{
+  vec3 sum;
+  vec3 sumSquares;
+  uint sampleCount;
+};
+
+// A queue of paths between two stages of the wavefront kernel. Stages that add paths to it also count the
+// workgroups the stage that consumes it needs, so the host dispatches that stage with vkCmdDispatchIndirect
+// on groupCountX/Y/Z, which form a VkDispatchIndirectCommand. The host resets a queue to {0, 0, 1, 1}.
+struct PathQueue
+{
+  uint count;
+  uint groupCountX;
+  uint groupCountY;
+  uint groupCountZ;
+};
+
+// Where the next random numbers of a path come from. Only SAMPLER_PCG uses rngState; the other samplers
+// take the next point of the pixel's sequence for each dimension the path asks for.
+struct PathSampler
+{
+  uint rngState;
+  uint sampleIndex;  // Index of the path's sample among the pixel's samples
+  uint dimension;    // Number of points the path has taken so far
+  uint pixel;        // Index of the pixel in the image
+};
+
+// State of one path of the wavefront kernel, between two stages.
+struct WavefrontPath
+{
+  vec3        origin;            // Origin of the next segment; in PATH_QUEUE_HIT, the hit position
+  uint        accumulatorIndex;  // Pixel of the render tile the path belongs to
+  vec3        direction;         // Direction of the next segment; in PATH_QUEUE_HIT, of the segment that hit
+  float       bsdfPdf;           // Solid-angle pdf of the direction of the last segment; 0 for camera rays
+  vec3        throughput;        // The amount of light that made it to the end of the path so far
+  vec3        normal;            // In PATH_QUEUE_HIT: the world-space normal at the hit
+  vec3        radiance;          // The light the path has gathered so far, which goes to the pixel when the path ends
+  PathSampler pathSampler;
+};
+
+// The first-hit AOVs (arbitrary output values) of a pixel, summed over its samples like its PixelAccumulator, which
+// guide the edge-stopping weights of the denoiser (see denoiser.hpp). Camera rays that escape count the sky color as
+// their albedo, SKY_DEPTH as their depth, and the direction they came from as their normal.
+struct PixelAovs
+{
+  vec3  albedo;  // Diffuse color of the first hit
+  float depth;   // Distance from the camera to the first hit
+  vec3  normal;  // World-space normal of the first hit, on the side of the camera
+};
+
+#define SKY_DEPTH 10000.0  // Depth of the sky: the longest segment a ray traces
+
+// A pixel of the denoiser's images: the illumination (the color divided by the albedo) filtered so far, and the
+// variance of its luminance. The last pass multiplies the albedo back in.
+struct DenoiserPixel
+{
+  vec3  illumination;
+  float variance;
+  vec2  depthSlope;  // How much the depth of the surface changes per pixel in x and y; from the prepare pass
+};
+
+// Noise estimate of one tile, for the convergence test on the host (see convergence.hpp).
+struct TileStats
+{
+  float meanNoise;       // Average over the tile's pixels of the relative standard error of their mean
+  uint  minSampleCount;  // Fewest samples of any pixel of the tile
+};
+
+// Members are ordered so that the std430 layout of the push constant block matches the C++ layout.
+struct PushConstants
+{
+  vec3  cameraOrigin;       // Position of the camera
+  float fovVerticalSlope;   // Vertical slope of the topmost rays, which defines the field of view
+  vec3  cameraRight;        // Camera basis: right, up, and forward (the viewing direction)
+  uint  batchIndex;         // Index of the current batch of samples, from --first-sample on; offsets the RNG seed
+  vec3  cameraUp;
+  uint  samplesPerBatch;    // Number of samples each pixel traces in this dispatch
+  vec3  cameraForward;
+  uint  sampleIndex;        // Wavefront kernel: the sample of the batch that the stages are tracing
+  uvec2 resolution;         // Size of the image in pixels
+  uvec2 tileOrigin;         // Render tile that this dispatch covers, in pixels; the accumulation buffer
+  uvec2 tileSize;           // only holds the tile's pixels, row by row (see GpuRenderer::render)
+  uint  segment;            // Wavefront kernel: the segment of the paths that the stages are tracing
+  uint  lightCount;         // Number of EmissiveTriangles
+  float inverseLightPower;  // 1 / the summed power of the lights: a light sample's area pdf is luminance(emission) * this
+  uint  seed;               // --seed: runs with different seeds trace independent samples
+  uint  denoisePass;        // denoise.comp.glsl: the pass to run; 0 prepares the image, pass i > 0 filters with a step of 2^(i-1) pixels
+  uint  denoisePassCount;   // and the number of passes, the last of which writes the denoised image
+  uint  firstSample;        // --first-sample: index of the job's first sample, which low-discrepancy samplers start from
+};
+
+#ifdef __cplusplus
+}  // namespace shaderio
+#endif
+
+#endif  // HOST_DEVICE_H
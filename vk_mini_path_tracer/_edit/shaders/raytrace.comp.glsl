@@ -3,24 +3,128 @@
 #version 460
 #extension GL_EXT_scalar_block_layout : require
 #extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : require
 
-layout(local_size_x = 16, local_size_y = 8, local_size_z = 1) in;
+#include "host_device.h"
+
+// The workgroup size and the number of segments are specialization constants (see host_device.h),
+// set by the host when it creates the pipeline. The host always sets the workgroup size; the
+// default of 1 x 1 here is only what the SPIR-V contains.
+layout(local_size_x_id = SPEC_WORKGROUP_WIDTH, local_size_y_id = SPEC_WORKGROUP_HEIGHT, local_size_z = 1) in;
+layout(constant_id = SPEC_MAX_SEGMENTS) const uint MAX_SEGMENTS = 32;
+layout(constant_id = SPEC_COUNT_RAYS) const bool COUNT_RAYS = false;
+layout(constant_id = SPEC_COMPACT_GEOMETRY) const bool COMPACT_GEOMETRY = false;
+// The megakernel, or one of the stages of the wavefront kernel (see WAVEFRONT_STAGE_* in host_device.h).
+layout(constant_id = SPEC_WAVEFRONT_STAGE) const uint WAVEFRONT_STAGE = WAVEFRONT_STAGE_NONE;
+// Next-event estimation: at each bounce, trace a shadow ray to a point on a light, and weight it against the
+// bounce that may hit the same light with multiple importance sampling. The host turns this off for scenes without lights.
+layout(constant_id = SPEC_SAMPLE_LIGHTS) const bool SAMPLE_LIGHTS = false;
+// Paths that have traced this many segments continue with a probability that follows their throughput; 0 = never end early.
+layout(constant_id = SPEC_RUSSIAN_ROULETTE) const uint RUSSIAN_ROULETTE_START = 0;
+// Where the random numbers of paths come from (see SAMPLER_* in host_device.h, and samplers.hpp).
+layout(constant_id = SPEC_SAMPLER) const uint SAMPLER = SAMPLER_PCG;
+// Whether the first segment of each sample adds its albedo, depth and normal to the pixel's PixelAovs, for the denoiser.
+layout(constant_id = SPEC_DENOISE) const bool DENOISE = false;
 
 // The scalar layout qualifier here means to align types according to the alignment
 // of their scalar components, instead of e.g. padding them to std140 rules.
-layout(binding = 0, set = 0, scalar) buffer storageBuffer
+layout(binding = BINDING_ACCUMULATORS, set = 0, scalar) buffer storageBuffer
 {
-  vec3 imageData[];
+  PixelAccumulator accumulators[];
 };
-layout(binding = 1, set = 0) uniform accelerationStructureEXT tlas;
-layout(binding = 2, set = 0, scalar) buffer Vertices
+layout(binding = BINDING_TLAS, set = 0) uniform accelerationStructureEXT tlas;
+layout(binding = BINDING_VERTICES, set = 0, scalar) buffer Vertices
 {
   vec3 vertices[];
 };
-layout(binding = 3, set = 0, scalar) buffer Indices
+layout(binding = BINDING_INDICES, set = 0, scalar) buffer Indices
 {
   uint indices[];
 };
+// One flag per workgroup. The host clears the flags of tiles whose noise is below the target.
+layout(binding = BINDING_TILE_MASK, set = 0, scalar) buffer TileMask
+{
+  uint tileActive[];
+};
+
+// Offsets of each mesh in the vertex and index buffers, indexed by the instance custom index.
+layout(binding = BINDING_MESHES, set = 0, scalar) buffer Meshes
+{
+  MeshInfo meshes[];
+};
+
+// One record per triangle of each mesh, starting at the mesh's firstPrimitive. Only read when COMPACT_GEOMETRY
+// is true; then, the vertices and indices aren't read at all.
+layout(binding = BINDING_HIT_RECORDS, set = 0, scalar) buffer HitRecords
+{
+  HitRecord hitRecords[];
+};
+
+// The scene's materials. Each instance's materials start at its SBT record offset.
+layout(binding = BINDING_MATERIALS, set = 0, scalar) buffer Materials
+{
+  Material materials[];
+};
+
+// The material ID of each triangle of each mesh, starting at the mesh's firstPrimitive. Only read when
+// COMPACT_GEOMETRY is false; hit records have their own.
+layout(binding = BINDING_MATERIAL_IDS, set = 0, scalar) buffer MaterialIds
+{
+  uint materialIds[];
+};
+
+// The emissive triangles, which light sampling picks with their alias table; pushConstants.lightCount long.
+layout(binding = BINDING_LIGHTS, set = 0, scalar) buffer Lights
+{
+  EmissiveTriangle lights[];
+};
+
+// The tables of the low-discrepancy samplers, which the host generates (see samplers.hpp). Only read when
+// SAMPLER isn't SAMPLER_PCG.
+layout(binding = BINDING_SOBOL, set = 0, scalar) buffer SobolMatrices
+{
+  uint sobolMatrices[SOBOL_DIMENSIONS * 32];
+};
+layout(binding = BINDING_BLUE_NOISE, set = 0, scalar) buffer BlueNoise
+{
+  uint blueNoise[BLUE_NOISE_SIZE * BLUE_NOISE_SIZE];
+};
+
+// Number of rays traced, for profiling. Only written when COUNT_RAYS is true.
+layout(binding = BINDING_RAY_COUNTER, set = 0, scalar) buffer RayCounterBuffer
+{
+  RayCounter rayCounter;
+};
+
+// The buffers of the wavefront kernel, which the megakernel doesn't use. The paths of each queue are stored
+// in their own region of `paths`, of one slot per pixel of the render tile, since a pixel has at most one live
+// path at a time: each stage traces one sample of every pixel.
+layout(binding = BINDING_PATHS, set = 0, scalar) buffer Paths
+{
+  WavefrontPath paths[];
+};
+layout(binding = BINDING_PATH_QUEUES, set = 0, scalar) buffer PathQueues
+{
+  PathQueue queues[PATH_QUEUE_COUNT];
+};
+// The RNG state each pixel's last path ended with, which its next sample continues from.
+layout(binding = BINDING_PIXEL_RNG, set = 0, scalar) buffer PixelRng
+{
+  uint pixelRngStates[];
+};
+layout(binding = BINDING_PATH_COUNTS, set = 0, scalar) buffer PathCounts
+{
+  RayCounter pathCounts[];
+};
+layout(binding = BINDING_AOVS, set = 0, scalar) buffer Aovs
+{
+  PixelAovs pixelAovs[];
+};
+
+layout(push_constant) uniform PushConstantBlock
+{
+  PushConstants pushConstants;
+};
 
 // Random number generation using pcg32i_random_t, using inc = 1. Our random state is a uint.
 uint stepRNG(uint rngState)
@@ -38,6 +142,98 @@ float stepAndOutputRNGFloat(inout uint rngState)
   return float(word) / 4294967295.0f;
 }
 
+// The initial RNG state of a pixel in a batch. Each batch starts from a different seed, so that batches trace
+// independent samples; --seed scrambles the seeds of all pixels, and seed 0 leaves them as they were.
+// Seeds depend on the pixel's position in the image, not in the tile, so tiling doesn't change the image.
+uint pcgSeed(uint batchIndex, uint linearIndex)
+{
+  return (pushConstants.resolution.x * pushConstants.resolution.y * batchIndex + linearIndex) ^ (pushConstants.seed * 0x9E3779B9u);
+}
+
+// Hashes a uint: one step of the PCG generator, and its output function.
+uint hashUint(uint x)
+{
+  const uint state = x * 747796405u + 2891336453u;
+  const uint word  = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+  return (word >> 22) ^ word;
+}
+
+uint hashCombine(uint seed, uint value)
+{
+  return seed ^ (hashUint(value) + 0x9E3779B9u + (seed << 6) + (seed >> 2));
+}
+
+// Owen scrambling: flips each bit of x depending on the bits above it, with the Laine-Karras hash
+// (which does this for the bits below each bit, hence the reversals).
+uint nestedUniformScramble(uint x, uint seed)
+{
+  x = bitfieldReverse(x);
+  x ^= x * 0x3D20ADEAu;
+  x += seed;
+  x *= (seed >> 16) | 1u;
+  x ^= x * 0x05526C56u;
+  x ^= x * 0x53A22864u;
+  return bitfieldReverse(x);
+}
+
+// Point `index` of the 2D Sobol sequence, Owen-scrambled with `seed`. Scrambling the index as well shuffles the
+// order of the points, so that the dimensions of a path, whose seeds differ, aren't correlated with each other.
+vec2 scrambledSobol2D(uint index, uint seed)
+{
+  index       = nestedUniformScramble(index, seed);
+  uvec2 point = uvec2(0);
+  for(uint bit = 0; index != 0; bit++, index >>= 1)
+  {
+    if((index & 1) != 0)
+    {
+      point ^= uvec2(sobolMatrices[bit], sobolMatrices[32 + bit]);
+    }
+  }
+  point = uvec2(nestedUniformScramble(point.x, hashCombine(seed, 0u)), nestedUniformScramble(point.y, hashCombine(seed, 1u)));
+  return vec2(point >> 8) / 16777216.0;  // 24 bits, so that the conversion to float can't round up to 1
+}
+
+uint blueNoiseRank(uint x, uint y)
+{
+  return blueNoise[(y % BLUE_NOISE_SIZE) * BLUE_NOISE_SIZE + x % BLUE_NOISE_SIZE];
+}
+
+// Returns the next 2D point of a path, in [0, 1]^2. Every 2D point a path takes (the position in the pixel, the
+// point on a light, the bounce direction...) has its own dimension, with its own scrambling.
+vec2 sample2D(inout PathSampler pathSampler)
+{
+  if(SAMPLER == SAMPLER_PCG)
+  {
+    const float x = stepAndOutputRNGFloat(pathSampler.rngState);
+    const float y = stepAndOutputRNGFloat(pathSampler.rngState);
+    return vec2(x, y);
+  }
+  const uint dimensionSeed = hashCombine(hashUint(pushConstants.seed), pathSampler.dimension++);
+  if(SAMPLER == SAMPLER_SOBOL)
+  {
+    return scrambledSobol2D(pathSampler.sampleIndex, hashCombine(dimensionSeed, pathSampler.pixel));
+  }
+  // SAMPLER_BLUE_NOISE: all pixels take the same points, shifted toroidally by the blue-noise mask, which is read
+  // at a different offset for each coordinate of each dimension.
+  const uint texelX = pathSampler.pixel % pushConstants.resolution.x;
+  const uint texelY = pathSampler.pixel / pushConstants.resolution.x;
+  const uint shiftX = hashUint(dimensionSeed);
+  const uint shiftY = hashUint(shiftX);
+  const vec2 shift  = (vec2(blueNoiseRank(texelX + shiftX, texelY + (shiftX >> 16)), blueNoiseRank(texelX + shiftY, texelY + (shiftY >> 16))) + 0.5)
+                     / float(BLUE_NOISE_SIZE * BLUE_NOISE_SIZE);
+  return fract(scrambledSobol2D(pathSampler.sampleIndex, dimensionSeed) + shift);
+}
+
+// Returns the next 1D sample of a path, in [0, 1]: with a low-discrepancy sampler, the first coordinate of a 2D point.
+float sample1D(inout PathSampler pathSampler)
+{
+  if(SAMPLER == SAMPLER_PCG)
+  {
+    return stepAndOutputRNGFloat(pathSampler.rngState);
+  }
+  return sample2D(pathSampler).x;
+}
+
 // Returns the color of the sky in a given direction (in linear color space)
 vec3 skyColor(vec3 direction)
 {
@@ -52,23 +248,61 @@ vec3 skyColor(vec3 direction)
   }
 }
 
+// Decodes a unit vector encoded by EncodeOctahedral() in compact_geometry.cpp.
+vec3 decodeOctahedral(uint encoded)
+{
+  const vec2 f = unpackSnorm2x16(encoded);
+  vec3       n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+  // Unfold the lower half of the octahedron
+  const float t = max(-n.z, 0.0);
+  n.x += (n.x >= 0.0) ? -t : t;
+  n.y += (n.y >= 0.0) ? -t : t;
+  return normalize(n);
+}
+
 struct HitInfo
 {
   vec3 color;
+  vec3 emission;
   vec3 worldPosition;
   vec3 worldNormal;
 };
 
+// Fills in the material of a hit, from the triangle's material ID within its mesh.
+void setMaterial(rayQueryEXT rayQuery, uint materialID, inout HitInfo hitInfo)
+{
+  const Material material = materials[rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(rayQuery, true) + materialID];
+  hitInfo.color           = material.diffuse;
+  hitInfo.emission        = material.emission;
+}
+
 HitInfo getObjectHitInfo(rayQueryEXT rayQuery)
 {
   HitInfo result;
-  // Get the ID of the triangle
+  // Get the ID of the triangle, within its mesh
   const int primitiveID = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true);
+  // Get the mesh of the instance that was hit: the host stores its index in the instance's custom index
+  const MeshInfo mesh = meshes[rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, true)];
+
+  // Normals transform with the inverse transpose of the object-to-world matrix; multiplying on the
+  // left by the world-to-object matrix is the same as multiplying by its transpose on the right.
+  const mat4x3 worldToObject = rayQueryGetIntersectionWorldToObjectEXT(rayQuery, true);
+
+  if(COMPACT_GEOMETRY)
+  {
+    // Compact layout: one record holds everything needed to shade the hit, and the position is on the ray.
+    const HitRecord record = hitRecords[mesh.firstPrimitive + primitiveID];
+    result.worldPosition   = rayQueryGetWorldRayOriginEXT(rayQuery)
+                           + rayQueryGetIntersectionTEXT(rayQuery, true) * rayQueryGetWorldRayDirectionEXT(rayQuery);
+    result.worldNormal     = normalize(decodeOctahedral(record.octahedralNormal) * mat3(worldToObject));
+    setMaterial(rayQuery, record.materialID, result);
+    return result;
+  }
 
   // Get the indices of the vertices of the triangle
-  const uint i0 = indices[3 * primitiveID + 0];
-  const uint i1 = indices[3 * primitiveID + 1];
-  const uint i2 = indices[3 * primitiveID + 2];
+  const uint i0 = mesh.firstVertex + indices[mesh.firstIndex + 3 * primitiveID + 0];
+  const uint i1 = mesh.firstVertex + indices[mesh.firstIndex + 3 * primitiveID + 1];
+  const uint i2 = mesh.firstVertex + indices[mesh.firstIndex + 3 * primitiveID + 2];
 
   // Get the vertices of the triangle
   const vec3 v0 = vertices[i0];
@@ -81,8 +315,9 @@ HitInfo getObjectHitInfo(rayQueryEXT rayQuery)
 
   // Compute the coordinates of the intersection
   const vec3 objectPos = v0 * barycentrics.x + v1 * barycentrics.y + v2 * barycentrics.z;
-  // For the main tutorial, object space is the same as world space:
-  result.worldPosition = objectPos;
+  // Transform it to world space with the instance's transform:
+  const mat4x3 objectToWorld = rayQueryGetIntersectionObjectToWorldEXT(rayQuery, true);
+  result.worldPosition       = objectToWorld * vec4(objectPos, 1.0f);
 
   // Compute the normal of the triangle in object space, using the right-hand rule:
   //    v2      .
@@ -94,21 +329,417 @@ HitInfo getObjectHitInfo(rayQueryEXT rayQuery)
   //  L v0---v1 .
   // n
   const vec3 objectNormal = normalize(cross(v1 - v0, v2 - v0));
-  // For the main tutorial, object space is the same as world space:
-  result.worldNormal = objectNormal;
+  // Transform it to world space:
+  result.worldNormal = normalize(objectNormal * mat3(worldToObject));
 
-  result.color = vec3(0.7f);
+  setMaterial(rayQuery, materialIds[mesh.firstPrimitive + primitiveID], result);
 
   return result;
 }
 
+// Returns the direction of a ray from the camera through a random point of `pixel`.
+vec3 cameraRayDirection(uvec2 pixel, inout PathSampler pathSampler)
+{
+  const uvec2 resolution = pushConstants.resolution;
+  // Define the field of view by the vertical slope of the topmost rays:
+  const float fovVerticalSlope = pushConstants.fovVerticalSlope;
+
+  // Compute the direction of the ray for this pixel. To do this, we first
+  // transform the screen coordinates to look like this, where a is the
+  // aspect ratio (width/height) of the screen:
+  //           1
+  //    .------+------.
+  //    |      |      |
+  // -a + ---- 0 ---- + a
+  //    |      |      |
+  //    '------+------'
+  //          -1
+  const vec2 randomPixelCenter = vec2(pixel) + sample2D(pathSampler);
+  const vec2 screenUV          = vec2((2.0 * randomPixelCenter.x - resolution.x) / resolution.y,    //
+                             -(2.0 * randomPixelCenter.y - resolution.y) / resolution.y);  // Flip the y axis
+  // Create a ray direction in the camera's basis:
+  vec3 rayDirection = fovVerticalSlope * screenUV.x * pushConstants.cameraRight  //
+                      + fovVerticalSlope * screenUV.y * pushConstants.cameraUp   //
+                      + pushConstants.cameraForward;
+  return normalize(rayDirection);
+}
+
+// Traces one ray segment. Returns true and fills hitInfo if it hit a triangle, and false if it hit the sky.
+bool traceSegment(vec3 rayOrigin, vec3 rayDirection, out HitInfo hitInfo)
+{
+  // Trace the ray and see if and where it intersects the scene!
+  // First, initialize a ray query object:
+  rayQueryEXT rayQuery;
+  rayQueryInitializeEXT(rayQuery,              // Ray query
+                        tlas,                  // Top-level acceleration structure
+                        gl_RayFlagsOpaqueEXT,  // Ray flags, here saying "treat all geometry as opaque"
+                        0xFF,                  // 8-bit instance mask, here saying "trace against all instances"
+                        rayOrigin,             // Ray origin
+                        0.0,                   // Minimum t-value
+                        rayDirection,          // Ray direction
+                        10000.0);              // Maximum t-value
+
+  // Start traversal, and loop over all ray-scene intersections. When this finishes,
+  // rayQuery stores a "committed" intersection, the closest intersection (if any).
+  while(rayQueryProceedEXT(rayQuery))
+  {
+  }
+
+  // Get the type of committed (true) intersection - nothing, a triangle, or
+  // a generated object
+  if(rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT)
+  {
+    hitInfo = getObjectHitInfo(rayQuery);
+    return true;
+  }
+  return false;
+}
+
+// Returns the direction a ray bounces to from a diffuse surface with the given world-space normal.
+vec3 scatterLambertian(vec3 worldNormal, inout PathSampler pathSampler)
+{
+  // Diffuse Reflection Algorithm: Lambertian material model
+  // A surface, a normal at an intersection point, and a sphere (here represented by a circle) centered at that normal of radius 1.
+  // To sample a random Lambertian reflection direction, choose a random point on the sphere, then normalize it; this gives the needed distribution! 
+  // p is then a random point on the unit sphere centered at (0,0,0). We then add the world-space normal, then normalize, to get the reflected ray direction. 
+
+  const vec2  random = sample2D(pathSampler);
+  const float theta  = 6.2831853 * random.x;  // Random in [0, 2pi] theta = 2pi * random_number
+  const float u      = 2.0 * random.y - 1.0;  // Random in [-1, 1] u = 2b - 1
+  const float r      = sqrt(1.0 - u * u);
+
+  const vec3 rayDirection = worldNormal + vec3(r * cos(theta), r * sin(theta), u);  // point p = (r*sin(theta), r*cos(theta), u) + world-space normal
+  return normalize(rayDirection);                                                    // normalize the ray direction p
+}
+
+// Whether nothing blocks the segment from rayOrigin to rayOrigin + tMax * rayDirection. Any hit will do, so
+// traversal stops at the first one instead of looking for the closest.
+bool isUnoccluded(vec3 rayOrigin, vec3 rayDirection, float tMax)
+{
+  rayQueryEXT rayQuery;
+  rayQueryInitializeEXT(rayQuery, tlas, gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT, 0xFF, rayOrigin, 0.0,
+                        rayDirection, tMax);
+  while(rayQueryProceedEXT(rayQuery))
+  {
+  }
+  return rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionNoneEXT;
+}
+
+// Luminance of a linear Rec. 709 color, which weights the lights for sampling (see light_table.hpp).
+float luminance(vec3 color)
+{
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Solid-angle pdf of scatterLambertian() about `normal`.
+float lambertianPdf(vec3 normal, vec3 direction)
+{
+  return max(dot(normal, direction), 0.0) / 3.14159265;
+}
+
+// Solid-angle pdf with which sampleLight() picks a point of a light at `distance`, seen at `cosLight` to its normal.
+float lightPdf(vec3 emission, float distance, float cosLight)
+{
+  return luminance(emission) * pushConstants.inverseLightPower * distance * distance / max(cosLight, 1e-6);
+}
+
+// The power heuristic of multiple importance sampling, for one sample of each of two strategies.
+float powerHeuristic(float pdf, float otherPdf)
+{
+  return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// The light a segment that hit a triangle brings back from its emission, weighted against the light sample of the
+// previous bounce, which could have found the same point. bsdfPdf is 0 for camera rays, which nothing else samples.
+vec3 emittedLight(HitInfo hitInfo, vec3 rayOrigin, vec3 rayDirection, float bsdfPdf)
+{
+  if(!SAMPLE_LIGHTS || bsdfPdf == 0.0 || hitInfo.emission == vec3(0.0))
+  {
+    return hitInfo.emission;
+  }
+  const float distance = length(hitInfo.worldPosition - rayOrigin);
+  const float cosLight = abs(dot(rayDirection, hitInfo.worldNormal));
+  return hitInfo.emission * powerHeuristic(bsdfPdf, lightPdf(hitInfo.emission, distance, cosLight));
+}
+
+// Next-event estimation: picks a light with the alias table and a uniform point on it, and returns the light that
+// arrives from it at `origin` and scatters off the diffuse surface with the given normal, divided by the albedo
+// (which is in the path's throughput already), weighted against the bounce that could hit the same point.
+// Always takes a 1D and a 2D sample, so that both kernels stay in step.
+vec3 sampleLight(vec3 origin, vec3 normal, inout PathSampler pathSampler)
+{
+  // One random number picks the alias table entry, and its fraction decides between the entry and its alias
+  const float scaled = sample1D(pathSampler) * float(pushConstants.lightCount);
+  uint        index  = min(uint(scaled), pushConstants.lightCount - 1);
+  if(scaled - float(index) >= lights[index].probability)
+  {
+    index = lights[index].alias;
+  }
+  const EmissiveTriangle light = lights[index];
+
+  // A uniform point on the triangle
+  const vec2  random = sample2D(pathSampler);
+  const float rootU  = sqrt(random.x);
+  const vec3  point  = (1.0 - rootU) * light.v0 + rootU * (1.0 - random.y) * light.v1 + rootU * random.y * light.v2;
+
+  const vec3  toLight    = point - origin;
+  const float distance   = length(toLight);
+  const vec3  direction  = toLight / distance;
+  const float cosSurface = dot(normal, direction);
+  const float cosLight   = abs(dot(normalize(cross(light.v1 - light.v0, light.v2 - light.v0)), direction));
+  if(cosSurface <= 0.0 || cosLight <= 0.0 || !isUnoccluded(origin, direction, distance * 0.999))
+  {
+    return vec3(0.0);
+  }
+  const float pdf = lightPdf(light.emission, distance, cosLight);
+  return light.emission * (cosSurface / 3.14159265) * powerHeuristic(pdf, lambertianPdf(normal, direction)) / pdf;
+}
+
+// Russian roulette: once a path has traced RUSSIAN_ROULETTE_START segments, it continues with a probability that
+// follows its throughput, and its throughput is divided by that probability so that the image stays unbiased.
+// Returns false if the path ends. Takes one 1D sample when it plays.
+bool survivesRussianRoulette(uint tracedSegments, inout vec3 throughput, inout PathSampler pathSampler)
+{
+  if(RUSSIAN_ROULETTE_START == 0 || tracedSegments < RUSSIAN_ROULETTE_START)
+  {
+    return true;
+  }
+  const float survival = min(max(throughput.r, max(throughput.g, throughput.b)), 0.95);
+  if(sample1D(pathSampler) >= survival)
+  {
+    return false;
+  }
+  throughput /= survival;
+  return true;
+}
+
+// Adds `count` to the ray counter. atomicAdd returns the old value of `low`, so the addition
+// wrapped around if the new value is smaller than the old one.
+void addToRayCounter(uint count)
+{
+  const uint previousLow = atomicAdd(rayCounter.low, count);
+  if(previousLow + count < previousLow)
+  {
+    atomicAdd(rayCounter.high, 1);
+  }
+}
+
+// Wavefront kernel
+// Each stage below is its own pipeline; the host dispatches generate once per sample, then extend, miss and
+// shade once per segment. The queue stages are dispatched indirectly, with as many workgroups as their input
+// queue needs, so their invocations only run on live paths: a path that escapes after one segment leaves no
+// idle invocation behind while other paths keep bouncing, as it does in the megakernel.
+
+// Number of invocations of a workgroup; the stages that read queues are one-dimensional within it.
+const uint kWorkgroupSize = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+
+// Appends a path to a queue, and counts the workgroups the queue's consumer needs.
+void pushPath(uint queue, WavefrontPath path)
+{
+  const uint slot = atomicAdd(queues[queue].count, 1);
+  // Whoever takes the first slot of a workgroup adds that workgroup to the indirect dispatch
+  if(slot % kWorkgroupSize == 0)
+  {
+    atomicAdd(queues[queue].groupCountX, 1);
+  }
+  const uint pathCapacity            = pushConstants.tileSize.x * pushConstants.tileSize.y;
+  paths[queue * pathCapacity + slot] = path;
+}
+
+// Reads this invocation's path from a queue. Returns false if the queue has no path for it.
+bool readQueuedPath(uint queue, out WavefrontPath path)
+{
+  const uint slot = gl_WorkGroupID.x * kWorkgroupSize + gl_LocalInvocationIndex;
+  if(slot >= queues[queue].count)
+  {
+    return false;
+  }
+  const uint pathCapacity = pushConstants.tileSize.x * pushConstants.tileSize.y;
+  path                    = paths[queue * pathCapacity + slot];
+  return true;
+}
+
+// Starts this pixel's next sample at the camera.
+void generatePath(uvec2 pixel, uint accumulatorIndex, uint linearIndex)
+{
+  WavefrontPath path;
+  path.accumulatorIndex = accumulatorIndex;
+  // The first sample of a batch starts from the batch's seed, like the megakernel; later ones continue
+  // from where the pixel's previous path left the RNG, so both kernels trace the same samples.
+  path.pathSampler.rngState = (pushConstants.sampleIndex == 0) ? pcgSeed(pushConstants.batchIndex, linearIndex) : pixelRngStates[accumulatorIndex];
+  // The index of the pixel's next sample, which the low-discrepancy samplers index their points with
+  path.pathSampler.sampleIndex = pushConstants.firstSample + accumulators[accumulatorIndex].sampleCount;
+  path.pathSampler.dimension   = 0;
+  path.pathSampler.pixel       = linearIndex;
+  path.origin                  = pushConstants.cameraOrigin;
+  path.direction               = cameraRayDirection(pixel, path.pathSampler);
+  path.throughput              = vec3(1.0);
+  path.bsdfPdf                 = 0.0;
+  path.normal                  = vec3(0.0);
+  path.radiance                = vec3(0.0);
+  pushPath(PATH_QUEUE_EXTEND, path);
+
+  // The sample counts whether or not its path escapes, as in the megakernel
+  accumulators[accumulatorIndex].sampleCount += 1;
+}
+
+// The AOVs of the first segment of a sample (see PixelAovs), which started at the camera.
+PixelAovs firstHitAovs(bool hit, HitInfo hitInfo, vec3 rayDirection)
+{
+  PixelAovs aovs;
+  if(hit)
+  {
+    aovs.albedo = hitInfo.color;
+    aovs.depth  = length(hitInfo.worldPosition - pushConstants.cameraOrigin);
+    aovs.normal = faceforward(hitInfo.worldNormal, rayDirection, hitInfo.worldNormal);
+  }
+  else
+  {
+    aovs.albedo = skyColor(rayDirection);
+    aovs.depth  = SKY_DEPTH;
+    aovs.normal = -rayDirection;
+  }
+  return aovs;
+}
+
+// Adds the AOVs of a sample to its pixel's. Each pixel has one invocation, so no other one writes them.
+void addAovs(uint accumulatorIndex, PixelAovs aovs)
+{
+  pixelAovs[accumulatorIndex].albedo += aovs.albedo;
+  pixelAovs[accumulatorIndex].depth += aovs.depth;
+  pixelAovs[accumulatorIndex].normal += aovs.normal;
+}
+
+void extendPath()
+{
+  // One invocation records how many paths are alive at this segment, and how many rays that is.
+  // The count is final, since the previous stage has finished.
+  if(gl_WorkGroupID.x == 0 && gl_LocalInvocationIndex == 0)
+  {
+    const uint liveCount   = queues[PATH_QUEUE_EXTEND].count;
+    const uint previousLow = atomicAdd(pathCounts[pushConstants.segment].low, liveCount);
+    if(previousLow + liveCount < previousLow)
+    {
+      atomicAdd(pathCounts[pushConstants.segment].high, 1);
+    }
+    if(COUNT_RAYS)
+    {
+      addToRayCounter(liveCount);
+    }
+  }
+
+  WavefrontPath path;
+  if(!readQueuedPath(PATH_QUEUE_EXTEND, path))
+  {
+    return;
+  }
+
+  HitInfo    hitInfo;
+  const bool hit = traceSegment(path.origin, path.direction, hitInfo);
+  if(DENOISE && pushConstants.segment == 0)
+  {
+    addAovs(path.accumulatorIndex, firstHitAovs(hit, hitInfo, path.direction));
+  }
+  if(hit)
+  {
+    path.radiance += path.throughput * emittedLight(hitInfo, path.origin, path.direction, path.bsdfPdf);
+    // Apply color absorption here, so that the shade stage only needs the position and normal of the hit
+    path.throughput *= hitInfo.color;
+    path.origin = hitInfo.worldPosition;
+    path.normal = hitInfo.worldNormal;
+    pushPath(PATH_QUEUE_HIT, path);
+  }
+  else
+  {
+    pushPath(PATH_QUEUE_MISS, path);
+  }
+}
+
+// Adds the light a path gathered to its pixel, and keeps its RNG state for the pixel's next sample. Each pixel
+// has at most one path in the queues, so no other invocation writes its accumulator.
+void finishPath(WavefrontPath path)
+{
+  accumulators[path.accumulatorIndex].sum += path.radiance;
+  accumulators[path.accumulatorIndex].sumSquares += path.radiance * path.radiance;
+  pixelRngStates[path.accumulatorIndex] = path.pathSampler.rngState;
+}
+
+void shadePath()
+{
+  // Each hit traces one shadow ray; count them like extendPath() counts segments.
+  if(COUNT_RAYS && SAMPLE_LIGHTS && gl_WorkGroupID.x == 0 && gl_LocalInvocationIndex == 0)
+  {
+    addToRayCounter(queues[PATH_QUEUE_HIT].count);
+  }
+
+  WavefrontPath path;
+  if(!readQueuedPath(PATH_QUEUE_HIT, path))
+  {
+    return;
+  }
+
+  // Start the next ray at the hit position, offset against the direction of the segment that hit
+  path.origin = path.origin - 0.0001 * sign(dot(path.direction, path.normal)) * path.normal;
+
+  // Shade the side of the surface the segment came from: about a normal that faces away from it, the light
+  // sample and the bounce would go through the surface.
+  const vec3 normal = faceforward(path.normal, path.direction, path.normal);
+  if(SAMPLE_LIGHTS)
+  {
+    path.radiance += path.throughput * sampleLight(path.origin, normal, path.pathSampler);
+  }
+  path.direction = scatterLambertian(normal, path.pathSampler);
+  path.bsdfPdf   = lambertianPdf(normal, path.direction);
+
+  if(survivesRussianRoulette(pushConstants.segment + 1, path.throughput, path.pathSampler) && pushConstants.segment + 1 < MAX_SEGMENTS)
+  {
+    pushPath(PATH_QUEUE_EXTEND, path);
+  }
+  else
+  {
+    // Russian roulette ended the path, or it has traced MAX_SEGMENTS segments
+    finishPath(path);
+  }
+}
+
+void accumulateMissedPath()
+{
+  WavefrontPath path;
+  if(!readQueuedPath(PATH_QUEUE_MISS, path))
+  {
+    return;
+  }
+
+  // Ray hit the sky
+  path.radiance += path.throughput * skyColor(path.direction);
+  finishPath(path);
+}
+
 void main()
 {
-  // The resolution of the buffer, which in this case is a hardcoded vector
-  // of 2 unsigned integers:
-  const uvec2 resolution = uvec2(800, 600);
+  // The stages that read queues have one invocation per queued path
+  if(WAVEFRONT_STAGE == WAVEFRONT_STAGE_EXTEND)
+  {
+    extendPath();
+    return;
+  }
+  if(WAVEFRONT_STAGE == WAVEFRONT_STAGE_SHADE)
+  {
+    shadePath();
+    return;
+  }
+  if(WAVEFRONT_STAGE == WAVEFRONT_STAGE_MISS)
+  {
+    accumulateMissedPath();
+    return;
+  }
+
+  // The megakernel and the generate stage have one invocation per pixel.
+  // The resolution of the image, which the host sets for each render job:
+  const uvec2 resolution = pushConstants.resolution;
 
-  // Get the coordinates of the pixel for this invocation:
+  // Get the coordinates of the pixel for this invocation. The dispatch covers one render tile
+  // of the image, which starts at tileOrigin:
   //
   // .-------.-> x
   // |       |
@@ -116,80 +747,84 @@ void main()
   // '-------'
   // v
   // y
-  const uvec2 pixel = gl_GlobalInvocationID.xy;
+  const uvec2 tilePixel = gl_GlobalInvocationID.xy;
+  const uvec2 pixel     = pushConstants.tileOrigin + tilePixel;
+
+  // If the pixel is outside of the tile, don't do anything:
+  if((tilePixel.x >= pushConstants.tileSize.x) || (tilePixel.y >= pushConstants.tileSize.y))
+  {
+    return;
+  }
 
-  // If the pixel is outside of the image, don't do anything:
-  if((pixel.x >= resolution.x) || (pixel.y >= resolution.y))
+  // If this workgroup's tile has already converged, don't do anything either:
+  if(tileActive[gl_NumWorkGroups.x * gl_WorkGroupID.y + gl_WorkGroupID.x] == 0)
   {
     return;
   }
 
-  // State of the random number generator.
-  uint rngState = resolution.x * pixel.y + pixel.x;  // Initial seed
+  // Get the index of this invocation in the accumulation buffer, and of its pixel in the image:
+  const uint accumulatorIndex = pushConstants.tileSize.x * tilePixel.y + tilePixel.x;
+  const uint linearIndex      = resolution.x * pixel.y + pixel.x;
+
+  if(WAVEFRONT_STAGE == WAVEFRONT_STAGE_GENERATE)
+  {
+    generatePath(pixel, accumulatorIndex, linearIndex);
+    return;
+  }
+
+  // State of the sampler. The random number generator starts from the batch's seed (see pcgSeed()), and the
+  // low-discrepancy samplers continue from the pixel's last sample.
+  PathSampler pathSampler;
+  pathSampler.rngState        = pcgSeed(pushConstants.batchIndex, linearIndex);
+  pathSampler.pixel           = linearIndex;
+  const uint firstSampleIndex = pushConstants.firstSample + accumulators[accumulatorIndex].sampleCount;
 
   // This scene uses a right-handed coordinate system like the OBJ file format, where the
   // +x axis points right, the +y axis points up, and the -z axis points into the screen.
-  // The camera is located at (-0.001, 1, 6).
-  const vec3 cameraOrigin = vec3(-0.001, 1.0, 6.0);
-  // Define the field of view by the vertical slope of the topmost rays:
-  const float fovVerticalSlope = 1.0 / 5.0;
+  // The camera comes from the render job; by default, it is located at (-0.001, 1, 6)
+  // and looks down the -z axis.
+  const vec3 cameraOrigin = pushConstants.cameraOrigin;
 
-  // The sum of the colors of all of the samples.
-  vec3 summedPixelColor = vec3(0.0);
+  // The number of ray segments this invocation traces, when counting rays.
+  uint tracedRays = 0;
 
-  // Limit the kernel to trace at most 64 samples.
-  const int NUM_SAMPLES = 64;
-  for(int sampleIdx = 0; sampleIdx < NUM_SAMPLES; sampleIdx++)
+  // The sum of the colors and of the squared colors of all of the samples in this batch.
+  vec3 summedPixelColor   = vec3(0.0);
+  vec3 summedPixelSquares = vec3(0.0);
+  // And of their first-hit AOVs, when denoising.
+  PixelAovs summedAovs = PixelAovs(vec3(0.0), 0.0, vec3(0.0));
+
+  // Trace one batch of samples; the host dispatches batches until the image has converged.
+  for(uint sampleIdx = 0; sampleIdx < pushConstants.samplesPerBatch; sampleIdx++)
   {
     // Rays always originate at the camera for now. In the future, they'll
     // bounce around the scene.
-    vec3 rayOrigin = cameraOrigin;
-    // Compute the direction of the ray for this pixel. To do this, we first
-    // transform the screen coordinates to look like this, where a is the
-    // aspect ratio (width/height) of the screen:
-    //           1
-    //    .------+------.
-    //    |      |      |
-    // -a + ---- 0 ---- + a
-    //    |      |      |
-    //    '------+------'
-    //          -1
-    const vec2 randomPixelCenter = vec2(pixel) + vec2(stepAndOutputRNGFloat(rngState), stepAndOutputRNGFloat(rngState));
-    const vec2 screenUV          = vec2((2.0 * randomPixelCenter.x - resolution.x) / resolution.y,    //
-                               -(2.0 * randomPixelCenter.y - resolution.y) / resolution.y);  // Flip the y axis
-    // Create a ray direction:
-    vec3 rayDirection = vec3(fovVerticalSlope * screenUV.x, fovVerticalSlope * screenUV.y, -1.0);
-    rayDirection      = normalize(rayDirection);
-
-    vec3 accumulatedRayColor = vec3(1.0);  // The amount of light that made it to the end of the current ray.
-
-    // Limit the kernel to trace at most 32 segments.
-    for(int tracedSegments = 0; tracedSegments < 32; tracedSegments++)
+    pathSampler.sampleIndex = firstSampleIndex + sampleIdx;
+    pathSampler.dimension   = 0;
+    vec3 rayOrigin          = cameraOrigin;
+    vec3 rayDirection       = cameraRayDirection(pixel, pathSampler);
+
+    vec3  accumulatedRayColor = vec3(1.0);  // The amount of light that made it to the end of the current ray.
+    vec3  sampleColor         = vec3(0.0);  // The light gathered along the path so far.
+    float bsdfPdf             = 0.0;        // Solid-angle pdf of rayDirection; 0 for the camera ray.
+
+    // Limit the kernel to trace at most MAX_SEGMENTS segments (32 by default).
+    for(uint tracedSegments = 0; tracedSegments < MAX_SEGMENTS; tracedSegments++)
     {
-      // Trace the ray and see if and where it intersects the scene!
-      // First, initialize a ray query object:
-      rayQueryEXT rayQuery;
-      rayQueryInitializeEXT(rayQuery,              // Ray query
-                            tlas,                  // Top-level acceleration structure
-                            gl_RayFlagsOpaqueEXT,  // Ray flags, here saying "treat all geometry as opaque"
-                            0xFF,                  // 8-bit instance mask, here saying "trace against all instances"
-                            rayOrigin,             // Ray origin
-                            0.0,                   // Minimum t-value
-                            rayDirection,          // Ray direction
-                            10000.0);              // Maximum t-value
-
-      // Start traversal, and loop over all ray-scene intersections. When this finishes,
-      // rayQuery stores a "committed" intersection, the closest intersection (if any).
-      while(rayQueryProceedEXT(rayQuery))
+      tracedRays++;
+      HitInfo    hitInfo;
+      const bool hit = traceSegment(rayOrigin, rayDirection, hitInfo);
+      if(DENOISE && tracedSegments == 0)
       {
+        const PixelAovs aovs = firstHitAovs(hit, hitInfo, rayDirection);
+        summedAovs.albedo += aovs.albedo;
+        summedAovs.depth += aovs.depth;
+        summedAovs.normal += aovs.normal;
       }
-
-      // Get the type of committed (true) intersection - nothing, a triangle, or
-      // a generated object
-      if(rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT)
+      if(hit)
       {
-        // Ray hit a triangle
-        HitInfo hitInfo = getObjectHitInfo(rayQuery);
+        // Ray hit a triangle, which may emit light
+        sampleColor += accumulatedRayColor * emittedLight(hitInfo, rayOrigin, rayDirection, bsdfPdf);
 
         // Apply color absorption
         accumulatedRayColor *= hitInfo.color;
@@ -198,34 +833,52 @@ void main()
         // the normal against rayDirection:
         rayOrigin = hitInfo.worldPosition - 0.0001 * sign(dot(rayDirection, hitInfo.worldNormal)) * hitInfo.worldNormal;
 
-        // Diffuse Reflection Algorithm: Lambertian material model
-        // A surface, a normal at an intersection point, and a sphere (here represented by a circle) centered at that normal of radius 1.
-        // To sample a random Lambertian reflection direction, choose a random point on the sphere, then normalize it; this gives the needed distribution! 
-        // p is then a random point on the unit sphere centered at (0,0,0). We then add the world-space normal, then normalize, to get the reflected ray direction. 
+        // Shade the side of the surface the ray came from: about a normal that faces away from it, the light
+        // sample and the bounce would go through the surface.
+        const vec3 normal = faceforward(hitInfo.worldNormal, rayDirection, hitInfo.worldNormal);
 
-        const float theta = 6.2831853 * stepAndOutputRNGFloat(rngState);   // Random in [0, 2pi] theta = 2pi * random_number
-        const float u     = 2.0 * stepAndOutputRNGFloat(rngState) - 1.0;  // Random in [-1, 1] u = 2b - 1
-        const float r     = sqrt(1.0 - u * u);
+        // Add the light that a light sample finds from here
+        if(SAMPLE_LIGHTS)
+        {
+          tracedRays++;
+          sampleColor += accumulatedRayColor * sampleLight(rayOrigin, normal, pathSampler);
+        }
 
-        rayDirection = hitInfo.worldNormal + vec3(r * cos(theta), r * sin(theta), u); // point p = (r*sin(theta), r*cos(theta), u) + world-space normal
-        rayDirection = normalize(rayDirection);                                            // normalize the ray direction p
+        // Bounce it in a random direction
+        rayDirection = scatterLambertian(normal, pathSampler);
+        bsdfPdf      = lambertianPdf(normal, rayDirection);
+
+        if(!survivesRussianRoulette(tracedSegments + 1, accumulatedRayColor, pathSampler))
+        {
+          break;
+        }
       }
       else
       {
         // Ray hit the sky
-        accumulatedRayColor *= skyColor(rayDirection);
-        
-        // Sum this with the pixel's other samples.
-        // (Note that we treat a ray that didn't find a light source as if it had
-        // an accumulated color of (0, 0, 0)).
-        summedPixelColor += accumulatedRayColor;
-    
+        sampleColor += accumulatedRayColor * skyColor(rayDirection);
         break;
       }
     }
+
+    // Sum this with the pixel's other samples.
+    // (Note that a path that never finds a light source adds (0, 0, 0)).
+    summedPixelColor += sampleColor;
+    summedPixelSquares += sampleColor * sampleColor;
   }
 
-  // Get the index of this invocation in the buffer:
-  uint linearIndex       = resolution.x * pixel.y + pixel.x;
-  imageData[linearIndex] = summedPixelColor / float(NUM_SAMPLES);  // Take the average
+  // Add this invocation's rays to the 64-bit counter.
+  if(COUNT_RAYS)
+  {
+    addToRayCounter(tracedRays);
+  }
+
+  // Add this batch to the pixel's accumulator; resolve.comp.glsl takes the average at the end.
+  accumulators[accumulatorIndex].sum += summedPixelColor;
+  accumulators[accumulatorIndex].sumSquares += summedPixelSquares;
+  accumulators[accumulatorIndex].sampleCount += pushConstants.samplesPerBatch;
+  if(DENOISE)
+  {
+    addAovs(accumulatorIndex, summedAovs);
+  }
 }
\ No newline at end of file
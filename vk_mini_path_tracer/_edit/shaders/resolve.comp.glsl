@@ -0,0 +1,124 @@
+#version 460
+#extension GL_EXT_scalar_block_layout : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "host_device.h"
+
+// Resolve: divides each pixel's sum of sample colors by its sample count, and packs the result in
+// the output format (row by row over the render tile), so that the host reads back 4 (RGBE) or
+// 6 (half) bytes per pixel instead of a whole PixelAccumulator. Each invocation packs a pair of
+// pixels, which fills a whole number of uints in every format: 2 for RGBE, 3 for half floats, 6 for floats.
+// OUTPUT_FORMAT_ACCUMULATORS copies the PixelAccumulators as they are, 14 uints per pair, for accumulation files.
+layout(local_size_x_id = SPEC_WORKGROUP_WIDTH, local_size_y_id = SPEC_WORKGROUP_HEIGHT, local_size_z = 1) in;
+layout(constant_id = SPEC_OUTPUT_FORMAT) const uint OUTPUT_FORMAT = OUTPUT_FORMAT_RGBE;
+// Whether to pack the image denoise.comp.glsl wrote, instead of the mean of each pixel's samples.
+layout(constant_id = SPEC_DENOISE) const bool DENOISE = false;
+
+layout(binding = BINDING_ACCUMULATORS, set = 0, scalar) buffer storageBuffer
+{
+  PixelAccumulator accumulators[];
+};
+layout(binding = BINDING_OUTPUT, set = 0, scalar) buffer Output
+{
+  uint outputWords[];
+};
+layout(binding = BINDING_DENOISER, set = 0, scalar) buffer Denoiser
+{
+  DenoiserPixel denoiserPixels[];
+};
+
+layout(push_constant) uniform PushConstantBlock
+{
+  PushConstants pushConstants;
+};
+
+vec3 resolvePixel(uint pixelIndex)
+{
+  if(DENOISE)
+  {
+    // The last pass of the denoiser writes the first of its two images
+    return denoiserPixels[pixelIndex].illumination;
+  }
+  const PixelAccumulator accumulator = accumulators[pixelIndex];
+  return (accumulator.sampleCount > 0) ? accumulator.sum / float(accumulator.sampleCount) : vec3(0.0);
+}
+
+// Shared-exponent RGBE, bytes in the order r, g, b, e. Rounds the same way as stb_image_write's
+// stbiw__linear_to_rgbe, so .hdr files have the same bytes as when the host encoded them.
+uint packRgbe(vec3 color)
+{
+  const float maxComponent = max(color.r, max(color.g, color.b));
+  if(maxComponent < 1e-32)
+  {
+    return 0;
+  }
+  int         exponent;
+  const float mantissa = frexp(maxComponent, exponent);
+  const uvec3 rgb      = uvec3(color * (mantissa * 256.0 / maxComponent));
+  return rgb.r | (rgb.g << 8) | (rgb.b << 16) | (uint(exponent + 128) << 24);
+}
+
+void main()
+{
+  // The host dispatches a 2D grid of workgroups when one row would exceed the dispatch size limit.
+  const uint workgroupIndex = gl_NumWorkGroups.x * gl_WorkGroupID.y + gl_WorkGroupID.x;
+  const uint pairIndex      = workgroupIndex * (gl_WorkGroupSize.x * gl_WorkGroupSize.y) + gl_LocalInvocationIndex;
+  const uint pixelCount     = pushConstants.tileSize.x * pushConstants.tileSize.y;
+  const uint first          = 2 * pairIndex;
+  if(first >= pixelCount)
+  {
+    return;
+  }
+  // Tiles with an odd number of pixels end with half a pair: words past the end of the image
+  // aren't written, and the second pixel's share of a word is 0.
+  const bool hasSecond = (first + 1 < pixelCount);
+  if(OUTPUT_FORMAT == OUTPUT_FORMAT_ACCUMULATORS)
+  {
+    for(uint i = 0; i < (hasSecond ? 2 : 1); i++)
+    {
+      const PixelAccumulator accumulator = accumulators[first + i];
+      const uint             word        = 14 * pairIndex + 7 * i;
+      for(uint c = 0; c < 3; c++)
+      {
+        outputWords[word + c]     = floatBitsToUint(accumulator.sum[c]);
+        outputWords[word + 3 + c] = floatBitsToUint(accumulator.sumSquares[c]);
+      }
+      outputWords[word + 6] = accumulator.sampleCount;
+    }
+    return;
+  }
+  const vec3 c0 = resolvePixel(first);
+  const vec3 c1 = hasSecond ? resolvePixel(first + 1) : vec3(0.0);
+
+  if(OUTPUT_FORMAT == OUTPUT_FORMAT_RGBE)
+  {
+    outputWords[2 * pairIndex + 0] = packRgbe(c0);
+    if(hasSecond)
+    {
+      outputWords[2 * pairIndex + 1] = packRgbe(c1);
+    }
+  }
+  else if(OUTPUT_FORMAT == OUTPUT_FORMAT_HALF)
+  {
+    // Values above the largest half float would become infinity
+    const vec3 h0 = min(c0, vec3(65504.0));
+    const vec3 h1 = min(c1, vec3(65504.0));
+    outputWords[3 * pairIndex + 0] = packHalf2x16(h0.rg);
+    outputWords[3 * pairIndex + 1] = packHalf2x16(vec2(h0.b, h1.r));
+    if(hasSecond)
+    {
+      outputWords[3 * pairIndex + 2] = packHalf2x16(h1.gb);
+    }
+  }
+  else
+  {
+    for(uint c = 0; c < 3; c++)
+    {
+      outputWords[6 * pairIndex + c] = floatBitsToUint(c0[c]);
+      if(hasSecond)
+      {
+        outputWords[6 * pairIndex + 3 + c] = floatBitsToUint(c1[c]);
+      }
+    }
+  }
+}
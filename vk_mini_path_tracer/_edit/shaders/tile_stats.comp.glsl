@@ -0,0 +1,99 @@
+#version 460
+#extension GL_EXT_scalar_block_layout : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "host_device.h"
+
+// Convergence statistics: one workgroup per convergence tile, with the same workgroup size as raytrace.comp.glsl.
+// Each invocation estimates the noise of its pixel, the workgroup reduces these to the tile's mean
+// noise and smallest sample count, and the host reads back only one TileStats per tile to decide
+// which tiles have converged.
+layout(local_size_x_id = SPEC_WORKGROUP_WIDTH, local_size_y_id = SPEC_WORKGROUP_HEIGHT, local_size_z = 1) in;
+
+layout(binding = BINDING_ACCUMULATORS, set = 0, scalar) buffer storageBuffer
+{
+  PixelAccumulator accumulators[];
+};
+layout(binding = BINDING_TILE_MASK, set = 0, scalar) buffer TileMask
+{
+  uint tileActive[];
+};
+layout(binding = BINDING_TILE_STATS, set = 0, scalar) buffer TileStatsBuffer
+{
+  TileStats tileStats[];
+};
+
+layout(push_constant) uniform PushConstantBlock
+{
+  PushConstants pushConstants;
+};
+
+// Pixels darker than this are treated as if they had this brightness when computing relative noise,
+// so that dark pixels do not sample forever.
+const float kDarkPixelFloor = 0.01;
+
+const uint kInvocationCount = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+shared float sharedNoise[kInvocationCount];
+shared uint  sharedMinSamples[kInvocationCount];
+shared uint  sharedPixelCount[kInvocationCount];
+
+// Estimated relative standard error of a pixel's mean color, averaged over the color channels.
+float estimatePixelNoise(PixelAccumulator accumulator)
+{
+  const uint n = accumulator.sampleCount;
+  if(n < 2)
+  {
+    return 1.0e30;
+  }
+  const vec3 mean = accumulator.sum / float(n);
+  // Unbiased sample variance, and from it the variance of the mean
+  const vec3 variance      = max(vec3(0.0), (accumulator.sumSquares - float(n) * mean * mean) / float(n - 1));
+  const vec3 standardError = sqrt(variance / float(n));
+  const vec3 relativeError = standardError / max(mean, vec3(kDarkPixelFloor));
+  return (relativeError.x + relativeError.y + relativeError.z) / 3.0;
+}
+
+void main()
+{
+  // Converged tiles don't change anymore. This is the same for the whole workgroup, so returning
+  // here doesn't skip any barrier() for the others.
+  const uint tileIndex = gl_NumWorkGroups.x * gl_WorkGroupID.y + gl_WorkGroupID.x;
+  if(tileActive[tileIndex] == 0)
+  {
+    return;
+  }
+
+  // Pixels outside of the render tile take part in the reduction, but don't count.
+  const uvec2 tileSize  = pushConstants.tileSize;
+  const uvec2 tilePixel = gl_GlobalInvocationID.xy;
+  const uint  local     = gl_LocalInvocationIndex;
+  sharedNoise[local]      = 0.0;
+  sharedMinSamples[local] = 0xFFFFFFFFu;
+  sharedPixelCount[local] = 0;
+  if((tilePixel.x < tileSize.x) && (tilePixel.y < tileSize.y))
+  {
+    const PixelAccumulator accumulator = accumulators[tileSize.x * tilePixel.y + tilePixel.x];
+    sharedNoise[local]                 = estimatePixelNoise(accumulator);
+    sharedMinSamples[local]            = accumulator.sampleCount;
+    sharedPixelCount[local]            = 1;
+  }
+  barrier();
+
+  // Tree reduction, which also works when the workgroup size isn't a power of 2
+  for(uint stride = 1; stride < kInvocationCount; stride *= 2)
+  {
+    if((local % (2 * stride) == 0) && (local + stride < kInvocationCount))
+    {
+      sharedNoise[local] += sharedNoise[local + stride];
+      sharedMinSamples[local] = min(sharedMinSamples[local], sharedMinSamples[local + stride]);
+      sharedPixelCount[local] += sharedPixelCount[local + stride];
+    }
+    barrier();
+  }
+
+  if(local == 0)
+  {
+    tileStats[tileIndex].meanNoise      = sharedNoise[0] / float(sharedPixelCount[0]);
+    tileStats[tileIndex].minSampleCount = sharedMinSamples[0];
+  }
+}
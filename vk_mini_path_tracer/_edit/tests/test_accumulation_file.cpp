@@ -0,0 +1,106 @@
+#include "tests.hpp"
+#include "accumulation_file.hpp"
+#include "image_writer.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <string>
+#include <vector>
+
+void TestAccumulationFile()
+{
+  // Two runs of 3 and 5 samples per pixel, whose merge has to match one run of all 8
+  constexpr uint32_t kWidth         = 7;
+  constexpr uint32_t kHeight        = 5;
+  constexpr uint32_t kRunSamples[2] = {3, 5};
+  auto sampleValue = [](uint32_t pixel, uint32_t sample, uint32_t channel) { return float((pixel * 13 + sample * 7 + channel * 3) % 17) * 0.25f; };
+
+  TemporaryDirectory                                   directory("vk_mini_path_tracer_tests_accum");
+  std::vector<std::string>                             paths;
+  std::vector<std::vector<shaderio::PixelAccumulator>> runs(2, std::vector<shaderio::PixelAccumulator>(kWidth * kHeight));
+  {
+    Profiler    profiler;
+    ImageWriter writer(profiler);
+    uint32_t    firstSample = 0;
+    for(uint32_t run = 0; run < 2; run++)
+    {
+      for(uint32_t pixel = 0; pixel < kWidth * kHeight; pixel++)
+      {
+        shaderio::PixelAccumulator& accumulator = runs[run][pixel];
+        accumulator                             = {};
+        for(uint32_t sample = firstSample; sample < firstSample + kRunSamples[run]; sample++)
+        {
+          const shaderio::vec3 value{sampleValue(pixel, sample, 0), sampleValue(pixel, sample, 1), sampleValue(pixel, sample, 2)};
+          accumulator.sum        = {accumulator.sum.x + value.x, accumulator.sum.y + value.y, accumulator.sum.z + value.z};
+          accumulator.sumSquares = {accumulator.sumSquares.x + value.x * value.x, accumulator.sumSquares.y + value.y * value.y,
+                                    accumulator.sumSquares.z + value.z * value.z};
+          accumulator.sampleCount++;
+        }
+      }
+      paths.push_back(directory.getPath(run == 0 ? "run0.accum" : "run1.accum"));
+      const AccumulationInfo info{42, SAMPLER_SOBOL, firstSample, kRunSamples[run]};
+      // In two bands, as the renderers write them
+      std::future<bool> top    = writer.write(paths[run], kWidth, kHeight, OUTPUT_FORMAT_ACCUMULATORS, 0, 2, runs[run].data(), info);
+      std::future<bool> bottom = writer.write(paths[run], kWidth, kHeight, OUTPUT_FORMAT_ACCUMULATORS, 2, kHeight - 2,
+                                              runs[run].data() + 2 * kWidth, info);
+      CHECK(top.get() && bottom.get());
+      firstSample += kRunSamples[run];
+    }
+    CHECK(writer.finish());
+  }
+
+  // Round trip: the header and the accumulators come back as they were written
+  AccumulationFile files[2];
+  for(uint32_t run = 0; run < 2; run++)
+  {
+    if(!CHECK(files[run].open(paths[run])))
+      return;
+    const AccumulationFileHeader& header = files[run].getHeader();
+    CHECK(header.width == kWidth && header.height == kHeight);
+    CHECK(header.info.seed == 42 && header.info.sampler == SAMPLER_SOBOL);
+    CHECK(header.info.firstSample == (run == 0 ? 0 : kRunSamples[0]) && header.info.sampleCount == kRunSamples[run]);
+    bool samePixels = true;
+    for(uint32_t y = 0; y < kHeight; y++)
+    {
+      samePixels &= (memcmp(files[run].getRow(y), runs[run].data() + y * kWidth, kWidth * sizeof(shaderio::PixelAccumulator)) == 0);
+    }
+    CHECK(samePixels);
+  }
+
+  // Merge: the mean and the variance of the mean of all 8 samples
+  for(uint32_t y = 0; y < kHeight; y++)
+  {
+    for(uint32_t x = 0; x < kWidth; x++)
+    {
+      AccumulatorSum sum;
+      sum.add(files[0].getRow(y)[x]);
+      sum.add(files[1].getRow(y)[x]);
+      const uint32_t pixel       = y * kWidth + x;
+      const uint32_t sampleCount = kRunSamples[0] + kRunSamples[1];
+      CHECK(sum.sampleCount == sampleCount);
+      for(uint32_t c = 0; c < 3; c++)
+      {
+        double mean = 0.0, squaredDeviations = 0.0;
+        for(uint32_t sample = 0; sample < sampleCount; sample++)
+        {
+          mean += sampleValue(pixel, sample, c) / double(sampleCount);
+        }
+        for(uint32_t sample = 0; sample < sampleCount; sample++)
+        {
+          squaredDeviations += (sampleValue(pixel, sample, c) - mean) * (sampleValue(pixel, sample, c) - mean);
+        }
+        CHECK(std::abs(sum.getMean(c) - mean) < 1e-5);
+        CHECK(std::abs(sum.getVarianceOfMean(c) - squaredDeviations / (sampleCount - 1) / sampleCount) < 1e-5);
+      }
+    }
+  }
+
+  // Truncated files and other files are rejected
+  std::filesystem::copy_file(paths[0], directory.getPath("truncated.accum"));
+  std::filesystem::resize_file(directory.getPath("truncated.accum"), std::filesystem::file_size(paths[0]) - 1);
+  AccumulationFile invalid;
+  CHECK(!invalid.open(directory.getPath("truncated.accum")));
+  CHECK(!invalid.open(directory.write("image.hdr", "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 1 +X 1\n0000")));
+}
@@ -0,0 +1,132 @@
+#include "tests.hpp"
+#include "compact_geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+// Mirrors decodeOctahedral() in raytrace.comp.glsl.
+Vec3 decodeOctahedral(uint32_t encoded)
+{
+  auto unpack = [](uint32_t bits) { return std::clamp(float(int16_t(uint16_t(bits))) / 32767.0f, -1.0f, 1.0f); };
+  Vec3        n(unpack(encoded), unpack(encoded >> 16), 0.0f);
+  n.z           = 1.0f - std::abs(n.x) - std::abs(n.y);
+  const float t = std::max(-n.z, 0.0f);
+  n.x += (n.x >= 0.0f) ? -t : t;
+  n.y += (n.y >= 0.0f) ? -t : t;
+  return normalize(n);
+}
+
+// A mesh of `triangleCount` small random triangles, each with vertices of its own
+ObjMesh makeMesh(uint32_t triangleCount, std::mt19937& random)
+{
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  ObjMesh                               mesh;
+  for(uint32_t triangle = 0; triangle < triangleCount; triangle++)
+  {
+    const Vec3 center(uniform(random) * 3.0f, uniform(random), uniform(random) * 0.5f);
+    for(uint32_t corner = 0; corner < 3; corner++)
+    {
+      const Vec3 vertex = center + Vec3(uniform(random), uniform(random), uniform(random)) * 0.1f;
+      mesh.vertices.insert(mesh.vertices.end(), {vertex.x, vertex.y, vertex.z});
+      mesh.indices.push_back(3 * triangle + corner);
+    }
+  }
+  return mesh;
+}
+
+// The index `i` of a mesh of the compact layout
+uint32_t getCompactIndex(const CompactGeometry& geometry, const CompactMesh& mesh, uint32_t i)
+{
+  if(!mesh.shortIndices)
+    return geometry.indices[mesh.firstIndexWord + i];
+  const uint32_t word = geometry.indices[mesh.firstIndexWord + i / 2];
+  return (i % 2 == 0) ? (word & 0xFFFF) : (word >> 16);
+}
+
+float distance(const Vec3& a, const Vec3& b)
+{
+  const Vec3 difference = a - b;
+  return std::sqrt(dot(difference, difference));
+}
+}  // namespace
+
+void TestCompactGeometry()
+{
+  // Octahedral normals: the axes, and random directions
+  std::vector<Vec3>                     normals = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+  std::mt19937                          random(1);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  while(normals.size() < 100000)
+  {
+    const Vec3 v(uniform(random), uniform(random), uniform(random));
+    if(dot(v, v) > 1e-4f && dot(v, v) <= 1.0f)
+    {
+      normals.push_back(normalize(v));
+    }
+  }
+  float maxError = 0.0f;
+  for(const Vec3& normal : normals)
+  {
+    maxError = std::max(maxError, distance(decodeOctahedral(EncodeOctahedral(normal)), normal));
+  }
+  // 16 bits per coordinate leave a few 1e-5 of error
+  CHECK(maxError < 1e-4f);
+
+  // A mesh small enough for 16-bit indices, with an odd number of them, and one that needs 32-bit indices
+  Scene scene;
+  scene.addMesh(makeMesh(31, random));
+  scene.addMesh(makeMesh(65538 / 3, random));
+  for(bool quantize : {false, true})
+  {
+    CompactGeometry geometry;
+    BuildCompactGeometry(scene, quantize, geometry);
+    if(!CHECK(geometry.meshes.size() == 2))
+      return;
+    CHECK(geometry.meshes[0].shortIndices && !geometry.meshes[1].shortIndices);
+    CHECK(geometry.meshes[1].firstIndexWord == (31 * 3 + 1) / 2 && geometry.meshes[1].firstVertex == 31 * 3);
+    CHECK(geometry.quantizedPositions.size() == (quantize ? (31 * 3 + 65538) * 4 : 0));
+
+    bool     sameIndices = true, sameMaterials = true;
+    float    maxNormalError = 0.0f, maxPositionError = 0.0f;
+    uint32_t firstTriangle  = 0;
+    for(uint32_t meshIndex = 0; meshIndex < 2; meshIndex++)
+    {
+      const SceneMesh&   mesh        = scene.getMeshes()[meshIndex];
+      const CompactMesh& compactMesh = geometry.meshes[meshIndex];
+      auto               getVertex   = [&](uint32_t index) {
+        return Vec3(mesh.vertices[3 * index + 0], mesh.vertices[3 * index + 1], mesh.vertices[3 * index + 2]);
+      };
+      // Quantized positions are within one step of their mesh's bounds, which are at most 3.1 wide
+      for(uint32_t i = 0; quantize && i < mesh.vertexCount; i++)
+      {
+        const int16_t* q = &geometry.quantizedPositions[4 * size_t(compactMesh.firstVertex + i)];
+        const Vec3     normalized(float(q[0]) / 32767.0f, float(q[1]) / 32767.0f, float(q[2]) / 32767.0f);
+        maxPositionError = std::max(maxPositionError, distance(compactMesh.dequantize.transformPoint(normalized), getVertex(i)));
+      }
+      // The normals are in the space the BLAS is built in: object space, scaled down to the quantized one
+      const Vec3 scale(compactMesh.dequantize.matrix[0][0], compactMesh.dequantize.matrix[1][1], compactMesh.dequantize.matrix[2][2]);
+      for(uint32_t i = 0; i < mesh.indexCount; i++)
+      {
+        sameIndices &= (getCompactIndex(geometry, compactMesh, i) == mesh.indices[i]);
+      }
+      for(uint32_t triangle = 0; triangle < mesh.indexCount / 3; triangle++)
+      {
+        const Vec3                 v0     = getVertex(mesh.indices[3 * triangle + 0]);
+        const Vec3                 v1     = getVertex(mesh.indices[3 * triangle + 1]);
+        const Vec3                 v2     = getVertex(mesh.indices[3 * triangle + 2]);
+        const shaderio::HitRecord& record = geometry.hitRecords[firstTriangle + triangle];
+        const Vec3                 normal = normalize(cross(v1 - v0, v2 - v0) * scale);
+        maxNormalError                    = std::max(maxNormalError, distance(decodeOctahedral(record.octahedralNormal), normal));
+        sameMaterials &= (record.materialID == mesh.materialIds[triangle]);
+      }
+      firstTriangle += mesh.indexCount / 3;
+    }
+    CHECK(sameIndices && sameMaterials);
+    CHECK(firstTriangle == geometry.hitRecords.size());
+    CHECK(maxNormalError < 1e-4f);
+    CHECK(maxPositionError < 3.2f / 32767.0f);
+  }
+}
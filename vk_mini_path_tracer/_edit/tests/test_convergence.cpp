@@ -0,0 +1,91 @@
+#include "tests.hpp"
+#include "convergence.hpp"
+#include "cpu_renderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+shaderio::PixelAccumulator makeAccumulator(const std::vector<float>& samples)
+{
+  shaderio::PixelAccumulator accumulator{};
+  for(float sample : samples)
+  {
+    accumulator.sum        = {accumulator.sum.x + sample, accumulator.sum.y + sample, accumulator.sum.z + sample};
+    accumulator.sumSquares = {accumulator.sumSquares.x + sample * sample, accumulator.sumSquares.y + sample * sample,
+                              accumulator.sumSquares.z + sample * sample};
+    accumulator.sampleCount++;
+  }
+  return accumulator;
+}
+}  // namespace
+
+void TestConvergence()
+{
+  // A 4 x 2 image: the left 2 x 2 tile is flat, the right one is noisy, and one of its pixels has fewer samples
+  const shaderio::PixelAccumulator flat  = makeAccumulator({0.5f, 0.5f, 0.5f, 0.5f});
+  const shaderio::PixelAccumulator noisy = makeAccumulator({0.0f, 2.0f, 0.0f, 2.0f});
+  const shaderio::PixelAccumulator few   = makeAccumulator({1.0f, 1.0f});
+
+  const shaderio::PixelAccumulator image[] = {flat, flat, noisy, noisy,  //
+                                              flat, flat, noisy, few};
+
+  const shaderio::TileStats flatStats  = GetTileStats(image, 4, 0, 0, 2, 2);
+  const shaderio::TileStats noisyStats = GetTileStats(image, 4, 2, 0, 4, 2);
+  CHECK(flatStats.meanNoise < 1e-4f && flatStats.minSampleCount == 4);
+  // Each noisy pixel has a mean of 1 and a sample variance of 4/3, so the relative standard error of its mean is
+  // sqrt(1/3); the pixel with 2 equal samples has no noise.
+  CHECK(std::abs(noisyStats.meanNoise - 3.0f * std::sqrt(1.0f / 3.0f) / 4.0f) < 1e-5f && noisyStats.minSampleCount == 2);
+  // A pixel with a single sample doesn't tell how noisy it is
+  const shaderio::PixelAccumulator single = makeAccumulator({1.0f});
+  CHECK(GetTileStats(&single, 1, 0, 0, 1, 1).meanNoise > 1e20f);
+
+  // Tile 0 has converged; tile 1 is too noisy; tile 2 is quiet, but has too few samples; tile 3 stopped earlier
+  const shaderio::TileStats tileStats[] = {flatStats, noisyStats, {0.0f, 3}, {0.0f, 100}};
+  ConvergenceSettings       settings;
+  settings.targetNoise  = 0.1f;
+  settings.minSamples   = 4;
+  uint32_t tileActive[] = {1, 1, 1, 0};
+  CHECK(UpdateTileMask(tileStats, 4, settings, tileActive) == 2);
+  CHECK(tileActive[0] == 0 && tileActive[1] == 1 && tileActive[2] == 1 && tileActive[3] == 0);
+  settings.targetNoise = 0.0f;
+  uint32_t allActive[] = {1, 1, 1, 1};
+  CHECK(UpdateTileMask(tileStats, 4, settings, allActive) == 4);
+
+  // On the CPU backend: above the horizon, the tiles of the sky stop once they have the minimum number of samples,
+  // while the tiles of the floor, lit by the sky through diffuse bounces, keep sampling.
+  ObjMesh floor;
+  floor.vertices = {-50.0f, 0.0f, 50.0f, 50.0f, 0.0f, 50.0f, 50.0f, 0.0f, -50.0f, -50.0f, 0.0f, -50.0f};
+  floor.indices  = {0, 1, 2, 0, 2, 3};
+  Scene scene;
+  scene.addMesh(std::move(floor));
+  CpuRenderer renderer;
+  renderer.setScene(scene);
+  CpuRenderSettings renderSettings;
+  renderSettings.width                   = 64;
+  renderSettings.height                  = 64;
+  renderSettings.numSamples              = 64;
+  renderSettings.samplesPerBatch         = 8;
+  renderSettings.threadCount             = 4;
+  renderSettings.convergence.targetNoise = 0.01f;
+  renderSettings.convergence.minSamples  = 16;
+  std::vector<float>                      imageData;
+  std::vector<shaderio::PixelAccumulator> accumulators;
+  const CpuTraceStats                     stats = renderer.render(renderSettings, imageData, &accumulators);
+  CHECK(stats.convergedTiles > 0 && stats.convergedTiles < stats.tileCount);
+  CHECK(stats.samplesTraced == 64);
+  CHECK(accumulators.front().sampleCount == 16);  // The sky, at the top left
+  CHECK(accumulators.back().sampleCount == 64);   // The floor, at the bottom right
+  bool countsInRange = true;
+  for(const shaderio::PixelAccumulator& accumulator : accumulators)
+  {
+    countsInRange &= (accumulator.sampleCount >= 16 && accumulator.sampleCount <= 64 && accumulator.sampleCount % 8 == 0);
+  }
+  CHECK(countsInRange);
+
+  // Once all tiles have converged, no more batches are traced
+  renderSettings.convergence.targetNoise = 1e6f;
+  const CpuTraceStats allConverged       = renderer.render(renderSettings, imageData, &accumulators);
+  CHECK(allConverged.convergedTiles == allConverged.tileCount && allConverged.batchCount == 2);
+}
@@ -0,0 +1,99 @@
+#include "tests.hpp"
+
+#include "cpu_bvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+// The closest intersection of the ray with any of the triangles in [tMin, tMax], with all triangles tested.
+CpuHit intersectBruteForce(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const Vec3& origin, const Vec3& direction, float tMin, float tMax)
+{
+  CpuHit hit;
+  hit.t = tMax;
+  for(uint32_t triangle = 0; triangle < uint32_t(indices.size() / 3); triangle++)
+  {
+    auto vertex = [&](uint32_t corner) {
+      const uint32_t index = indices[3 * triangle + corner];
+      return Vec3(vertices[3 * index + 0], vertices[3 * index + 1], vertices[3 * index + 2]);
+    };
+    // Moller-Trumbore, without culling
+    const Vec3  v0 = vertex(0), e1 = vertex(1) - v0, e2 = vertex(2) - v0;
+    const Vec3  p           = cross(direction, e2);
+    const float determinant = dot(e1, p);
+    if(determinant == 0.0f)
+      continue;
+    const Vec3  s = origin - v0;
+    const float u = dot(s, p) / determinant;
+    const Vec3  q = cross(s, e1);
+    const float v = dot(direction, q) / determinant;
+    const float t = dot(e2, q) / determinant;
+    if(u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= tMin && t <= hit.t)
+    {
+      hit = {triangle, t, u, v};
+    }
+  }
+  return hit;
+}
+
+void checkBvhAgainstBruteForce(const CpuBvh& bvh, const std::vector<float>& vertices, const std::vector<uint32_t>& indices, std::mt19937& random)
+{
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  uint32_t                              mismatches = 0, hits = 0;
+  for(uint32_t ray = 0; ray < 2000; ray++)
+  {
+    const Vec3   origin(2.0f * uniform(random), 2.0f * uniform(random), 2.0f * uniform(random));
+    const Vec3   direction = normalize(Vec3(uniform(random), uniform(random), uniform(random)) + Vec3(1e-3f));
+    const float  tMax      = (ray % 4 == 0) ? 0.5f : 100.0f;
+    const CpuHit expected  = intersectBruteForce(vertices, indices, origin, direction, 0.0f, tMax);
+    const CpuHit closest   = bvh.intersect(origin, direction, 0.0f, tMax);
+    const CpuHit any       = bvh.intersect(origin, direction, 0.0f, tMax, true);
+    hits += expected.valid() ? 1 : 0;
+    // Ties between triangles at the same distance may go either way, and rays that graze an edge may round either way
+    const bool sameClosest = (closest.valid() == expected.valid())
+                             && (!expected.valid() || std::abs(closest.t - expected.t) <= 1e-4f * std::max(1.0f, expected.t));
+    const bool anyValid = (any.valid() == expected.valid()) && (!any.valid() || (any.t >= 0.0f && any.t <= tMax));
+    mismatches += (sameClosest && anyValid) ? 0 : 1;
+  }
+  CHECK(hits > 100);  // The rays actually test something
+  CHECK(mismatches <= 2);
+}
+
+}  // namespace
+
+void TestCpuBvh()
+{
+  // Small random triangles, and a cluster of nearly identical ones, which the SAH can't split
+  std::mt19937                          random(2);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  std::vector<float>                    vertices;
+  std::vector<uint32_t>                 indices;
+  for(uint32_t triangle = 0; triangle < 3000; triangle++)
+  {
+    const bool clustered = (triangle >= 2500);
+    const Vec3 center    = clustered ? Vec3(0.25f) : Vec3(uniform(random), uniform(random), uniform(random));
+    const float size     = clustered ? 0.2f : 0.1f;
+    for(uint32_t corner = 0; corner < 3; corner++)
+    {
+      const Vec3 vertex = center + Vec3(uniform(random), uniform(random), uniform(random)) * (clustered ? size * 1e-3f : size)
+                          + (clustered ? Vec3(corner == 1 ? size : 0.0f, corner == 2 ? size : 0.0f, 0.0f) : Vec3(0.0f));
+      vertices.insert(vertices.end(), {vertex.x, vertex.y, vertex.z});
+      indices.push_back(uint32_t(indices.size()));
+    }
+  }
+  CpuBvh bvh;
+  bvh.build(vertices.data(), vertices.size() / 3, indices.data(), indices.size());
+  CHECK(bvh.getNodeCount() > 1);
+  checkBvhAgainstBruteForce(bvh, vertices, indices, random);
+
+  // After a refit to moved vertices, the tree must still find the closest hits
+  for(size_t i = 0; i < vertices.size(); i += 3)
+  {
+    vertices[i + 0] = vertices[i + 0] * 1.5f + 0.1f * std::sin(vertices[i + 1] * 7.0f);
+    vertices[i + 2] = -vertices[i + 2];
+  }
+  bvh.refit(vertices.data(), vertices.size() / 3, indices.data(), indices.size());
+  checkBvhAgainstBruteForce(bvh, vertices, indices, random);
+}
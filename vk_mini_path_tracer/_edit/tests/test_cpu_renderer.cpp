@@ -0,0 +1,107 @@
+#include "tests.hpp"
+#include "cpu_renderer.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+// A floor and a few standing triangles in front of the default camera, lit by the sky.
+void makeScene(Scene& scene)
+{
+  ObjMesh mesh;
+  auto    addTriangle = [&mesh](const Vec3& a, const Vec3& b, const Vec3& c) {
+    for(const Vec3& v : {a, b, c})
+    {
+      mesh.indices.push_back(uint32_t(mesh.vertices.size() / 3));
+      mesh.vertices.insert(mesh.vertices.end(), {v.x, v.y, v.z});
+    }
+  };
+  addTriangle(Vec3(-4.0f, 0.0f, 4.0f), Vec3(4.0f, 0.0f, 4.0f), Vec3(4.0f, 0.0f, -4.0f));
+  addTriangle(Vec3(-4.0f, 0.0f, 4.0f), Vec3(4.0f, 0.0f, -4.0f), Vec3(-4.0f, 0.0f, -4.0f));
+  for(int i = -1; i <= 1; i++)
+  {
+    const float x = 0.8f * float(i);
+    addTriangle(Vec3(x - 0.3f, 0.0f, 0.2f * float(i)), Vec3(x + 0.3f, 0.0f, 0.0f), Vec3(x, 1.2f, -0.3f));
+  }
+  scene.addMesh(std::move(mesh));
+}
+
+struct Render
+{
+  CpuTraceStats                           stats;
+  std::vector<float>                      image;
+  std::vector<shaderio::PixelAccumulator> accumulators;
+};
+
+Render render(const CpuRenderer& renderer, const CpuRenderSettings& settings)
+{
+  Render result;
+  result.stats = renderer.render(settings, result.image, &result.accumulators);
+  return result;
+}
+
+// Whether two renders have the same bits in every pixel
+bool sameImages(const Render& a, const Render& b)
+{
+  return a.image == b.image && a.accumulators.size() == b.accumulators.size()
+         && memcmp(a.accumulators.data(), b.accumulators.data(), a.accumulators.size() * sizeof(shaderio::PixelAccumulator)) == 0;
+}
+}  // namespace
+
+void TestCpuRenderer()
+{
+  Scene scene;
+  makeScene(scene);
+  CpuRenderer renderer;
+  renderer.setScene(scene);
+
+  // An image of partial tiles, so that the edges of the tiles are covered too
+  CpuRenderSettings settings;
+  settings.width           = 40;
+  settings.height          = 24;
+  settings.numSamples      = 12;
+  settings.samplesPerBatch = 4;
+  settings.maxSegments     = 4;
+  settings.threadCount     = 4;
+  const Render reference   = render(renderer, settings);
+  CHECK(reference.stats.batchCount == 3 && reference.stats.samplesTraced == 12);
+  CHECK(reference.stats.tileCount == 3 * 2 && reference.stats.convergedTiles == 0);
+  CHECK(reference.stats.rayCount >= uint64_t(40 * 24 * 12));
+  bool allSampled = true;
+  for(const shaderio::PixelAccumulator& accumulator : reference.accumulators)
+  {
+    allSampled &= (accumulator.sampleCount == 12);
+  }
+  CHECK(allSampled);
+
+  // Each pixel is traced on its own, so the image doesn't depend on which thread traces it
+  settings.threadCount = 1;
+  CHECK(sameImages(render(renderer, settings), reference));
+  settings.threadCount = 4;
+  CHECK(sameImages(render(renderer, settings), reference));
+
+  // The PCG sampler reseeds each batch, so its image depends on the batch size; a different seed gives a
+  // different image.
+  settings.samplesPerBatch = 3;
+  CHECK(!sameImages(render(renderer, settings), reference));
+  settings.samplesPerBatch = 4;
+  settings.seed            = 1;
+  CHECK(!sameImages(render(renderer, settings), reference));
+  settings.seed = 0;
+
+  // The Sobol and blue-noise samplers take the points of each sample by its index in the render, whatever batch
+  // it is in; so any batch size, even one that doesn't divide the number of samples, gives the same bits.
+  for(uint32_t sampler : {uint32_t(SAMPLER_SOBOL), uint32_t(SAMPLER_BLUE_NOISE)})
+  {
+    settings.sampler         = sampler;
+    settings.samplesPerBatch = 12;
+    const Render oneBatch    = render(renderer, settings);
+    for(uint32_t samplesPerBatch : {1u, 4u, 5u})
+    {
+      settings.samplesPerBatch = samplesPerBatch;
+      const Render batched     = render(renderer, settings);
+      CHECK(batched.stats.batchCount == (12 + samplesPerBatch - 1) / samplesPerBatch);
+      CHECK(sameImages(batched, oneBatch));
+    }
+  }
+}
@@ -0,0 +1,155 @@
+#include "tests.hpp"
+#include "denoiser.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+// A synthetic render of two walls facing the camera, with 16 noisy samples per pixel: the left one, at a depth of 2,
+// has an illumination of 0.4, and the right one, from column `edgeX` on, has an illumination of 0.6 at a depth of
+// `rightDepth`. Both have an albedo of 0.5.
+struct NoisyRender
+{
+  uint32_t                                width = 0, height = 0, edgeX = 0;
+  std::vector<shaderio::PixelAccumulator> accumulators;
+  std::vector<shaderio::PixelAovs>        aovs;
+
+  float getIllumination(uint32_t x) const { return (x < edgeX) ? 0.4f : 0.6f; }
+};
+
+NoisyRender makeRender(uint32_t width, uint32_t height, uint32_t edgeX, float rightDepth)
+{
+  constexpr uint32_t kSamples = 16;
+  constexpr float    kAlbedo  = 0.5f;
+
+  NoisyRender render;
+  render.width  = width;
+  render.height = height;
+  render.edgeX  = edgeX;
+  render.accumulators.resize(size_t(width) * height);
+  render.aovs.resize(size_t(width) * height);
+  std::mt19937                          random(1);
+  std::uniform_real_distribution<float> noise(0.0f, 2.0f);
+  for(uint32_t y = 0; y < height; y++)
+  {
+    for(uint32_t x = 0; x < width; x++)
+    {
+      shaderio::PixelAccumulator& accumulator = render.accumulators[size_t(width) * y + x];
+      shaderio::PixelAovs&        aovs        = render.aovs[size_t(width) * y + x];
+      for(uint32_t i = 0; i < kSamples; i++)
+      {
+        const float sample = kAlbedo * render.getIllumination(x) * noise(random);
+        accumulator.sum    = {accumulator.sum.x + sample, accumulator.sum.y + sample, accumulator.sum.z + sample};
+        accumulator.sumSquares = {accumulator.sumSquares.x + sample * sample, accumulator.sumSquares.y + sample * sample,
+                                  accumulator.sumSquares.z + sample * sample};
+      }
+      accumulator.sampleCount = kSamples;
+      aovs.albedo             = {kSamples * kAlbedo, kSamples * kAlbedo, kSamples * kAlbedo};
+      aovs.depth              = kSamples * ((x < edgeX) ? 2.0f : rightDepth);
+      aovs.normal             = {0.0f, 0.0f, float(kSamples)};
+    }
+  }
+  return render;
+}
+
+// The pixels of a rectangle of a render, as a render of their own
+NoisyRender crop(const NoisyRender& render, uint32_t x0, uint32_t y0, uint32_t width, uint32_t height)
+{
+  NoisyRender result;
+  result.width  = width;
+  result.height = height;
+  result.edgeX  = render.edgeX - x0;
+  for(uint32_t y = y0; y < y0 + height; y++)
+  {
+    for(uint32_t x = x0; x < x0 + width; x++)
+    {
+      result.accumulators.push_back(render.accumulators[size_t(render.width) * y + x]);
+      result.aovs.push_back(render.aovs[size_t(render.width) * y + x]);
+    }
+  }
+  return result;
+}
+
+std::vector<float> denoise(const NoisyRender& render, float fovVerticalSlope, uint32_t iterations)
+{
+  DenoiseSettings settings;
+  settings.width            = render.width;
+  settings.height           = render.height;
+  settings.iterations       = iterations;
+  settings.fovVerticalSlope = fovVerticalSlope;
+  settings.threadCount      = 4;
+  std::vector<float> imageData;
+  Profiler           profiler;
+  Denoise(settings, render.accumulators, render.aovs, imageData, profiler);
+  return imageData;
+}
+
+// Root mean square error of the red channel of the pixels of column x0 to x1 (excluded), against the noiseless image
+float columnError(const NoisyRender& render, const std::vector<float>& imageData, uint32_t x0, uint32_t x1)
+{
+  double squaredErrorSum = 0.0;
+  for(uint32_t y = 0; y < render.height; y++)
+  {
+    for(uint32_t x = x0; x < x1; x++)
+    {
+      const double error = imageData[3 * (size_t(render.width) * y + x)] - 0.5 * render.getIllumination(x);
+      squaredErrorSum += error * error;
+    }
+  }
+  return float(std::sqrt(squaredErrorSum / (double(render.height) * (x1 - x0))));
+}
+
+// The mean color of each pixel, as the image is without denoising
+std::vector<float> meanImage(const NoisyRender& render)
+{
+  std::vector<float> imageData;
+  for(const shaderio::PixelAccumulator& accumulator : render.accumulators)
+  {
+    const float inverseCount = 1.0f / float(accumulator.sampleCount);
+    imageData.insert(imageData.end(), {accumulator.sum.x * inverseCount, accumulator.sum.y * inverseCount,
+                                       accumulator.sum.z * inverseCount});
+  }
+  return imageData;
+}
+}  // namespace
+
+void TestDenoiser()
+{
+  const NoisyRender        render   = makeRender(64, 128, 32, 8.0f);
+  const std::vector<float> denoised = denoise(render, 0.5f, 3);
+  const std::vector<float> noisy    = meanImage(render);
+
+  // The walls are flat, so away from the edge the denoiser removes most of the noise
+  CHECK(columnError(render, denoised, 0, 24) < 0.25f * columnError(render, noisy, 0, 24));
+  CHECK(columnError(render, denoised, 40, 64) < 0.25f * columnError(render, noisy, 40, 64));
+
+  // Next to the depth edge, the pixels of each wall don't take in the other's: their error stays well below the one
+  // they have when the walls are at the same depth, where only the difference of their colors stops the filter.
+  const NoisyRender        flatRender   = makeRender(64, 128, 32, 2.0f);
+  const std::vector<float> flatDenoised = denoise(flatRender, 0.5f, 3);
+  CHECK(columnError(render, denoised, 30, 32) < 0.75f * columnError(flatRender, flatDenoised, 30, 32));
+  CHECK(columnError(render, denoised, 32, 34) < 0.75f * columnError(flatRender, flatDenoised, 32, 34));
+
+  // A render tile denoised with its apron, the 2^(iterations+1) - 1 pixels around it, gets the same pixels as the
+  // whole image, which is how the GPU backend denoises render tiles. The crop is half as high as the image, with
+  // half its field of view, so that its pixels have the same size; the tile touches the left edge of the image,
+  // where the apron stops.
+  const uint32_t           apron          = (2u << 3) - 1;
+  const uint32_t           tileX0         = 0, tileY0 = 48, tileX1 = 40, tileY1 = 80;
+  const NoisyRender        tileWithApron  = crop(render, 0, tileY0 - apron, tileX1 + apron, 64);
+  const std::vector<float> tileDenoised   = denoise(tileWithApron, 0.25f, 3);
+  bool                     matchesInImage = true;
+  for(uint32_t y = tileY0; y < tileY1; y++)
+  {
+    for(uint32_t x = tileX0; x < tileX1; x++)
+    {
+      for(uint32_t c = 0; c < 3; c++)
+      {
+        matchesInImage &= (tileDenoised[3 * (size_t(tileWithApron.width) * (y - tileY0 + apron) + x) + c]
+                           == denoised[3 * (size_t(render.width) * y + x) + c]);
+      }
+    }
+  }
+  CHECK(matchesInImage);
+}
@@ -0,0 +1,65 @@
+#include "tests.hpp"
+#include "light_table.hpp"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+void TestLightTable()
+{
+  WorkStealingScheduler scheduler(4);
+
+  // Emissive triangles of different areas and emissions, and one that doesn't emit
+  TemporaryDirectory directory("vk_mini_path_tracer_tests_lights");
+  directory.write("lights.mtl",
+                  "newmtl dim\nKe 1 1 1\n"
+                  "newmtl bright\nKe 4 4 4\n"
+                  "newmtl red\nKe 2 0 0\n"
+                  "newmtl gray\nKd 0.5 0.5 0.5\n");
+  const std::string objPath = directory.write("lights.obj",
+                                              "mtllib lights.mtl\n"
+                                              "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 3 0 0\nv 0 2 0\nv 0 0 5\n"
+                                              "usemtl dim\nf 1 2 3\nf 1 4 5\n"
+                                              "usemtl bright\nf 1 2 3\nf 1 3 6\n"
+                                              "usemtl red\nf 1 4 6\n"
+                                              "usemtl gray\nf 1 5 6\n");
+  Scene scene;
+  if(!CHECK(scene.load(objPath, scheduler)))
+    return;
+  LightTable table;
+  BuildLightTable(scene, table);
+  const std::vector<double> expectedPowers = {0.5 * 1.0, 3.0 * 1.0, 0.5 * 4.0, 2.5 * 4.0, 7.5 * 2.0 * 0.2126};
+  if(!CHECK(table.triangles.size() == expectedPowers.size()))
+    return;
+
+  // Each entry is picked with probability 1 / count, and then keeps itself with its probability or goes to its alias
+  double expectedTotal = 0.0;
+  for(double power : expectedPowers)
+  {
+    expectedTotal += power;
+  }
+  const size_t        count = table.triangles.size();
+  std::vector<double> picked(count, 0.0);
+  for(const shaderio::EmissiveTriangle& triangle : table.triangles)
+  {
+    CHECK(triangle.probability >= 0.0f && triangle.probability <= 1.0f && triangle.alias < count);
+    picked[&triangle - table.triangles.data()] += triangle.probability / double(count);
+    picked[triangle.alias] += (1.0 - triangle.probability) / double(count);
+  }
+  double pickedSum = 0.0;
+  for(size_t i = 0; i < count; i++)
+  {
+    pickedSum += picked[i];
+    CHECK(std::abs(picked[i] - expectedPowers[i] / expectedTotal) < 1e-6);
+  }
+  CHECK(std::abs(pickedSum - 1.0) < 1e-6);
+  CHECK(std::abs(table.totalPower - expectedTotal) < 1e-5 * expectedTotal);
+
+  // A scene without emissive materials has no lights
+  Scene unlit;
+  if(CHECK(unlit.load(directory.write("unlit.obj", "mtllib lights.mtl\nv 0 0 0\nv 1 0 0\nv 0 1 0\nusemtl gray\nf 1 2 3\n"), scheduler)))
+  {
+    BuildLightTable(unlit, table);
+    CHECK(table.triangles.empty() && table.totalPower == 0.0f);
+  }
+}
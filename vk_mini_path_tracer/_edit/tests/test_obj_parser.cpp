@@ -0,0 +1,84 @@
+#include "tests.hpp"
+#include "obj_parser.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+bool parseObj(const std::string& text, const WorkStealingScheduler& scheduler, ObjMesh& mesh)
+{
+  return ParseObjParallel(text.data(), text.size(), scheduler, mesh);
+}
+}  // namespace
+
+void TestObjParser()
+{
+  WorkStealingScheduler scheduler(4);
+
+  // A parallelogram whose diagonal from vertex 2 to 4 is the shorter one, in both vertex orders; a triangle with
+  // relative indices; and a pentagon, which becomes a fan.
+  const std::string text =
+      "v 0 0 0\n"
+      "v 2 0 0\n"
+      "v 3 1 0\n"
+      "v 1 1 0\n"
+      "o quads\n"
+      "f 1 2 3 4\n"
+      "f 2/1 3/2 4/3 1/4\n"
+      "g relative\n"
+      "f -4 -3//1 -2\n"
+      "v 0 2 0\n"
+      "o pentagon\n"
+      "f 1 2 3 4 -1\n";
+  ObjMesh mesh;
+  if(!CHECK(parseObj(text, scheduler, mesh)))
+    return;
+  const std::vector<uint32_t> expectedIndices = {0, 1, 3, 1, 2, 3,           // Split along 2-4
+                                                 1, 2, 3, 1, 3, 0,           // The same diagonal, from vertex 2
+                                                 0, 1, 2,                    // Relative
+                                                 0, 1, 2, 0, 2, 3, 0, 3, 4}; // Fan
+  CHECK(mesh.vertices.size() == 5 * 3);
+  CHECK(mesh.indices == expectedIndices);
+  CHECK(mesh.materialIds.size() == expectedIndices.size() / 3);
+  if(CHECK(mesh.shapes.size() == 3))
+  {
+    CHECK(mesh.shapes[0].name == "quads" && mesh.shapes[0].firstIndex == 0 && mesh.shapes[0].indexCount == 12);
+    CHECK(mesh.shapes[1].name == "relative" && mesh.shapes[1].firstIndex == 12 && mesh.shapes[1].indexCount == 3);
+    CHECK(mesh.shapes[2].name == "pentagon" && mesh.shapes[2].firstIndex == 15 && mesh.shapes[2].indexCount == 9);
+  }
+
+  ObjMesh invalid;
+  CHECK(!parseObj("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n", scheduler, invalid));
+  CHECK(!parseObj("v 0 0 0\nf -2 -1 1\n", scheduler, invalid));
+
+  // A file of several chunks (see kChunkSize in obj_parser.cpp), whose relative indices are resolved against the
+  // vertices of earlier chunks, must give the same mesh as with absolute indices.
+  const uint32_t triangleCount = 200000;
+  std::string    relativeText, absoluteText;
+  for(uint32_t triangle = 0; triangle < triangleCount; triangle++)
+  {
+    std::string vertices;
+    for(uint32_t corner = 0; corner < 3; corner++)
+    {
+      vertices += "v " + std::to_string(triangle) + " " + std::to_string(corner) + " 0.5\n";
+    }
+    relativeText += vertices + "f -3 -2 -1\n";
+    absoluteText += vertices + "f " + std::to_string(3 * triangle + 1) + " " + std::to_string(3 * triangle + 2) + " "
+                    + std::to_string(3 * triangle + 3) + "\n";
+  }
+  CHECK(relativeText.size() > (size_t(8) << 20));
+  ObjMesh relative, absolute;
+  if(CHECK(parseObj(relativeText, scheduler, relative)) && CHECK(parseObj(absoluteText, scheduler, absolute)))
+  {
+    CHECK(relative.indices == absolute.indices);
+    CHECK(relative.vertices == absolute.vertices);
+    CHECK(relative.indices.size() == size_t(triangleCount) * 3);
+    bool sequential = true;
+    for(uint32_t i = 0; i < uint32_t(relative.indices.size()); i++)
+    {
+      sequential &= (relative.indices[i] == i);
+    }
+    CHECK(sequential);
+    CHECK(relative.vertices[3 * (3 * 123456 + 2)] == 123456.0f);
+  }
+}
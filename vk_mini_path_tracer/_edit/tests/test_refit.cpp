@@ -0,0 +1,41 @@
+#include "tests.hpp"
+#include "refit.hpp"
+
+#include <cmath>
+#include <vector>
+
+void TestRefit()
+{
+  const RefitSettings thresholdOnly{1.5f, 0};
+  CHECK(!ShouldRebuild(thresholdOnly, 1.0f, 1));
+  CHECK(!ShouldRebuild(thresholdOnly, 1.5f, 1000));
+  CHECK(ShouldRebuild(thresholdOnly, 1.51f, 1));
+  const RefitSettings withInterval{1.5f, 4};
+  CHECK(!ShouldRebuild(withInterval, 1.0f, 3));
+  CHECK(ShouldRebuild(withInterval, 1.0f, 4));
+  CHECK(ShouldRebuild(withInterval, 2.0f, 1));
+
+  // A grid of boxes: refitting to the same boxes keeps the cost, and scattering them grows it
+  std::vector<Aabb> boxes;
+  for(uint32_t i = 0; i < 256; i++)
+  {
+    const Vec3 corner(float(i % 16), float(i / 16), 0.0f);
+    Aabb       box;
+    box.grow(corner);
+    box.grow(corner + Vec3(0.9f, 0.9f, 0.1f));
+    boxes.push_back(box);
+  }
+  RefitTracker tracker;
+  tracker.build(boxes);
+  CHECK(std::abs(tracker.refit(boxes) - 1.0f) < 1e-5f);
+  std::vector<Aabb> scattered = boxes;
+  for(uint32_t i = 0; i < uint32_t(scattered.size()); i++)
+  {
+    const Vec3 offset(float((i * 7) % 16) * 4.0f, float((i * 11) % 16) * 4.0f, float(i % 5) * 8.0f);
+    scattered[i].lo = scattered[i].lo + offset;
+    scattered[i].hi = scattered[i].hi + offset;
+  }
+  CHECK(ShouldRebuild(thresholdOnly, tracker.refit(scattered), 1));
+  tracker.build(scattered);
+  CHECK(std::abs(tracker.refit(scattered) - 1.0f) < 1e-5f);
+}
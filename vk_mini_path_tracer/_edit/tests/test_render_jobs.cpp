@@ -0,0 +1,50 @@
+#include "tests.hpp"
+#include "render_jobs.hpp"
+
+#include <cmath>
+#include <sstream>
+
+namespace {
+// Whether the camera's vectors are unit length and at right angles to each other
+bool isOrthonormal(const Camera& camera)
+{
+  auto isUnit = [](const Vec3& v) { return std::abs(dot(v, v) - 1.0f) < 1e-5f; };
+  return isUnit(camera.forward) && isUnit(camera.right) && isUnit(camera.up) && std::abs(dot(camera.forward, camera.right)) < 1e-5f
+         && std::abs(dot(camera.forward, camera.up)) < 1e-5f && std::abs(dot(camera.right, camera.up)) < 1e-5f;
+}
+}  // namespace
+
+void TestRenderJobs()
+{
+  RenderJob   job;
+  const char* problem = nullptr;
+  if(CHECK(ParseRenderJob("out.hdr 800 600 64  -0.001 1 6  -0.001 1 0", job, problem)))
+  {
+    CHECK(job.outputPath == "out.hdr" && job.width == 800 && job.height == 600 && job.samples == 64);
+    CHECK(job.camera.fovVerticalSlope == Camera().fovVerticalSlope && isOrthonormal(job.camera));
+    CHECK(job.camera.forward.z < -0.9999f && job.camera.up.y > 0.9999f);
+  }
+  // Straight down, where +y can't be the up vector
+  CHECK(ParseRenderJob("down.hdr 64 64 4  0 5 0  0 0 0  0.5", job, problem) && isOrthonormal(job.camera));
+  CHECK(job.camera.fovVerticalSlope == 0.5f);
+
+  // Jobs that would render garbage are rejected
+  const char* const invalidJobs[] = {
+      "same.hdr 64 64 4  1 2 3  1 2 3",      // The eye is at the target
+      "zero.hdr 0 64 4  0 0 0  0 0 -1",      // No pixels
+      "fov.hdr 64 64 4  0 0 0  0 0 -1  0",   // No field of view
+      "fov.hdr 64 64 4  0 0 0  0 0 -1  x",   // Not a field of view
+      "short.hdr 64 64 4  0 0 0  0 0",       // No target z
+  };
+  for(const char* line : invalidJobs)
+  {
+    problem = nullptr;
+    CHECK(!ParseRenderJob(line, job, problem) && problem != nullptr);
+  }
+
+  // ReadRenderJob() skips comments, blank lines and invalid jobs, and counts the lines it has read
+  std::istringstream input("# A comment\n\nsame.hdr 64 64 4  1 2 3  1 2 3\nok.hdr 64 32 4  0 0 0  0 0 -1\n");
+  uint32_t           lineNumber = 0;
+  CHECK(ReadRenderJob(input, "jobs.txt", lineNumber, job) && job.outputPath == "ok.hdr" && lineNumber == 4);
+  CHECK(!ReadRenderJob(input, "jobs.txt", lineNumber, job));
+}
@@ -0,0 +1,76 @@
+#include "tests.hpp"
+#include "samplers.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+// Whether the first 2^m points are a (0, m, 2)-net: each box of 2^-k x 2^-(m-k) holds exactly one of them.
+bool isNet(const std::vector<float>& x, const std::vector<float>& y, uint32_t m)
+{
+  const uint32_t pointCount = 1u << m;
+  for(uint32_t k = 0; k <= m; k++)
+  {
+    std::vector<uint32_t> boxCounts(pointCount, 0);
+    for(uint32_t i = 0; i < pointCount; i++)
+    {
+      const uint32_t column = uint32_t(x[i] * float(1u << k));
+      const uint32_t row    = uint32_t(y[i] * float(1u << (m - k)));
+      boxCounts[(row << k) | column]++;
+    }
+    if(std::any_of(boxCounts.begin(), boxCounts.end(), [](uint32_t count) { return count != 1; }))
+      return false;
+  }
+  return true;
+}
+}  // namespace
+
+void TestSamplers()
+{
+  SamplerTables tables;
+  BuildSamplerTables(tables);
+
+  // The generator matrix of the first dimension is the van der Corput sequence
+  bool vanDerCorput = true;
+  for(uint32_t bit = 0; bit < 32; bit++)
+  {
+    vanDerCorput &= (tables.sobolMatrices[bit] == 1u << (31 - bit));
+  }
+  CHECK(vanDerCorput);
+
+  // The blue-noise mask ranks its texels: each rank appears once
+  std::vector<uint32_t> ranks = tables.blueNoise;
+  std::sort(ranks.begin(), ranks.end());
+  bool isPermutation = (ranks.size() == BLUE_NOISE_SIZE * BLUE_NOISE_SIZE);
+  for(uint32_t i = 0; isPermutation && i < ranks.size(); i++)
+  {
+    isPermutation = (ranks[i] == i);
+  }
+  CHECK(isPermutation);
+
+  // The index scrambling shuffles the points of each power-of-two prefix among themselves, and the Owen scrambling
+  // of their coordinates keeps them a net; so the first 2^m samples of each pixel and dimension are a net.
+  constexpr uint32_t kMaxM = 10;
+  for(uint32_t seed : {0u, 7u})
+  {
+    const SamplerSettings settings{&tables, SAMPLER_SOBOL, seed, 64};
+    for(uint32_t pixel : {0u, 1u, 4097u})
+    {
+      for(uint32_t dimension = 0; dimension < 4; dimension++)
+      {
+        std::vector<float> x(1u << kMaxM), y(1u << kMaxM);
+        for(uint32_t i = 0; i < (1u << kMaxM); i++)
+        {
+          shaderio::PathSampler sampler{0, i, dimension, pixel};
+          Sample2D(settings, sampler, x[i], y[i]);
+          CHECK(sampler.dimension == dimension + 1);
+          CHECK(x[i] >= 0.0f && x[i] < 1.0f && y[i] >= 0.0f && y[i] < 1.0f);
+        }
+        for(uint32_t m = 0; m <= kMaxM; m++)
+        {
+          CHECK(isNet(x, y, m));
+        }
+      }
+    }
+  }
+}
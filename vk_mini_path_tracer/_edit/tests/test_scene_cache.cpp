@@ -0,0 +1,85 @@
+#include "tests.hpp"
+#include "scene_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace {
+// The vertices of mesh `meshIndex` of a cache, as xyz floats.
+std::vector<float> getMeshVertices(const SceneCache& cache, uint32_t meshIndex)
+{
+  const SceneCacheMesh& mesh = cache.getMeshes()[meshIndex];
+  const float*          data = cache.getVertices() + size_t(mesh.firstVertex) * 3;
+  return std::vector<float>(data, data + size_t(mesh.vertexCount) * 3);
+}
+
+std::vector<uint32_t> getMeshIndices(const SceneCache& cache, uint32_t meshIndex)
+{
+  const SceneCacheMesh& mesh = cache.getMeshes()[meshIndex];
+  return std::vector<uint32_t>(cache.getIndices() + mesh.firstIndex, cache.getIndices() + mesh.firstIndex + mesh.indexCount);
+}
+}  // namespace
+
+void TestSceneCache()
+{
+  WorkStealingScheduler scheduler(4);
+  TemporaryDirectory    directory("vk_mini_path_tracer_tests_cache");
+
+  // Shapes a and b have the same geometry, so they share a mesh; c is a quad of its own.
+  const std::string objText =
+      "mtllib shapes.mtl\n"
+      "o a\nv 0 0 0\nv 1 0 0\nv 0 1 0\nusemtl red\nf 1 2 3\n"
+      "o b\nv 0 0 0\nv 1 0 0\nv 0 1 0\nf -3 -2 -1\n"
+      "o c\nv 0 0 2\nv 1 0 2\nv 1 1 2\nv 0 1 2\nusemtl blue\nf 7 8 9 10\n";
+  const std::string objPath   = directory.write("shapes.obj", objText);
+  const std::string cachePath = objPath + ".cache";
+  {
+    SceneCache cache;
+    if(!CHECK(cache.loadOrBuild(objPath, scheduler)) || !CHECK(std::filesystem::exists(cachePath)))
+      return;
+    if(CHECK(cache.getMeshCount() == 2 && cache.getShapeCount() == 3))
+    {
+      const uint32_t* shapeMeshes = cache.getShapeMeshes();
+      CHECK(shapeMeshes[0] == shapeMeshes[1] && shapeMeshes[1] != shapeMeshes[2]);
+      CHECK(getMeshVertices(cache, shapeMeshes[0]) == std::vector<float>({0, 0, 0, 1, 0, 0, 0, 1, 0}));
+      CHECK(getMeshIndices(cache, shapeMeshes[0]) == std::vector<uint32_t>({0, 1, 2}));
+      // The quad's vertices are in the order its triangles first use them
+      using Corner                    = std::array<float, 3>;
+      std::vector<float>  quadVertices = getMeshVertices(cache, shapeMeshes[2]);
+      std::vector<Corner> corners;
+      for(size_t i = 0; i < quadVertices.size(); i += 3)
+      {
+        corners.push_back({quadVertices[i], quadVertices[i + 1], quadVertices[i + 2]});
+      }
+      std::sort(corners.begin(), corners.end());
+      CHECK(corners == std::vector<Corner>({{0, 0, 2}, {0, 1, 2}, {1, 0, 2}, {1, 1, 2}}));
+      const std::vector<uint32_t> quadIndices = getMeshIndices(cache, shapeMeshes[2]);
+      CHECK(quadIndices.size() == 6 && *std::max_element(quadIndices.begin(), quadIndices.end()) == 3);
+    }
+    CHECK(cache.getMaterialNames() == std::vector<std::string>({"red", "blue"}));
+    CHECK(cache.getMaterialLibraries() == std::vector<std::string>({"shapes.mtl"}));
+  }
+
+  // A second load maps the cache that the first one wrote, without writing it again
+  const std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(cachePath);
+  {
+    SceneCache cache;
+    CHECK(cache.loadOrBuild(objPath, scheduler) && cache.getMeshCount() == 2 && cache.getShapeCount() == 3);
+    CHECK(std::filesystem::last_write_time(cachePath) == writeTime);
+  }
+
+  // A changed OBJ gets a new cache, and so does a cache that was cut short
+  directory.write("shapes.obj", objText + "o d\nv 5 5 5\nv 6 5 5\nv 5 6 5\nf -3 -2 -1\n");
+  {
+    SceneCache cache;
+    CHECK(cache.loadOrBuild(objPath, scheduler) && cache.getMeshCount() == 3 && cache.getShapeCount() == 4);
+  }
+  std::filesystem::resize_file(cachePath, std::filesystem::file_size(cachePath) / 2);
+  {
+    SceneCache cache;
+    CHECK(cache.loadOrBuild(objPath, scheduler) && cache.getMeshCount() == 3 && cache.getShapeCount() == 4);
+  }
+}
@@ -0,0 +1,48 @@
+#include "tests.hpp"
+#include "sequence.hpp"
+
+#include <sstream>
+#include <vector>
+
+void TestSequence()
+{
+  WorkStealingScheduler scheduler(4);
+
+  // Two instances of two triangles, side by side (the scene would share the mesh of equal ones)
+  Scene scene;
+  for(uint32_t mesh = 0; mesh < 2; mesh++)
+  {
+    const float x = float(mesh);
+    ObjMesh     triangle;
+    triangle.vertices = {x, 0.0f, 0.0f, x + 1.0f, 0.0f, 0.0f, x, 1.0f, 0.0f};
+    triangle.indices  = {0, 1, 2};
+    scene.addMesh(std::move(triangle));
+  }
+
+  // The second frame moves instance 1 and deforms the mesh of instance 0; the invalid lines between them are skipped
+  TemporaryDirectory directory("vk_mini_path_tracer_tests_sequence");
+  directory.write("moved.obj", "v 0 0 1\nv 2 0 1\nv 0 2 1\nf 1 2 3\n");
+  directory.write("quad.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n");
+  std::istringstream input(
+      "first.hdr 8 8 1  0 0 5  0 0 0\n"
+      "instance 1  1 2 3\n"
+      "instance 2  1 2 3\n"     // No such instance
+      "instance 1  1 2\n"       // Not a transform
+      "vertices 0  quad.obj\n"  // Not the faces of the mesh
+      "vertices 0  moved.obj\n"
+      "second.hdr 8 8 1  0 0 5  0 0 0\n");
+  SequenceReader reader(input, "sequence.txt", directory.getPath(""), true);
+  RenderJob      job;
+  SceneChanges   changes;
+  CHECK(reader.readFrame(scene, scheduler, job, changes) && job.outputPath == "first.hdr" && changes.empty());
+  if(CHECK(reader.readFrame(scene, scheduler, job, changes) && job.outputPath == "second.hdr"))
+  {
+    CHECK(changes.movedInstances && changes.deformedMeshes == std::vector<uint32_t>{0});
+    const Transform& transform = scene.getInstances()[1].transform;
+    CHECK(transform.matrix[0][3] == 1.0f && transform.matrix[1][3] == 2.0f && transform.matrix[2][3] == 3.0f);
+    const SceneMesh& mesh = scene.getMeshes()[0];
+    CHECK(mesh.vertexCount == 3 && mesh.vertices[2] == 1.0f && mesh.vertices[3] == 2.0f);
+    CHECK(scene.getMeshes()[1].vertices[2] == 0.0f);
+  }
+  CHECK(!reader.readFrame(scene, scheduler, job, changes));
+}
@@ -0,0 +1,68 @@
+#include "tests.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+uint32_t g_failedChecks = 0;
+}  // namespace
+
+bool Check(bool condition, const char* expression, const char* file, int line)
+{
+  if(!condition)
+  {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    g_failedChecks++;
+  }
+  return condition;
+}
+
+TemporaryDirectory::TemporaryDirectory(const char* name)
+    : m_path(std::filesystem::temp_directory_path() / name)
+{
+  std::filesystem::remove_all(m_path);
+  std::filesystem::create_directories(m_path);
+}
+
+TemporaryDirectory::~TemporaryDirectory()
+{
+  std::filesystem::remove_all(m_path);
+}
+
+std::string TemporaryDirectory::write(const char* fileName, const std::string& contents) const
+{
+  const std::string path = getPath(fileName);
+  std::ofstream(path, std::ios::binary) << contents;
+  return path;
+}
+
+int main()
+{
+  const struct
+  {
+    const char* name;
+    void (*run)();
+  } tests[] = {
+      {"cpu bvh", TestCpuBvh},
+      {"cpu renderer", TestCpuRenderer},
+      {"obj parser", TestObjParser},
+      {"scene cache", TestSceneCache},
+      {"convergence", TestConvergence},
+      {"render jobs", TestRenderJobs},
+      {"compact geometry", TestCompactGeometry},
+      {"light table", TestLightTable},
+      {"samplers", TestSamplers},
+      {"denoiser", TestDenoiser},
+      {"accumulation file", TestAccumulationFile},
+      {"refit", TestRefit},
+      {"sequence", TestSequence},
+  };
+  for(const auto& test : tests)
+  {
+    const uint32_t failedBefore = g_failedChecks;
+    test.run();
+    printf("%-20s %s\n", test.name, (g_failedChecks == failedBefore) ? "passed" : "FAILED");
+  }
+  return int(std::min(g_failedChecks, 255u));
+}
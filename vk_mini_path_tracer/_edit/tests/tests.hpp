@@ -0,0 +1,45 @@
+#pragma once
+
+// Tests of the CPU-side parts of the path tracer (run by ctest): a separate executable, without Vulkan.
+//
+// Each test checks a part against a simple reference, such as the CPU BVH against brute-force intersection.
+// The tests of each part live in a file of their own (test_*.cpp), and tests.cpp runs them all. Failed checks
+// are printed with their file and line; the exit code is the number of failed checks.
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Counts and prints a failed check; returns `condition`, so that a test can skip the checks that depend on it.
+bool Check(bool condition, const char* expression, const char* file, int line);
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+// A directory for the files a test writes, removed with everything in it when the test is done.
+class TemporaryDirectory
+{
+public:
+  explicit TemporaryDirectory(const char* name);
+  ~TemporaryDirectory();
+
+  // Writes `contents` to a file in the directory, and returns its path.
+  std::string write(const char* fileName, const std::string& contents) const;
+  std::string getPath(const char* fileName) const { return (m_path / fileName).string(); }
+
+private:
+  std::filesystem::path m_path;
+};
+
+// The tests, by the file they are in
+void TestCpuBvh();            // test_cpu_bvh.cpp
+void TestCpuRenderer();       // test_cpu_renderer.cpp
+void TestObjParser();         // test_obj_parser.cpp
+void TestSceneCache();        // test_scene_cache.cpp
+void TestConvergence();       // test_convergence.cpp
+void TestRenderJobs();        // test_render_jobs.cpp
+void TestCompactGeometry();   // test_compact_geometry.cpp
+void TestLightTable();        // test_light_table.cpp
+void TestSamplers();          // test_samplers.cpp
+void TestDenoiser();          // test_denoiser.cpp
+void TestAccumulationFile();  // test_accumulation_file.cpp
+void TestRefit();             // test_refit.cpp
+void TestSequence();          // test_sequence.cpp
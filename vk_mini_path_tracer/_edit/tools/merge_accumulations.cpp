@@ -0,0 +1,235 @@
+// Merge tool for accumulation files (see accumulation_file.hpp): a separate executable, without Vulkan.
+//
+// Adds up the PixelAccumulators of any number of accumulation files of the same size, pixel by pixel, and
+// writes the mean of each pixel's samples as an image, like the path tracer would have for one run of all
+// of the samples. With --variance, it also writes the variance of each pixel's mean, per channel: the
+// square of the noise that is left, which is where more samples would help most.
+//
+// The files are memory-mapped and merged in bands of rows, spread over the threads of a
+// WorkStealingScheduler, while an ImageWriter writes the band before; so memory stays bounded by a few
+// bands, whatever the number and size of the files.
+
+#include "accumulation_file.hpp"
+#include "image_writer.hpp"
+#include "profiler.hpp"
+#include "work_stealing.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr uint32_t kBandHeight = 32;  // Rows merged at a time
+
+struct MergeOptions
+{
+  std::string              outputPath;
+  std::string              variancePath;     // --variance; empty = don't write the variance
+  std::string              profilePath;      // --profile
+  uint32_t                 threadCount = 0;  // --threads; 0 = all hardware threads
+  std::vector<std::string> inputPaths;
+};
+
+void printUsage(const char* exeName)
+{
+  printf(
+      "Usage: %s [options] output.hdr input.accum...\n"
+      "Adds up the samples of accumulation files (written with --output-format accum) into one image.\n"
+      "  --variance file.hdr   Also write the variance of the mean of each pixel, per channel\n"
+      "  --threads N           Threads that merge the files (default: all)\n"
+      "  --profile report.json Print the time of each phase, and write it as a JSON report\n",
+      exeName);
+}
+
+// Prints the usage and returns false on --help or on an invalid argument.
+bool parseCommandLine(int argc, const char** argv, MergeOptions& options)
+{
+  std::vector<std::string> paths;
+  for(int i = 1; i < argc; i++)
+  {
+    const std::string arg     = argv[i];
+    const bool        hasNext = (i + 1 < argc);
+    try
+    {
+      if(arg == "--variance" && hasNext)
+        options.variancePath = argv[++i];
+      else if(arg == "--threads" && hasNext)
+        options.threadCount = uint32_t(std::stoul(argv[++i]));
+      else if(arg == "--profile" && hasNext)
+        options.profilePath = argv[++i];
+      else if(arg.empty() || arg[0] != '-')
+        paths.push_back(arg);
+      else
+      {
+        if(arg != "--help")
+          fprintf(stderr, "Unknown or incomplete argument: %s\n", arg.c_str());
+        printUsage(argv[0]);
+        return false;
+      }
+    }
+    catch(const std::logic_error&)
+    {
+      fprintf(stderr, "Invalid value for %s: %s\n", arg.c_str(), argv[i]);
+      return false;
+    }
+  }
+
+  if(paths.size() < 2)
+  {
+    fprintf(stderr, "Need an output image and at least one accumulation file\n");
+    printUsage(argv[0]);
+    return false;
+  }
+  options.outputPath = paths[0];
+  options.inputPaths.assign(paths.begin() + 1, paths.end());
+  return true;
+}
+
+// Warns about files that traced the same samples: their noise is the same, so adding them up doesn't
+// reduce it, although the variance map claims it does.
+void warnAboutOverlaps(const MergeOptions& options, const std::vector<AccumulationFile>& files)
+{
+  for(size_t i = 0; i < files.size(); i++)
+  {
+    for(size_t j = i + 1; j < files.size(); j++)
+    {
+      const AccumulationInfo& a = files[i].getHeader().info;
+      const AccumulationInfo& b = files[j].getHeader().info;
+      if(a.seed == b.seed && a.sampler == b.sampler && a.firstSample < b.firstSample + b.sampleCount
+         && b.firstSample < a.firstSample + a.sampleCount)
+      {
+        fprintf(stderr, "Warning: %s and %s traced the same samples (seed %u, from sample %u); use other seeds or other --first-sample ranges\n",
+                options.inputPaths[i].c_str(), options.inputPaths[j].c_str(), a.seed, std::max(a.firstSample, b.firstSample));
+      }
+    }
+  }
+}
+
+// A band of the output images, with the writes that still read it.
+struct Band
+{
+  std::vector<float> mean;      // RGB floats
+  std::vector<float> variance;  // RGB floats, with --variance
+  std::future<bool>  pendingMeanWrite;
+  std::future<bool>  pendingVarianceWrite;
+};
+}  // namespace
+
+int main(int argc, const char** argv)
+{
+  MergeOptions options;
+  if(!parseCommandLine(argc, argv, options))
+  {
+    return 1;
+  }
+
+  Profiler                      profiler;
+  std::vector<AccumulationFile> files(options.inputPaths.size());
+  {
+    Profiler::Scope scope(profiler, "open files");
+    for(size_t i = 0; i < files.size(); i++)
+    {
+      if(!files[i].open(options.inputPaths[i]))
+      {
+        return 1;  // Already reported
+      }
+      if(files[i].getHeader().width != files[0].getHeader().width || files[i].getHeader().height != files[0].getHeader().height)
+      {
+        fprintf(stderr, "%s is %u x %u pixels, but %s is %u x %u\n", options.inputPaths[i].c_str(), files[i].getHeader().width,
+                files[i].getHeader().height, options.inputPaths[0].c_str(), files[0].getHeader().width, files[0].getHeader().height);
+        return 1;
+      }
+    }
+  }
+  warnAboutOverlaps(options, files);
+
+  const uint32_t        width         = files[0].getHeader().width;
+  const uint32_t        height        = files[0].getHeader().height;
+  const bool            writeVariance = !options.variancePath.empty();
+  WorkStealingScheduler scheduler(options.threadCount);
+
+  // The image writers encode and write one band while the next one is merged; each image has its own
+  // writer, since a writer writes one image after the other.
+  ImageWriter                              meanWriter(profiler);
+  ImageWriter                              varianceWriter(profiler);
+  std::array<Band, 2>                      bands;
+  std::vector<std::vector<AccumulatorSum>> workerSums(scheduler.getThreadCount());  // Scratch of each thread: a row of sums
+  std::vector<uint64_t>                    workerSampleCounts(scheduler.getThreadCount(), 0);
+  bool                                     allWritesSucceeded = true;
+  for(uint32_t bandY = 0; bandY < height; bandY += kBandHeight)
+  {
+    const uint32_t bandHeight = std::min(kBandHeight, height - bandY);
+    Band&          band       = bands[(bandY / kBandHeight) % bands.size()];
+    if(band.pendingMeanWrite.valid())
+    {
+      allWritesSucceeded &= band.pendingMeanWrite.get();  // The band from two bands ago is still being written
+    }
+    if(band.pendingVarianceWrite.valid())
+    {
+      allWritesSucceeded &= band.pendingVarianceWrite.get();
+    }
+    band.mean.resize(size_t(width) * bandHeight * 3);
+    band.variance.resize(writeVariance ? band.mean.size() : 0);
+
+    {
+      Profiler::Scope scope(profiler, "merge");
+      scheduler.run(bandHeight, [&](uint32_t row, uint32_t worker) {
+        std::vector<AccumulatorSum>& sums = workerSums[worker];
+        sums.assign(width, AccumulatorSum());
+        for(const AccumulationFile& file : files)
+        {
+          const shaderio::PixelAccumulator* accumulators = file.getRow(bandY + row);
+          for(uint32_t x = 0; x < width; x++)
+          {
+            sums[x].add(accumulators[x]);
+          }
+        }
+
+        float* meanRow     = &band.mean[size_t(width) * row * 3];
+        float* varianceRow = writeVariance ? &band.variance[size_t(width) * row * 3] : nullptr;
+        for(uint32_t x = 0; x < width; x++)
+        {
+          for(uint32_t c = 0; c < 3; c++)
+          {
+            meanRow[3 * x + c] = sums[x].getMean(c);
+            if(varianceRow != nullptr)
+            {
+              varianceRow[3 * x + c] = sums[x].getVarianceOfMean(c);
+            }
+          }
+          workerSampleCounts[worker] += uint64_t(sums[x].sampleCount);
+        }
+      });
+    }
+
+    band.pendingMeanWrite = meanWriter.write(options.outputPath, width, height, OUTPUT_FORMAT_FLOAT, bandY, bandHeight, band.mean.data());
+    if(writeVariance)
+    {
+      band.pendingVarianceWrite =
+          varianceWriter.write(options.variancePath, width, height, OUTPUT_FORMAT_FLOAT, bandY, bandHeight, band.variance.data());
+    }
+  }
+  allWritesSucceeded &= meanWriter.finish();
+  allWritesSucceeded &= varianceWriter.finish();
+
+  uint64_t sampleCount = 0;
+  for(uint64_t workerSampleCount : workerSampleCounts)
+  {
+    sampleCount += workerSampleCount;
+  }
+  printf("Merged %zu files of %u x %u pixels: %.1f samples per pixel on average\n", files.size(), width, height,
+         double(sampleCount) / std::max(double(width) * height, 1.0));
+
+  if(!options.profilePath.empty())
+  {
+    profiler.setInfo("mode", "merge");
+    profiler.setInfo("files", uint64_t(files.size()));
+    profiler.printSummary();
+    allWritesSucceeded &= profiler.writeJson(options.profilePath);
+  }
+  return allWritesSucceeded ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include "work_stealing.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+// A task queue owned by one worker. The owner uses the back, thieves use the front.
+struct TaskDeque
+{
+  std::mutex           mutex;
+  std::deque<uint32_t> tasks;
+
+  bool popBack(uint32_t& task)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(tasks.empty())
+      return false;
+    task = tasks.back();
+    tasks.pop_back();
+    return true;
+  }
+
+  bool stealFront(uint32_t& task)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(tasks.empty())
+      return false;
+    task = tasks.front();
+    tasks.pop_front();
+    return true;
+  }
+};
+}  // namespace
+
+WorkStealingScheduler::WorkStealingScheduler(uint32_t threadCount)
+    : m_threadCount(threadCount)
+{
+  if(m_threadCount == 0)
+  {
+    m_threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+void WorkStealingScheduler::run(uint32_t taskCount, const std::function<void(uint32_t taskIndex, uint32_t workerIndex)>& fn) const
+{
+  if(taskCount == 0)
+    return;
+
+  const uint32_t workerCount = std::min(m_threadCount, taskCount);
+  if(workerCount == 1)
+  {
+    for(uint32_t task = 0; task < taskCount; task++)
+      fn(task, 0);
+    return;
+  }
+
+  // Give each worker a contiguous range of tasks. The owner pops from the back, so reverse
+  // each range to process it in increasing order.
+  std::vector<std::unique_ptr<TaskDeque>> deques(workerCount);
+  for(uint32_t w = 0; w < workerCount; w++)
+  {
+    deques[w]             = std::make_unique<TaskDeque>();
+    const uint32_t first  = uint32_t(uint64_t(taskCount) * w / workerCount);
+    const uint32_t last   = uint32_t(uint64_t(taskCount) * (w + 1) / workerCount);
+    for(uint32_t task = last; task > first; task--)
+      deques[w]->tasks.push_back(task - 1);
+  }
+
+  auto worker = [&](uint32_t self) {
+    uint32_t task;
+    while(true)
+    {
+      if(deques[self]->popBack(task))
+      {
+        fn(task, self);
+        continue;
+      }
+      // Our own deque is empty: try to steal from the other workers, starting with our neighbour.
+      bool stole = false;
+      for(uint32_t offset = 1; offset < workerCount && !stole; offset++)
+      {
+        stole = deques[(self + offset) % workerCount]->stealFront(task);
+      }
+      if(!stole)
+        return;  // No task is left anywhere, since tasks are never added after the start.
+      fn(task, self);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(workerCount - 1);
+  for(uint32_t w = 1; w < workerCount; w++)
+    threads.emplace_back(worker, w);
+  worker(0);  // The calling thread is worker 0
+  for(std::thread& thread : threads)
+    thread.join();
+}
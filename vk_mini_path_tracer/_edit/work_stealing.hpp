@@ -0,0 +1,28 @@
+#pragma once
+
+// A small work-stealing scheduler used by the CPU-side parts of the path tracer.
+//
+// Run(taskCount, fn) spreads the task indices [0, taskCount) over one deque per worker thread.
+// Each worker pops tasks from the back of its own deque; when it runs dry, it steals from the
+// front of another worker's deque. Tasks that are close together in index (for instance,
+// neighbouring image tiles) therefore tend to stay on the same core, while workers that finish
+// early help out the ones that got the expensive tasks.
+
+#include <cstdint>
+#include <functional>
+
+class WorkStealingScheduler
+{
+public:
+  // threadCount == 0 means "one worker per hardware thread".
+  explicit WorkStealingScheduler(uint32_t threadCount = 0);
+
+  uint32_t getThreadCount() const { return m_threadCount; }
+
+  // Calls fn(taskIndex, workerIndex) once for every task index, and returns when all tasks have finished.
+  // workerIndex is in [0, getThreadCount()), so it can be used to index per-thread scratch data.
+  void run(uint32_t taskCount, const std::function<void(uint32_t taskIndex, uint32_t workerIndex)>& fn) const;
+
+private:
+  uint32_t m_threadCount;
+};